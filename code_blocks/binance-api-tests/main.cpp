@@ -0,0 +1,672 @@
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <future>
+#include "tools/binance-cpp-api-event-dispatcher.hpp"
+#include "tools/binance-cpp-api-conflating-dispatcher.hpp"
+#include "tools/binance-cpp-api-subscription-manager.hpp"
+#include "tools/binance-cpp-api-order-book.hpp"
+#include "tools/binance-cpp-api-trade-bar-aggregator.hpp"
+#include "tools/binance-cpp-api-server-clock.hpp"
+#include "tools/binance-cpp-api-timer-wheel.hpp"
+#include "binance-cpp-api-websocket.hpp"
+
+using namespace std;
+
+static int num_errors = 0;
+
+#define TEST_CHECK(condition) \
+    do { \
+        if(!(condition)) { \
+            ++num_errors; \
+            std::cerr << "test error, line: " << __LINE__ << ", what: " << #condition << std::endl; \
+        } \
+    } while(0)
+
+/// Событие для проверки диспетчеров
+class TestEvent {
+public:
+    std::string key;
+    int value = 0;
+    bool is_final = false;
+    TestEvent() {};
+    TestEvent(const std::string &_key, const int _value, const bool _is_final = false) :
+        key(_key), value(_value), is_final(_is_final) {};
+};
+
+/** \brief Проверить порядок доставленных событий
+ * \param delivered Доставленные события
+ * \param expected Ожидаемые значения событий
+ */
+void check_values(const std::vector<TestEvent> &delivered, const std::vector<int> &expected) {
+    TEST_CHECK(delivered.size() == expected.size());
+    for(size_t i = 0; i < delivered.size() && i < expected.size(); ++i) {
+        TEST_CHECK(delivered[i].value == expected[i]);
+    }
+}
+
+/** \brief Переполнить очередь диспетчера событий
+ *
+ * Первое событие задерживает потребителя, пока остальные события переполняют очередь
+ * \param policy Политика при переполнении очереди
+ * \param delivered Доставленные события
+ * \param metrics Метрики очереди после доставки всех событий
+ * \return Вернет true, если производитель ждал места в очереди
+ */
+bool overflow_event_dispatcher(
+        const binance_api::TypesBackpressure policy,
+        std::vector<TestEvent> &delivered,
+        binance_api::DispatcherMetrics &metrics) {
+    std::promise<void> entered;
+    std::promise<void> gate;
+    std::shared_future<void> gate_future = gate.get_future().share();
+    bool is_blocked = false;
+    {
+        binance_api::EventDispatcher<TestEvent> dispatcher(
+            [&](const TestEvent &event) {
+                delivered.push_back(event);
+                if(event.value == 1) {
+                    entered.set_value();
+                    gate_future.wait();
+                }
+            },
+            2,
+            policy,
+            [](const TestEvent &event) -> std::string {
+                return event.key;
+            });
+        dispatcher.push(TestEvent("A", 1));
+        entered.get_future().wait();
+        /* очередь вмещает два события */
+        dispatcher.push(TestEvent("A", 2));
+        dispatcher.push(TestEvent("B", 3));
+        std::future<void> producer = std::async(std::launch::async, [&]() {
+            dispatcher.push(TestEvent("A", 4));
+            dispatcher.push(TestEvent("B", 5));
+            dispatcher.push(TestEvent("A", 6));
+        });
+        is_blocked = producer.wait_for(std::chrono::milliseconds(100)) == std::future_status::timeout;
+        gate.set_value();
+        producer.wait();
+        metrics = dispatcher.get_metrics();
+        /* деструктор доставляет оставшиеся события */
+    }
+    return is_blocked;
+}
+
+/// Политики переполнения очереди диспетчера событий
+void test_event_dispatcher() {
+    std::cout << "test_event_dispatcher" << std::endl;
+    {
+        /* производитель ждет места в очереди, события не теряются */
+        std::vector<TestEvent> delivered;
+        binance_api::DispatcherMetrics metrics;
+        TEST_CHECK(overflow_event_dispatcher(binance_api::TypesBackpressure::BLOCK, delivered, metrics));
+        check_values(delivered, {1, 2, 3, 4, 5, 6});
+        TEST_CHECK(metrics.pushed == 6 && metrics.dropped == 0);
+    }
+    {
+        /* выбрасываются самые старые события очереди */
+        std::vector<TestEvent> delivered;
+        binance_api::DispatcherMetrics metrics;
+        TEST_CHECK(!overflow_event_dispatcher(binance_api::TypesBackpressure::DROP_OLDEST, delivered, metrics));
+        check_values(delivered, {1, 5, 6});
+        TEST_CHECK(metrics.dropped == 3);
+    }
+    {
+        /* A4 заменен A6, который встает после B5 */
+        std::vector<TestEvent> delivered;
+        binance_api::DispatcherMetrics metrics;
+        TEST_CHECK(!overflow_event_dispatcher(binance_api::TypesBackpressure::CONFLATE, delivered, metrics));
+        check_values(delivered, {1, 2, 3, 5, 6});
+        TEST_CHECK(metrics.conflated == 1 && metrics.dropped == 0);
+    }
+}
+
+/// Промежуточные события схлопываются, финальные не теряются, порядок поступления сохраняется
+void test_conflating_dispatcher() {
+    std::cout << "test_conflating_dispatcher" << std::endl;
+    std::vector<TestEvent> delivered;
+    /* первое событие задерживает потребителя, пока остальные накапливаются в слотах */
+    std::promise<void> entered;
+    std::promise<void> gate;
+    std::shared_future<void> gate_future = gate.get_future().share();
+    {
+        binance_api::ConflatingDispatcher<TestEvent> dispatcher(
+            [&](const TestEvent &event) {
+                delivered.push_back(event);
+                if(event.value == 1) {
+                    entered.set_value();
+                    gate_future.wait();
+                }
+            },
+            [](const TestEvent &event) -> std::string {
+                return event.key;
+            },
+            [](const TestEvent &event) -> bool {
+                return event.is_final;
+            });
+        dispatcher.push(TestEvent("A", 1));
+        entered.get_future().wait();
+        dispatcher.push(TestEvent("A", 2));
+        dispatcher.push(TestEvent("B", 3));
+        dispatcher.push(TestEvent("A", 4, true));
+        dispatcher.push(TestEvent("A", 5));
+        dispatcher.push(TestEvent("B", 6));
+        gate.set_value();
+        /* деструктор доставляет оставшиеся события */
+    }
+    /* A2 заменен финальным A4, B3 заменен B6, A5 занимает новый слот после финального события */
+    check_values(delivered, {1, 4, 6, 5});
+}
+
+/// Менеджер подписок отправляет только разницу желаемых и подтвержденных потоков
+void test_subscription_manager() {
+    std::cout << "test_subscription_manager" << std::endl;
+    std::vector<binance_api::SubscriptionManager::json> messages;
+    binance_api::SubscriptionManager manager([&](const std::string &message) -> bool {
+        messages.push_back(binance_api::SubscriptionManager::json::parse(message));
+        return true;
+    }, 500);
+    std::vector<std::string> rejected;
+    manager.on_reject = [&](const std::string &param, const bool is_subscribe) {
+        if(is_subscribe) rejected.push_back(param);
+    };
+    auto process = [&]() {
+        /* ограничение скорости 500 сообщений в секунду */
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        manager.process();
+    };
+    auto respond = [&](const size_t index, const bool is_error) {
+        binance_api::SubscriptionManager::json j;
+        j["id"] = messages[index]["id"];
+        if(is_error) j["error"] = {{"code", 2}, {"msg", "Invalid request"}};
+        else j["result"] = nullptr;
+        TEST_CHECK(manager.on_response(j));
+    };
+    auto check_message = [&](const size_t index, const std::string &method, const std::vector<std::string> &params) {
+        TEST_CHECK(messages.size() > index);
+        if(messages.size() <= index) return;
+        TEST_CHECK(messages[index]["method"] == method);
+        TEST_CHECK(messages[index]["params"].get<std::vector<std::string>>() == params);
+    };
+
+    manager.set_max_params(2);
+    manager.subscribe("a@kline_1m");
+    manager.subscribe("b@kline_1m");
+    manager.subscribe("c@kline_1m");
+    /* без соединения ничего не отправляется */
+    process();
+    TEST_CHECK(messages.empty());
+
+    manager.on_open();
+    process();
+    check_message(0, "SUBSCRIBE", {"a@kline_1m", "b@kline_1m"});
+    /* следующее сообщение не раньше ограничения скорости */
+    manager.process();
+    TEST_CHECK(messages.size() == 1);
+    /* потоки запроса без ответа не отправляются повторно */
+    process();
+    check_message(1, "SUBSCRIBE", {"c@kline_1m"});
+    respond(0, false);
+
+    /* отписка отправляется раньше подписки, подписка с отпиской до отправки взаимно сокращаются */
+    manager.unsubscribe("b@kline_1m");
+    manager.subscribe("d@kline_1m");
+    manager.unsubscribe("e@kline_1m");
+    manager.subscribe("e@kline_1m");
+    manager.unsubscribe("e@kline_1m");
+    process();
+    check_message(2, "UNSUBSCRIBE", {"b@kline_1m"});
+    respond(1, true);
+    respond(2, false);
+    TEST_CHECK(rejected.size() == 1 && rejected[0] == "c@kline_1m");
+    TEST_CHECK(!manager.synchronized());
+    process();
+    check_message(3, "SUBSCRIBE", {"d@kline_1m"});
+    respond(3, false);
+    process();
+    TEST_CHECK(messages.size() == 4);
+    TEST_CHECK(manager.synchronized());
+    TEST_CHECK(manager.get_acked() == std::set<std::string>({"a@kline_1m", "d@kline_1m"}));
+
+    /* новое соединение не имеет подписок, желаемые потоки отправляются заново */
+    manager.on_close();
+    manager.on_open();
+    process();
+    check_message(4, "SUBSCRIBE", {"a@kline_1m", "d@kline_1m"});
+}
+
+
+/// Снимок стакана и последующие обновления
+void test_order_book() {
+    std::cout << "test_order_book" << std::endl;
+    binance_api::OrderBook order_book;
+    binance_api::DepthSnapshotSpec snapshot;
+    snapshot.last_update_id = 100;
+    /* уровни не отсортированы, повторная цена заменяет предыдущую, нулевой объем удаляет уровень */
+    snapshot.bids = {{99.0, 1.0}, {101.0, 2.0}, {100.0, 3.0}, {101.0, 4.0}, {98.0, 0.0}};
+    snapshot.asks = {{103.0, 1.0}, {102.0, 2.0}, {104.0, 0.0}, {102.0, 5.0}};
+    order_book.set_snapshot(snapshot);
+    TEST_CHECK(order_book.get_last_update_id() == 100);
+    TEST_CHECK(order_book.get_num_bids() == 3);
+    TEST_CHECK(order_book.get_num_asks() == 2);
+
+    binance_api::DepthLevelSpec level;
+    TEST_CHECK(order_book.get_best_bid(level));
+    TEST_CHECK(level.price == 101.0 && level.quantity == 4.0);
+    TEST_CHECK(order_book.get_best_ask(level));
+    TEST_CHECK(level.price == 102.0 && level.quantity == 5.0);
+
+    /* обновления после снимка */
+    order_book.update_bid(101.0, 0.0);
+    order_book.update_bid(100.5, 7.0);
+    order_book.update_ask(102.0, 0.0);
+    order_book.update_ask(101.5, 1.5);
+    order_book.update_ask(110.0, 0.0);
+    order_book.set_last_update_id(101);
+    TEST_CHECK(order_book.get_last_update_id() == 101);
+    TEST_CHECK(order_book.get_best_bid(level));
+    TEST_CHECK(level.price == 100.5 && level.quantity == 7.0);
+    TEST_CHECK(order_book.get_best_ask(level));
+    TEST_CHECK(level.price == 101.5 && level.quantity == 1.5);
+
+    std::vector<binance_api::DepthLevelSpec> bids;
+    order_book.get_bids(bids);
+    const std::vector<double> expected_bids = {100.5, 100.0, 99.0};
+    TEST_CHECK(bids.size() == expected_bids.size());
+    for(size_t i = 0; i < bids.size() && i < expected_bids.size(); ++i) {
+        TEST_CHECK(bids[i].price == expected_bids[i]);
+    }
+    std::vector<binance_api::DepthLevelSpec> asks;
+    order_book.get_asks(asks, 1);
+    TEST_CHECK(asks.size() == 1);
+
+    /* новый снимок полностью заменяет стакан */
+    binance_api::DepthSnapshotSpec next_snapshot;
+    next_snapshot.last_update_id = 200;
+    next_snapshot.bids = {{90.0, 1.0}};
+    order_book.set_snapshot(next_snapshot);
+    TEST_CHECK(order_book.get_num_bids() == 1);
+    TEST_CHECK(order_book.get_num_asks() == 0);
+    TEST_CHECK(!order_book.get_best_ask(level));
+    order_book.clear();
+    TEST_CHECK(order_book.empty());
+}
+
+/** \brief Создать изменение стакана
+ * \param first_update_id U
+ * \param final_update_id u
+ * \param prev_update_id pu
+ * \param bid_price Цена уровня покупки
+ * \param bid_quantity Количество уровня покупки
+ * \return Изменение стакана
+ */
+binance_api::DepthUpdateSpec make_depth_update(
+        const uint64_t first_update_id,
+        const uint64_t final_update_id,
+        const uint64_t prev_update_id,
+        const double bid_price = 0,
+        const double bid_quantity = 0) {
+    binance_api::DepthUpdateSpec update;
+    update.first_update_id = first_update_id;
+    update.final_update_id = final_update_id;
+    update.prev_update_id = prev_update_id;
+    if(bid_price != 0) update.bids.push_back(binance_api::DepthLevelSpec(bid_price, bid_quantity));
+    return update;
+}
+
+/// Синхронизация стакана по U/u/pu
+void test_order_book_sync() {
+    std::cout << "test_order_book_sync" << std::endl;
+    using SequenceTypes = binance_api::OrderBookSync::SequenceTypes;
+    binance_api::DepthSnapshotSpec snapshot;
+    snapshot.last_update_id = 100;
+    snapshot.bids = {{10.0, 1.0}, {11.0, 1.0}};
+    snapshot.asks = {{12.0, 1.0}};
+    {
+        /* фьючерсы: изменения до снимка отбрасываются, первое изменение содержит lastUpdateId снимка */
+        binance_api::OrderBookSync sync(true);
+        sync.buffer.push_back(make_depth_update(90, 95, 89, 10.0, 5.0));
+        sync.buffer.push_back(make_depth_update(96, 105, 95, 11.0, 0.0));
+        sync.buffer.push_back(make_depth_update(106, 110, 105, 11.5, 2.0));
+        TEST_CHECK(sync.apply_snapshot(snapshot));
+        TEST_CHECK(sync.is_synced);
+        TEST_CHECK(sync.buffer.empty());
+        TEST_CHECK(sync.book.get_last_update_id() == 110);
+        binance_api::DepthLevelSpec level;
+        TEST_CHECK(sync.book.get_best_bid(level) && level.price == 11.5);
+        TEST_CHECK(sync.book.get_num_bids() == 2);
+
+        /* дальше каждое изменение продолжает предыдущее по pu */
+        TEST_CHECK(sync.check_sequence(make_depth_update(111, 115, 110)) == SequenceTypes::APPLY);
+        TEST_CHECK(sync.check_sequence(make_depth_update(101, 108, 100)) == SequenceTypes::SKIP);
+        TEST_CHECK(sync.check_sequence(make_depth_update(116, 120, 112)) == SequenceTypes::GAP);
+        sync.apply_update(make_depth_update(111, 115, 110));
+        TEST_CHECK(sync.book.get_last_update_id() == 115);
+        TEST_CHECK(sync.check_sequence(make_depth_update(116, 120, 115)) == SequenceTypes::APPLY);
+
+        sync.reset();
+        TEST_CHECK(!sync.is_synced && sync.book.empty() && sync.is_first_update);
+    }
+    {
+        /* снимок старше изменений: стакан не синхронизирован, изменения ждут следующего снимка */
+        binance_api::OrderBookSync sync(true);
+        sync.buffer.push_back(make_depth_update(90, 95, 89));
+        sync.buffer.push_back(make_depth_update(120, 125, 119));
+        TEST_CHECK(!sync.apply_snapshot(snapshot));
+        TEST_CHECK(!sync.is_synced);
+        TEST_CHECK(sync.book.empty());
+        TEST_CHECK(sync.buffer.size() == 1 && sync.buffer[0].first_update_id == 120);
+        binance_api::DepthSnapshotSpec next_snapshot = snapshot;
+        next_snapshot.last_update_id = 122;
+        TEST_CHECK(sync.apply_snapshot(next_snapshot));
+        TEST_CHECK(sync.book.get_last_update_id() == 125);
+    }
+    {
+        /* спот: первое изменение U <= lastUpdateId + 1 <= u, далее U = u предыдущего + 1 */
+        binance_api::OrderBookSync sync(false);
+        sync.buffer.push_back(make_depth_update(95, 100, 0));
+        sync.buffer.push_back(make_depth_update(101, 105, 0));
+        TEST_CHECK(sync.apply_snapshot(snapshot));
+        TEST_CHECK(sync.book.get_last_update_id() == 105);
+        TEST_CHECK(sync.check_sequence(make_depth_update(106, 110, 0)) == SequenceTypes::APPLY);
+        TEST_CHECK(sync.check_sequence(make_depth_update(107, 110, 0)) == SequenceTypes::GAP);
+        TEST_CHECK(sync.check_sequence(make_depth_update(100, 105, 0)) == SequenceTypes::SKIP);
+    }
+}
+
+/// Закрытый бар агрегатора сделок
+class TestBar {
+public:
+    uint32_t bar_id = 0;
+    uint64_t open_time = 0;
+    xquotes_common::Candle candle;
+    TestBar() {};
+    TestBar(const uint32_t _bar_id, const uint64_t _open_time, const xquotes_common::Candle &_candle) :
+        bar_id(_bar_id), open_time(_open_time), candle(_candle) {};
+};
+
+/// Бары по времени, количеству сделок и объему, опоздавшие сделки не меняют закрытые бары
+void test_trade_bar_aggregator() {
+    std::cout << "test_trade_bar_aggregator" << std::endl;
+    binance_api::TradeBarAggregator aggregator;
+    const uint32_t time_id = aggregator.add_time_bars(500);
+    const uint32_t tick_id = aggregator.add_tick_bars(3);
+    const uint32_t volume_id = aggregator.add_volume_bars(2.0);
+    TEST_CHECK(aggregator.get_num_bars() == 3);
+
+    std::vector<TestBar> closed;
+    aggregator.on_candle = [&](
+            const std::string &symbol,
+            const xquotes_common::Candle &candle,
+            const uint32_t bar_id,
+            const uint64_t open_time,
+            const bool close_candle) {
+        TEST_CHECK(symbol == "BTCUSDT");
+        if(close_candle) closed.push_back(TestBar(bar_id, open_time, candle));
+    };
+
+    aggregator.on_trade("BTCUSDT", 10.0, 1.0, 1000);
+    aggregator.on_trade("BTCUSDT", 12.0, 1.0, 1200);
+    TEST_CHECK(closed.size() == 1);
+    TEST_CHECK(!closed.empty() && closed.back().bar_id == volume_id && closed.back().open_time == 1000);
+    aggregator.on_trade("BTCUSDT", 9.0, 0.5, 1499);
+    TEST_CHECK(closed.size() == 2);
+    TEST_CHECK(closed.size() == 2 && closed.back().bar_id == tick_id && closed.back().candle.close == 9.0);
+
+    /* сделка следующего периода закрывает бар по времени */
+    aggregator.on_trade("BTCUSDT", 11.0, 1.0, 1500);
+    TEST_CHECK(closed.size() == 3);
+    if(closed.size() == 3) {
+        const TestBar &bar = closed.back();
+        TEST_CHECK(bar.bar_id == time_id && bar.open_time == 1000);
+        TEST_CHECK(bar.candle.open == 10.0 && bar.candle.high == 12.0);
+        TEST_CHECK(bar.candle.low == 9.0 && bar.candle.close == 9.0);
+        TEST_CHECK(bar.candle.volume == 2.5 && bar.candle.timestamp == 1);
+    }
+
+    /* опоздавшая сделка закрытого периода отбрасывается */
+    aggregator.on_trade("BTCUSDT", 100.0, 1.0, 1100);
+    aggregator.close_expired_bars(1999);
+    TEST_CHECK(closed.size() == 3);
+    aggregator.close_expired_bars(2000);
+    TEST_CHECK(closed.size() == 4);
+    if(closed.size() == 4) {
+        const TestBar &bar = closed.back();
+        TEST_CHECK(bar.bar_id == time_id && bar.open_time == 1500);
+        TEST_CHECK(bar.candle.high == 11.0 && bar.candle.volume == 1.0);
+    }
+
+    /* бары по сделкам, закрытые в одну миллисекунду, получают разное время открытия */
+    binance_api::TradeBarAggregator tick_aggregator;
+    tick_aggregator.add_tick_bars(1);
+    std::vector<uint64_t> open_times;
+    tick_aggregator.on_candle = [&](
+            const std::string &symbol,
+            const xquotes_common::Candle &candle,
+            const uint32_t bar_id,
+            const uint64_t open_time,
+            const bool close_candle) {
+        if(close_candle) open_times.push_back(open_time);
+    };
+    tick_aggregator.on_trade("BTCUSDT", 10.0, 1.0, 2000);
+    tick_aggregator.on_trade("BTCUSDT", 10.0, 1.0, 2000);
+    tick_aggregator.on_trade("BTCUSDT", 10.0, 1.0, 2000);
+    const std::vector<uint64_t> expected = {2000, 2001, 2002};
+    TEST_CHECK(open_times == expected);
+}
+
+/// Время сервера в миллисекундах для тестов синхронизации времени
+uint64_t to_server_ms(const xtime::ftimestamp_t server_time) {
+    return (uint64_t)std::llround(server_time * 1000.0);
+}
+
+/// Фильтр минимальной задержки, нижняя граница по событиям потоков и уход часов
+void test_server_clock() {
+    std::cout << "test_server_clock" << std::endl;
+    const xtime::ftimestamp_t t = 1600000000.0;
+    {
+        binance_api::ServerClock server_clock;
+        TEST_CHECK(!server_clock.check_estimated());
+        /* запрос с ошибкой не дает измерения */
+        TEST_CHECK(server_clock.sync([](uint64_t &server_time) -> int {
+            return binance_api::CURL_REQUEST_FAILED;
+        }, 2) == binance_api::CURL_REQUEST_FAILED);
+        TEST_CHECK(!server_clock.check_synced());
+
+        server_clock.add_sample(t, t + 0.2, to_server_ms(t + 0.1 + 5.0));
+        TEST_CHECK(server_clock.check_synced());
+        TEST_CHECK(std::abs(server_clock.get_offset(t + 0.2) - 5.0) < 1e-4);
+        TEST_CHECK(std::abs(server_clock.get_error() - 0.1) < 1e-4);
+
+        /* измерение с меньшей задержкой точнее */
+        server_clock.add_sample(t + 1.0, t + 1.02, to_server_ms(t + 1.01 + 5.03));
+        TEST_CHECK(std::abs(server_clock.get_offset(t + 1.02) - 5.03) < 1e-4);
+        TEST_CHECK(std::abs(server_clock.get_error() - 0.01) < 1e-4);
+
+        /* измерение с большой задержкой не меняет оценку */
+        server_clock.add_sample(t + 2.0, t + 3.0, to_server_ms(t + 2.5 + 7.0));
+        TEST_CHECK(std::abs(server_clock.get_offset(t + 3.0) - 5.03) < 1e-4);
+
+        /* событие потока не может прийти раньше, чем произошло: граница уточняет оценку */
+        server_clock.add_passive_sample(to_server_ms(t + 4.0 + 5.035), t + 4.0);
+        TEST_CHECK(std::abs(server_clock.get_offset(t + 4.0) - 5.035) < 1e-4);
+        TEST_CHECK(std::abs(server_clock.get_error() - 0.005) < 1e-4);
+
+        /* граница не выходит за погрешность запроса */
+        server_clock.add_passive_sample(to_server_ms(t + 5.0 + 6.0), t + 5.0);
+        TEST_CHECK(std::abs(server_clock.get_offset(t + 5.0) - 5.04) < 1e-4);
+        TEST_CHECK(server_clock.get_error() < 1e-4);
+    }
+    {
+        /* уход часов оценивается по смещениям, измеренным с интервалом */
+        binance_api::ServerClock server_clock;
+        server_clock.add_sample(t, t + 0.01, to_server_ms(t + 0.005 + 5.0));
+        server_clock.add_sample(t + 100.0, t + 100.004, to_server_ms(t + 100.002 + 5.01));
+        TEST_CHECK(std::abs(server_clock.get_drift() - 0.0001) < 1e-6);
+        TEST_CHECK(std::abs(server_clock.get_offset(t + 200.004) - 5.02) < 1e-4);
+    }
+    {
+        /* скачок смещения не дает уход часов больше допустимого */
+        binance_api::ServerClock server_clock;
+        server_clock.add_sample(t, t + 0.01, to_server_ms(t + 0.005 + 5.0));
+        server_clock.add_sample(t + 100.0, t + 100.004, to_server_ms(t + 100.002 + 6.0));
+        TEST_CHECK(std::abs(server_clock.get_drift() - 0.0005) < 1e-9);
+    }
+}
+
+/// Таймеры срабатывают не раньше срока и по порядку, отмененный таймер не срабатывает
+void test_timer_wheel() {
+    std::cout << "test_timer_wheel" << std::endl;
+    binance_api::TimerWheel timer_wheel;
+    std::mutex fired_mutex;
+    std::vector<std::pair<uint64_t, uint64_t>> fired;
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    /* задержки на границах уровней колеса */
+    const std::vector<uint64_t> delays = {1, 5, 50, 255, 256, 257, 300, 700, 1500};
+    for(size_t i = 0; i < delays.size(); ++i) {
+        const uint64_t delay = delays[i];
+        timer_wheel.schedule_after(delay, [&, delay]() {
+            const uint64_t elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            std::lock_guard<std::mutex> lock(fired_mutex);
+            fired.push_back(std::make_pair(delay, elapsed));
+        });
+    }
+    bool is_canceled_fired = false;
+    binance_api::TimerWheel::timer_id id = timer_wheel.schedule_after(100, [&]() {
+        is_canceled_fired = true;
+    });
+    TEST_CHECK(timer_wheel.cancel(id));
+    TEST_CHECK(!timer_wheel.cancel(id));
+    std::this_thread::sleep_for(std::chrono::milliseconds(1800));
+
+    std::lock_guard<std::mutex> lock(fired_mutex);
+    TEST_CHECK(fired.size() == delays.size());
+    TEST_CHECK(!is_canceled_fired);
+    for(size_t i = 0; i < fired.size(); ++i) {
+        TEST_CHECK(fired[i].second >= fired[i].first);
+        TEST_CHECK(fired[i].second <= (fired[i].first + 50));
+        if(i > 0) TEST_CHECK(fired[i].first > fired[i - 1].first);
+    }
+    TEST_CHECK(timer_wheel.size() == 0);
+}
+
+/// Сверка таблицы ордеров потока пользовательских данных с ответами сервера
+void test_user_data_reconcile() {
+    std::cout << "test_user_data_reconcile" << std::endl;
+    binance_api::UserDataStreams streams("test");
+    auto make_order = [](
+            const std::string &id,
+            const binance_api::TypesOrderStatus status,
+            const double update_time) -> binance_api::OrderUpdateSpec {
+        binance_api::OrderUpdateSpec order;
+        order.symbol = "BTCUSDT";
+        order.client_order_id = id;
+        order.status = status;
+        order.update_time = update_time;
+        return order;
+    };
+    const std::vector<binance_api::PositionSpec> positions;
+    const std::vector<binance_api::BalanceSpec> balances;
+
+    /* ордер найден в таблице потока пользовательских данных */
+    streams.reconcile(positions, balances, {make_order("order-1", binance_api::TypesOrderStatus::NEW, 10)});
+    TEST_CHECK(streams.check_valid());
+    binance_api::UserDataStreams::order_ptr order = streams.get_order("order-1");
+    TEST_CHECK(order && order->status == binance_api::TypesOrderStatus::NEW);
+    TEST_CHECK(!streams.get_order("order-2"));
+
+    /* ордер найден по событию, пришедшему после подписки */
+    std::vector<binance_api::OrderUpdateSpec> events;
+    streams.set_order_callback("order-2", [&](const binance_api::OrderUpdateSpec &update) {
+        events.push_back(update);
+    });
+    streams.reconcile(positions, balances, {make_order("order-2", binance_api::TypesOrderStatus::FILLED, 20)});
+    TEST_CHECK(events.size() == 1);
+    TEST_CHECK(!events.empty() && events[0].status == binance_api::TypesOrderStatus::FILLED);
+    /* после финального события подписка удаляется */
+    streams.reconcile(positions, balances, {make_order("order-2", binance_api::TypesOrderStatus::FILLED, 30)});
+    TEST_CHECK(events.size() == 1);
+
+    /* более старый ответ сервера не откатывает состояние ордера */
+    streams.reconcile(positions, balances, {make_order("order-2", binance_api::TypesOrderStatus::NEW, 15)});
+    order = streams.get_order("order-2");
+    TEST_CHECK(order && order->status == binance_api::TypesOrderStatus::FILLED);
+
+    /* ордера нет на сервере (NO_SUCH_ORDER), он удаляется из таблицы */
+    streams.reconcile(positions, balances, {}, {"order-1"});
+    TEST_CHECK(!streams.get_order("order-1"));
+    TEST_CHECK(streams.get_order("order-2"));
+
+    /* снимок позиции старше сохраненной не откатывает ее */
+    auto make_position = [](const double amount, const double update_time) -> binance_api::PositionSpec {
+        binance_api::PositionSpec position;
+        position.symbol = "BTCUSDT";
+        position.position_side = binance_api::TypesPositionSide::BOTH;
+        position.position_amount = amount;
+        position.update_time = update_time;
+        return position;
+    };
+    binance_api::PositionSpec position;
+    streams.reconcile({make_position(1.0, 40)}, balances, {});
+    streams.reconcile({make_position(0.0, 35)}, balances, {});
+    TEST_CHECK(streams.get_position("BTCUSDT", binance_api::TypesPositionSide::BOTH, position));
+    TEST_CHECK(position.position_amount == 1.0 && position.update_time == 40);
+    streams.reconcile({make_position(0.0, 45)}, balances, {});
+    TEST_CHECK(streams.get_position("BTCUSDT", binance_api::TypesPositionSide::BOTH, position));
+    TEST_CHECK(position.position_amount == 0.0);
+}
+
+/// Ошибки, после которых ордер мог быть размещен, требуют поиска ордера
+void test_unknown_status() {
+    std::cout << "test_unknown_status" << std::endl;
+    const std::vector<int> unknown = {
+        binance_api::NO_RESPONSE_WAITING_PERIOD,
+        binance_api::SERVER_ERROR,
+        binance_api::UNKNOWN,
+        binance_api::UNEXPECTED_RESPONSE,
+        binance_api::TIMEOUT,
+        binance_api::CURL_OPERATION_TIMEDOUT,
+        binance_api::CURL_GOT_NOTHING,
+        binance_api::CURL_SEND_ERROR,
+        binance_api::CURL_RECV_ERROR};
+    for(size_t i = 0; i < unknown.size(); ++i) {
+        TEST_CHECK(binance_api::check_unknown_status(unknown[i]));
+    }
+    /* ответ сервера или ошибка до отправки запроса окончательны */
+    const std::vector<int> known = {
+        binance_api::OK,
+        binance_api::CURL_REQUEST_FAILED,
+        binance_api::LIMITING_NUMBER_REQUESTS,
+        binance_api::INVALID_TIMESTAMP,
+        binance_api::NO_SUCH_ORDER,
+        6,  /* CURLE_COULDNT_RESOLVE_HOST */
+        7}; /* CURLE_COULDNT_CONNECT */
+    for(size_t i = 0; i < known.size(); ++i) {
+        TEST_CHECK(!binance_api::check_unknown_status(known[i]));
+    }
+}
+
+int main() {
+    test_event_dispatcher();
+    test_conflating_dispatcher();
+    test_subscription_manager();
+    test_order_book();
+    test_order_book_sync();
+    test_trade_bar_aggregator();
+    test_server_clock();
+    test_timer_wheel();
+    test_user_data_reconcile();
+    test_unknown_status();
+    if(num_errors > 0) {
+        std::cout << "tests failed: " << num_errors << std::endl;
+        return 1;
+    }
+    std::cout << "tests passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,21 @@
+#ifndef PCH_INTRADE_BAR_HPP_INCLUDED
+#define PCH_INTRADE_BAR_HPP_INCLUDED
+
+//#include <curl/curl.h>
+#include <xtime.hpp>
+//#include <gzip/decompress.hpp>
+#include <nlohmann/json.hpp>
+#include <thread>
+#include <mutex>
+#include <array>
+#include <map>
+#include <atomic>
+#include <iostream>
+#include <limits>
+#include <list>
+#include <random>
+#include <xquotes_common.hpp>
+#include "client_wss.hpp"
+#include <openssl/ssl.h>
+
+#endif // PCH_HPP_INCLUDED
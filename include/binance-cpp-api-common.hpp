@@ -29,6 +29,7 @@
 #include <sstream>
 #include <mutex>
 #include <algorithm>
+#include <vector>
 #include <nlohmann/json.hpp>
 #include "tools/base36.h"
 #include "xtime.hpp"
@@ -120,6 +121,13 @@ namespace binance_api {
             GTX = 4,    /**< Хорошо до пересечения (Post Only) */
         };
 
+        /// Политики поведения при переполнении очереди событий
+        enum class TypesBackpressure {
+            BLOCK = 0,          /**< Ждать освобождения места в очереди */
+            DROP_OLDEST = 1,    /**< Выбросить самое старое событие */
+            CONFLATE = 2,       /**< Схлопнуть события с одинаковым ключом */
+        };
+
         /// Варианты состояния ошибок
         enum ErrorType {
             OK = 0,                             ///< Ошибки нет
@@ -136,6 +144,10 @@ namespace binance_api {
             NO_RESPONSE_WAITING_PERIOD = -11,
             INVALID_PARAMETER = -12,
             NO_PRICE_STREAM_SUBSCRIPTION = -13,
+            SERVER_ERROR = -14,                 ///< Внутренняя ошибка сервера (HTTP 5XX), состояние исполнения неизвестно
+            UNKNOWN = -1000,                            /**< Неизвестная ошибка при обработке запроса */
+            UNEXPECTED_RESPONSE = -1006,                /**< Неожиданный ответ внутренней шины сервера, состояние исполнения неизвестно */
+            TIMEOUT = -1007,                            /**< Ответ сервера не получен за время ожидания, состояние исполнения неизвестно */
             INVALID_TIMESTAMP = -1021,                  /**< Временная метка для этого запроса находится за пределами recvWindow или Временная метка для этого запроса была на 1000 мс раньше времени сервера. */
             NO_SUCH_ORDER = -2013,                      /**< Заказ не существует */
             ORDER_WOULD_IMMEDIATELY_TRIGGER = -2021,    /**< Заказ сразу сработает. */
@@ -156,6 +168,79 @@ namespace binance_api {
             It is important to NOT treat this as a failure operation; the execution status is UNKNOWN and could have been a success.
         */
 
+        /* коды CURL, которые возвращают HTTP запросы */
+        const int CURL_OPERATION_TIMEDOUT = 28; ///< CURLE_OPERATION_TIMEDOUT
+        const int CURL_GOT_NOTHING = 52;        ///< CURLE_GOT_NOTHING, сервер закрыл соединение без ответа
+        const int CURL_SEND_ERROR = 55;         ///< CURLE_SEND_ERROR
+        const int CURL_RECV_ERROR = 56;         ///< CURLE_RECV_ERROR
+
+        /** \brief Проверить, что состояние исполнения запроса неизвестно
+         *
+         * Запрос мог быть исполнен: любой HTTP 5XX, коды -1000, -1006 и -1007,
+         * а также ошибки CURL, которые могут произойти после отправки запроса
+         * \param err Код ошибки
+         * \return Вернет true, если ордер мог быть размещен
+         */
+        inline bool check_unknown_status(const int err) {
+            switch(err) {
+            case NO_RESPONSE_WAITING_PERIOD:
+            case SERVER_ERROR:
+            case UNKNOWN:
+            case UNEXPECTED_RESPONSE:
+            case TIMEOUT:
+            case CURL_OPERATION_TIMEDOUT:
+            case CURL_GOT_NOTHING:
+            case CURL_SEND_ERROR:
+            case CURL_RECV_ERROR:
+                return true;
+            default:
+                break;
+            };
+            return false;
+        }
+
+        /** \brief Получить состояние ордера из строки
+         *
+         * Общий разбор для ответов REST API и событий потока пользовательских данных
+         * \param status Состояние ордера, например FILLED
+         * \return Состояние ордера
+         */
+        inline TypesOrderStatus to_order_status(const std::string &status) {
+            if(status == "NEW") return TypesOrderStatus::NEW;
+            if(status == "PARTIALLY_FILLED") return TypesOrderStatus::PARTIALLY_FILLED;
+            if(status == "FILLED") return TypesOrderStatus::FILLED;
+            if(status == "CANCELED") return TypesOrderStatus::CANCELED;
+            if(status == "REJECTED") return TypesOrderStatus::REJECTED;
+            if(status == "EXPIRED") return TypesOrderStatus::EXPIRED;
+            return TypesOrderStatus::NONE;
+        }
+
+        /** \brief Получить тип ордера из строки
+         * \param type Тип ордера, например STOP_MARKET
+         * \return Тип ордера
+         */
+        inline TypesOrder to_order_type(const std::string &type) {
+            if(type == "LIMIT") return TypesOrder::LIMIT;
+            if(type == "MARKET") return TypesOrder::MARKET;
+            if(type == "STOP") return TypesOrder::STOP;
+            if(type == "TAKE_PROFIT") return TypesOrder::TAKE_PROFIT;
+            if(type == "STOP_MARKET") return TypesOrder::STOP_MARKET;
+            if(type == "TAKE_PROFIT_MARKET") return TypesOrder::TAKE_PROFIT_MARKET;
+            if(type == "TRAILING_STOP_MARKET") return TypesOrder::TRAILING_STOP_MARKET;
+            return TypesOrder::NONE;
+        }
+
+        /** \brief Получить сторону позиции из строки
+         * \param position_side Сторона позиции: BOTH, LONG или SHORT
+         * \return Сторона позиции
+         */
+        inline TypesPositionSide to_position_side(const std::string &position_side) {
+            if(position_side == "BOTH") return TypesPositionSide::BOTH;
+            if(position_side == "LONG") return TypesPositionSide::LONG;
+            if(position_side == "SHORT") return TypesPositionSide::SHORT;
+            return TypesPositionSide::NONE;
+        }
+
         /** \brief параметры символов
          */
         class SymbolSpec {
@@ -173,6 +258,7 @@ namespace binance_api {
             std::string symbol;         /**< Символ */
             TypesPositionSide position_side = TypesPositionSide::NONE;
             double position_amount = 0; /**< Размер позиции (если 0, то позиции нет) */
+            xtime::ftimestamp_t update_time = 0;    /**< Время изменения позиции */
             PositionSpec() {};
         };
 
@@ -194,6 +280,165 @@ namespace binance_api {
             };
         };
 
+        /** \brief Изменение счета из события ACCOUNT_UPDATE
+         *
+         * Содержит только балансы и позиции, которые пришли в событии
+         */
+        class AccountUpdateSpec {
+        public:
+            std::string reason;                     /**< Причина изменения (ORDER, FUNDING_FEE, DEPOSIT, WITHDRAW...) */
+            xtime::ftimestamp_t event_time = 0;     /**< Время события */
+            xtime::ftimestamp_t transaction_time = 0;   /**< Время транзакции */
+            std::vector<BalanceSpec> balances;      /**< Изменившиеся балансы */
+            std::vector<PositionSpec> positions;    /**< Изменившиеся позиции */
+            AccountUpdateSpec() {};
+        };
+
+        /** \brief Уровень стакана
+         */
+        class DepthLevelSpec {
+        public:
+            double price = 0;       /**< Цена */
+            double quantity = 0;    /**< Количество (если 0, то уровня нет) */
+            DepthLevelSpec() {};
+            DepthLevelSpec(const double _price, const double _quantity) :
+                price(_price), quantity(_quantity) {
+            };
+        };
+
+        /** \brief Снимок стакана
+         */
+        class DepthSnapshotSpec {
+        public:
+            uint64_t last_update_id = 0;        /**< ID последнего обновления, вошедшего в снимок */
+            std::vector<DepthLevelSpec> bids;   /**< Заявки на покупку, от лучшей цены */
+            std::vector<DepthLevelSpec> asks;   /**< Заявки на продажу, от лучшей цены */
+            DepthSnapshotSpec() {};
+        };
+
+        /** \brief Параметры ордера для пакетного запроса
+         */
+        class OrderRequestSpec {
+        public:
+            std::string symbol;                                     /**< Символ */
+            std::string new_client_order_id;                        /**< Уникальный номер ордера */
+            TypesOrder type = TypesOrder::MARKET;                   /**< Тип ордера */
+            TypesSide side = TypesSide::NONE;                       /**< Направление сделки */
+            TypesPositionSide position_side = TypesPositionSide::BOTH;  /**< Направление позиции */
+            TypesTimeInForce time_in_force = TypesTimeInForce::NONE;    /**< Время в силе (для лимитных ордеров) */
+            TypesWorking working_type = TypesWorking::CONTRACT_PRICE;   /**< Цена срабатывания стоп ордера */
+            double quantity = 0;                                    /**< Размер ордера */
+            double price = 0;                                       /**< Цена (для лимитных ордеров) */
+            double stop_price = 0;                                  /**< Цена срабатывания (для стоп ордеров) */
+            bool close_position = false;                            /**< Закрыть всю позицию (для стоп ордеров) */
+            bool reduce_only = false;                               /**< Только уменьшение позиции */
+            OrderRequestSpec() {};
+        };
+
+        /** \brief Параметры изменения лимитного ордера
+         *
+         * Ордер определяется по ID биржи или по уникальному номеру ордера
+         */
+        class OrderModifySpec {
+        public:
+            std::string symbol;                                     /**< Символ */
+            std::string orig_client_order_id;                       /**< Уникальный номер ордера */
+            uint64_t order_id = 0;                                  /**< ID ордера биржи */
+            TypesSide side = TypesSide::NONE;                       /**< Направление сделки, должно совпадать с ордером */
+            double quantity = 0;                                    /**< Новый размер ордера */
+            double price = 0;                                       /**< Новая цена */
+            OrderModifySpec() {};
+        };
+
+        /** \brief Результат ордера пакетного запроса
+         */
+        class OrderResultSpec {
+        public:
+            int error_code = OK;                                    /**< Код ошибки ордера */
+            std::string message;                                    /**< Сообщение об ошибке */
+            std::string symbol;
+            std::string client_order_id;                            /**< Уникальный номер ордера */
+            uint64_t order_id = 0;                                  /**< ID ордера биржи */
+            TypesOrderStatus status = TypesOrderStatus::NONE;
+            xtime::ftimestamp_t update_time = 0;                    /**< Время обновления ордера */
+            OrderResultSpec() {};
+        };
+
+        /** \brief Результат закрытия позиций и отмены ордеров символа
+         */
+        class FlattenResultSpec {
+        public:
+            std::string symbol;
+            int close_error_code = OK;      /**< Код ошибки закрытия позиций */
+            int cancel_error_code = OK;     /**< Код ошибки отмены ордеров */
+            uint32_t closed_positions = 0;  /**< Количество закрытых позиций */
+            bool is_canceled = false;       /**< Ордера символа были отменены */
+            FlattenResultSpec() {};
+
+            /** \brief Получить код ошибки символа
+             * \return Код ошибки закрытия позиций, если он есть, иначе код ошибки отмены ордеров
+             */
+            inline int get_error_code() const {
+                return close_error_code != OK ? close_error_code : cancel_error_code;
+            }
+        };
+
+        /** \brief Состояние ордера по событиям потока пользовательских данных
+         */
+        class OrderUpdateSpec {
+        public:
+            std::string symbol;                                     /**< Символ */
+            std::string client_order_id;                            /**< Уникальный номер ордера */
+            uint64_t order_id = 0;                                  /**< ID ордера биржи */
+            TypesOrder type = TypesOrder::NONE;                     /**< Тип ордера */
+            TypesSide side = TypesSide::NONE;                       /**< Направление сделки */
+            TypesPositionSide position_side = TypesPositionSide::NONE;
+            TypesOrderStatus status = TypesOrderStatus::NONE;       /**< Состояние ордера */
+            std::string execution_type;                             /**< Тип последнего события ордера (NEW, TRADE, CANCELED...) */
+            double quantity = 0;                                    /**< Размер ордера */
+            double price = 0;                                       /**< Цена ордера */
+            double stop_price = 0;                                  /**< Цена срабатывания */
+            double average_price = 0;                               /**< Средняя цена исполнения */
+            double filled_quantity = 0;                             /**< Исполненный объем */
+            double last_filled_quantity = 0;                        /**< Объем последнего исполнения */
+            double last_filled_price = 0;                           /**< Цена последнего исполнения */
+            double realized_profit = 0;                             /**< Реализованная прибыль сделки */
+            double commission = 0;                                  /**< Комиссия последнего исполнения */
+            std::string commission_asset;
+            bool is_reduce_only = false;
+            bool is_close_position = false;
+            xtime::ftimestamp_t update_time = 0;                    /**< Время события ордера */
+
+            OrderUpdateSpec() {};
+
+            /** \brief Проверить завершение ордера
+             * \return Вернет true, если ордер больше не изменится
+             */
+            inline bool is_final() const {
+                return status == TypesOrderStatus::FILLED ||
+                    status == TypesOrderStatus::CANCELED ||
+                    status == TypesOrderStatus::REJECTED ||
+                    status == TypesOrderStatus::EXPIRED;
+            }
+        };
+
+        /** \brief Позиция из события маржин-колла
+         */
+        class MarginCallSpec {
+        public:
+            std::string symbol;                                     /**< Символ */
+            TypesPositionSide position_side = TypesPositionSide::NONE;
+            TypesMargin margin_type = TypesMargin::CROSSED;
+            double position_amount = 0;                             /**< Размер позиции */
+            double isolated_wallet = 0;                             /**< Кошелек изолированной позиции */
+            double mark_price = 0;                                  /**< Цена маркировки */
+            double unrealized_profit = 0;                           /**< Нереализованная прибыль */
+            double maintenance_margin = 0;                          /**< Требуемая поддерживающая маржа */
+            double cross_wallet_balance = 0;                        /**< Баланс кросс-кошелька */
+            xtime::ftimestamp_t event_time = 0;                     /**< Время события */
+            MarginCallSpec() {};
+        };
+
         /** \brief Открыть файл JSON
          *
          * Данная функция прочитает файл с JSON и запишет данные в JSON структуру
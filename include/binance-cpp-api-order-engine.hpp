@@ -0,0 +1,1129 @@
+/*
+* binance-cpp-api - C ++ API client for binance
+*
+* Copyright (c) 2019 Elektro Yar. Email: git.electroyar@gmail.com
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef BINANCE_CPP_API_ORDER_ENGINE_HPP_INCLUDED
+#define BINANCE_CPP_API_ORDER_ENGINE_HPP_INCLUDED
+
+#include "binance-cpp-fapi-http.hpp"
+#include "binance-cpp-api-websocket.hpp"
+#include "tools/binance-cpp-api-timer-wheel.hpp"
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <map>
+#include <cmath>
+
+namespace binance_api {
+    using namespace common;
+
+    /** \brief Параметры сделки с тейк-профитом и стоп-лоссом
+     */
+    class BracketOrderSpec {
+    public:
+        std::string symbol;
+        TypesPositionSide position_side = TypesPositionSide::NONE; /**< Тип позиции (LONG или SHORT) */
+        TypesPositionMode position_mode = TypesPositionMode::NONE;
+        std::vector<double> quantities;         /**< Объемы маркет ордеров открытия */
+        double take_profit = 0;                 /**< Цена тейк-профита (0 - не ставить) */
+        double stop_loss = 0;                   /**< Цена стоп-лосса (0 - не ставить) */
+        uint64_t take_profit_pips = 0;          /**< Тейк-профит в пунктах от цены (0 - не ставить) */
+        uint64_t stop_loss_pips = 0;            /**< Стоп-лосс в пунктах от цены (0 - не ставить) */
+        bool is_pips = false;                   /**< Тейк-профит и стоп-лосс заданы в пунктах */
+        bool is_close_position = false;         /**< Стоп ордера закрывают всю позицию */
+        bool is_market_close = false;           /**< При ошибке стоп ордеров закрывать объем сделки маркет ордером, иначе всю позицию */
+        bool is_expiration = true;              /**< Закрыть сделку по экспирации */
+        uint64_t expiration = 0;                /**< Экспирация: длительность сделки или дата, сек. */
+        bool use_date = false;                  /**< Экспирация задана датой */
+        uint64_t recv_window = 60000;           /**< Время ожидания ответа, мс. Ордера сделки отправляются с окном не больше 5000 мс */
+        std::function<void(
+            const int status,
+            const xtime::ftimestamp_t timestamp)> callback = nullptr;   /**< Состояние сделки, OPEN_ORDER_STATUS_* */
+        BracketOrderSpec() {};
+    };
+
+    /** \brief Класс сопровождения сделок
+     *
+     * Каждая сделка - конечный автомат: открытие маркет ордером, установка тейк-профита и стоп-лосса,
+     * ожидание закрытия позиции или экспирации, закрытие. Автомат переходит между состояниями
+     * только по событиям: изменению позиции из потока пользовательских данных и таймерам
+     * экспирации и повторов, поэтому ожидающие сделки не занимают потоки.
+     * Сделки распределяются по потокам-шардам по символу, все события одного символа
+     * обрабатываются одним потоком по порядку. Запросы выполняются в потоке шарда, а ожидания
+     * (поиск ордера с неизвестным состоянием, повторы) планируются таймером и не занимают поток.
+     */
+    class OrderEngine {
+    public:
+        using close_function = std::function<int(const std::string &symbol)>;
+        using price_function = std::function<double(
+            const std::string &symbol,
+            const TypesPositionSide position_side)>;
+
+    private:
+        /// Состояния сделки
+        enum class BracketStates {
+            OPENING,    /**< Открытие позиции и установка стоп ордеров */
+            OPEN,       /**< Ожидание закрытия позиции или экспирации */
+            CLOSING,    /**< Закрытие сделки */
+            CLOSED,
+        };
+
+        /// Сделка
+        class Bracket {
+        public:
+            uint64_t id = 0;
+            BracketOrderSpec spec;
+            BracketStates state = BracketStates::OPENING;
+            TypesSide side_close = TypesSide::NONE;
+            TypesPositionSide real_position_side = TypesPositionSide::NONE;
+            double quantity = 0;                        /**< Открытый объем */
+            xtime::ftimestamp_t open_timestamp = 0;     /**< Время открытия сделки */
+            bool is_position_confirmed = false;         /**< Поток пользовательских данных подтвердил позицию */
+            TimerWheel::timer_id expiration_timer = 0;
+            TimerWheel::timer_id position_timer = 0;    /**< Таймер проверки позиции запросом */
+            std::vector<std::string> stop_order_ids;    /**< Уникальные номера тейк-профита и стоп-лосса */
+            Bracket() {};
+        };
+
+        using bracket_ptr = std::shared_ptr<Bracket>;
+
+        /// Функция отложенного вызова: выполнить задачу не раньше, чем через задержку в мс
+        using defer_function = std::function<void(const uint64_t delay, std::function<void()> task)>;
+        /// Результат отправки ордеров: код ошибки запроса и результаты ордеров
+        using submit_callback = std::function<void(const int err, const std::vector<OrderResultSpec> &results)>;
+
+        /// Поиск ордера с неизвестным состоянием исполнения
+        class UnknownOrder {
+        public:
+            OrderRequestSpec order;
+            std::chrono::steady_clock::time_point submit_time;  /**< Время отправки ордера */
+            uint64_t recv_window = 0;
+            uint64_t delay = 0;                         /**< Задержка до следующего запроса, мс */
+            uint32_t attempt = 0;                       /**< Количество запросов, завершившихся ошибкой */
+            std::mutex event_mutex;
+            std::shared_ptr<OrderUpdateSpec> event;     /**< Событие ордера из потока пользовательских данных */
+            defer_function defer;
+            std::function<void(const int err, const OrderUpdateSpec &update)> callback; /**< OK, NO_SUCH_ORDER или код ошибки */
+            UnknownOrder() {};
+        };
+
+        using unknown_order_ptr = std::shared_ptr<UnknownOrder>;
+
+        /// Отправка ордеров без повторного исполнения
+        class Submission {
+        public:
+            std::vector<OrderRequestSpec> orders;
+            std::vector<OrderResultSpec> results;
+            std::vector<size_t> pending;                /**< Ордера, которые нужно отправить */
+            std::vector<size_t> unknown;                /**< Индексы в pending ордеров с неизвестным состоянием */
+            std::vector<size_t> absent;                 /**< Ордера, отсутствие которых подтверждено */
+            std::vector<OrderResultSpec> batch_results; /**< Результаты последней отправки */
+            std::chrono::steady_clock::time_point submit_time;
+            uint64_t recv_window = 0;
+            uint32_t attempt = 0;
+            size_t next_unknown = 0;
+            defer_function defer;
+            submit_callback callback;
+            Submission() {};
+        };
+
+        using submission_ptr = std::shared_ptr<Submission>;
+
+        /// Поток обработки сделок
+        class Shard {
+        public:
+            std::deque<std::function<void()>> tasks;
+            std::mutex tasks_mutex;
+            std::condition_variable tasks_cv;
+            std::map<std::string, std::map<uint64_t, bracket_ptr>> brackets;   /**< Сделки по символам, доступны только потоку шарда */
+            std::future<void> worker;
+            Shard() {};
+        };
+
+        std::shared_ptr<BinanceHttpFApi> binance_http_fapi;
+        std::shared_ptr<UserDataStreams> user_data_streams;
+        close_function close_provider = nullptr;    /**< Закрытие позиции символа */
+        price_function price_provider = nullptr;    /**< Цена для расчета тейк-профита и стоп-лосса */
+
+        std::vector<std::unique_ptr<Shard>> shards;
+        std::shared_ptr<TimerWheel> timer_wheel;    /**< Таймеры экспирации и повторов */
+        std::shared_ptr<TimerLifetime> timer_lifetime = std::make_shared<TimerLifetime>();
+        std::atomic<uint64_t> bracket_counter = ATOMIC_VAR_INIT(0);
+        std::atomic<uint64_t> num_brackets = ATOMIC_VAR_INIT(0);
+        std::atomic<bool> is_closing = ATOMIC_VAR_INIT(false);     /**< Закрытие всех сделок при разрушении */
+        std::atomic<bool> is_shutdown = ATOMIC_VAR_INIT(false);
+
+        const uint32_t close_attempts = 10;         /**< Количество попыток закрытия маркет ордером */
+        const uint64_t close_retry_delay = 1000;    /**< Задержка между попытками, мс */
+        const uint32_t submit_attempts = 3;         /**< Количество отправок ордера, отсутствие которого подтверждено */
+        const uint32_t query_attempts = 5;          /**< Количество запросов ордера с неизвестным состоянием */
+        const uint64_t query_retry_delay = 20;      /**< Начальная задержка между запросами ордера, мс */
+        const uint64_t query_max_delay = 1000;      /**< Максимальная задержка между запросами ордера, мс */
+        const uint64_t recv_window_margin = 1000;   /**< Запас к recv_window на расхождение часов, мс */
+        const uint64_t order_recv_window = 5000;    /**< Наибольшее recv_window ордеров сделки, мс: столько ждет подтверждение отсутствия ордера */
+        const uint64_t stream_wait_delay = 50;      /**< Ожидание события ордера из потока пользовательских данных, мс */
+        const uint64_t position_check_delay = 10000;    /**< Период проверки позиции сделки без экспирации запросом, мс */
+
+        /** \brief Проверить, что ордер принят биржей
+         * \param status Состояние ордера
+         * \return Вернет true, если ордер размещен или уже исполнен
+         */
+        static inline bool check_order_placed(const TypesOrderStatus status) {
+            return status == TypesOrderStatus::NEW ||
+                status == TypesOrderStatus::PARTIALLY_FILLED ||
+                status == TypesOrderStatus::FILLED;
+        }
+
+        /** \brief Заполнить результат ордера по состоянию ордера
+         * \param update Состояние ордера
+         * \param result Результат ордера
+         */
+        static void set_order_result(const OrderUpdateSpec &update, OrderResultSpec &result) {
+            result = OrderResultSpec();
+            result.symbol = update.symbol;
+            result.client_order_id = update.client_order_id;
+            result.order_id = update.order_id;
+            result.status = update.status;
+            result.update_time = update.update_time;
+        }
+
+        /** \brief Получить отложенный вызов в потоке шарда символа
+         *
+         * Задача планируется таймером и затем передается потоку шарда, поэтому ожидание не занимает поток.
+         * При разрушении объекта таймеры не работают, и задача выполняется после задержки в текущем потоке
+         * \param symbol Символ
+         * \return Функция отложенного вызова
+         */
+        defer_function get_shard_defer(const std::string &symbol) {
+            return [this, symbol](const uint64_t delay, std::function<void()> task) {
+                if(is_closing) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+                    task();
+                    return;
+                }
+                timer_wheel->schedule_after(delay, TimerLifetime::wrap(timer_lifetime, [this, symbol, task]() {
+                    post(symbol, task);
+                }));
+            };
+        }
+
+        /** \brief Получить отложенный вызов в текущем потоке
+         * \return Функция отложенного вызова, которая ждет задержку и выполняет задачу сразу
+         */
+        static defer_function get_blocking_defer() {
+            return [](const uint64_t delay, std::function<void()> task) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+                task();
+            };
+        }
+
+        /** \brief Найти ордер с неизвестным состоянием исполнения
+         *
+         * Сначала проверяется таблица ордеров потока пользовательских данных, затем после задержки
+         * stream_wait_delay проверяется событие ордера, и только потом ордер запрашивается по уникальному номеру.
+         * Все ожидания выполняются через функцию отложенного вызова поиска
+         * \param query Поиск ордера
+         */
+        void resolve_unknown_order(const unknown_order_ptr &query) {
+            query->delay = query_retry_delay;
+            const std::string &id = query->order.new_client_order_id;
+            if(!user_data_streams || !user_data_streams->check_valid()) {
+                query_unknown_order(query);
+                return;
+            }
+            /* подписываемся до проверки таблицы, чтобы не пропустить событие между ними */
+            user_data_streams->set_order_callback(id, [query](const OrderUpdateSpec &update) {
+                std::lock_guard<std::mutex> lock(query->event_mutex);
+                if(!query->event) query->event = std::make_shared<OrderUpdateSpec>(update);
+            });
+            UserDataStreams::order_ptr cached = user_data_streams->get_order(id);
+            if(cached) {
+                user_data_streams->remove_order_callback(id);
+                query->callback(OK, *cached);
+                return;
+            }
+            query->defer(stream_wait_delay, [this, query]() {
+                user_data_streams->remove_order_callback(query->order.new_client_order_id);
+                std::shared_ptr<OrderUpdateSpec> event;
+                {
+                    std::lock_guard<std::mutex> lock(query->event_mutex);
+                    event = query->event;
+                }
+                if(event) {
+                    query->callback(OK, *event);
+                    return;
+                }
+                query_unknown_order(query);
+            });
+        }
+
+        /** \brief Запросить ордер с неизвестным состоянием исполнения по уникальному номеру
+         *
+         * Пока не истекло recv_window с момента отправки, запрос еще может быть принят сервером,
+         * поэтому ответ NO_SUCH_ORDER до этого момента не считается отсутствием ордера.
+         * Повторные запросы планируются с растущей задержкой
+         * \param query Поиск ордера
+         */
+        void query_unknown_order(const unknown_order_ptr &query) {
+            OrderUpdateSpec update;
+            const int err = binance_http_fapi->get_order(query->order.symbol, query->order.new_client_order_id, update);
+            if(err == OK) {
+                query->callback(OK, update);
+                return;
+            }
+            if(err == NO_SUCH_ORDER) {
+                const uint64_t elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - query->submit_time).count();
+                if(elapsed >= (query->recv_window + recv_window_margin)) {
+                    query->callback(NO_SUCH_ORDER, update);
+                    return;
+                }
+            } else if(++query->attempt >= query_attempts) {
+                query->callback(err, update);
+                return;
+            }
+            const uint64_t delay = query->delay;
+            query->delay = std::min(delay * 2, query_max_delay);
+            query->defer(delay, [this, query]() {
+                query_unknown_order(query);
+            });
+        }
+
+        /** \brief Отправить ордера без повторного исполнения
+         *
+         * Если состояние исполнения запроса или отдельного ордера пакета неизвестно (см. check_unknown_status()),
+         * ордер ищется по уникальному номеру, и повторно отправляются только ордера, отсутствие которых подтверждено.
+         * Повторная отправка использует тот же уникальный номер ордера.
+         * Ожидания поиска выполняются через функцию отложенного вызова, callback-функция вызывается один раз
+         * \param orders Параметры ордеров (не больше BinanceHttpFApi::MAX_BATCH_ORDERS)
+         * \param recv_window Время ожидания ответа, в мс.
+         * \param defer Функция отложенного вызова
+         * \param callback Код ошибки запроса и результаты ордеров в том же порядке
+         */
+        void submit_orders(
+                const std::vector<OrderRequestSpec> &orders,
+                const uint64_t recv_window,
+                defer_function defer,
+                submit_callback callback) {
+            submission_ptr submission = std::make_shared<Submission>();
+            submission->orders = orders;
+            submission->results.assign(orders.size(), OrderResultSpec());
+            for(size_t i = 0; i < orders.size(); ++i) {
+                submission->pending.push_back(i);
+            }
+            submission->recv_window = recv_window;
+            submission->defer = defer;
+            submission->callback = callback;
+            send_orders(submission);
+        }
+
+        /** \brief Отправить ордера, отсутствие которых подтверждено
+         * \param submission Отправка ордеров
+         */
+        void send_orders(const submission_ptr &submission) {
+            Submission &s = *submission;
+            if(s.attempt >= submit_attempts || s.pending.empty()) {
+                /* отсутствие ордеров подтверждено, но попытки отправки закончились */
+                for(size_t i = 0; i < s.pending.size(); ++i) {
+                    s.results[s.pending[i]].error_code = NO_SUCH_ORDER;
+                }
+                s.callback(OK, s.results);
+                return;
+            }
+            ++s.attempt;
+            std::vector<OrderRequestSpec> batch;
+            for(size_t i = 0; i < s.pending.size(); ++i) {
+                batch.push_back(s.orders[s.pending[i]]);
+            }
+            s.batch_results.assign(batch.size(), OrderResultSpec());
+            s.submit_time = std::chrono::steady_clock::now();
+            int err = OK;
+            if(batch.size() == 1) {
+                err = binance_http_fapi->open_order(batch[0], s.batch_results[0], s.recv_window);
+                /* ошибка ордера передается в результате, как у пакетного запроса */
+                if(err != OK && !check_unknown_status(err) && s.batch_results[0].error_code == err) err = OK;
+            } else {
+                err = binance_http_fapi->open_batch_orders(batch, s.batch_results, s.recv_window);
+            }
+            if(err != OK && !check_unknown_status(err)) {
+                s.callback(err, s.results);
+                return;
+            }
+            if(err != OK) std::cerr << "binance_api::OrderEngine unknown order status, code: " << err << std::endl;
+            /* неизвестным может быть состояние всего запроса или отдельного ордера пакета */
+            s.unknown.clear();
+            s.absent.clear();
+            s.next_unknown = 0;
+            for(size_t i = 0; i < s.pending.size(); ++i) {
+                const int err_order = err != OK ? err : s.batch_results[i].error_code;
+                if(!check_unknown_status(err_order)) {
+                    s.results[s.pending[i]] = s.batch_results[i];
+                    continue;
+                }
+                if(err == OK) std::cerr << "binance_api::OrderEngine unknown order status, client order id: " << s.orders[s.pending[i]].new_client_order_id << ", code: " << err_order << std::endl;
+                s.unknown.push_back(i);
+            }
+            resolve_next_order(submission);
+        }
+
+        /** \brief Найти следующий ордер с неизвестным состоянием, затем отправить отсутствующие ордера
+         * \param submission Отправка ордеров
+         */
+        void resolve_next_order(const submission_ptr &submission) {
+            Submission &s = *submission;
+            if(s.next_unknown >= s.unknown.size()) {
+                s.pending = s.absent;
+                send_orders(submission);
+                return;
+            }
+            const size_t i = s.unknown[s.next_unknown++];
+            const size_t index = s.pending[i];
+            unknown_order_ptr query = std::make_shared<UnknownOrder>();
+            query->order = s.orders[index];
+            query->submit_time = s.submit_time;
+            query->recv_window = s.recv_window;
+            query->defer = s.defer;
+            query->callback = [this, submission, i, index](const int err, const OrderUpdateSpec &update) {
+                Submission &s = *submission;
+                if(err == OK) {
+                    set_order_result(update, s.results[index]);
+                } else
+                if(err == NO_SUCH_ORDER) {
+                    s.absent.push_back(index);
+                } else {
+                    /* состояние ордера так и осталось неизвестным */
+                    s.results[index] = s.batch_results[i];
+                    s.results[index].error_code = err;
+                }
+                resolve_next_order(submission);
+            };
+            resolve_unknown_order(query);
+        }
+
+        /** \brief Получить время ожидания ответа для ордеров сделки
+         * \param spec Параметры сделки
+         * \return recv_window ордеров, не больше order_recv_window
+         */
+        inline uint64_t get_order_recv_window(const BracketOrderSpec &spec) const {
+            return std::min(spec.recv_window, order_recv_window);
+        }
+
+        inline Shard &get_shard(const std::string &symbol) {
+            return *shards[std::hash<std::string>()(symbol) % shards.size()];
+        }
+
+        void post(const std::string &symbol, std::function<void()> task) {
+            Shard &shard = get_shard(symbol);
+            std::lock_guard<std::mutex> lock(shard.tasks_mutex);
+            shard.tasks.push_back(std::move(task));
+            shard.tasks_cv.notify_one();
+        }
+
+        void worker_loop(Shard &shard) {
+            while(true) {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(shard.tasks_mutex);
+                    shard.tasks_cv.wait(lock, [&]() {
+                        return is_shutdown || !shard.tasks.empty();
+                    });
+                    /* при остановке поток завершается после выполнения всех задач */
+                    if(shard.tasks.empty()) break;
+                    task = std::move(shard.tasks.front());
+                    shard.tasks.pop_front();
+                }
+                try {
+                    task();
+                }
+                catch(const std::exception &e) {
+                    std::cerr << "binance_api::OrderEngine task error, what: " << e.what() << std::endl;
+                }
+                catch(...) {
+                    std::cerr << "binance_api::OrderEngine task error" << std::endl;
+                }
+            }
+        }
+
+        inline xtime::ftimestamp_t get_server_ftimestamp() {
+            return binance_http_fapi->get_server_ftimestamp();
+        }
+
+        inline void notify(const bracket_ptr &bracket, const int status, const xtime::ftimestamp_t timestamp) {
+            if(bracket->spec.callback != nullptr) bracket->spec.callback(status, timestamp);
+        }
+
+        inline void notify(const bracket_ptr &bracket, const int status) {
+            notify(bracket, status, get_server_ftimestamp());
+        }
+
+        /** \brief Завершить сопровождение сделки
+         */
+        void finish(const bracket_ptr &bracket) {
+            if(bracket->state == BracketStates::CLOSED) return;
+            bracket->state = BracketStates::CLOSED;
+            if(bracket->expiration_timer != 0) {
+                timer_wheel->cancel(bracket->expiration_timer);
+                bracket->expiration_timer = 0;
+            }
+            if(bracket->position_timer != 0) {
+                timer_wheel->cancel(bracket->position_timer);
+                bracket->position_timer = 0;
+            }
+            Shard &shard = get_shard(bracket->spec.symbol);
+            auto it_symbol = shard.brackets.find(bracket->spec.symbol);
+            if(it_symbol != shard.brackets.end()) {
+                it_symbol->second.erase(bracket->id);
+                if(it_symbol->second.empty()) shard.brackets.erase(it_symbol);
+            }
+            --num_brackets;
+        }
+
+        /** \brief Найти сделку
+         */
+        bracket_ptr find_bracket(const std::string &symbol, const uint64_t id) {
+            Shard &shard = get_shard(symbol);
+            auto it_symbol = shard.brackets.find(symbol);
+            if(it_symbol == shard.brackets.end()) return bracket_ptr();
+            auto it = it_symbol->second.find(id);
+            if(it == it_symbol->second.end()) return bracket_ptr();
+            return it->second;
+        }
+
+        /** \brief Получить сделки символа
+         */
+        std::vector<bracket_ptr> get_brackets(const std::string &symbol) {
+            std::vector<bracket_ptr> list;
+            Shard &shard = get_shard(symbol);
+            auto it_symbol = shard.brackets.find(symbol);
+            if(it_symbol == shard.brackets.end()) return list;
+            for(auto &item : it_symbol->second) {
+                list.push_back(item.second);
+            }
+            return list;
+        }
+
+        /** \brief Закрыть объем сделки маркет ордером
+         *
+         * Биржа проверяет уникальность clientOrderId только среди открытых ордеров, поэтому
+         * повторная отправка с тем же номером не защищает от двойного закрытия. Перед каждой
+         * повторной попыткой ордер запрашивается, и новый ордер отправляется, только если прежний
+         * не исполнен (см. check_close_order())
+         * \param bracket Сделка
+         * \param error_status Состояние сделки при неудаче всех попыток
+         * \param next Следующий шаг закрытия
+         */
+        void close_market(
+                const bracket_ptr &bracket,
+                const int error_status,
+                std::function<void()> next) {
+            OrderRequestSpec order;
+            order.symbol = bracket->spec.symbol;
+            order.new_client_order_id = get_uuid(get_server_ftimestamp());
+            order.type = TypesOrder::MARKET;
+            order.side = bracket->side_close;
+            order.position_side = bracket->real_position_side;
+            order.quantity = bracket->quantity;
+            /* в одностороннем режиме закрытие не должно открыть встречную позицию */
+            order.reduce_only = bracket->real_position_side == TypesPositionSide::BOTH;
+            close_market(bracket, order, 0, error_status, next);
+        }
+
+        /** \brief Отправить ордер закрытия объема сделки
+         *
+         * Поиск ордера и повторные попытки планируются таймером и не блокируют поток шарда
+         * (см. get_shard_defer())
+         * \param bracket Сделка
+         * \param order Ордер закрытия
+         * \param attempt Номер попытки
+         * \param error_status Состояние сделки при неудаче всех попыток
+         * \param next Следующий шаг закрытия
+         */
+        void close_market(
+                const bracket_ptr &bracket,
+                const OrderRequestSpec &order,
+                const uint32_t attempt,
+                const int error_status,
+                std::function<void()> next) {
+            const std::string symbol = bracket->spec.symbol;
+            submit_orders(std::vector<OrderRequestSpec>(1, order), get_order_recv_window(bracket->spec), get_shard_defer(symbol),
+                    [this, symbol, bracket, order, attempt, error_status, next](const int err_submit, const std::vector<OrderResultSpec> &results) {
+                int err = err_submit != OK ? err_submit : results[0].error_code;
+                if(err == OK && !check_order_placed(results[0].status)) err = DATA_NOT_AVAILABLE;
+                if(err == OK) {
+                    next();
+                    return;
+                }
+                std::cerr << "binance_api::OrderEngine close market order error, symbol: " << symbol << ", code: " << err << std::endl;
+                /* все отправки ордера уже выполнены, поэтому время ответа не раньше последней отправки */
+                const std::chrono::steady_clock::time_point send_time = std::chrono::steady_clock::now();
+                get_shard_defer(symbol)(close_retry_delay, [this, bracket, order, attempt, send_time, error_status, next]() {
+                    check_close_order(bracket, order, attempt, send_time, error_status, next);
+                });
+            });
+        }
+
+        /** \brief Проверить ордер закрытия перед повторной попыткой
+         *
+         * Если ордер размещен или исполнен, закрытие завершено. Новый ордер с новым уникальным номером
+         * отправляется, только если прежний ордер отменен, отклонен или истек, либо сервер не знает его
+         * спустя recv_window после отправки. Иначе проверка повторяется через close_retry_delay
+         * \param bracket Сделка
+         * \param order Ордер закрытия
+         * \param attempt Номер попытки
+         * \param send_time Время отправки ордера
+         * \param error_status Состояние сделки при неудаче всех попыток
+         * \param next Следующий шаг закрытия
+         */
+        void check_close_order(
+                const bracket_ptr &bracket,
+                const OrderRequestSpec &order,
+                const uint32_t attempt,
+                const std::chrono::steady_clock::time_point send_time,
+                const int error_status,
+                std::function<void()> next) {
+            const std::string symbol = bracket->spec.symbol;
+            OrderUpdateSpec update;
+            const int err = binance_http_fapi->get_order(symbol, order.new_client_order_id, update, get_order_recv_window(bracket->spec));
+            if(err == OK && check_order_placed(update.status)) {
+                next();
+                return;
+            }
+            const uint32_t n = attempt + 1;
+            if(n >= close_attempts) {
+                notify(bracket, error_status);
+                std::cerr << "binance_api::OrderEngine close market order error, symbol: " << symbol << ", attempts: " << n << std::endl;
+                next();
+                return;
+            }
+            const uint64_t elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - send_time).count();
+            const bool is_absent = err == OK ||
+                (err == NO_SUCH_ORDER && elapsed >= (get_order_recv_window(bracket->spec) + recv_window_margin));
+            if(is_absent) {
+                /* новый номер, чтобы поиск ордера не нашел запись прежнего ордера */
+                OrderRequestSpec retry_order = order;
+                retry_order.new_client_order_id = get_uuid(get_server_ftimestamp());
+                close_market(bracket, retry_order, n, error_status, next);
+                return;
+            }
+            if(err != NO_SUCH_ORDER) std::cerr << "binance_api::OrderEngine get_order() error, symbol: " << symbol << ", code: " << err << std::endl;
+            get_shard_defer(symbol)(close_retry_delay, [this, bracket, order, n, send_time, error_status, next]() {
+                check_close_order(bracket, order, n, send_time, error_status, next);
+            });
+        }
+
+        /** \brief Отменить стоп ордера и завершить сделку
+         * \param bracket Сделка
+         * \param error_status Состояние сделки при ошибке отмены
+         * \param close_status Состояние закрытия сделки
+         */
+        void cancel_and_finish(const bracket_ptr &bracket, const int error_status, const int close_status) {
+            /* отменяем только стоп ордера сделки, сработавший ордер отменить уже нельзя */
+            if(!bracket->stop_order_ids.empty()) {
+                std::vector<OrderResultSpec> results;
+                int err = binance_http_fapi->cancel_batch_orders(bracket->spec.symbol, bracket->stop_order_ids, results);
+                if(err != OK) {
+                    notify(bracket, error_status);
+                    std::cerr << "binance_api::OrderEngine cancel_batch_orders() error, symbol: " << bracket->spec.symbol << ", code: " << err << std::endl;
+                }
+                bracket->stop_order_ids.clear();
+            }
+            notify(bracket, close_status);
+            finish(bracket);
+        }
+
+        /** \brief Закрыть сделку, стоп ордера которой не удалось установить
+         */
+        void close_after_stop_error(const bracket_ptr &bracket) {
+            bracket->state = BracketStates::CLOSING;
+            if(bracket->spec.is_market_close) {
+                close_market(bracket, OPEN_ORDER_STATUS_ERROR_5, [this, bracket]() {
+                    cancel_and_finish(bracket, OPEN_ORDER_STATUS_ERROR_6, OPEN_ORDER_STATUS_CLOSE_1);
+                });
+                return;
+            }
+            int err = close_provider(bracket->spec.symbol);
+            if(err != OK) {
+                std::cerr << "binance_api::OrderEngine close position error, symbol: " << bracket->spec.symbol << ", code: " << err << std::endl;
+                notify(bracket, OPEN_ORDER_STATUS_ERROR_1);
+                finish(bracket);
+                return;
+            }
+            cancel_and_finish(bracket, OPEN_ORDER_STATUS_ERROR_6, OPEN_ORDER_STATUS_CLOSE_1);
+        }
+
+        /** \brief Позиция сделки закрыта (сработал тейк-профит, стоп-лосс или позицию закрыли вручную)
+         */
+        void on_position_closed(const bracket_ptr &bracket) {
+            bracket->state = BracketStates::CLOSING;
+            cancel_and_finish(bracket, OPEN_ORDER_STATUS_ERROR_7, OPEN_ORDER_STATUS_CLOSE_2);
+        }
+
+        /** \brief Сделка истекла
+         */
+        void on_expiration(const bracket_ptr &bracket) {
+            if(bracket->state != BracketStates::OPEN) return;
+            bracket->state = BracketStates::CLOSING;
+            bracket->expiration_timer = 0;
+            close_market(bracket, OPEN_ORDER_STATUS_ERROR_8, [this, bracket]() {
+                cancel_and_finish(bracket, OPEN_ORDER_STATUS_ERROR_9, OPEN_ORDER_STATUS_CLOSE_3);
+            });
+        }
+
+        /** \brief Запланировать экспирацию сделки
+         */
+        void schedule_expiration(const bracket_ptr &bracket) {
+            const BracketOrderSpec &spec = bracket->spec;
+            const xtime::ftimestamp_t stop_timestamp = spec.use_date ?
+                (xtime::ftimestamp_t)spec.expiration :
+                (bracket->open_timestamp + (xtime::ftimestamp_t)spec.expiration);
+            const std::string symbol = spec.symbol;
+            const uint64_t id = bracket->id;
+            bracket->expiration_timer = timer_wheel->schedule_at_server_time(stop_timestamp, TimerLifetime::wrap(timer_lifetime, [this, symbol, id]() {
+                post(symbol, [this, symbol, id]() {
+                    bracket_ptr bracket = find_bracket(symbol, id);
+                    if(bracket) on_expiration(bracket);
+                });
+            }));
+        }
+
+        /** \brief Запланировать проверку позиции сделки запросом
+         *
+         * Сделка без экспирации завершается только закрытием позиции. Если событие позиции
+         * потока пользовательских данных потеряно, закрытие будет обнаружено запросом positionRisk
+         */
+        void schedule_position_check(const bracket_ptr &bracket) {
+            const std::string symbol = bracket->spec.symbol;
+            const uint64_t id = bracket->id;
+            bracket->position_timer = timer_wheel->schedule_after(position_check_delay, TimerLifetime::wrap(timer_lifetime, [this, symbol, id]() {
+                post(symbol, [this, symbol, id]() {
+                    bracket_ptr bracket = find_bracket(symbol, id);
+                    if(bracket) check_position(bracket);
+                });
+            }));
+        }
+
+        /** \brief Проверить позицию сделки запросом
+         *
+         * Запрос выполняется после открытия позиции, поэтому нулевая позиция означает,
+         * что позиция закрыта, даже если поток не подтвердил ее открытие
+         */
+        void check_position(const bracket_ptr &bracket) {
+            bracket->position_timer = 0;
+            if(bracket->state != BracketStates::OPEN) return;
+            bool is_found = false;
+            double position_amount = 0;
+            const int err = binance_http_fapi->get_position_risk(bracket->spec.symbol, [&](const PositionSpec &position) {
+                if(position.symbol != bracket->spec.symbol) return;
+                if(position.position_side != bracket->real_position_side) return;
+                is_found = true;
+                position_amount = position.position_amount;
+            }, bracket->spec.recv_window);
+            if(err != OK || !is_found) {
+                if(err != OK) std::cerr << "binance_api::OrderEngine get_position_risk() error, symbol: " << bracket->spec.symbol << ", code: " << err << std::endl;
+                schedule_position_check(bracket);
+                return;
+            }
+            if(position_amount != 0.0) {
+                bracket->is_position_confirmed = true;
+                schedule_position_check(bracket);
+                return;
+            }
+            on_position_closed(bracket);
+        }
+
+        /** \brief Открыть сделку
+         *
+         * Выполняется в потоке шарда символа
+         */
+        void run_open(const bracket_ptr &bracket) {
+            const BracketOrderSpec &spec = bracket->spec;
+
+            /* проверяем наличие позиции по данной паре и закрываем, если есть */
+            int err = close_provider(spec.symbol);
+            if(err != OK) {
+                std::cerr << "binance_api::OrderEngine close position error, symbol: " << spec.symbol << ", code: " << err << std::endl;
+                notify(bracket, OPEN_ORDER_STATUS_ERROR_1);
+                finish(bracket);
+                return;
+            }
+
+            /* прежние сделки символа закрыты вместе с позицией, их стоп ордера отменяем до установки новых */
+            std::vector<bracket_ptr> list = get_brackets(spec.symbol);
+            for(size_t i = 0; i < list.size(); ++i) {
+                if(list[i]->id == bracket->id || list[i]->state != BracketStates::OPEN) continue;
+                on_position_closed(list[i]);
+            }
+
+            /* определяем состояния сделок */
+            bracket->side_close = spec.position_side == TypesPositionSide::LONG ? TypesSide::SELL : TypesSide::BUY;
+            bracket->real_position_side = spec.position_mode == TypesPositionMode::One_way_Mode ? TypesPositionSide::BOTH : spec.position_side;
+
+            open_market_orders(bracket, 0);
+        }
+
+        /** \brief Открыть маркет ордера сделки пакетами, по одному запросу на пакет
+         *
+         * Следующий пакет отправляется после результата предыдущего, затем ставятся стоп ордера
+         * \param bracket Сделка
+         * \param offset Индекс первого объема пакета
+         */
+        void open_market_orders(const bracket_ptr &bracket, const size_t offset) {
+            const BracketOrderSpec &spec = bracket->spec;
+            if(offset >= spec.quantities.size()) {
+                place_stop_orders(bracket);
+                return;
+            }
+            const TypesSide side = spec.position_side == TypesPositionSide::LONG ? TypesSide::BUY : TypesSide::SELL;
+            const size_t batch_end = std::min(spec.quantities.size(), offset + BinanceHttpFApi::MAX_BATCH_ORDERS);
+            std::vector<OrderRequestSpec> orders;
+            for(size_t n = offset; n < batch_end; ++n) {
+                OrderRequestSpec order;
+                order.symbol = spec.symbol;
+                order.new_client_order_id = get_uuid(get_server_ftimestamp());
+                order.type = TypesOrder::MARKET;
+                order.side = side;
+                order.position_side = bracket->real_position_side;
+                order.quantity = spec.quantities[n];
+                orders.push_back(order);
+            }
+            submit_orders(orders, get_order_recv_window(spec), get_shard_defer(spec.symbol),
+                    [this, bracket, orders, batch_end](const int err_open, const std::vector<OrderResultSpec> &results) {
+                for(size_t n = 0; n < orders.size(); ++n) {
+                    const int err_order = err_open != OK ? err_open : results[n].error_code;
+                    if(err_order != OK || !check_order_placed(results[n].status)) {
+                        std::cerr << "binance_api::OrderEngine open_batch_orders() error, symbol: " << bracket->spec.symbol << ", code: " << err_order << std::endl;
+                        notify(bracket, OPEN_ORDER_STATUS_ERROR_1);
+                        continue;
+                    }
+                    /* запоминаем время открытия ордера */
+                    bracket->open_timestamp = results[n].update_time;
+                    bracket->quantity += orders[n].quantity;
+                }
+                open_market_orders(bracket, batch_end);
+            });
+        }
+
+        /** \brief Поставить тейк-профит и стоп-лосс открытой сделки
+         * \param bracket Сделка
+         */
+        void place_stop_orders(const bracket_ptr &bracket) {
+            const BracketOrderSpec &spec = bracket->spec;
+            if(bracket->quantity == 0) {
+                finish(bracket);
+                return;
+            }
+
+            notify(bracket, OPEN_ORDER_STATUS_OPEN, bracket->open_timestamp);
+            bracket->state = BracketStates::OPEN;
+
+            /* находим цены тейк-профита и стоп-лосса */
+            double take_profit = spec.take_profit;
+            double stop_loss = spec.stop_loss;
+            if(spec.is_pips && (spec.take_profit_pips != 0 || spec.stop_loss_pips != 0)) {
+                const double last_price = price_provider == nullptr ? 0.0 : price_provider(spec.symbol, spec.position_side);
+                if(last_price == 0) {
+                    std::cerr << "binance_api::OrderEngine no price, symbol: " << spec.symbol << std::endl;
+                    notify(bracket, OPEN_ORDER_STATUS_ERROR_10);
+                    close_after_stop_error(bracket);
+                    return;
+                }
+                const uint32_t mult = std::pow(10, binance_http_fapi->get_precision(spec.symbol));
+                const double step_price = 1.0d/(double)mult;
+                const bool is_long = spec.position_side == TypesPositionSide::LONG;
+                take_profit = spec.take_profit_pips == 0 ? 0.0 :
+                    (is_long ? (last_price + step_price * (double)spec.take_profit_pips) : (last_price - step_price * (double)spec.take_profit_pips));
+                stop_loss = spec.stop_loss_pips == 0 ? 0.0 :
+                    (is_long ? (last_price - step_price * (double)spec.stop_loss_pips) : (last_price + step_price * (double)spec.stop_loss_pips));
+                take_profit = (double)((uint64_t)((take_profit * (double)mult) + 0.5d)) / (double)mult;
+                stop_loss = (double)((uint64_t)((stop_loss * (double)mult) + 0.5d)) / (double)mult;
+            } else
+            if(spec.is_pips) {
+                take_profit = stop_loss = 0;
+            }
+
+            /* открываем два стоп маркета одним запросом, чтобы позиция не оставалась без защиты лишнее время */
+            std::vector<OrderRequestSpec> orders;
+            std::vector<bool> is_take_profit;
+            const double stop_prices[2] = {take_profit, stop_loss};
+            const TypesOrder stop_types[2] = {TypesOrder::TAKE_PROFIT_MARKET, TypesOrder::STOP_MARKET};
+            for(size_t i = 0; i < 2; ++i) {
+                if(stop_prices[i] == 0) continue;
+                OrderRequestSpec order;
+                order.symbol = spec.symbol;
+                order.new_client_order_id = get_uuid(get_server_ftimestamp());
+                order.type = stop_types[i];
+                order.side = bracket->side_close;
+                order.position_side = bracket->real_position_side;
+                order.quantity = bracket->quantity;
+                order.stop_price = stop_prices[i];
+                order.close_position = spec.is_close_position;
+                orders.push_back(order);
+                is_take_profit.push_back(i == 0);
+            }
+            if(orders.empty()) {
+                on_stop_orders(bracket, OK, OK);
+                return;
+            }
+            submit_orders(orders, get_order_recv_window(spec), get_shard_defer(spec.symbol),
+                    [this, bracket, orders, is_take_profit](const int err, const std::vector<OrderResultSpec> &results) {
+                int err_take = OK, err_stop = OK;
+                std::vector<std::string> order_ids;
+                for(size_t i = 0; i < orders.size(); ++i) {
+                    const int err_order = err != OK ? err :
+                        (results[i].error_code != OK ? results[i].error_code :
+                        (check_order_placed(results[i].status) ? (int)OK : (int)DATA_NOT_AVAILABLE));
+                    if(is_take_profit[i]) err_take = err_order;
+                    else err_stop = err_order;
+                    if(err == OK && results[i].error_code == OK) order_ids.push_back(orders[i].new_client_order_id);
+                }
+                if(bracket->state != BracketStates::OPEN) {
+                    /* сделку закрыли, пока ставились стоп ордера */
+                    if(!order_ids.empty()) {
+                        std::vector<OrderResultSpec> cancel_results;
+                        const int err_cancel = binance_http_fapi->cancel_batch_orders(bracket->spec.symbol, order_ids, cancel_results);
+                        if(err_cancel != OK) std::cerr << "binance_api::OrderEngine cancel_batch_orders() error, symbol: " << bracket->spec.symbol << ", code: " << err_cancel << std::endl;
+                    }
+                    return;
+                }
+                bracket->stop_order_ids = order_ids;
+                on_stop_orders(bracket, err_take, err_stop);
+            });
+        }
+
+        /** \brief Обработать результат установки стоп ордеров
+         * \param bracket Сделка
+         * \param err_take Код ошибки тейк-профита
+         * \param err_stop Код ошибки стоп-лосса
+         */
+        void on_stop_orders(const bracket_ptr &bracket, const int err_take, const int err_stop) {
+            const BracketOrderSpec &spec = bracket->spec;
+            /* проверяем ситуацию, когда уже сработал один из стоп маркет ордеров или была ошибка */
+            if(err_take != OK || err_stop != OK) {
+                std::cerr << "binance_api::OrderEngine open_batch_orders() error, symbol: " << spec.symbol
+                    << ", take profit code: " << err_take << ", stop loss code: " << err_stop << std::endl;
+                if(err_take == ORDER_WOULD_IMMEDIATELY_TRIGGER || err_stop == ORDER_WOULD_IMMEDIATELY_TRIGGER) {
+                    notify(bracket, OPEN_ORDER_STATUS_ERROR_3);
+                } else {
+                    notify(bracket, OPEN_ORDER_STATUS_ERROR_4);
+                }
+                close_after_stop_error(bracket);
+                return;
+            }
+
+            /* теперь ждем либо закрытия позиции, либо экспирации */
+            if(spec.is_expiration) schedule_expiration(bracket);
+            else schedule_position_check(bracket);
+
+            /* событие открытия позиции могло быть обработано раньше, проверяем позицию по снимку.
+             * Снимок, обновленный до исполнения ордера открытия, описывает прежнюю позицию
+             */
+            PositionSpec position;
+            if(user_data_streams->get_position(spec.symbol, bracket->real_position_side, position) &&
+                position.position_amount != 0.0 &&
+                position.update_time >= bracket->open_timestamp) {
+                bracket->is_position_confirmed = true;
+            }
+        }
+
+        /** \brief Обработать изменение позиции
+         *
+         * Выполняется в потоке шарда символа. Нулевая позиция закрывает сделку, только если
+         * поток уже подтвердил открытие позиции, иначе это событие закрытия прежней позиции.
+         * Ненулевая позиция подтверждает сделку, только если она изменена не раньше исполнения ордера открытия
+         */
+        void run_position(const PositionSpec &position) {
+            std::vector<bracket_ptr> list = get_brackets(position.symbol);
+            for(size_t i = 0; i < list.size(); ++i) {
+                bracket_ptr &bracket = list[i];
+                if(bracket->state != BracketStates::OPEN) continue;
+                if(bracket->real_position_side != position.position_side) continue;
+                if(position.position_amount != 0.0) {
+                    if(position.update_time >= bracket->open_timestamp) bracket->is_position_confirmed = true;
+                    continue;
+                }
+                if(bracket->is_position_confirmed) on_position_closed(bracket);
+            }
+        }
+
+        /** \brief Закрыть по экспирации все открытые сделки шарда
+         */
+        void run_expire_all(Shard &shard) {
+            std::vector<bracket_ptr> list;
+            for(auto &item_symbol : shard.brackets) {
+                for(auto &item : item_symbol.second) {
+                    list.push_back(item.second);
+                }
+            }
+            for(size_t i = 0; i < list.size(); ++i) {
+                on_expiration(list[i]);
+            }
+        }
+
+    public:
+
+        /** \brief Конструктор сопровождения сделок
+         * \param user_binance_http_fapi HTTP клиент фьючерсов
+         * \param user_user_data_streams Поток пользовательских данных
+         * \param user_close_provider Функция закрытия позиции символа
+         * \param user_price_provider Функция цены для расчета тейк-профита и стоп-лосса в пунктах
+         * \param num_threads Количество потоков-шардов
+         * \param user_timer_wheel Общее колесо таймеров по времени сервера (если не указано, создается свое)
+         */
+        OrderEngine(
+                std::shared_ptr<BinanceHttpFApi> user_binance_http_fapi,
+                std::shared_ptr<UserDataStreams> user_user_data_streams,
+                close_function user_close_provider,
+                price_function user_price_provider = nullptr,
+                const uint32_t num_threads = 2,
+                std::shared_ptr<TimerWheel> user_timer_wheel = nullptr) :
+                binance_http_fapi(user_binance_http_fapi),
+                user_data_streams(user_user_data_streams),
+                close_provider(user_close_provider),
+                price_provider(user_price_provider) {
+            timer_wheel = user_timer_wheel;
+            if(!timer_wheel) {
+                timer_wheel = std::make_shared<TimerWheel>();
+                timer_wheel->set_time_source([&]() -> xtime::ftimestamp_t {
+                    return get_server_ftimestamp();
+                });
+            }
+            const uint32_t n = num_threads == 0 ? 1 : num_threads;
+            for(uint32_t i = 0; i < n; ++i) {
+                shards.push_back(std::unique_ptr<Shard>(new Shard()));
+            }
+            for(uint32_t i = 0; i < n; ++i) {
+                Shard *shard = shards[i].get();
+                shard->worker = std::async(std::launch::async,[&, shard]() {
+                    worker_loop(*shard);
+                });
+            }
+        }
+
+        /** \brief Деструктор
+         *
+         * Открытые сделки закрываются по экспирации, как при остановке программы
+         */
+        ~OrderEngine() {
+            /* сделки закрываются без таймеров, повторы выполняются в потоках шардов */
+            timer_lifetime->expire();
+            is_closing = true;
+            for(size_t i = 0; i < shards.size(); ++i) {
+                Shard *shard = shards[i].get();
+                std::lock_guard<std::mutex> lock(shard->tasks_mutex);
+                shard->tasks.push_back([this, shard]() {
+                    run_expire_all(*shard);
+                });
+                shard->tasks_cv.notify_one();
+            }
+            for(size_t i = 0; i < shards.size(); ++i) {
+                Shard *shard = shards[i].get();
+                {
+                    std::lock_guard<std::mutex> lock(shard->tasks_mutex);
+                    is_shutdown = true;
+                    shard->tasks_cv.notify_one();
+                }
+                if(shard->worker.valid()) {
+                    try {
+                        shard->worker.wait();
+                        shard->worker.get();
+                    }
+                    catch(const std::exception &e) {
+                        std::cerr << "binance_api::~OrderEngine() error, what: " << e.what() << std::endl;
+                    }
+                    catch(...) {
+                        std::cerr << "binance_api::~OrderEngine() error" << std::endl;
+                    }
+                }
+            }
+        }
+
+        /** \brief Отправить ордер без повторного исполнения
+         *
+         * Если ответ биржи не получен или получен с кодом неизвестного состояния,
+         * ордер ищется в кэше и потоке пользовательских данных, затем запросом по уникальному номеру.
+         * Ордер отправляется повторно, только если биржа подтвердила его отсутствие.
+         * Метод блокирует вызывающий поток до результата, сделки используют неблокирующую отправку.
+         * Отсутствие ордера подтверждается не раньше, чем через recv_window, поэтому окно лучше делать коротким
+         * \param order Параметры ордера. Уникальный номер ордера обязателен
+         * \param result Результат ордера
+         * \param recv_window Время ожидания ответа, в мс.
+         * \return Код ошибки
+         */
+        int submit_order(const OrderRequestSpec &order, OrderResultSpec &result, const uint64_t recv_window = 5000) {
+            if(order.new_client_order_id.empty()) return INVALID_PARAMETER;
+            int err = OK;
+            std::vector<OrderResultSpec> results;
+            /* все ожидания выполняются в вызывающем потоке, поэтому результат готов при возврате */
+            submit_orders(std::vector<OrderRequestSpec>(1, order), recv_window, get_blocking_defer(),
+                    [&](const int err_submit, const std::vector<OrderResultSpec> &list) {
+                err = err_submit;
+                results = list;
+            });
+            if(!results.empty()) result = results[0];
+            return err != OK ? err : result.error_code;
+        }
+
+        /** \brief Открыть сделку
+         *
+         * Сделка сопровождается асинхронно, состояние передается через callback-функцию параметров
+         * \param spec Параметры сделки
+         * \return Код ошибки
+         */
+        int open_bracket(const BracketOrderSpec &spec) {
+            if(spec.position_side != TypesPositionSide::LONG && spec.position_side != TypesPositionSide::SHORT) return INVALID_PARAMETER;
+            if(spec.quantities.empty()) return DATA_NOT_AVAILABLE;
+            if(is_closing) return DATA_NOT_AVAILABLE;
+            bracket_ptr bracket = std::make_shared<Bracket>();
+            bracket->id = ++bracket_counter;
+            bracket->spec = spec;
+            ++num_brackets;
+            post(spec.symbol, [this, bracket]() {
+                get_shard(bracket->spec.symbol).brackets[bracket->spec.symbol][bracket->id] = bracket;
+                run_open(bracket);
+            });
+            return OK;
+        }
+
+        /** \brief Передать изменение позиции
+         *
+         * Метод следует вызывать для каждого события позиции потока пользовательских данных
+         * \param position Позиция
+         */
+        void on_position(const PositionSpec &position) {
+            post(position.symbol, [this, position]() {
+                run_position(position);
+            });
+        }
+
+        /** \brief Получить количество сопровождаемых сделок
+         * \return Количество сделок
+         */
+        inline uint64_t get_num_brackets() const {
+            return num_brackets;
+        }
+    };
+}
+
+#endif // BINANCE_CPP_API_ORDER_ENGINE_HPP_INCLUDED
@@ -31,6 +31,16 @@ namespace binance_api {
         bool demo_candlestick_stream = false;               /**< Флаг демо аккаунта для потока котировок */
         bool futures_candlestick_stream = false;            /**< Флаг фьючерсов */
 
+        uint32_t dispatch_queue_size = 0;                   /**< Емкость очереди асинхронной доставки событий потоков (0 - доставка в потоке вебсокета) */
+        TypesBackpressure dispatch_policy = TypesBackpressure::BLOCK;   /**< Политика при переполнении очереди асинхронной доставки */
+        bool conflate_candles = false;                      /**< Флаг доставки в историю MQL только последних значений баров */
+        bool resample_candles = false;                      /**< Флаг построения старших периодов из минутного потока */
+        uint32_t event_loop_threads = 0;                    /**< Количество потоков общего цикла событий вебсокетов (0 - у каждого клиента свой поток) */
+        std::vector<int> event_loop_cores;                  /**< Номера ядер для закрепления потоков цикла событий */
+        bool book_ticker_stream = false;                    /**< Флаг расчета ордеров по лучшим ценам потока bookTicker */
+        uint64_t book_ticker_max_age = 5000;                /**< Возраст лучших цен, после которого используется цена бара, мс */
+        uint32_t order_engine_threads = 2;                  /**< Количество потоков сопровождения сделок */
+
         bool is_error = false;
 
         Settings() {};
@@ -75,6 +85,35 @@ namespace binance_api {
                 if(j["recv_window"] != nullptr) recv_window = j["recv_window"];
                 if(j["timezone"] != nullptr) timezone = j["timezone"];
                 if(j["path"] != nullptr) path = j["path"];
+                if(j["conflate_candles"] != nullptr) conflate_candles = j["conflate_candles"];
+                if(j["resample_candles"] != nullptr) resample_candles = j["resample_candles"];
+                if(j["book_ticker_stream"] != nullptr) book_ticker_stream = j["book_ticker_stream"];
+                if(j["book_ticker_max_age"] != nullptr) book_ticker_max_age = j["book_ticker_max_age"];
+                if(j["order_engine_threads"] != nullptr) order_engine_threads = j["order_engine_threads"];
+                if(j["event_loop_threads"] != nullptr) event_loop_threads = j["event_loop_threads"];
+                if(j["event_loop_cores"] != nullptr && j["event_loop_cores"].is_array()) {
+                    const size_t cores_size = j["event_loop_cores"].size();
+                    for(size_t i = 0; i < cores_size; ++i) {
+                        const int core = j["event_loop_cores"][i];
+                        event_loop_cores.push_back(core);
+                    }
+                }
+                if(j["dispatch_queue_size"] != nullptr) dispatch_queue_size = j["dispatch_queue_size"];
+                if(j["dispatch_policy"] != nullptr) {
+                    if (j["dispatch_policy"] == "BLOCK" ||
+                        j["dispatch_policy"] == "block") {
+                        dispatch_policy = TypesBackpressure::BLOCK;
+                    } else
+                    if (j["dispatch_policy"] == "DROP_OLDEST" ||
+                        j["dispatch_policy"] == "drop_oldest" ||
+                        j["dispatch_policy"] == "drop-oldest") {
+                        dispatch_policy = TypesBackpressure::DROP_OLDEST;
+                    } else
+                    if (j["dispatch_policy"] == "CONFLATE" ||
+                        j["dispatch_policy"] == "conflate") {
+                        dispatch_policy = TypesBackpressure::CONFLATE;
+                    }
+                }
                 if(j["symbols"] != nullptr && j["symbols"].is_array()) {
                     const size_t symbols_size = j["symbols"].size();
                     for(size_t i = 0; i < symbols_size; ++i) {
@@ -0,0 +1,543 @@
+/*
+* binance-cpp-api - C ++ API client for binance
+*
+* Copyright (c) 2019 Elektro Yar. Email: git.electroyar@gmail.com
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef BINANCE_CPP_API_WEBSOCKET_AGG_TRADE_HPP_INCLUDED
+#define BINANCE_CPP_API_WEBSOCKET_AGG_TRADE_HPP_INCLUDED
+
+#include "binance-cpp-api-websocket.hpp"
+#include "tools/binance-cpp-api-trade-bar-aggregator.hpp"
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+
+namespace binance_api {
+    using namespace common;
+
+    /** \brief Класс баров, построенных из потока агрегированных сделок
+     *
+     * Один поток aggTrade символа позволяет получить бары любого периода,
+     * в том числе секундные, а также бары по количеству сделок и по объему,
+     * без отдельной подписки на каждый период.
+     * Бары по времени закрываются первой сделкой следующего периода,
+     * а при отсутствии сделок - по оценке времени сервера в таймере соединения.
+     * Бары хранятся и передаются так же, как в CandlestickStreams,
+     * вместо периода используется ID бара, ключ бара - время открытия в мс.
+     */
+    class AggTradeStreams {
+    public:
+        using EndpointTypes = CandlestickStreams::EndpointTypes;
+        using BarTypes = TradeBarAggregator::BarTypes;
+        using BarSpec = TradeBarAggregator::BarSpec;
+
+    private:
+        using json = nlohmann::json;
+        std::string point = "stream.binancefuture.com/stream";
+        std::string sert_file = "curl-ca-bundle.crt";
+
+        WebSocketConnection connection;         /**< Соединение */
+
+        std::shared_ptr<SubscriptionManager> subscription_manager;    /**< Менеджер подписок */
+
+        std::atomic<bool> is_websocket_init = ATOMIC_VAR_INIT(false);    /**< Состояние соединения */
+        std::atomic<bool> is_error = ATOMIC_VAR_INIT(false);             /**< Ошибка соединения */
+        std::atomic<bool> is_close_connection = ATOMIC_VAR_INIT(false);  /**< Флаг для закрытия соединения */
+        std::atomic<bool> is_open = ATOMIC_VAR_INIT(false);
+
+        TradeBarAggregator aggregator;
+        std::recursive_mutex aggregator_mutex;
+
+        using candle_data = std::map<uint64_t, xquotes_common::Candle>;
+        using bar_data = std::map<uint32_t, candle_data>;
+        std::map<std::string, bar_data> candles;    /**< Бары символов по ID бара и времени открытия, последний бар может быть не закрыт */
+        std::recursive_mutex candles_mutex;
+        size_t max_history = 1440;
+
+        std::atomic<uint64_t> last_event_time = ATOMIC_VAR_INIT(0);     /**< Время последнего события на сервере, мс */
+        std::atomic<uint64_t> last_event_steady_time = ATOMIC_VAR_INIT(0);
+
+        inline static uint64_t get_steady_ms() {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        /** \brief Сохранить бар и передать его пользователю
+         */
+        void store_candle(
+                const std::string &symbol,
+                const xquotes_common::Candle &candle,
+                const uint32_t bar_id,
+                const uint64_t open_time,
+                const bool close_candle) {
+            {
+                std::lock_guard<std::recursive_mutex> lock(candles_mutex);
+                candle_data &history = candles[symbol][bar_id];
+                /* незакрытый бар обновляется на месте */
+                history[open_time] = candle;
+                while(history.size() > max_history) history.erase(history.begin());
+            }
+            if(on_candle != nullptr) on_candle(symbol, candle, bar_id, open_time, close_candle);
+        }
+
+        /** \brief Получить оценку текущего времени сервера
+         * \return Время сервера, мс (0, если событий еще не было)
+         */
+        uint64_t get_server_time_estimate() {
+            const uint64_t event_time = last_event_time;
+            if(event_time == 0) return 0;
+            return event_time + (get_steady_ms() - last_event_steady_time);
+        }
+
+        /** \brief Закрыть бары по времени, период которых истек
+         *
+         * Вызывается в таймере соединения, поэтому бары закрываются в том же потоке, что и сделки
+         */
+        void flush_expired_bars() {
+            const uint64_t server_time = get_server_time_estimate();
+            if(server_time == 0) return;
+            std::lock_guard<std::recursive_mutex> lock(aggregator_mutex);
+            aggregator.close_expired_bars(server_time);
+        }
+
+        /** \brief Парсер сообщения от вебсокета
+         * \param response Ответ от сервера
+         */
+        void parser(const std::string &response) {
+            /* Пример сообщения
+                {
+                    "stream":"btcusdt@aggTrade",
+                    "data":{
+                        "e":"aggTrade",
+                        "E":123456789,
+                        "s":"BTCUSDT",
+                        "a":5933014,
+                        "p":"0.001",
+                        "q":"100",
+                        "f":100,
+                        "l":105,
+                        "T":123456785,
+                        "m":true
+                    }
+                }
+             */
+            try {
+                json j = json::parse(response);
+
+                /* ответ на запрос подписки, например {"result":null,"id":1} */
+                if(j.find("stream") == j.end()) {
+                    subscription_manager->on_response(j);
+                    return;
+                }
+
+                auto j_data = j.find("data");
+                if(j_data == j.end()) return;
+                const std::string &symbol = (*j_data)["s"].get_ref<const std::string&>();
+                const double price = std::atof((*j_data)["p"].get_ref<const std::string&>().c_str());
+                const double quantity = std::atof((*j_data)["q"].get_ref<const std::string&>().c_str());
+                const uint64_t first_trade_id = (*j_data)["f"];
+                const uint64_t last_trade_id = (*j_data)["l"];
+                const uint64_t trade_time = (*j_data)["T"];
+                const uint64_t event_time = (*j_data)["E"];
+                last_event_steady_time = get_steady_ms();
+                if(event_time > last_event_time) last_event_time = event_time;
+                {
+                    std::lock_guard<std::recursive_mutex> lock(aggregator_mutex);
+                    aggregator.on_trade(symbol, price, quantity, trade_time, last_trade_id - first_trade_id + 1);
+                }
+                is_websocket_init = true;
+            }
+            catch(const json::parse_error& e) {
+                std::cerr << "binance_api::AggTradeStreams parser error (json::parse_error), what: " << std::string(e.what()) << std::endl;
+            }
+            catch(const json::out_of_range& e) {
+                std::cerr << "binance_api::AggTradeStreams parser error (json::out_of_range), what: " << std::string(e.what()) << std::endl;
+            }
+            catch(const json::type_error& e) {
+                std::cerr << "binance_api::AggTradeStreams parser error (json::type_error), what: " << std::string(e.what()) << std::endl;
+            }
+            catch(...) {
+                std::cerr << "binance_api::AggTradeStreams parser error" << std::endl;
+            }
+        }
+
+        bool send(const std::string &message) {
+            return connection.send(message);
+        }
+
+        std::string to_upper_case(const std::string &s){
+            std::string temp = s;
+            std::transform(temp.begin(), temp.end(), temp.begin(), [](char ch) {
+                return std::use_facet<std::ctype<char>>(std::locale()).toupper(ch);
+            });
+            return temp;
+        }
+
+        std::string to_lower_case(const std::string &s){
+            std::string temp = s;
+            std::transform(temp.begin(), temp.end(), temp.begin(), [](char ch) {
+                return std::use_facet<std::ctype<char>>(std::locale()).tolower(ch);
+            });
+            return temp;
+        }
+
+        /** \brief Инициализировать callback-функции соединения
+         */
+        void init_connection() {
+            connection.set_point(point);
+            connection.set_sert_file(sert_file);
+
+            /* подписки отправляются, а бары по времени закрываются в потоке соединения */
+            connection.on_timer = [&]() {
+                subscription_manager->process();
+                flush_expired_bars();
+            };
+
+            connection.on_stale = [&]() {
+                if(on_stale != nullptr) on_stale();
+            };
+
+            subscription_manager->on_reject = [&](const std::string &param, const bool is_subscribe) {
+                if(on_subscription_reject != nullptr) on_subscription_reject(param, is_subscribe);
+            };
+
+            /* читаем собщения, которые пришли */
+            connection.on_message = [&](const std::string &message) {
+                parser(message);
+            };
+
+            connection.on_open = [&]() {
+                subscription_manager->on_open();
+                is_open = true;
+            };
+
+            connection.on_close = [&]() {
+                is_websocket_init = false;
+                is_open = false;
+                is_error = true;
+                subscription_manager->on_close();
+            };
+        }
+
+    public:
+        /** \brief Бар обновлен или закрыт
+         *
+         * Бар определяется ID бара и временем открытия в мс (см. TradeBarAggregator::candle_function),
+         * это же время является ключом get_timestamp_candle()
+         */
+        TradeBarAggregator::candle_function on_candle = nullptr;
+        std::function<void(
+            const std::string &param,
+            const bool is_subscribe)> on_subscription_reject = nullptr; /**< Сервер отклонил подписку или отписку потока */
+        std::function<void()> on_stale = nullptr;  /**< Соединение устарело и будет переподключено */
+
+        /** \brief Конструктор класса баров из потока сделок
+         * \param user_type Тип конечной точки подключения
+         * \param user_max_history Количество хранимых баров каждого ID
+         * \param user_sert_file Файл-сертификат. По умолчанию используется от curl: curl-ca-bundle.crt
+         */
+        AggTradeStreams(
+                const EndpointTypes user_type,
+                const size_t user_max_history = 1440,
+                const std::string user_sert_file = "curl-ca-bundle.crt") {
+            switch(user_type) {
+            case EndpointTypes::FUTURES_DEMO:
+                point = "stream.binancefuture.com/stream";
+                break;
+            case EndpointTypes::FUTURES_REAL:
+                point = "fstream.binance.com/stream";
+                break;
+            case EndpointTypes::SPOT_DEMO:
+                point = "testnet.binance.vision/stream";
+                break;
+            case EndpointTypes::SPOT_REAL:
+                point = "stream.binance.com:9443/stream";
+                break;
+            default:
+                point = "stream.binancefuture.com/stream";
+                break;
+            }
+            sert_file = user_sert_file;
+            max_history = user_max_history == 0 ? 1 : user_max_history;
+            aggregator.on_candle = [&](
+                    const std::string &symbol,
+                    const xquotes_common::Candle &candle,
+                    const uint32_t bar_id,
+                    const uint64_t open_time,
+                    const bool close_candle) {
+                store_candle(symbol, candle, bar_id, open_time, close_candle);
+            };
+            subscription_manager = std::make_shared<SubscriptionManager>([&](const std::string &message) -> bool {
+                return send(message);
+            });
+            init_connection();
+        }
+
+        ~AggTradeStreams() {
+            is_close_connection = true;
+            /* после остановки соединения его callback-функции больше не вызываются */
+            connection.stop();
+            subscription_manager.reset();
+        }
+
+        /** \brief Добавить бары по времени
+         * \param interval Период бара, мс (например, 1000 для секундных баров)
+         * \return ID бара
+         */
+        uint32_t add_time_bars(const uint64_t interval) {
+            std::lock_guard<std::recursive_mutex> lock(aggregator_mutex);
+            return aggregator.add_time_bars(interval);
+        }
+
+        /** \brief Добавить бары по количеству сделок
+         * \param ticks Количество сделок бара
+         * \return ID бара
+         */
+        uint32_t add_tick_bars(const uint64_t ticks) {
+            std::lock_guard<std::recursive_mutex> lock(aggregator_mutex);
+            return aggregator.add_tick_bars(ticks);
+        }
+
+        /** \brief Добавить бары по объему
+         * \param volume Объем бара
+         * \return ID бара
+         */
+        uint32_t add_volume_bars(const double volume) {
+            std::lock_guard<std::recursive_mutex> lock(aggregator_mutex);
+            return aggregator.add_volume_bars(volume);
+        }
+
+        /** \brief Получить параметры бара
+         * \param bar_id ID бара
+         * \param bar Параметры бара
+         * \return Вернет true, если бар существует
+         */
+        bool get_bar_spec(const uint32_t bar_id, BarSpec &bar) {
+            std::lock_guard<std::recursive_mutex> lock(aggregator_mutex);
+            return aggregator.get_bar_spec(bar_id, bar);
+        }
+
+        /** \brief Добавить поток сделок символа
+         * \param symbol Имя символа
+         */
+        void add_symbol_stream(const std::string &symbol) {
+            subscription_manager->subscribe(to_lower_case(symbol) + "@aggTrade");
+        }
+
+        /** \brief Убрать поток сделок символа
+         * \param symbol Имя символа
+         */
+        void del_symbol_stream(const std::string &symbol) {
+            subscription_manager->unsubscribe(to_lower_case(symbol) + "@aggTrade");
+        }
+
+        /** \brief Получить цену последней сделки
+         * \param symbol Имя символа
+         * \param bar_id ID бара
+         * \return Цена закрытия последнего бара
+         */
+        inline double get_price(const std::string &symbol, const uint32_t bar_id) {
+            if(!is_websocket_init) return 0.0;
+            std::lock_guard<std::recursive_mutex> lock(candles_mutex);
+            auto it_symbol = candles.find(to_upper_case(symbol));
+            if(it_symbol == candles.end()) return 0.0;
+            auto it_bar = it_symbol->second.find(bar_id);
+            if(it_bar == it_symbol->second.end() || it_bar->second.empty()) return 0.0;
+            return it_bar->second.rbegin()->second.close;
+        }
+
+        /** \brief Получить бар
+         * \param symbol Имя символа
+         * \param bar_id ID бара
+         * \param offset Смещение от последнего бара
+         * \return Бар
+         */
+        inline xquotes_common::Candle get_candle(
+                const std::string &symbol,
+                const uint32_t bar_id,
+                const size_t offset = 0) {
+            if(!is_websocket_init) return xquotes_common::Candle();
+            std::lock_guard<std::recursive_mutex> lock(candles_mutex);
+            auto it_symbol = candles.find(to_upper_case(symbol));
+            if(it_symbol == candles.end()) return xquotes_common::Candle();
+            auto it_bar = it_symbol->second.find(bar_id);
+            if(it_bar == it_symbol->second.end()) return xquotes_common::Candle();
+            if(offset >= it_bar->second.size()) return xquotes_common::Candle();
+            auto it_candle = it_bar->second.rbegin();
+            std::advance(it_candle, offset);
+            return it_candle->second;
+        }
+
+        /** \brief Получить количество баров
+         * \param symbol Имя символа
+         * \param bar_id ID бара
+         * \return Количество баров
+         */
+        inline uint32_t get_num_candles(
+                const std::string &symbol,
+                const uint32_t bar_id) {
+            if(!is_websocket_init) return 0;
+            std::lock_guard<std::recursive_mutex> lock(candles_mutex);
+            auto it_symbol = candles.find(to_upper_case(symbol));
+            if(it_symbol == candles.end()) return 0;
+            auto it_bar = it_symbol->second.find(bar_id);
+            if(it_bar == it_symbol->second.end()) return 0;
+            return it_bar->second.size();
+        }
+
+        /** \brief Получить бар по времени открытия
+         * \param symbol Имя символа
+         * \param bar_id ID бара
+         * \param open_time Время открытия бара, мс
+         * \return Бар
+         */
+        inline xquotes_common::Candle get_timestamp_candle(
+                const std::string &symbol,
+                const uint32_t bar_id,
+                const uint64_t open_time) {
+            if(!is_websocket_init) return xquotes_common::Candle();
+            std::lock_guard<std::recursive_mutex> lock(candles_mutex);
+            auto it_symbol = candles.find(to_upper_case(symbol));
+            if(it_symbol == candles.end()) return xquotes_common::Candle();
+            auto it_bar = it_symbol->second.find(bar_id);
+            if(it_bar == it_symbol->second.end()) return xquotes_common::Candle();
+            auto it_candle = it_bar->second.find(open_time);
+            if(it_candle == it_bar->second.end()) return xquotes_common::Candle();
+            return it_candle->second;
+        }
+
+        /** \brief Получить массив баров
+         * \param symbol Имя символа
+         * \param bar_id ID бара
+         * \param array_candles Бары от старых к новым, последний бар может быть не закрыт
+         * \return Код ошибки, вернет 0 если все в порядке
+         */
+        template<class T>
+        int get_array_candles(
+                const std::string &symbol,
+                const uint32_t bar_id,
+                T &array_candles) {
+            std::lock_guard<std::recursive_mutex> lock(candles_mutex);
+            auto it_symbol = candles.find(to_upper_case(symbol));
+            if(it_symbol == candles.end()) return DATA_NOT_AVAILABLE;
+            auto it_bar = it_symbol->second.find(bar_id);
+            if(it_bar == it_symbol->second.end()) return DATA_NOT_AVAILABLE;
+            for(auto &item : it_bar->second) {
+                array_candles.push_back(item.second);
+            }
+            return OK;
+        }
+
+        /** \brief Состояние соединения
+         * \return вернет true, если соединение есть
+         */
+        inline bool connected() {
+            return is_websocket_init;
+        }
+
+        /** \brief Подождать соединение
+         *
+         * Данный метод ждет, пока не установится соединение
+         * \return вернет true, если соединение есть, иначе произошла ошибка
+         */
+        inline bool wait() {
+            uint32_t tick = 0;
+            while(!is_error && !is_open && !is_close_connection) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                ++tick;
+                const uint32_t MAX_TICK = 10*100*5;
+                if(tick > MAX_TICK) {
+                    is_error = true;
+                    return is_open;
+                }
+            }
+            return is_open;
+        }
+
+        /** \brief Использовать внешний цикл событий
+         *
+         * Метод следует вызывать до start()
+         * \param user_event_loop Указатель на io_context
+         */
+        void set_event_loop(std::shared_ptr<SimpleWeb::io_context> user_event_loop) {
+            connection.set_event_loop(user_event_loop);
+        }
+
+        /** \brief Использовать цикл событий из пула
+         * \param pool Пул циклов событий
+         */
+        void set_event_loop(EventLoopPool &pool) {
+            set_event_loop(pool.get_io_context());
+        }
+
+        /** \brief Настроить сторожевой таймер соединения
+         *
+         * Соединение, которое перестало доставлять данные, но не закрылось,
+         * переподключается без задержки. Метод следует вызывать до start()
+         * \param user_message_timeout Допустимое время без сообщений, мс (0 - не проверять)
+         * \param user_ping_interval Период отправки ping для измерения RTT, мс (0 - не отправлять)
+         * \param user_pong_timeout Допустимое время ожидания pong, мс
+         */
+        void set_watchdog(
+                const uint64_t user_message_timeout,
+                const uint64_t user_ping_interval = 5000,
+                const uint64_t user_pong_timeout = 5000) {
+            connection.set_watchdog(user_message_timeout, user_ping_interval, user_pong_timeout);
+        }
+
+        /** \brief Получить время прохождения ping-pong
+         * \return RTT последнего ping, мс (0, если еще не измерено)
+         */
+        inline double get_ping_rtt() {
+            return connection.get_ping_rtt();
+        }
+
+        /** \brief Получить время с последнего сообщения соединения
+         * \return Время, мс
+         */
+        inline uint64_t get_last_message_age() {
+            return connection.get_last_message_age();
+        }
+
+        /** \brief Проверить, устарело ли соединение
+         * \return Вернет true, если сообщений нет дольше допустимого времени
+         */
+        inline bool check_stale() {
+            return connection.check_stale();
+        }
+
+        /** \brief Получить количество принудительных переподключений
+         * \return Количество переподключений
+         */
+        inline uint64_t get_num_stale_reconnects() {
+            return connection.get_num_stale_reconnects();
+        }
+
+        /** \brief Запустить поток
+         */
+        void start() {
+            connection.start();
+        }
+    };
+}
+
+#endif // BINANCE_CPP_API_WEBSOCKET_AGG_TRADE_HPP_INCLUDED
@@ -0,0 +1,438 @@
+/*
+* binance-cpp-api - C ++ API client for binance
+*
+* Copyright (c) 2019 Elektro Yar. Email: git.electroyar@gmail.com
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef BINANCE_CPP_API_WEBSOCKET_BOOK_TICKER_HPP_INCLUDED
+#define BINANCE_CPP_API_WEBSOCKET_BOOK_TICKER_HPP_INCLUDED
+
+#include "binance-cpp-api-websocket.hpp"
+#include "tools/binance-cpp-api-seqlock.hpp"
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+
+namespace binance_api {
+    using namespace common;
+
+    /** \brief Лучшие цены символа
+     */
+    class BookTickerSpec {
+    public:
+        double bid_price = 0;       /**< Лучшая цена покупки */
+        double bid_quantity = 0;    /**< Количество по лучшей цене покупки */
+        double ask_price = 0;       /**< Лучшая цена продажи */
+        double ask_quantity = 0;    /**< Количество по лучшей цене продажи */
+        uint64_t update_id = 0;     /**< ID обновления стакана */
+        uint64_t event_time = 0;    /**< Время события на сервере, мс (0 для спота) */
+        BookTickerSpec() {};
+
+        /** \brief Получить середину спреда
+         * \return Цена
+         */
+        inline double get_mid() const {
+            return (bid_price + ask_price) / 2.0;
+        }
+    };
+
+    /** \brief Класс лучших цен из потоков bookTicker
+     *
+     * Лучшие цены каждого символа записываются в слот фиксированного размера под seqlock,
+     * поэтому чтение по дескриптору не использует мьютексы и не блокирует парсер.
+     * Можно подписаться на отдельные символы или на поток всех символов рынка,
+     * в этом случае слоты создаются при первом сообщении символа.
+     */
+    class BookTickerStreams {
+    public:
+        using EndpointTypes = CandlestickStreams::EndpointTypes;
+        using handle_t = uint32_t;
+        static const handle_t INVALID_HANDLE = 0xFFFFFFFF;
+
+    private:
+        using json = nlohmann::json;
+        std::string point = "stream.binancefuture.com/stream";
+        std::string sert_file = "curl-ca-bundle.crt";
+
+        WebSocketConnection connection;         /**< Соединение */
+
+        std::shared_ptr<SubscriptionManager> subscription_manager;    /**< Менеджер подписок */
+
+        std::atomic<bool> is_websocket_init = ATOMIC_VAR_INIT(false);    /**< Состояние соединения */
+        std::atomic<bool> is_error = ATOMIC_VAR_INIT(false);             /**< Ошибка соединения */
+        std::atomic<bool> is_close_connection = ATOMIC_VAR_INIT(false);  /**< Флаг для закрытия соединения */
+        std::atomic<bool> is_open = ATOMIC_VAR_INIT(false);
+
+        SeqLockArray<BookTickerSpec> slots;                 /**< Слоты символов */
+        std::unique_ptr<uint64_t[]> last_update_ids;        /**< Последний ID обновления слотов, только для парсера */
+        uint32_t max_symbols = 0;
+        std::atomic<uint32_t> num_slots = ATOMIC_VAR_INIT(0);
+        std::map<std::string, handle_t> symbol_to_handle;
+        std::mutex symbol_to_handle_mutex;
+
+        /** \brief Найти или создать слот символа
+         * \param symbol Имя символа в верхнем регистре
+         * \return Дескриптор символа или INVALID_HANDLE, если слоты закончились
+         */
+        handle_t get_or_create_handle(const std::string &symbol) {
+            std::lock_guard<std::mutex> lock(symbol_to_handle_mutex);
+            auto it = symbol_to_handle.find(symbol);
+            if(it != symbol_to_handle.end()) return it->second;
+            if(num_slots >= max_symbols) return INVALID_HANDLE;
+            const handle_t handle = num_slots;
+            last_update_ids[handle] = 0;
+            symbol_to_handle[symbol] = handle;
+            ++num_slots;
+            return handle;
+        }
+
+        /** \brief Парсер сообщения от вебсокета
+         * \param response Ответ от сервера
+         */
+        void parser(const std::string &response) {
+            /* Пример сообщения
+                {
+                    "stream":"bnbusdt@bookTicker",
+                    "data":{
+                        "e":"bookTicker",
+                        "u":400900217,
+                        "E":1568014460893,
+                        "T":1568014460891,
+                        "s":"BNBUSDT",
+                        "b":"25.35190000",
+                        "B":"31.21000000",
+                        "a":"25.36520000",
+                        "A":"40.66000000"
+                    }
+                }
+             */
+            try {
+                json j = json::parse(response);
+
+                /* ответ на запрос подписки, например {"result":null,"id":1} */
+                if(j.find("stream") == j.end()) {
+                    subscription_manager->on_response(j);
+                    return;
+                }
+
+                auto j_data = j.find("data");
+                if(j_data == j.end()) return;
+                const handle_t handle = get_or_create_handle((*j_data)["s"].get_ref<const std::string&>());
+                if(handle == INVALID_HANDLE) return;
+
+                BookTickerSpec ticker;
+                ticker.update_id = (*j_data)["u"];
+                /* сообщения с устаревшим ID обновления пропускаем */
+                if(ticker.update_id < last_update_ids[handle]) return;
+                last_update_ids[handle] = ticker.update_id;
+                ticker.bid_price = std::atof((*j_data)["b"].get_ref<const std::string&>().c_str());
+                ticker.bid_quantity = std::atof((*j_data)["B"].get_ref<const std::string&>().c_str());
+                ticker.ask_price = std::atof((*j_data)["a"].get_ref<const std::string&>().c_str());
+                ticker.ask_quantity = std::atof((*j_data)["A"].get_ref<const std::string&>().c_str());
+                auto it_event_time = j_data->find("E");
+                if(it_event_time != j_data->end()) ticker.event_time = *it_event_time;
+                slots[handle].store(ticker);
+                is_websocket_init = true;
+                if(on_book_ticker != nullptr) on_book_ticker(handle, ticker);
+            }
+            catch(const json::parse_error& e) {
+                std::cerr << "binance_api::BookTickerStreams parser error (json::parse_error), what: " << std::string(e.what()) << std::endl;
+            }
+            catch(const json::out_of_range& e) {
+                std::cerr << "binance_api::BookTickerStreams parser error (json::out_of_range), what: " << std::string(e.what()) << std::endl;
+            }
+            catch(const json::type_error& e) {
+                std::cerr << "binance_api::BookTickerStreams parser error (json::type_error), what: " << std::string(e.what()) << std::endl;
+            }
+            catch(...) {
+                std::cerr << "binance_api::BookTickerStreams parser error" << std::endl;
+            }
+        }
+
+        bool send(const std::string &message) {
+            return connection.send(message);
+        }
+
+        std::string to_upper_case(const std::string &s){
+            std::string temp = s;
+            std::transform(temp.begin(), temp.end(), temp.begin(), [](char ch) {
+                return std::use_facet<std::ctype<char>>(std::locale()).toupper(ch);
+            });
+            return temp;
+        }
+
+        std::string to_lower_case(const std::string &s){
+            std::string temp = s;
+            std::transform(temp.begin(), temp.end(), temp.begin(), [](char ch) {
+                return std::use_facet<std::ctype<char>>(std::locale()).tolower(ch);
+            });
+            return temp;
+        }
+
+        /** \brief Инициализировать callback-функции соединения
+         */
+        void init_connection() {
+            connection.set_point(point);
+            connection.set_sert_file(sert_file);
+
+            /* подписки отправляются в потоке соединения с учетом ограничения скорости */
+            connection.on_timer = [&]() {
+                subscription_manager->process();
+            };
+
+            connection.on_stale = [&]() {
+                if(on_stale != nullptr) on_stale();
+            };
+
+            subscription_manager->on_reject = [&](const std::string &param, const bool is_subscribe) {
+                if(on_subscription_reject != nullptr) on_subscription_reject(param, is_subscribe);
+            };
+
+            /* читаем собщения, которые пришли */
+            connection.on_message = [&](const std::string &message) {
+                parser(message);
+            };
+
+            connection.on_open = [&]() {
+                subscription_manager->on_open();
+                is_open = true;
+            };
+
+            connection.on_close = [&]() {
+                is_websocket_init = false;
+                is_open = false;
+                is_error = true;
+                subscription_manager->on_close();
+            };
+        }
+
+    public:
+        std::function<void(
+            const handle_t handle,
+            const BookTickerSpec &ticker)> on_book_ticker = nullptr;  /**< Лучшие цены обновлены */
+        std::function<void(
+            const std::string &param,
+            const bool is_subscribe)> on_subscription_reject = nullptr; /**< Сервер отклонил подписку или отписку потока */
+        std::function<void()> on_stale = nullptr;  /**< Соединение устарело и будет переподключено */
+
+        /** \brief Конструктор класса лучших цен
+         * \param user_type Тип конечной точки подключения
+         * \param user_max_symbols Максимальное количество символов
+         * \param user_sert_file Файл-сертификат. По умолчанию используется от curl: curl-ca-bundle.crt
+         */
+        BookTickerStreams(
+                const EndpointTypes user_type,
+                const uint32_t user_max_symbols = 2048,
+                const std::string user_sert_file = "curl-ca-bundle.crt") {
+            switch(user_type) {
+            case EndpointTypes::FUTURES_DEMO:
+                point = "stream.binancefuture.com/stream";
+                break;
+            case EndpointTypes::FUTURES_REAL:
+                point = "fstream.binance.com/stream";
+                break;
+            case EndpointTypes::SPOT_DEMO:
+                point = "testnet.binance.vision/stream";
+                break;
+            case EndpointTypes::SPOT_REAL:
+                point = "stream.binance.com:9443/stream";
+                break;
+            default:
+                point = "stream.binancefuture.com/stream";
+                break;
+            }
+            sert_file = user_sert_file;
+            max_symbols = user_max_symbols == 0 ? 1 : user_max_symbols;
+            slots.reset(max_symbols);
+            last_update_ids.reset(new uint64_t[max_symbols]);
+            subscription_manager = std::make_shared<SubscriptionManager>([&](const std::string &message) -> bool {
+                return send(message);
+            });
+            init_connection();
+        }
+
+        ~BookTickerStreams() {
+            is_close_connection = true;
+            /* после остановки соединения его callback-функции больше не вызываются */
+            connection.stop();
+            subscription_manager.reset();
+        }
+
+        /** \brief Добавить поток символа
+         * \param symbol Имя символа
+         * \return Дескриптор символа или INVALID_HANDLE, если слоты закончились
+         */
+        handle_t add_symbol_stream(const std::string &symbol) {
+            const handle_t handle = get_or_create_handle(to_upper_case(symbol));
+            if(handle == INVALID_HANDLE) {
+                std::cerr << "binance_api::BookTickerStreams error, what: no free slots for " << symbol << std::endl;
+                return INVALID_HANDLE;
+            }
+            subscription_manager->subscribe(to_lower_case(symbol) + "@bookTicker");
+            return handle;
+        }
+
+        /** \brief Убрать поток символа
+         *
+         * Слот символа сохраняется, поэтому дескриптор остается действительным
+         * \param symbol Имя символа
+         */
+        void del_symbol_stream(const std::string &symbol) {
+            subscription_manager->unsubscribe(to_lower_case(symbol) + "@bookTicker");
+        }
+
+        /** \brief Подписаться на лучшие цены всех символов рынка
+         */
+        void add_all_market_stream() {
+            subscription_manager->subscribe("!bookTicker");
+        }
+
+        /** \brief Отписаться от лучших цен всех символов рынка
+         */
+        void del_all_market_stream() {
+            subscription_manager->unsubscribe("!bookTicker");
+        }
+
+        /** \brief Получить дескриптор символа
+         * \param symbol Имя символа
+         * \return Дескриптор символа или INVALID_HANDLE
+         */
+        handle_t get_handle(const std::string &symbol) {
+            const std::string s = to_upper_case(symbol);
+            std::lock_guard<std::mutex> lock(symbol_to_handle_mutex);
+            auto it = symbol_to_handle.find(s);
+            if(it == symbol_to_handle.end()) return INVALID_HANDLE;
+            return it->second;
+        }
+
+        /** \brief Получить лучшие цены
+         * \param handle Дескриптор символа
+         * \param ticker Лучшие цены
+         * \return Вернет true, если данные уже были получены
+         */
+        inline bool get_book_ticker(const handle_t handle, BookTickerSpec &ticker) const {
+            if(handle >= num_slots) return false;
+            return slots[handle].load(ticker) != 0;
+        }
+
+        /** \brief Получить лучшие цены
+         * \param symbol Имя символа
+         * \param ticker Лучшие цены
+         * \return Вернет true, если данные уже были получены
+         */
+        inline bool get_book_ticker(const std::string &symbol, BookTickerSpec &ticker) {
+            return get_book_ticker(get_handle(symbol), ticker);
+        }
+
+        /** \brief Состояние соединения
+         * \return вернет true, если соединение есть
+         */
+        inline bool connected() {
+            return is_websocket_init;
+        }
+
+        /** \brief Подождать соединение
+         *
+         * Данный метод ждет, пока не установится соединение
+         * \return вернет true, если соединение есть, иначе произошла ошибка
+         */
+        inline bool wait() {
+            uint32_t tick = 0;
+            while(!is_error && !is_open && !is_close_connection) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                ++tick;
+                const uint32_t MAX_TICK = 10*100*5;
+                if(tick > MAX_TICK) {
+                    is_error = true;
+                    return is_open;
+                }
+            }
+            return is_open;
+        }
+
+        /** \brief Использовать внешний цикл событий
+         *
+         * Метод следует вызывать до start()
+         * \param user_event_loop Указатель на io_context
+         */
+        void set_event_loop(std::shared_ptr<SimpleWeb::io_context> user_event_loop) {
+            connection.set_event_loop(user_event_loop);
+        }
+
+        /** \brief Использовать цикл событий из пула
+         * \param pool Пул циклов событий
+         */
+        void set_event_loop(EventLoopPool &pool) {
+            set_event_loop(pool.get_io_context());
+        }
+
+        /** \brief Настроить сторожевой таймер соединения
+         *
+         * Соединение, которое перестало доставлять данные, но не закрылось,
+         * переподключается без задержки. Метод следует вызывать до start()
+         * \param user_message_timeout Допустимое время без сообщений, мс (0 - не проверять)
+         * \param user_ping_interval Период отправки ping для измерения RTT, мс (0 - не отправлять)
+         * \param user_pong_timeout Допустимое время ожидания pong, мс
+         */
+        void set_watchdog(
+                const uint64_t user_message_timeout,
+                const uint64_t user_ping_interval = 5000,
+                const uint64_t user_pong_timeout = 5000) {
+            connection.set_watchdog(user_message_timeout, user_ping_interval, user_pong_timeout);
+        }
+
+        /** \brief Получить время прохождения ping-pong
+         * \return RTT последнего ping, мс (0, если еще не измерено)
+         */
+        inline double get_ping_rtt() {
+            return connection.get_ping_rtt();
+        }
+
+        /** \brief Получить время с последнего сообщения соединения
+         * \return Время, мс
+         */
+        inline uint64_t get_last_message_age() {
+            return connection.get_last_message_age();
+        }
+
+        /** \brief Проверить, устарело ли соединение
+         * \return Вернет true, если сообщений нет дольше допустимого времени
+         */
+        inline bool check_stale() {
+            return connection.check_stale();
+        }
+
+        /** \brief Получить количество принудительных переподключений
+         * \return Количество переподключений
+         */
+        inline uint64_t get_num_stale_reconnects() {
+            return connection.get_num_stale_reconnects();
+        }
+
+        /** \brief Запустить поток
+         */
+        void start() {
+            connection.start();
+        }
+    };
+}
+
+#endif // BINANCE_CPP_API_WEBSOCKET_BOOK_TICKER_HPP_INCLUDED
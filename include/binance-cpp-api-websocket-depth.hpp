@@ -0,0 +1,1114 @@
+/*
+* binance-cpp-api - C ++ API client for binance
+*
+* Copyright (c) 2019 Elektro Yar. Email: git.electroyar@gmail.com
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef BINANCE_CPP_API_WEBSOCKET_DEPTH_HPP_INCLUDED
+#define BINANCE_CPP_API_WEBSOCKET_DEPTH_HPP_INCLUDED
+
+#include "binance-cpp-api-websocket.hpp"
+#include "tools/binance-cpp-api-order-book.hpp"
+#include "tools/binance-cpp-api-seqlock.hpp"
+#include <condition_variable>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <array>
+
+namespace binance_api {
+    using namespace common;
+
+    /** \brief Класс локальных стаканов по потокам изменений глубины рынка
+     *
+     * Стакан каждого символа синхронизируется по правилам Binance:
+     * изменения буферизуются, загружается снимок через REST API,
+     * изменения старше снимка отбрасываются, остальные применяются по порядку.
+     * Разрыв последовательности U/u/pu или переподключение запускает повторную синхронизацию.
+     */
+    class DepthStreams {
+    public:
+        using EndpointTypes = CandlestickStreams::EndpointTypes;
+
+        /// Функция загрузки снимка стакана через REST API
+        using snapshot_function = std::function<int(
+            DepthSnapshotSpec &snapshot,
+            const std::string &symbol)>;
+
+    private:
+        using json = nlohmann::json;
+        std::string point = "stream.binancefuture.com/stream";
+        std::string sert_file = "curl-ca-bundle.crt";
+        std::string stream_suffix = "@depth@100ms";
+        bool is_futures = true;     /**< Правила последовательности фьючерсов (pu) или спота */
+
+        WebSocketConnection connection;         /**< Соединение */
+
+        std::shared_ptr<SubscriptionManager> subscription_manager;    /**< Менеджер подписок */
+
+        std::atomic<bool> is_websocket_init = ATOMIC_VAR_INIT(false);    /**< Состояние соединения */
+        std::atomic<bool> is_error = ATOMIC_VAR_INIT(false);             /**< Ошибка соединения */
+        std::atomic<bool> is_close_connection = ATOMIC_VAR_INIT(false);  /**< Флаг для закрытия соединения */
+        std::atomic<bool> is_open = ATOMIC_VAR_INIT(false);
+
+        using DepthUpdate = DepthUpdateSpec;
+        using SequenceTypes = OrderBookSync::SequenceTypes;
+
+        /// Состояние стакана символа
+        class BookState : public OrderBookSync {
+        public:
+            bool is_snapshot_wait = false;      /**< Идет загрузка снимка */
+            std::mutex book_mutex;
+            BookState(const bool is_futures) : OrderBookSync(is_futures) {};
+        };
+
+        using book_ptr = std::shared_ptr<BookState>;
+        std::map<std::string, book_ptr> books;
+        std::mutex books_mutex;
+
+        snapshot_function snapshot_provider = nullptr;
+        std::vector<std::future<void>> snapshot_futures;
+        std::mutex snapshot_futures_mutex;
+        std::mutex snapshot_slots_mutex;
+        std::condition_variable snapshot_slots_cv;
+        uint32_t snapshot_active = 0;
+        uint32_t max_snapshot_parallel = 2;
+        std::atomic<uint64_t> resync_counter = ATOMIC_VAR_INIT(0);
+
+        /** \brief Начать синхронизацию стакана заново
+         * \param symbol Имя символа
+         * \param state Состояние стакана (должно быть заблокировано)
+         */
+        void reset_book(const std::string &symbol, BookState &state) {
+            state.reset(false);
+            if(state.is_snapshot_wait) return;
+            state.is_snapshot_wait = true;
+            start_snapshot(symbol);
+        }
+
+        book_ptr get_book_state(const std::string &symbol) {
+            std::lock_guard<std::mutex> lock(books_mutex);
+            auto it = books.find(symbol);
+            if(it == books.end()) return book_ptr();
+            return it->second;
+        }
+
+        /** \brief Обработать изменение стакана
+         * \param symbol Имя символа
+         * \param update Изменение стакана
+         */
+        void process_update(const std::string &symbol, DepthUpdate &update) {
+            book_ptr state = get_book_state(symbol);
+            if(!state) return;
+            bool is_gap = false;
+            {
+                std::lock_guard<std::mutex> lock(state->book_mutex);
+                if(!state->is_synced) {
+                    state->buffer.push_back(std::move(update));
+                    if(!state->is_snapshot_wait) reset_book(symbol, *state);
+                    return;
+                }
+                switch(state->check_sequence(update)) {
+                case SequenceTypes::SKIP:
+                    return;
+                case SequenceTypes::APPLY:
+                    state->apply_update(update);
+                    if(on_depth != nullptr) on_depth(symbol, state->book);
+                    return;
+                case SequenceTypes::GAP:
+                    std::cerr << "binance_api::DepthStreams error, what: sequence gap, symbol: " << symbol
+                        << " last update id: " << state->book.get_last_update_id()
+                        << " U: " << update.first_update_id << std::endl;
+                    ++resync_counter;
+                    state->buffer.clear();
+                    state->buffer.push_back(std::move(update));
+                    reset_book(symbol, *state);
+                    is_gap = true;
+                    break;
+                };
+            }
+            if(is_gap && on_resync != nullptr) on_resync(symbol);
+        }
+
+        /** \brief Запустить загрузку снимка
+         * \param symbol Имя символа
+         */
+        void start_snapshot(const std::string &symbol) {
+            if(snapshot_provider == nullptr) {
+                std::cerr << "binance_api::DepthStreams error, what: snapshot provider is not set" << std::endl;
+                return;
+            }
+            std::lock_guard<std::mutex> lock(snapshot_futures_mutex);
+            /* удаляем завершенные задачи */
+            size_t index = 0;
+            while(index < snapshot_futures.size()) {
+                if(snapshot_futures[index].wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+                    snapshot_futures.erase(snapshot_futures.begin() + index);
+                } else ++index;
+            }
+            snapshot_futures.push_back(std::async(std::launch::async,[&, symbol]() {
+                run_snapshot(symbol);
+            }));
+        }
+
+        void run_snapshot(const std::string &symbol) {
+            const uint64_t RETRY_DELAY = 1000;
+            while(!is_close_connection) {
+                book_ptr state = get_book_state(symbol);
+                if(!state) return;
+
+                /* ограничиваем количество одновременных запросов */
+                {
+                    std::unique_lock<std::mutex> lock(snapshot_slots_mutex);
+                    snapshot_slots_cv.wait(lock, [&]() {
+                        return snapshot_active < max_snapshot_parallel || is_close_connection;
+                    });
+                    ++snapshot_active;
+                }
+                DepthSnapshotSpec snapshot;
+                int err = OK;
+                if(!is_close_connection) {
+                    try {
+                        err = snapshot_provider(snapshot, symbol);
+                    }
+                    catch(...) {
+                        err = DATA_NOT_AVAILABLE;
+                    }
+                }
+                {
+                    std::lock_guard<std::mutex> lock(snapshot_slots_mutex);
+                    --snapshot_active;
+                }
+                snapshot_slots_cv.notify_one();
+                if(is_close_connection) return;
+                if(err != OK) {
+                    std::cerr << "binance_api::DepthStreams snapshot error, symbol: " << symbol << " code: " << err << std::endl;
+                    std::this_thread::sleep_for(std::chrono::milliseconds(RETRY_DELAY));
+                    continue;
+                }
+
+                /* применяем снимок и накопленные изменения */
+                bool is_synced = false;
+                {
+                    std::lock_guard<std::mutex> lock(state->book_mutex);
+                    if(state->apply_snapshot(snapshot)) {
+                        state->is_snapshot_wait = false;
+                        is_synced = true;
+                        if(on_depth != nullptr && !state->is_first_update) on_depth(symbol, state->book);
+                    }
+                }
+                if(is_synced) return;
+                std::this_thread::sleep_for(std::chrono::milliseconds(RETRY_DELAY));
+            }
+        }
+
+        /** \brief Сбросить все стаканы
+         *
+         * После переподключения изменения могли быть пропущены, поэтому все стаканы синхронизируются заново
+         */
+        void reset_all_books() {
+            std::lock_guard<std::mutex> lock(books_mutex);
+            for(auto &item : books) {
+                std::lock_guard<std::mutex> lock_book(item.second->book_mutex);
+                item.second->reset();
+            }
+        }
+
+        void parse_levels(const json &j_levels, std::vector<DepthLevelSpec> &levels) {
+            levels.reserve(j_levels.size());
+            for(size_t i = 0; i < j_levels.size(); ++i) {
+                levels.push_back(DepthLevelSpec(
+                    std::atof(j_levels[i][0].get_ref<const std::string&>().c_str()),
+                    std::atof(j_levels[i][1].get_ref<const std::string&>().c_str())));
+            }
+        }
+
+        /** \brief Парсер сообщения от вебсокета
+         * \param response Ответ от сервера
+         */
+        void parser(const std::string &response) {
+            /* Пример сообщения
+                {
+                    "stream":"btcusdt@depth@100ms",
+                    "data":{
+                        "e":"depthUpdate",
+                        "E":123456789,
+                        "T":123456788,
+                        "s":"BTCUSDT",
+                        "U":157,
+                        "u":160,
+                        "pu":149,
+                        "b":[["0.0024","10"]],
+                        "a":[["0.0026","100"]]
+                    }
+                }
+             */
+            try {
+                json j = json::parse(response);
+
+                /* ответ на запрос подписки, например {"result":null,"id":1} */
+                if(j.find("stream") == j.end()) {
+                    subscription_manager->on_response(j);
+                    return;
+                }
+
+                auto j_data = j.find("data");
+                if(j_data == j.end()) return;
+                const std::string symbol = (*j_data)["s"];
+                DepthUpdate update;
+                update.first_update_id = (*j_data)["U"];
+                update.final_update_id = (*j_data)["u"];
+                auto it_pu = j_data->find("pu");
+                if(it_pu != j_data->end()) update.prev_update_id = *it_pu;
+                update.event_time = (*j_data)["E"];
+                parse_levels((*j_data)["b"], update.bids);
+                parse_levels((*j_data)["a"], update.asks);
+                process_update(symbol, update);
+                is_websocket_init = true;
+            }
+            catch(const json::parse_error& e) {
+                std::cerr << "binance_api::DepthStreams parser error (json::parse_error), what: " << std::string(e.what()) << std::endl;
+            }
+            catch(const json::out_of_range& e) {
+                std::cerr << "binance_api::DepthStreams parser error (json::out_of_range), what: " << std::string(e.what()) << std::endl;
+            }
+            catch(const json::type_error& e) {
+                std::cerr << "binance_api::DepthStreams parser error (json::type_error), what: " << std::string(e.what()) << std::endl;
+            }
+            catch(...) {
+                std::cerr << "binance_api::DepthStreams parser error" << std::endl;
+            }
+        }
+
+        bool send(const std::string &message) {
+            return connection.send(message);
+        }
+
+        std::string to_upper_case(const std::string &s){
+            std::string temp = s;
+            std::transform(temp.begin(), temp.end(), temp.begin(), [](char ch) {
+                return std::use_facet<std::ctype<char>>(std::locale()).toupper(ch);
+            });
+            return temp;
+        }
+
+        std::string to_lower_case(const std::string &s){
+            std::string temp = s;
+            std::transform(temp.begin(), temp.end(), temp.begin(), [](char ch) {
+                return std::use_facet<std::ctype<char>>(std::locale()).tolower(ch);
+            });
+            return temp;
+        }
+
+        /** \brief Инициализировать callback-функции соединения
+         */
+        void init_connection() {
+            connection.set_point(point);
+            connection.set_sert_file(sert_file);
+
+            /* подписки отправляются в потоке соединения с учетом ограничения скорости */
+            connection.on_timer = [&]() {
+                subscription_manager->process();
+            };
+
+            connection.on_stale = [&]() {
+                if(on_stale != nullptr) on_stale();
+            };
+
+            subscription_manager->on_reject = [&](const std::string &param, const bool is_subscribe) {
+                if(is_subscribe) {
+                    /* стакан без потока никогда не синхронизируется */
+                    std::lock_guard<std::mutex> lock(books_mutex);
+                    books.erase(to_upper_case(param.substr(0, param.find('@'))));
+                }
+                if(on_subscription_reject != nullptr) on_subscription_reject(param, is_subscribe);
+            };
+
+            /* читаем собщения, которые пришли */
+            connection.on_message = [&](const std::string &message) {
+                parser(message);
+            };
+
+            connection.on_open = [&]() {
+                reset_all_books();
+                subscription_manager->on_open();
+                is_open = true;
+            };
+
+            connection.on_close = [&]() {
+                is_websocket_init = false;
+                is_open = false;
+                is_error = true;
+                subscription_manager->on_close();
+            };
+        }
+
+    public:
+        /** \brief Стакан изменен
+         *
+         * Функция вызывается при заблокированном стакане символа,
+         * ссылку на стакан нельзя сохранять после возврата
+         */
+        std::function<void(
+            const std::string &symbol,
+            const OrderBook &book)> on_depth = nullptr;
+        std::function<void(const std::string &symbol)> on_resync = nullptr;    /**< Разрыв последовательности, стакан синхронизируется заново */
+        std::function<void(
+            const std::string &param,
+            const bool is_subscribe)> on_subscription_reject = nullptr; /**< Сервер отклонил подписку или отписку потока */
+        std::function<void()> on_stale = nullptr;  /**< Соединение устарело и будет переподключено */
+
+        /** \brief Конструктор класса локальных стаканов
+         * \param user_type Тип конечной точки подключения
+         * \param update_speed Период обновлений, мс (100, 250 или 500 для фьючерсов, 100 или 1000 для спота)
+         * \param user_sert_file Файл-сертификат. По умолчанию используется от curl: curl-ca-bundle.crt
+         */
+        DepthStreams(
+                const EndpointTypes user_type,
+                const uint32_t update_speed = 100,
+                const std::string user_sert_file = "curl-ca-bundle.crt") {
+            switch(user_type) {
+            case EndpointTypes::FUTURES_DEMO:
+                point = "stream.binancefuture.com/stream";
+                break;
+            case EndpointTypes::FUTURES_REAL:
+                point = "fstream.binance.com/stream";
+                break;
+            case EndpointTypes::SPOT_DEMO:
+                point = "testnet.binance.vision/stream";
+                is_futures = false;
+                break;
+            case EndpointTypes::SPOT_REAL:
+                point = "stream.binance.com:9443/stream";
+                is_futures = false;
+                break;
+            default:
+                point = "stream.binancefuture.com/stream";
+                break;
+            }
+            /* период по умолчанию обозначается потоком без суффикса */
+            const uint32_t default_speed = is_futures ? 250 : 1000;
+            if(update_speed == 0 || update_speed == default_speed) stream_suffix = "@depth";
+            else stream_suffix = "@depth@" + std::to_string(update_speed) + "ms";
+            sert_file = user_sert_file;
+            subscription_manager = std::make_shared<SubscriptionManager>([&](const std::string &message) -> bool {
+                return send(message);
+            });
+            init_connection();
+        }
+
+        ~DepthStreams() {
+            is_close_connection = true;
+            /* после остановки соединения его callback-функции больше не вызываются */
+            connection.stop();
+            subscription_manager.reset();
+            /* дожидаемся загрузки снимков */
+            snapshot_slots_cv.notify_all();
+            std::lock_guard<std::mutex> lock(snapshot_futures_mutex);
+            for(size_t i = 0; i < snapshot_futures.size(); ++i) {
+                if(!snapshot_futures[i].valid()) continue;
+                try {
+                    snapshot_futures[i].wait();
+                    snapshot_futures[i].get();
+                }
+                catch(...) {}
+            }
+        }
+
+        /** \brief Установить функцию загрузки снимка стакана
+         *
+         * Без снимка стакан не может быть синхронизирован. Метод следует вызывать до start()
+         * \param provider Функция загрузки снимка
+         * \param max_parallel Максимальное количество одновременных запросов
+         */
+        void set_snapshot_provider(
+                snapshot_function provider,
+                const uint32_t max_parallel = 2) {
+            snapshot_provider = provider;
+            std::lock_guard<std::mutex> lock(snapshot_slots_mutex);
+            max_snapshot_parallel = max_parallel == 0 ? 1 : max_parallel;
+        }
+
+        /** \brief Добавить стакан символа
+         * \param symbol Имя символа
+         */
+        void add_symbol_stream(const std::string &symbol) {
+            const std::string s = to_upper_case(symbol);
+            {
+                std::lock_guard<std::mutex> lock(books_mutex);
+                if(books.find(s) != books.end()) return;
+                books[s] = std::make_shared<BookState>(is_futures);
+            }
+            subscription_manager->subscribe(to_lower_case(symbol) + stream_suffix);
+        }
+
+        /** \brief Убрать стакан символа
+         * \param symbol Имя символа
+         */
+        void del_symbol_stream(const std::string &symbol) {
+            {
+                std::lock_guard<std::mutex> lock(books_mutex);
+                books.erase(to_upper_case(symbol));
+            }
+            subscription_manager->unsubscribe(to_lower_case(symbol) + stream_suffix);
+        }
+
+        /** \brief Проверить синхронизацию стакана
+         * \param symbol Имя символа
+         * \return Вернет true, если стакан синхронизирован
+         */
+        bool check_synced(const std::string &symbol) {
+            book_ptr state = get_book_state(to_upper_case(symbol));
+            if(!state) return false;
+            std::lock_guard<std::mutex> lock(state->book_mutex);
+            return state->is_synced;
+        }
+
+        /** \brief Получить лучшие цены стакана
+         * \param symbol Имя символа
+         * \param bid Лучший уровень покупки
+         * \param ask Лучший уровень продажи
+         * \return Вернет true, если стакан синхронизирован и обе стороны не пусты
+         */
+        bool get_best_bid_ask(
+                const std::string &symbol,
+                DepthLevelSpec &bid,
+                DepthLevelSpec &ask) {
+            book_ptr state = get_book_state(to_upper_case(symbol));
+            if(!state) return false;
+            std::lock_guard<std::mutex> lock(state->book_mutex);
+            if(!state->is_synced) return false;
+            return state->book.get_best_bid(bid) && state->book.get_best_ask(ask);
+        }
+
+        /** \brief Получить уровни стакана
+         * \param symbol Имя символа
+         * \param bids Уровни покупки от лучшей цены
+         * \param asks Уровни продажи от лучшей цены
+         * \param depth Количество уровней (0 - все)
+         * \return Вернет true, если стакан синхронизирован
+         */
+        bool get_depth(
+                const std::string &symbol,
+                std::vector<DepthLevelSpec> &bids,
+                std::vector<DepthLevelSpec> &asks,
+                const size_t depth = 0) {
+            book_ptr state = get_book_state(to_upper_case(symbol));
+            if(!state) return false;
+            std::lock_guard<std::mutex> lock(state->book_mutex);
+            if(!state->is_synced) return false;
+            state->book.get_bids(bids, depth);
+            state->book.get_asks(asks, depth);
+            return true;
+        }
+
+        /** \brief Получить время последнего изменения стакана на сервере
+         * \param symbol Имя символа
+         * \return Время события, мс (0, если изменений нет)
+         */
+        uint64_t get_event_time(const std::string &symbol) {
+            book_ptr state = get_book_state(to_upper_case(symbol));
+            if(!state) return 0;
+            std::lock_guard<std::mutex> lock(state->book_mutex);
+            return state->event_time;
+        }
+
+        /** \brief Получить количество повторных синхронизаций из-за разрыва последовательности
+         * \return Количество синхронизаций
+         */
+        inline uint64_t get_num_resyncs() {
+            return resync_counter;
+        }
+
+        /** \brief Состояние соединения
+         * \return вернет true, если соединение есть
+         */
+        inline bool connected() {
+            return is_websocket_init;
+        }
+
+        /** \brief Подождать соединение
+         *
+         * Данный метод ждет, пока не установится соединение
+         * \return вернет true, если соединение есть, иначе произошла ошибка
+         */
+        inline bool wait() {
+            uint32_t tick = 0;
+            while(!is_error && !is_open && !is_close_connection) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                ++tick;
+                const uint32_t MAX_TICK = 10*100*5;
+                if(tick > MAX_TICK) {
+                    is_error = true;
+                    return is_open;
+                }
+            }
+            return is_open;
+        }
+
+        /** \brief Использовать внешний цикл событий
+         *
+         * Метод следует вызывать до start()
+         * \param user_event_loop Указатель на io_context
+         */
+        void set_event_loop(std::shared_ptr<SimpleWeb::io_context> user_event_loop) {
+            connection.set_event_loop(user_event_loop);
+        }
+
+        /** \brief Использовать цикл событий из пула
+         * \param pool Пул циклов событий
+         */
+        void set_event_loop(EventLoopPool &pool) {
+            set_event_loop(pool.get_io_context());
+        }
+
+        /** \brief Настроить сторожевой таймер соединения
+         *
+         * Соединение, которое перестало доставлять данные, но не закрылось,
+         * переподключается без задержки. Метод следует вызывать до start()
+         * \param user_message_timeout Допустимое время без сообщений, мс (0 - не проверять)
+         * \param user_ping_interval Период отправки ping для измерения RTT, мс (0 - не отправлять)
+         * \param user_pong_timeout Допустимое время ожидания pong, мс
+         */
+        void set_watchdog(
+                const uint64_t user_message_timeout,
+                const uint64_t user_ping_interval = 5000,
+                const uint64_t user_pong_timeout = 5000) {
+            connection.set_watchdog(user_message_timeout, user_ping_interval, user_pong_timeout);
+        }
+
+        /** \brief Получить время прохождения ping-pong
+         * \return RTT последнего ping, мс (0, если еще не измерено)
+         */
+        inline double get_ping_rtt() {
+            return connection.get_ping_rtt();
+        }
+
+        /** \brief Получить время с последнего сообщения соединения
+         * \return Время, мс
+         */
+        inline uint64_t get_last_message_age() {
+            return connection.get_last_message_age();
+        }
+
+        /** \brief Проверить, устарело ли соединение
+         * \return Вернет true, если сообщений нет дольше допустимого времени
+         */
+        inline bool check_stale() {
+            return connection.check_stale();
+        }
+
+        /** \brief Получить количество принудительных переподключений
+         * \return Количество переподключений
+         */
+        inline uint64_t get_num_stale_reconnects() {
+            return connection.get_num_stale_reconnects();
+        }
+
+        /** \brief Запустить поток
+         */
+        void start() {
+            connection.start();
+        }
+    };
+
+    /** \brief Верхние уровни стакана фиксированного размера
+     *
+     * Цены и количества хранятся в отдельных выровненных массивах,
+     * поэтому расчеты по уровням компилятор может векторизовать
+     */
+    class alignas(64) PartialDepthSpec {
+    public:
+        static const size_t MAX_LEVELS = 20;
+
+        alignas(64) std::array<double, MAX_LEVELS> bid_prices;
+        alignas(64) std::array<double, MAX_LEVELS> bid_quantities;
+        alignas(64) std::array<double, MAX_LEVELS> ask_prices;
+        alignas(64) std::array<double, MAX_LEVELS> ask_quantities;
+        uint32_t num_bids = 0;          /**< Количество уровней покупки */
+        uint32_t num_asks = 0;          /**< Количество уровней продажи */
+        uint64_t last_update_id = 0;    /**< ID последнего обновления */
+        uint64_t event_time = 0;        /**< Время события на сервере, мс (0 для спота) */
+
+        PartialDepthSpec() {
+            bid_prices.fill(0);
+            bid_quantities.fill(0);
+            ask_prices.fill(0);
+            ask_quantities.fill(0);
+        };
+
+        /** \brief Получить суммарную стоимость уровней покупки
+         * \param levels Количество уровней от лучшей цены
+         * \return Сумма цена * количество
+         */
+        inline double get_bid_notional(const size_t levels = MAX_LEVELS) const {
+            const size_t n = std::min(levels, (size_t)num_bids);
+            double sum = 0;
+            for(size_t i = 0; i < n; ++i) {
+                sum += bid_prices[i] * bid_quantities[i];
+            }
+            return sum;
+        }
+
+        /** \brief Получить суммарную стоимость уровней продажи
+         * \param levels Количество уровней от лучшей цены
+         * \return Сумма цена * количество
+         */
+        inline double get_ask_notional(const size_t levels = MAX_LEVELS) const {
+            const size_t n = std::min(levels, (size_t)num_asks);
+            double sum = 0;
+            for(size_t i = 0; i < n; ++i) {
+                sum += ask_prices[i] * ask_quantities[i];
+            }
+            return sum;
+        }
+
+        inline double get_bid_quantity(const size_t levels = MAX_LEVELS) const {
+            const size_t n = std::min(levels, (size_t)num_bids);
+            double sum = 0;
+            for(size_t i = 0; i < n; ++i) {
+                sum += bid_quantities[i];
+            }
+            return sum;
+        }
+
+        inline double get_ask_quantity(const size_t levels = MAX_LEVELS) const {
+            const size_t n = std::min(levels, (size_t)num_asks);
+            double sum = 0;
+            for(size_t i = 0; i < n; ++i) {
+                sum += ask_quantities[i];
+            }
+            return sum;
+        }
+
+        /** \brief Получить середину спреда, взвешенную по глубине
+         *
+         * Средние цены сторон (VWAP по уровням) взвешиваются объемом противоположной стороны,
+         * поэтому середина смещается в сторону меньшей ликвидности
+         * \param levels Количество уровней от лучшей цены
+         * \return Цена (0, если одна из сторон пуста)
+         */
+        double get_weighted_mid(const size_t levels = MAX_LEVELS) const {
+            const double bid_quantity = get_bid_quantity(levels);
+            const double ask_quantity = get_ask_quantity(levels);
+            if(bid_quantity <= 0 || ask_quantity <= 0) return 0;
+            const double bid_vwap = get_bid_notional(levels) / bid_quantity;
+            const double ask_vwap = get_ask_notional(levels) / ask_quantity;
+            return (bid_vwap * ask_quantity + ask_vwap * bid_quantity) / (bid_quantity + ask_quantity);
+        }
+    };
+
+    /** \brief Класс верхних уровней стаканов из потоков частичной глубины
+     *
+     * Потоки depth5/10/20 передают верхние уровни стакана целиком,
+     * поэтому синхронизация со снимком не нужна. Уровни каждого символа записываются
+     * в слот фиксированного размера, читатели получают согласованную копию без блокировки писателя.
+     * Слоты выделяются один раз, доступ к ним выполняется по дескриптору.
+     */
+    class PartialDepthStreams {
+    public:
+        using EndpointTypes = CandlestickStreams::EndpointTypes;
+        using handle_t = uint32_t;
+        static const handle_t INVALID_HANDLE = 0xFFFFFFFF;
+
+    private:
+        using json = nlohmann::json;
+        std::string point = "stream.binancefuture.com/stream";
+        std::string sert_file = "curl-ca-bundle.crt";
+        std::string stream_suffix = "@depth20@100ms";
+        uint32_t levels = 20;
+
+        WebSocketConnection connection;         /**< Соединение */
+
+        std::shared_ptr<SubscriptionManager> subscription_manager;    /**< Менеджер подписок */
+
+        std::atomic<bool> is_websocket_init = ATOMIC_VAR_INIT(false);    /**< Состояние соединения */
+        std::atomic<bool> is_error = ATOMIC_VAR_INIT(false);             /**< Ошибка соединения */
+        std::atomic<bool> is_close_connection = ATOMIC_VAR_INIT(false);  /**< Флаг для закрытия соединения */
+        std::atomic<bool> is_open = ATOMIC_VAR_INIT(false);
+
+        SeqLockArray<PartialDepthSpec> slots;  /**< Слоты символов */
+        uint32_t max_symbols = 0;
+        std::atomic<uint32_t> num_slots = ATOMIC_VAR_INIT(0);
+        std::map<std::string, handle_t> symbol_to_handle;
+        std::mutex symbol_to_handle_mutex;
+
+        handle_t find_handle(const std::string &symbol) {
+            std::lock_guard<std::mutex> lock(symbol_to_handle_mutex);
+            auto it = symbol_to_handle.find(symbol);
+            if(it == symbol_to_handle.end()) return INVALID_HANDLE;
+            return it->second;
+        }
+
+        static uint32_t parse_levels(
+                const json &j_levels,
+                std::array<double, PartialDepthSpec::MAX_LEVELS> &prices,
+                std::array<double, PartialDepthSpec::MAX_LEVELS> &quantities) {
+            const size_t n = std::min(j_levels.size(), PartialDepthSpec::MAX_LEVELS);
+            for(size_t i = 0; i < n; ++i) {
+                prices[i] = std::atof(j_levels[i][0].get_ref<const std::string&>().c_str());
+                quantities[i] = std::atof(j_levels[i][1].get_ref<const std::string&>().c_str());
+            }
+            return n;
+        }
+
+        /** \brief Парсер сообщения от вебсокета
+         * \param response Ответ от сервера
+         */
+        void parser(const std::string &response) {
+            /* Пример сообщения фьючерсов
+                {
+                    "stream":"btcusdt@depth5@100ms",
+                    "data":{"e":"depthUpdate","E":1571889248277,"T":1571889248276,"s":"BTCUSDT",
+                        "U":390497796,"u":390497878,"pu":390497794,
+                        "b":[["7403.89","0.002"], ...],
+                        "a":[["7405.96","3.340"], ...]}
+                }
+               Пример сообщения спота
+                {
+                    "stream":"btcusdt@depth5@100ms",
+                    "data":{"lastUpdateId":160,"bids":[["0.0024","10"]],"asks":[["0.0026","100"]]}
+                }
+             */
+            try {
+                json j = json::parse(response);
+
+                /* ответ на запрос подписки, например {"result":null,"id":1} */
+                auto it_stream = j.find("stream");
+                if(it_stream == j.end()) {
+                    subscription_manager->on_response(j);
+                    return;
+                }
+
+                const std::string &stream = it_stream->get_ref<const std::string&>();
+                const handle_t handle = find_handle(to_upper_case(stream.substr(0, stream.find('@'))));
+                if(handle == INVALID_HANDLE) return;
+
+                auto j_data = j.find("data");
+                if(j_data == j.end()) return;
+                PartialDepthSpec depth;
+                auto it_bids = j_data->find("b");
+                if(it_bids != j_data->end()) {
+                    depth.num_bids = parse_levels(*it_bids, depth.bid_prices, depth.bid_quantities);
+                    depth.num_asks = parse_levels((*j_data)["a"], depth.ask_prices, depth.ask_quantities);
+                    depth.last_update_id = (*j_data)["u"];
+                    depth.event_time = (*j_data)["E"];
+                } else {
+                    depth.num_bids = parse_levels((*j_data)["bids"], depth.bid_prices, depth.bid_quantities);
+                    depth.num_asks = parse_levels((*j_data)["asks"], depth.ask_prices, depth.ask_quantities);
+                    depth.last_update_id = (*j_data)["lastUpdateId"];
+                }
+                slots[handle].store(depth);
+                is_websocket_init = true;
+                if(on_depth != nullptr) on_depth(handle, depth);
+            }
+            catch(const json::parse_error& e) {
+                std::cerr << "binance_api::PartialDepthStreams parser error (json::parse_error), what: " << std::string(e.what()) << std::endl;
+            }
+            catch(const json::out_of_range& e) {
+                std::cerr << "binance_api::PartialDepthStreams parser error (json::out_of_range), what: " << std::string(e.what()) << std::endl;
+            }
+            catch(const json::type_error& e) {
+                std::cerr << "binance_api::PartialDepthStreams parser error (json::type_error), what: " << std::string(e.what()) << std::endl;
+            }
+            catch(...) {
+                std::cerr << "binance_api::PartialDepthStreams parser error" << std::endl;
+            }
+        }
+
+        bool send(const std::string &message) {
+            return connection.send(message);
+        }
+
+        std::string to_upper_case(const std::string &s){
+            std::string temp = s;
+            std::transform(temp.begin(), temp.end(), temp.begin(), [](char ch) {
+                return std::use_facet<std::ctype<char>>(std::locale()).toupper(ch);
+            });
+            return temp;
+        }
+
+        std::string to_lower_case(const std::string &s){
+            std::string temp = s;
+            std::transform(temp.begin(), temp.end(), temp.begin(), [](char ch) {
+                return std::use_facet<std::ctype<char>>(std::locale()).tolower(ch);
+            });
+            return temp;
+        }
+
+        /** \brief Инициализировать callback-функции соединения
+         */
+        void init_connection() {
+            connection.set_point(point);
+            connection.set_sert_file(sert_file);
+
+            /* подписки отправляются в потоке соединения с учетом ограничения скорости */
+            connection.on_timer = [&]() {
+                subscription_manager->process();
+            };
+
+            connection.on_stale = [&]() {
+                if(on_stale != nullptr) on_stale();
+            };
+
+            subscription_manager->on_reject = [&](const std::string &param, const bool is_subscribe) {
+                if(on_subscription_reject != nullptr) on_subscription_reject(param, is_subscribe);
+            };
+
+            /* читаем собщения, которые пришли */
+            connection.on_message = [&](const std::string &message) {
+                parser(message);
+            };
+
+            connection.on_open = [&]() {
+                subscription_manager->on_open();
+                is_open = true;
+            };
+
+            connection.on_close = [&]() {
+                is_websocket_init = false;
+                is_open = false;
+                is_error = true;
+                subscription_manager->on_close();
+            };
+        }
+
+    public:
+        std::function<void(
+            const handle_t handle,
+            const PartialDepthSpec &depth)> on_depth = nullptr;  /**< Уровни стакана обновлены */
+        std::function<void(
+            const std::string &param,
+            const bool is_subscribe)> on_subscription_reject = nullptr; /**< Сервер отклонил подписку или отписку потока */
+        std::function<void()> on_stale = nullptr;  /**< Соединение устарело и будет переподключено */
+
+        /** \brief Конструктор класса верхних уровней стаканов
+         * \param user_type Тип конечной точки подключения
+         * \param user_levels Количество уровней (5, 10 или 20)
+         * \param update_speed Период обновлений, мс (100, 250 или 500 для фьючерсов, 100 или 1000 для спота)
+         * \param user_max_symbols Максимальное количество символов
+         * \param user_sert_file Файл-сертификат. По умолчанию используется от curl: curl-ca-bundle.crt
+         */
+        PartialDepthStreams(
+                const EndpointTypes user_type,
+                const uint32_t user_levels = 20,
+                const uint32_t update_speed = 100,
+                const uint32_t user_max_symbols = 1024,
+                const std::string user_sert_file = "curl-ca-bundle.crt") {
+            bool is_futures = true;
+            switch(user_type) {
+            case EndpointTypes::FUTURES_DEMO:
+                point = "stream.binancefuture.com/stream";
+                break;
+            case EndpointTypes::FUTURES_REAL:
+                point = "fstream.binance.com/stream";
+                break;
+            case EndpointTypes::SPOT_DEMO:
+                point = "testnet.binance.vision/stream";
+                is_futures = false;
+                break;
+            case EndpointTypes::SPOT_REAL:
+                point = "stream.binance.com:9443/stream";
+                is_futures = false;
+                break;
+            default:
+                point = "stream.binancefuture.com/stream";
+                break;
+            }
+            if(user_levels <= 5) levels = 5;
+            else if(user_levels <= 10) levels = 10;
+            else levels = 20;
+            stream_suffix = "@depth" + std::to_string(levels);
+            const uint32_t default_speed = is_futures ? 250 : 1000;
+            if(update_speed != 0 && update_speed != default_speed) {
+                stream_suffix += "@" + std::to_string(update_speed) + "ms";
+            }
+            sert_file = user_sert_file;
+            max_symbols = user_max_symbols == 0 ? 1 : user_max_symbols;
+            slots.reset(max_symbols);
+            subscription_manager = std::make_shared<SubscriptionManager>([&](const std::string &message) -> bool {
+                return send(message);
+            });
+            init_connection();
+        }
+
+        ~PartialDepthStreams() {
+            is_close_connection = true;
+            /* после остановки соединения его callback-функции больше не вызываются */
+            connection.stop();
+            subscription_manager.reset();
+        }
+
+        /** \brief Добавить поток символа
+         * \param symbol Имя символа
+         * \return Дескриптор символа или INVALID_HANDLE, если слоты закончились
+         */
+        handle_t add_symbol_stream(const std::string &symbol) {
+            const std::string s = to_upper_case(symbol);
+            handle_t handle = INVALID_HANDLE;
+            {
+                std::lock_guard<std::mutex> lock(symbol_to_handle_mutex);
+                auto it = symbol_to_handle.find(s);
+                if(it != symbol_to_handle.end()) return it->second;
+                if(num_slots >= max_symbols) {
+                    std::cerr << "binance_api::PartialDepthStreams error, what: no free slots for " << s << std::endl;
+                    return INVALID_HANDLE;
+                }
+                handle = num_slots;
+                symbol_to_handle[s] = handle;
+                ++num_slots;
+            }
+            subscription_manager->subscribe(to_lower_case(symbol) + stream_suffix);
+            return handle;
+        }
+
+        /** \brief Убрать поток символа
+         *
+         * Слот символа сохраняется, поэтому дескриптор остается действительным
+         * \param symbol Имя символа
+         */
+        void del_symbol_stream(const std::string &symbol) {
+            subscription_manager->unsubscribe(to_lower_case(symbol) + stream_suffix);
+        }
+
+        /** \brief Получить дескриптор символа
+         * \param symbol Имя символа
+         * \return Дескриптор символа или INVALID_HANDLE
+         */
+        inline handle_t get_handle(const std::string &symbol) {
+            return find_handle(to_upper_case(symbol));
+        }
+
+        /** \brief Получить уровни стакана
+         * \param handle Дескриптор символа
+         * \param depth Уровни стакана
+         * \return Вернет true, если данные уже были получены
+         */
+        inline bool get_depth(const handle_t handle, PartialDepthSpec &depth) const {
+            if(handle >= num_slots) return false;
+            return slots[handle].load(depth) != 0;
+        }
+
+        /** \brief Получить номер версии уровней стакана
+         *
+         * Позволяет проверить наличие новых данных без копирования
+         * \param handle Дескриптор символа
+         * \return Номер версии (0, если данных нет)
+         */
+        inline uint64_t get_version(const handle_t handle) const {
+            if(handle >= num_slots) return 0;
+            return slots[handle].get_version();
+        }
+
+        /** \brief Состояние соединения
+         * \return вернет true, если соединение есть
+         */
+        inline bool connected() {
+            return is_websocket_init;
+        }
+
+        /** \brief Подождать соединение
+         *
+         * Данный метод ждет, пока не установится соединение
+         * \return вернет true, если соединение есть, иначе произошла ошибка
+         */
+        inline bool wait() {
+            uint32_t tick = 0;
+            while(!is_error && !is_open && !is_close_connection) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                ++tick;
+                const uint32_t MAX_TICK = 10*100*5;
+                if(tick > MAX_TICK) {
+                    is_error = true;
+                    return is_open;
+                }
+            }
+            return is_open;
+        }
+
+        /** \brief Использовать внешний цикл событий
+         *
+         * Метод следует вызывать до start()
+         * \param user_event_loop Указатель на io_context
+         */
+        void set_event_loop(std::shared_ptr<SimpleWeb::io_context> user_event_loop) {
+            connection.set_event_loop(user_event_loop);
+        }
+
+        /** \brief Использовать цикл событий из пула
+         * \param pool Пул циклов событий
+         */
+        void set_event_loop(EventLoopPool &pool) {
+            set_event_loop(pool.get_io_context());
+        }
+
+        /** \brief Настроить сторожевой таймер соединения
+         *
+         * Соединение, которое перестало доставлять данные, но не закрылось,
+         * переподключается без задержки. Метод следует вызывать до start()
+         * \param user_message_timeout Допустимое время без сообщений, мс (0 - не проверять)
+         * \param user_ping_interval Период отправки ping для измерения RTT, мс (0 - не отправлять)
+         * \param user_pong_timeout Допустимое время ожидания pong, мс
+         */
+        void set_watchdog(
+                const uint64_t user_message_timeout,
+                const uint64_t user_ping_interval = 5000,
+                const uint64_t user_pong_timeout = 5000) {
+            connection.set_watchdog(user_message_timeout, user_ping_interval, user_pong_timeout);
+        }
+
+        /** \brief Получить время прохождения ping-pong
+         * \return RTT последнего ping, мс (0, если еще не измерено)
+         */
+        inline double get_ping_rtt() {
+            return connection.get_ping_rtt();
+        }
+
+        /** \brief Получить время с последнего сообщения соединения
+         * \return Время, мс
+         */
+        inline uint64_t get_last_message_age() {
+            return connection.get_last_message_age();
+        }
+
+        /** \brief Проверить, устарело ли соединение
+         * \return Вернет true, если сообщений нет дольше допустимого времени
+         */
+        inline bool check_stale() {
+            return connection.check_stale();
+        }
+
+        /** \brief Получить количество принудительных переподключений
+         * \return Количество переподключений
+         */
+        inline uint64_t get_num_stale_reconnects() {
+            return connection.get_num_stale_reconnects();
+        }
+
+        /** \brief Запустить поток
+         */
+        void start() {
+            connection.start();
+        }
+    };
+}
+
+#endif // BINANCE_CPP_API_WEBSOCKET_DEPTH_HPP_INCLUDED
@@ -0,0 +1,348 @@
+/*
+* binance-cpp-api - C ++ API client for binance
+*
+* Copyright (c) 2019 Elektro Yar. Email: git.electroyar@gmail.com
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef BINANCE_CPP_API_WEBSOCKET_REDUNDANT_HPP_INCLUDED
+#define BINANCE_CPP_API_WEBSOCKET_REDUNDANT_HPP_INCLUDED
+
+#include "binance-cpp-api-websocket.hpp"
+#include "tools/binance-cpp-api-stream-deduplicator.hpp"
+#include <vector>
+#include <atomic>
+
+namespace binance_api {
+    using namespace common;
+
+    /** \brief Класс потока котировок с резервными соединениями
+     *
+     * Два и более соединения (возможно, к разным конечным точкам) несут одинаковые подписки.
+     * Сообщения сравниваются по потоку, времени события и времени открытия бара,
+     * потребитель получает сообщение, пришедшее первым.
+     * Обрыв или задержка одного соединения не прерывает поток котировок.
+     */
+    class RedundantCandlestickStreams {
+    public:
+        using EndpointTypes = CandlestickStreams::EndpointTypes;
+
+    private:
+        using leg_ptr = std::shared_ptr<CandlestickStreams>;
+        std::vector<leg_ptr> legs;                          /**< Соединения */
+        std::vector<std::shared_ptr<std::atomic<uint64_t>>> leg_wins;  /**< Количество первых сообщений по соединениям */
+        StreamDeduplicator deduplicator;
+
+        void init_leg(const size_t index) {
+            leg_ptr leg = legs[index];
+            std::shared_ptr<std::atomic<uint64_t>> wins = leg_wins[index];
+            leg->set_candle_filter([&, wins](const CandleEvent &event) -> bool {
+                std::string key(event.symbol);
+                key += "@";
+                key += std::to_string(event.period);
+                if(!deduplicator.check(key, event.event_time, event.candle.timestamp, event.close_candle)) return false;
+                ++(*wins);
+                return true;
+            });
+            leg->on_candle = [&](
+                    const std::string &symbol,
+                    const xquotes_common::Candle &candle,
+                    const uint32_t period,
+                    const bool close_candle) {
+                if(on_candle != nullptr) on_candle(symbol, candle, period, close_candle);
+            };
+        }
+
+        /** \brief Получить соединение с самыми свежими данными
+         * \return Указатель на соединение
+         */
+        leg_ptr get_fresh_leg() {
+            leg_ptr fresh;
+            xtime::ftimestamp_t fresh_timestamp = 0;
+            for(size_t i = 0; i < legs.size(); ++i) {
+                /* устаревшее соединение не используется, пока сторожевой таймер его не переподключит */
+                if(!legs[i]->connected() || legs[i]->check_stale()) continue;
+                const xtime::ftimestamp_t t = legs[i]->get_last_server_timestamp();
+                if(!fresh || t > fresh_timestamp) {
+                    fresh = legs[i];
+                    fresh_timestamp = t;
+                }
+            }
+            if(!fresh && !legs.empty()) fresh = legs[0];
+            return fresh;
+        }
+
+    public:
+        std::function<void(
+            const std::string &symbol,
+            const xquotes_common::Candle &candle,
+            const uint32_t period,
+            const bool close_candle)> on_candle = nullptr;
+
+        /** \brief Конструктор класса потока котировок с резервными соединениями
+         * \param points Конечные точки подключения, по одному соединению на каждую
+         * \param user_sert_file Файл-сертификат. По умолчанию используется от curl: curl-ca-bundle.crt
+         */
+        RedundantCandlestickStreams(
+                const std::vector<std::string> &points,
+                const std::string user_sert_file = "curl-ca-bundle.crt") {
+            for(size_t i = 0; i < points.size(); ++i) {
+                legs.push_back(std::make_shared<CandlestickStreams>(points[i], user_sert_file));
+                leg_wins.push_back(std::make_shared<std::atomic<uint64_t>>(0));
+                init_leg(i);
+            }
+        }
+
+        /** \brief Конструктор класса потока котировок с резервными соединениями
+         * \param user_type Тип конечной точки подключения
+         * \param num_connections Количество соединений
+         * \param user_sert_file Файл-сертификат. По умолчанию используется от curl: curl-ca-bundle.crt
+         */
+        RedundantCandlestickStreams(
+                const EndpointTypes user_type,
+                const size_t num_connections = 2,
+                const std::string user_sert_file = "curl-ca-bundle.crt") {
+            for(size_t i = 0; i < num_connections; ++i) {
+                legs.push_back(std::make_shared<CandlestickStreams>(user_type, user_sert_file));
+                leg_wins.push_back(std::make_shared<std::atomic<uint64_t>>(0));
+                init_leg(i);
+            }
+        }
+
+        ~RedundantCandlestickStreams() {
+            /* соединения закрываются до разрушения фильтра повторов */
+            legs.clear();
+        }
+
+        /** \brief Добавить поток символа с заданным периодом во все соединения
+         * \param symbol Имя символа
+         * \param period Период
+         */
+        void add_symbol_stream(
+                const std::string &symbol,
+                const uint32_t period) {
+            for(size_t i = 0; i < legs.size(); ++i) {
+                legs[i]->add_symbol_stream(symbol, period);
+            }
+        }
+
+        /** \brief Убрать поток символа с заданным периодом из всех соединений
+         * \param symbol Имя символа
+         * \param period Период
+         */
+        void del_symbol_stream(
+                const std::string &symbol,
+                const uint32_t period) {
+            for(size_t i = 0; i < legs.size(); ++i) {
+                legs[i]->del_symbol_stream(symbol, period);
+            }
+        }
+
+        /** \brief Использовать пул циклов событий
+         *
+         * Соединения распределяются по потокам пула по кругу. Метод следует вызывать до start()
+         * \param pool Пул циклов событий
+         */
+        void set_event_loop(EventLoopPool &pool) {
+            for(size_t i = 0; i < legs.size(); ++i) {
+                legs[i]->set_event_loop(pool);
+            }
+        }
+
+        /** \brief Включить заполнение пропусков через REST API во всех соединениях
+         *
+         * Повторные закрытия баров из разных соединений отбрасываются. Метод следует вызывать до start()
+         * \param provider Функция загрузки баров
+         * \param budget Проверка остатка веса запросов (по умолчанию загрузка не ограничивается)
+         */
+        void set_backfill_provider(
+                CandlestickStreams::backfill_function provider,
+                CandlestickStreams::budget_function budget = nullptr) {
+            for(size_t i = 0; i < legs.size(); ++i) {
+                legs[i]->set_backfill_provider(provider, budget);
+            }
+        }
+
+        /** \brief Настроить сторожевой таймер всех соединений
+         *
+         * Метод следует вызывать до start()
+         * \param message_timeout Допустимое время без сообщений, мс (0 - не проверять)
+         * \param ping_interval Период отправки ping для измерения RTT, мс (0 - не отправлять)
+         * \param pong_timeout Допустимое время ожидания pong, мс
+         */
+        void set_watchdog(
+                const uint64_t message_timeout,
+                const uint64_t ping_interval = 5000,
+                const uint64_t pong_timeout = 5000) {
+            for(size_t i = 0; i < legs.size(); ++i) {
+                legs[i]->set_watchdog(message_timeout, ping_interval, pong_timeout);
+            }
+        }
+
+        /** \brief Получить время прохождения ping-pong соединения
+         * \param index Индекс соединения
+         * \return RTT последнего ping, мс
+         */
+        double get_ping_rtt(const size_t index) {
+            if(index >= legs.size()) return 0;
+            return legs[index]->get_ping_rtt();
+        }
+
+        /** \brief Запустить все соединения
+         */
+        void start() {
+            for(size_t i = 0; i < legs.size(); ++i) {
+                legs[i]->start();
+            }
+        }
+
+        /** \brief Подождать соединение
+         * \return вернет true, если установлено хотя бы одно соединение
+         */
+        bool wait() {
+            bool is_ok = false;
+            for(size_t i = 0; i < legs.size(); ++i) {
+                if(legs[i]->wait()) is_ok = true;
+            }
+            return is_ok;
+        }
+
+        /** \brief Состояние соединения
+         * \return вернет true, если есть хотя бы одно соединение
+         */
+        bool connected() {
+            for(size_t i = 0; i < legs.size(); ++i) {
+                if(legs[i]->connected()) return true;
+            }
+            return false;
+        }
+
+        /** \brief Получить количество соединений
+         * \return Количество соединений
+         */
+        inline size_t get_num_connections() {
+            return legs.size();
+        }
+
+        /** \brief Получить количество сообщений, которые соединение доставило первым
+         * \param index Индекс соединения
+         * \return Количество сообщений
+         */
+        uint64_t get_num_wins(const size_t index) {
+            if(index >= leg_wins.size()) return 0;
+            return *leg_wins[index];
+        }
+
+        /** \brief Получить количество отброшенных повторов
+         * \return Количество сообщений
+         */
+        inline uint64_t get_num_duplicates() {
+            return deduplicator.get_duplicates();
+        }
+
+        /** \brief Получить метку времени сервера
+         * \return Метка времени сервера
+         */
+        xtime::ftimestamp_t get_server_timestamp() {
+            leg_ptr leg = get_fresh_leg();
+            if(!leg) return xtime::get_ftimestamp();
+            return leg->get_server_timestamp();
+        }
+
+        /** \brief Получить последнюю метку времени сервера
+         * \return Метка времени сервера
+         */
+        xtime::ftimestamp_t get_last_server_timestamp() {
+            leg_ptr leg = get_fresh_leg();
+            if(!leg) return 0;
+            return leg->get_last_server_timestamp();
+        }
+
+        /** \brief Получить цену тика символа
+         * \param symbol Имя символа
+         * \param period Период
+         * \return Последняя цена bid
+         */
+        double get_price(const std::string &symbol, const uint32_t period) {
+            leg_ptr leg = get_fresh_leg();
+            if(!leg) return 0.0;
+            return leg->get_price(symbol, period);
+        }
+
+        /** \brief Получить цену тика символа
+         * \param symbol Имя символа
+         * \return Последняя цена bid
+         */
+        double get_price(const std::string &symbol) {
+            leg_ptr leg = get_fresh_leg();
+            if(!leg) return 0.0;
+            return leg->get_price(symbol);
+        }
+
+        /** \brief Получить бар
+         * \param symbol Имя символа
+         * \param period Период
+         * \param offset Смещение
+         * \return Бар
+         */
+        xquotes_common::Candle get_candle(
+                const std::string &symbol,
+                const uint32_t period,
+                const size_t offset = 0) {
+            leg_ptr leg = get_fresh_leg();
+            if(!leg) return xquotes_common::Candle();
+            return leg->get_candle(symbol, period, offset);
+        }
+
+        /** \brief Получить бар по метке времени
+         * \param symbol Имя символа
+         * \param period Период
+         * \param timestamp Метка времени
+         * \return Бар
+         */
+        xquotes_common::Candle get_timestamp_candle(
+                const std::string &symbol,
+                const uint32_t period,
+                const xtime::timestamp_t timestamp) {
+            leg_ptr leg = get_fresh_leg();
+            if(!leg) return xquotes_common::Candle();
+            return leg->get_timestamp_candle(symbol, period, timestamp);
+        }
+
+        /** \brief Инициализировать массив японских свечей во всех соединениях
+         * \param symbol Имя символа
+         * \param period Период
+         * \param new_candles Массив баров
+         * \return Код ошибки, вернет 0 если все в порядке
+         */
+        template<class T>
+        int init_array_candles(
+                const std::string &symbol,
+                const uint32_t period,
+                const T &new_candles) {
+            for(size_t i = 0; i < legs.size(); ++i) {
+                int err = legs[i]->init_array_candles(symbol, period, new_candles);
+                if(err != OK) return err;
+            }
+            return OK;
+        }
+    };
+}
+
+#endif // BINANCE_CPP_API_WEBSOCKET_REDUNDANT_HPP_INCLUDED
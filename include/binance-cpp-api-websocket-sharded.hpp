@@ -0,0 +1,435 @@
+/*
+* binance-cpp-api - C ++ API client for binance
+*
+* Copyright (c) 2019 Elektro Yar. Email: git.electroyar@gmail.com
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef BINANCE_CPP_API_WEBSOCKET_SHARDED_HPP_INCLUDED
+#define BINANCE_CPP_API_WEBSOCKET_SHARDED_HPP_INCLUDED
+
+#include "binance-cpp-api-websocket.hpp"
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+
+namespace binance_api {
+    using namespace common;
+
+    /** \brief Класс потока котировок, распределенного по нескольким соединениям
+     *
+     * Подписки распределяются по соединениям с ограничением количества потоков на одно соединение.
+     * Каждое соединение обслуживается своим потоком ввода-вывода и своим парсером,
+     * либо соединения распределяются по потокам общего пула циклов событий.
+     * При переподключении соединения подписки перераспределяются равномерно.
+     */
+    class ShardedCandlestickStreams {
+    public:
+        using EndpointTypes = CandlestickStreams::EndpointTypes;
+
+    private:
+        using shard_ptr = std::shared_ptr<CandlestickStreams>;
+        std::vector<shard_ptr> shards;                  /**< Соединения */
+        std::vector<uint32_t> shard_streams;            /**< Количество потоков на соединениях */
+        std::map<std::string, size_t> stream_to_shard;  /**< Соединение для каждого потока символ@период */
+        std::map<std::string, xtime::timestamp_t> last_close_timestamp;
+        std::recursive_mutex shards_mutex;
+        std::mutex candle_mutex;    /**< Доставка баров потребителю по одному */
+
+        EndpointTypes endpoint_type = EndpointTypes::FUTURES_DEMO;
+        std::string sert_file = "curl-ca-bundle.crt";
+        uint32_t max_streams_per_connection = 200;
+        std::atomic<bool> is_start = ATOMIC_VAR_INIT(false);
+        std::atomic<bool> is_shutdown = ATOMIC_VAR_INIT(false);
+        EventLoopPool *event_loop_pool = nullptr;      /**< Пул циклов событий для соединений */
+        CandlestickStreams::backfill_function backfill_provider = nullptr;
+        CandlestickStreams::budget_function backfill_budget = nullptr;
+
+        std::string to_upper_case(const std::string &s){
+            std::string temp = s;
+            std::transform(temp.begin(), temp.end(), temp.begin(), [](char ch) {
+                return std::use_facet<std::ctype<char>>(std::locale()).toupper(ch);
+            });
+            return temp;
+        }
+
+        inline std::string get_stream_key(const std::string &symbol, const uint32_t period) {
+            return to_upper_case(symbol) + "@" + std::to_string(period);
+        }
+
+        inline void parse_stream_key(const std::string &key, std::string &symbol, uint32_t &period) {
+            const size_t pos = key.find_last_of("@");
+            symbol = key.substr(0, pos);
+            period = std::stoi(key.substr(pos + 1));
+        }
+
+        /** \brief Передать бар потребителю
+         *
+         * Вызывается из потоков ввода-вывода, доставки и загрузки пропусков всех соединений,
+         * поэтому проверка и вызов on_candle выполняются под одной блокировкой.
+         * При переносе потока между соединениями закрытие бара
+         * может прийти дважды, повторное закрытие отбрасывается
+         */
+        void emit_candle(
+                const std::string &symbol,
+                const xquotes_common::Candle &candle,
+                const uint32_t period,
+                const bool close_candle) {
+            std::lock_guard<std::mutex> lock(candle_mutex);
+            if(close_candle) {
+                const std::string key = get_stream_key(symbol, period);
+                auto it = last_close_timestamp.find(key);
+                if(it != last_close_timestamp.end() && it->second >= candle.timestamp) return;
+                last_close_timestamp[key] = candle.timestamp;
+            }
+            if(on_candle != nullptr) on_candle(symbol, candle, period, close_candle);
+        }
+
+        size_t create_shard() {
+            shard_ptr shard = std::make_shared<CandlestickStreams>(endpoint_type, sert_file);
+            shard->on_candle = [&](
+                    const std::string &symbol,
+                    const xquotes_common::Candle &candle,
+                    const uint32_t period,
+                    const bool close_candle) {
+                emit_candle(symbol, candle, period, close_candle);
+            };
+            shard->on_open = [&]() {
+                if(is_shutdown) return;
+                rebalance();
+            };
+            if(event_loop_pool) shard->set_event_loop(*event_loop_pool);
+            if(backfill_provider != nullptr) shard->set_backfill_provider(backfill_provider, backfill_budget);
+            shards.push_back(shard);
+            shard_streams.push_back(0);
+            if(is_start) shard->start();
+            return shards.size() - 1;
+        }
+
+        /** \brief Найти наименее загруженное соединение
+         * \return Индекс соединения
+         */
+        size_t get_free_shard() {
+            size_t index = shards.size();
+            for(size_t i = 0; i < shards.size(); ++i) {
+                if(shard_streams[i] >= max_streams_per_connection) continue;
+                if(index == shards.size() || shard_streams[i] < shard_streams[index]) index = i;
+            }
+            if(index == shards.size()) index = create_shard();
+            return index;
+        }
+
+        /** \brief Перенести поток на другое соединение
+         *
+         * Сначала поток подписывается на новом соединении, затем отписывается на старом,
+         * чтобы не потерять закрытие бара. История баров переносится вместе с потоком
+         */
+        void move_stream(const std::string &key, const size_t from, const size_t to) {
+            std::string symbol;
+            uint32_t period = 0;
+            parse_stream_key(key, symbol, period);
+            std::vector<xquotes_common::Candle> array_candles;
+            shards[from]->get_array_candles(symbol, period, array_candles);
+            if(!array_candles.empty()) shards[to]->init_array_candles(symbol, period, array_candles);
+            shards[to]->add_symbol_stream(symbol, period);
+            shards[from]->del_symbol_stream(symbol, period);
+            --shard_streams[from];
+            ++shard_streams[to];
+            stream_to_shard[key] = to;
+        }
+
+        shard_ptr get_shard(const std::string &symbol, const uint32_t period) {
+            std::lock_guard<std::recursive_mutex> lock(shards_mutex);
+            auto it = stream_to_shard.find(get_stream_key(symbol, period));
+            if(it == stream_to_shard.end()) return shard_ptr();
+            return shards[it->second];
+        }
+
+        shard_ptr get_shard(const std::string &symbol) {
+            const std::string prefix = to_upper_case(symbol) + "@";
+            std::lock_guard<std::recursive_mutex> lock(shards_mutex);
+            auto it = stream_to_shard.lower_bound(prefix);
+            if(it == stream_to_shard.end()) return shard_ptr();
+            if(it->first.compare(0, prefix.size(), prefix) != 0) return shard_ptr();
+            return shards[it->second];
+        }
+
+    public:
+        /** \brief Бар обновлен или закрыт
+         *
+         * Соединения обслуживаются разными потоками, но функция не вызывается одновременно:
+         * бары всех соединений передаются по одному. Функция выполняется в потоке, передавшем бар,
+         * поэтому долгая обработка задерживает остальные соединения, а удалять объект из нее нельзя
+         */
+        std::function<void(
+            const std::string &symbol,
+            const xquotes_common::Candle &candle,
+            const uint32_t period,
+            const bool close_candle)> on_candle = nullptr;
+
+        /** \brief Конструктор класса потока котировок с несколькими соединениями
+         * \param user_type Тип конечной точки подключения
+         * \param user_max_streams_per_connection Максимальное количество потоков на одно соединение
+         * \param user_sert_file Файл-сертификат. По умолчанию используется от curl: curl-ca-bundle.crt
+         */
+        ShardedCandlestickStreams(
+                const EndpointTypes user_type,
+                const uint32_t user_max_streams_per_connection = 200,
+                const std::string user_sert_file = "curl-ca-bundle.crt") :
+                endpoint_type(user_type),
+                sert_file(user_sert_file),
+                max_streams_per_connection(user_max_streams_per_connection) {
+            if(max_streams_per_connection == 0) max_streams_per_connection = 1;
+        }
+
+        ~ShardedCandlestickStreams() {
+            is_shutdown = true;
+            std::vector<shard_ptr> temp;
+            {
+                std::lock_guard<std::recursive_mutex> lock(shards_mutex);
+                temp.swap(shards);
+                shard_streams.clear();
+                stream_to_shard.clear();
+            }
+            /* соединения закрываются вне блокировки, так как их потоки могут ждать rebalance() */
+            temp.clear();
+        }
+
+        /** \brief Обслуживать соединения пулом циклов событий
+         *
+         * Соединения распределяются по потокам пула по кругу.
+         * Пул должен существовать дольше, чем данный объект. Метод следует вызывать до add_symbol_stream()
+         * \param pool Пул циклов событий
+         */
+        void set_event_loop(EventLoopPool &pool) {
+            std::lock_guard<std::recursive_mutex> lock(shards_mutex);
+            event_loop_pool = &pool;
+        }
+
+        /** \brief Включить заполнение пропусков через REST API для всех соединений
+         *
+         * Метод следует вызывать до add_symbol_stream()
+         * \param provider Функция загрузки баров
+         * \param budget Проверка остатка веса запросов (по умолчанию загрузка не ограничивается)
+         */
+        void set_backfill_provider(
+                CandlestickStreams::backfill_function provider,
+                CandlestickStreams::budget_function budget = nullptr) {
+            std::lock_guard<std::recursive_mutex> lock(shards_mutex);
+            backfill_provider = provider;
+            backfill_budget = budget;
+        }
+
+        /** \brief Добавить поток символа с заданным периодом
+         * \param symbol Имя символа
+         * \param period Период
+         */
+        void add_symbol_stream(
+                const std::string &symbol,
+                const uint32_t period) {
+            const std::string key = get_stream_key(symbol, period);
+            std::lock_guard<std::recursive_mutex> lock(shards_mutex);
+            if(stream_to_shard.find(key) != stream_to_shard.end()) return;
+            const size_t index = get_free_shard();
+            stream_to_shard[key] = index;
+            ++shard_streams[index];
+            shards[index]->add_symbol_stream(symbol, period);
+        }
+
+        /** \brief Убрать поток символа с заданным периодом
+         * \param symbol Имя символа
+         * \param period Период
+         */
+        void del_symbol_stream(
+                const std::string &symbol,
+                const uint32_t period) {
+            const std::string key = get_stream_key(symbol, period);
+            std::lock_guard<std::recursive_mutex> lock(shards_mutex);
+            auto it = stream_to_shard.find(key);
+            if(it == stream_to_shard.end()) return;
+            shards[it->second]->del_symbol_stream(symbol, period);
+            --shard_streams[it->second];
+            stream_to_shard.erase(it);
+        }
+
+        /** \brief Перераспределить потоки между соединениями
+         *
+         * Потоки переносятся с наиболее загруженных соединений на наименее загруженные,
+         * пока разница в количестве потоков больше одного.
+         * Метод вызывается автоматически при каждом подключении соединения
+         */
+        void rebalance() {
+            std::lock_guard<std::recursive_mutex> lock(shards_mutex);
+            if(shards.size() < 2) return;
+            while(true) {
+                size_t index_max = 0, index_min = 0;
+                for(size_t i = 1; i < shards.size(); ++i) {
+                    if(shard_streams[i] > shard_streams[index_max]) index_max = i;
+                    if(shard_streams[i] < shard_streams[index_min]) index_min = i;
+                }
+                if((shard_streams[index_max] - shard_streams[index_min]) <= 1) break;
+                std::string key;
+                for(auto &item : stream_to_shard) {
+                    if(item.second != index_max) continue;
+                    key = item.first;
+                    break;
+                }
+                if(key.empty()) break;
+                move_stream(key, index_max, index_min);
+            }
+        }
+
+        /** \brief Запустить все соединения
+         */
+        void start() {
+            std::lock_guard<std::recursive_mutex> lock(shards_mutex);
+            is_start = true;
+            for(auto &shard : shards) {
+                shard->start();
+            }
+        }
+
+        /** \brief Подождать соединения
+         * \return вернет true, если все соединения установлены
+         */
+        bool wait() {
+            std::vector<shard_ptr> temp;
+            {
+                std::lock_guard<std::recursive_mutex> lock(shards_mutex);
+                temp = shards;
+            }
+            bool is_ok = true;
+            for(auto &shard : temp) {
+                if(!shard->wait()) is_ok = false;
+            }
+            return is_ok;
+        }
+
+        /** \brief Состояние соединений
+         * \return вернет true, если все соединения есть
+         */
+        bool connected() {
+            std::lock_guard<std::recursive_mutex> lock(shards_mutex);
+            if(shards.empty()) return false;
+            for(auto &shard : shards) {
+                if(!shard->connected()) return false;
+            }
+            return true;
+        }
+
+        /** \brief Получить количество соединений
+         * \return Количество соединений
+         */
+        size_t get_num_connections() {
+            std::lock_guard<std::recursive_mutex> lock(shards_mutex);
+            return shards.size();
+        }
+
+        /** \brief Получить количество потоков на соединении
+         * \param index Индекс соединения
+         * \return Количество потоков
+         */
+        uint32_t get_num_streams(const size_t index) {
+            std::lock_guard<std::recursive_mutex> lock(shards_mutex);
+            if(index >= shard_streams.size()) return 0;
+            return shard_streams[index];
+        }
+
+        /** \brief Получить метку времени сервера
+         * \return Метка времени сервера
+         */
+        xtime::ftimestamp_t get_server_timestamp() {
+            std::lock_guard<std::recursive_mutex> lock(shards_mutex);
+            for(auto &shard : shards) {
+                if(shard->connected()) return shard->get_server_timestamp();
+            }
+            return xtime::get_ftimestamp();
+        }
+
+        /** \brief Получить цену тика символа
+         * \param symbol Имя символа
+         * \param period Период
+         * \return Последняя цена bid
+         */
+        double get_price(const std::string &symbol, const uint32_t period) {
+            shard_ptr shard = get_shard(symbol, period);
+            if(!shard) return 0.0;
+            return shard->get_price(symbol, period);
+        }
+
+        /** \brief Получить цену тика символа
+         * \param symbol Имя символа
+         * \return Последняя цена bid
+         */
+        double get_price(const std::string &symbol) {
+            shard_ptr shard = get_shard(symbol);
+            if(!shard) return 0.0;
+            return shard->get_price(symbol);
+        }
+
+        /** \brief Получить бар
+         * \param symbol Имя символа
+         * \param period Период
+         * \param offset Смещение
+         * \return Бар
+         */
+        xquotes_common::Candle get_candle(
+                const std::string &symbol,
+                const uint32_t period,
+                const size_t offset = 0) {
+            shard_ptr shard = get_shard(symbol, period);
+            if(!shard) return xquotes_common::Candle();
+            return shard->get_candle(symbol, period, offset);
+        }
+
+        /** \brief Получить бар по метке времени
+         * \param symbol Имя символа
+         * \param period Период
+         * \param timestamp Метка времени
+         * \return Бар
+         */
+        xquotes_common::Candle get_timestamp_candle(
+                const std::string &symbol,
+                const uint32_t period,
+                const xtime::timestamp_t timestamp) {
+            shard_ptr shard = get_shard(symbol, period);
+            if(!shard) return xquotes_common::Candle();
+            return shard->get_timestamp_candle(symbol, period, timestamp);
+        }
+
+        /** \brief Инициализировать массив японских свечей
+         * \param symbol Имя символа
+         * \param period Период
+         * \param new_candles Массив баров
+         * \return Код ошибки, вернет 0 если все в порядке
+         */
+        template<class T>
+        int init_array_candles(
+                const std::string &symbol,
+                const uint32_t period,
+                const T &new_candles) {
+            shard_ptr shard = get_shard(symbol, period);
+            if(!shard) return DATA_NOT_AVAILABLE;
+            return shard->init_array_candles(symbol, period, new_candles);
+        }
+    };
+}
+
+#endif // BINANCE_CPP_API_WEBSOCKET_SHARDED_HPP_INCLUDED
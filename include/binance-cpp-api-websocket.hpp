@@ -25,6 +25,13 @@
 #define BINANCE_CPP_API_WEBSOCKET_HPP_INCLUDED
 
 #include <binance-cpp-api-common.hpp>
+#include "tools/binance-cpp-api-event-dispatcher.hpp"
+#include "tools/binance-cpp-api-conflating-dispatcher.hpp"
+#include "tools/binance-cpp-api-event-loop.hpp"
+#include "tools/binance-cpp-api-websocket-connection.hpp"
+#include "tools/binance-cpp-api-subscription-manager.hpp"
+#include "tools/binance-cpp-api-timer-wheel.hpp"
+#include "tools/binance-cpp-api-server-clock.hpp"
 #include "client_wss.hpp"
 #include <openssl/ssl.h>
 #include <wincrypt.h>
@@ -35,6 +42,9 @@
 #include <atomic>
 #include <future>
 #include <cstdlib>
+#include <unordered_map>
+#include <deque>
+#include <set>
 //#include "utf8.h" // http://utfcpp.sourceforge.net/
 
 /*
@@ -45,20 +55,40 @@
 namespace binance_api {
     using namespace common;
 
+    /** \brief Событие обновления бара
+     */
+    class CandleEvent {
+    public:
+        std::string symbol;             /**< Символ */
+        xquotes_common::Candle candle;  /**< Бар */
+        uint32_t period = 0;            /**< Период */
+        bool close_candle = false;      /**< Флаг закрытия бара */
+        uint64_t event_time = 0;        /**< Время события на сервере в мс (0 для баров, загруженных через REST API) */
+        CandleEvent() {};
+        CandleEvent(
+            const std::string &_symbol,
+            const xquotes_common::Candle &_candle,
+            const uint32_t _period,
+            const bool _close_candle,
+            const uint64_t _event_time = 0) :
+            symbol(_symbol),
+            candle(_candle),
+            period(_period),
+            close_candle(_close_candle),
+            event_time(_event_time) {
+        };
+    };
+
     /** \brief Класс потока котировок для торговли Фьючерсами
      */
     class CandlestickStreams {
     private:
-        using WssClient = SimpleWeb::SocketClient<SimpleWeb::WSS>;
         using json = nlohmann::json;
         std::string point = "stream.binancefuture.com/stream";
         //std::string point = "fstream.binance.com/stream";
         std::string sert_file = "curl-ca-bundle.crt";
 
-        std::shared_ptr<WssClient::Connection> save_connection;
-        std::shared_ptr<WssClient> client;      /**< Webclosket Клиент */
-        std::future<void> client_future;		/**< Поток соединения */
-        std::mutex save_connection_mutex;
+        WebSocketConnection connection;         /**< Соединение */
 
         const std::map<std::string, uint32_t> str_interval_to_index = {
             {"1m",1},{"3m",3},{"5m",5},{"15m",15},{"30m",30},
@@ -74,6 +104,7 @@ namespace binance_api {
 
         std::map<std::string, std::map<uint32_t, bool>> list_subscriptions;
         std::mutex list_subscriptions_mutex;
+        std::shared_ptr<SubscriptionManager> subscription_manager;    /**< Менеджер подписок */
 
         using candle_data = std::map<xtime::timestamp_t, xquotes_common::Candle>;
         using period_data = std::map<uint32_t, candle_data>;
@@ -98,6 +129,619 @@ namespace binance_api {
         std::atomic<bool> is_autoupdate_logger_offset_timestamp;
 
         std::atomic<double> last_server_timestamp;
+        xtime::ftimestamp_t last_event_timestamp = 0;   /**< Последняя метка времени события для оценки смещения */
+        std::shared_ptr<ServerClock> server_clock;      /**< Синхронизация времени с сервером */
+
+    public:
+        /// Функция загрузки баров через REST API для заполнения пропусков
+        using backfill_function = std::function<int(
+            std::vector<xquotes_common::Candle> &candles,
+            const std::string &symbol,
+            const uint32_t period,
+            const xtime::timestamp_t start_date,
+            const xtime::timestamp_t stop_date)>;
+
+        /// Проверка остатка веса запросов: вернет true, если загрузку можно выполнить сейчас
+        using budget_function = std::function<bool()>;
+
+    private:
+        /// Состояние потока для поиска пропусков
+        class StreamState {
+        public:
+            xtime::timestamp_t last_timestamp = 0;  /**< Метка времени открытия последнего бара */
+            bool is_last_closed = false;            /**< Флаг доставки закрытия последнего бара */
+            bool is_backfill = false;               /**< Флаг загрузки пропуска */
+            std::vector<CandleEvent> buffer;        /**< Бары, пришедшие во время загрузки пропуска */
+            StreamState() {};
+        };
+
+        /// Пропуск потока, ожидающий загрузки
+        class BackfillTask {
+        public:
+            std::string symbol;
+            uint32_t period = 0;
+            xtime::timestamp_t start_date = 0;
+            xtime::timestamp_t stop_date = 0;
+            uint32_t attempt = 0;                               /**< Количество неудачных загрузок */
+            std::chrono::steady_clock::time_point retry_time;   /**< Время следующей загрузки */
+            BackfillTask() {};
+        };
+
+        backfill_function backfill_provider = nullptr;
+        budget_function backfill_budget = nullptr;      /**< Проверка остатка веса запросов */
+        uint32_t backfill_threads = 2;                  /**< Количество потоков загрузки пропусков */
+        std::map<std::string, std::map<uint32_t, StreamState>> stream_states;
+        std::mutex stream_states_mutex;
+        std::deque<BackfillTask> backfill_tasks;        /**< Очередь пропусков */
+        std::mutex backfill_mutex;
+        std::condition_variable backfill_cv;
+        std::vector<std::future<void>> backfill_workers;    /**< Потоки загрузки пропусков */
+        const uint32_t backfill_attempts = 10;          /**< Количество загрузок пропуска до отказа от него */
+        const uint64_t backfill_retry_delay = 1000;     /**< Первая задержка повтора загрузки, мс */
+        const uint64_t backfill_max_delay = 60000;      /**< Максимальная задержка повтора загрузки, мс */
+        const uint64_t backfill_budget_delay = 100;     /**< Период проверки остатка веса запросов, мс */
+
+        std::shared_ptr<EventDispatcher<CandleEvent>> candle_dispatcher;  /**< Асинхронная доставка баров */
+
+        using conflated_consumer_ptr = std::shared_ptr<ConflatingDispatcher<CandleEvent>>;
+        std::map<uint32_t, conflated_consumer_ptr> conflated_consumers;    /**< Потребители последних значений баров */
+        std::mutex conflated_consumers_mutex;
+        std::atomic<bool> is_conflated_consumers = ATOMIC_VAR_INIT(false);
+        uint32_t conflated_consumer_id = 0;
+
+        std::function<bool(const CandleEvent &event)> candle_filter = nullptr;  /**< Фильтр баров перед доставкой */
+
+        /// Состояние бара старшего периода, собираемого из баров базового периода
+        class DerivedState {
+        public:
+            xquotes_common::Candle closed_part;         /**< Объединение закрытых базовых баров */
+            xquotes_common::Candle current;             /**< Последнее значение бара */
+            xtime::timestamp_t open_timestamp = 0;      /**< Метка времени открытия бара */
+            xtime::timestamp_t last_closed_timestamp = 0;   /**< Метка времени последнего закрытого базового бара */
+            bool is_empty = true;                       /**< В баре еще нет закрытых базовых баров */
+            bool is_closed = false;                     /**< Закрытие бара уже передано */
+            DerivedState() {};
+        };
+
+        std::map<std::string, std::map<uint32_t, std::map<uint32_t, DerivedState>>> derived_states; /**< Символ, базовый период, старший период */
+        std::mutex derived_states_mutex;
+        std::atomic<bool> is_derived_streams = ATOMIC_VAR_INIT(false);
+
+        /** \brief Объединить бар с частью бара старшего периода
+         * \param part Часть бара
+         * \param candle Бар
+         */
+        inline static void merge_candle(xquotes_common::Candle &part, const xquotes_common::Candle &candle) {
+            part.high = std::max(part.high, candle.high);
+            part.low = std::min(part.low, candle.low);
+            part.close = candle.close;
+            part.volume += candle.volume;
+        }
+
+        /** \brief Заполнить начало бара старшего периода из хранилища баров
+         *
+         * Нужно, когда поток подключился в середине бара старшего периода
+         * \param symbol Имя символа
+         * \param base_period Базовый период
+         * \param stop_date Метка времени текущего базового бара (не включается)
+         * \param state Состояние бара старшего периода
+         */
+        void seed_derived_state(
+                const std::string &symbol,
+                const uint32_t base_period,
+                const xtime::timestamp_t stop_date,
+                DerivedState &state) {
+            std::lock_guard<std::recursive_mutex> lock(candles_mutex);
+            auto it_symbol = candles.find(symbol);
+            if(it_symbol == candles.end()) return;
+            auto it_period = it_symbol->second.find(base_period);
+            if(it_period == it_symbol->second.end()) return;
+            auto it = it_period->second.lower_bound(state.open_timestamp);
+            for(; it != it_period->second.end() && it->first < stop_date; ++it) {
+                if(state.is_empty) {
+                    state.closed_part = it->second;
+                    state.closed_part.timestamp = state.open_timestamp;
+                    state.is_empty = false;
+                } else {
+                    merge_candle(state.closed_part, it->second);
+                }
+                state.last_closed_timestamp = it->first;
+            }
+        }
+
+        /** \brief Обновить бары старших периодов по бару базового периода
+         *
+         * Каждый базовый бар обновляет бар старшего периода за O(1):
+         * закрытые базовые бары накапливаются, а текущий базовый бар объединяется с накопленной частью
+         * \param symbol Имя символа
+         * \param candle Бар базового периода
+         * \param base_period Базовый период
+         * \param close_candle Флаг закрытия бара
+         * \param event_time Время события на сервере
+         */
+        void update_derived_candles(
+                const std::string &symbol,
+                const xquotes_common::Candle &candle,
+                const uint32_t base_period,
+                const bool close_candle,
+                const uint64_t event_time) {
+            std::vector<CandleEvent> events;
+            {
+                std::lock_guard<std::mutex> lock(derived_states_mutex);
+                auto it_symbol = derived_states.find(symbol);
+                if(it_symbol == derived_states.end()) return;
+                auto it_base = it_symbol->second.find(base_period);
+                if(it_base == it_symbol->second.end()) return;
+                const xtime::timestamp_t base_step = base_period * xtime::SECONDS_IN_MINUTE;
+                for(auto &item : it_base->second) {
+                    const uint32_t period = item.first;
+                    DerivedState &state = item.second;
+                    const xtime::timestamp_t step = period * xtime::SECONDS_IN_MINUTE;
+                    const xtime::timestamp_t open_timestamp = candle.timestamp - candle.timestamp % step;
+                    if(open_timestamp < state.open_timestamp) continue;
+                    if(open_timestamp > state.open_timestamp) {
+                        /* закрываем предыдущий бар, если его последний базовый бар не пришел */
+                        if(state.open_timestamp != 0 && !state.is_closed) {
+                            events.push_back(CandleEvent(symbol, state.current, period, true, event_time));
+                        }
+                        state = DerivedState();
+                        state.open_timestamp = open_timestamp;
+                        seed_derived_state(symbol, base_period, candle.timestamp, state);
+                    }
+                    /* повтор уже учтенного базового бара */
+                    if(state.is_closed || (!state.is_empty && candle.timestamp <= state.last_closed_timestamp)) continue;
+
+                    xquotes_common::Candle derived = state.closed_part;
+                    if(state.is_empty) derived = candle;
+                    else merge_candle(derived, candle);
+                    derived.timestamp = open_timestamp;
+                    state.current = derived;
+                    if(close_candle) {
+                        state.closed_part = derived;
+                        state.is_empty = false;
+                        state.last_closed_timestamp = candle.timestamp;
+                    }
+                    const bool derived_close = close_candle && (candle.timestamp + base_step) >= (open_timestamp + step);
+                    if(derived_close) state.is_closed = true;
+                    {
+                        std::lock_guard<std::recursive_mutex> lock_candles(candles_mutex);
+                        candles[symbol][period][open_timestamp] = derived;
+                    }
+                    events.push_back(CandleEvent(symbol, derived, period, derived_close, event_time));
+                }
+            }
+            for(size_t i = 0; i < events.size(); ++i) {
+                emit_candle(events[i].symbol, events[i].candle, events[i].period, events[i].close_candle, events[i].event_time);
+            }
+        }
+
+        /* сторожевой таймер потоков, сторожевой таймер соединения см. WebSocketConnection */
+        std::atomic<uint64_t> stream_timeout = ATOMIC_VAR_INIT(0);      /**< Допустимое время без сообщений потока, мс */
+        std::atomic<bool> is_reconnect_stale_stream = ATOMIC_VAR_INIT(false);
+        std::atomic<uint64_t> stale_reconnect_counter = ATOMIC_VAR_INIT(0);    /**< Переподключения из-за устаревших потоков */
+        std::map<std::string, std::map<uint32_t, uint64_t>> stream_activity;   /**< Время последнего сообщения потоков, мс */
+        std::map<std::string, std::map<uint32_t, bool>> stale_streams;
+        std::mutex stream_activity_mutex;
+
+        inline void update_stream_activity(const std::string &symbol, const uint32_t period) {
+            if(stream_timeout == 0) return;
+            std::lock_guard<std::mutex> lock(stream_activity_mutex);
+            stream_activity[symbol][period] = connection.get_last_message_time();
+        }
+
+        /** \brief Сбросить состояние соединения
+         */
+        void reset_connection_state() {
+            is_websocket_init = false;
+            is_open = false;
+            if(subscription_manager) subscription_manager->on_close();
+        }
+
+        /** \brief Проверить потоки
+         *
+         * Метод вызывается в потоке соединения. Соединение целиком проверяет WebSocketConnection
+         */
+        void check_watchdog() {
+            if(!is_open) return;
+            const uint64_t now = WebSocketConnection::get_steady_ms();
+
+            /* проверяем потоки */
+            if(stream_timeout == 0) return;
+            std::vector<std::pair<std::string, uint32_t>> new_stale;
+            {
+                std::lock_guard<std::mutex> lock(stream_activity_mutex);
+                std::lock_guard<std::mutex> lock_subscriptions(list_subscriptions_mutex);
+                for(auto &item_symbol : list_subscriptions) {
+                    const std::string symbol = to_upper_case(item_symbol.first);
+                    for(auto &item_period : item_symbol.second) {
+                        uint64_t last_time = stream_activity[symbol][item_period.first];
+                        /* поток без сообщений отсчитывается от открытия соединения */
+                        if(last_time == 0) last_time = stream_activity[symbol][item_period.first] = now;
+                        bool &is_stale = stale_streams[symbol][item_period.first];
+                        if((now - last_time) > stream_timeout) {
+                            if(!is_stale) new_stale.push_back(std::make_pair(symbol, item_period.first));
+                            is_stale = true;
+                        } else {
+                            is_stale = false;
+                        }
+                    }
+                }
+            }
+            if(new_stale.empty()) return;
+            for(size_t i = 0; i < new_stale.size(); ++i) {
+                std::cerr << point << " watchdog: stale stream " << new_stale[i].first << " " << new_stale[i].second << std::endl;
+                if(on_stale != nullptr) on_stale(new_stale[i].first, new_stale[i].second);
+            }
+            if(!is_reconnect_stale_stream) return;
+            ++stale_reconnect_counter;
+            /* on_close будет вызван соединением один раз */
+            connection.force_reconnect();
+        }
+
+        /// Состояние закрытия бара потока
+        class CloseState {
+        public:
+            xtime::timestamp_t last_confirmed = 0;  /**< Метка времени открытия последнего бара, закрытие которого подтвердила биржа */
+            xtime::timestamp_t last_synthetic = 0;  /**< Метка времени открытия последнего бара, закрытого по таймеру */
+            CloseState() {};
+        };
+
+        std::shared_ptr<TimerWheel> close_timer_wheel;                  /**< Таймеры закрытия баров */
+        std::shared_ptr<TimerLifetime> close_timer_lifetime = std::make_shared<TimerLifetime>();
+        std::map<uint32_t, TimerWheel::timer_id> close_timers;          /**< Таймеры закрытия по периодам */
+        std::map<std::string, std::map<uint32_t, CloseState>> close_states;
+        std::mutex close_states_mutex;
+        std::atomic<bool> is_close_scheduler = ATOMIC_VAR_INIT(false);
+        std::atomic<uint64_t> close_delay = ATOMIC_VAR_INIT(0);         /**< Задержка закрытия по таймеру после границы периода, мс */
+        std::mutex close_wait_mutex;
+        std::condition_variable close_wait_cv;                          /**< Уведомление о закрытии минутного бара */
+
+        /** \brief Получить метку времени следующей границы периода
+         * \param period Период
+         * \param timestamp Метка времени сервера
+         * \return Метка времени открытия следующего бара
+         */
+        inline static xtime::timestamp_t get_next_close_timestamp(
+                const uint32_t period,
+                const xtime::timestamp_t timestamp) {
+            /* недельные бары открываются в понедельник, а 1 января 1970 года - четверг */
+            const xtime::timestamp_t WEEK_OFFSET = 4 * xtime::SECONDS_IN_DAY;
+            const xtime::timestamp_t step = period * xtime::SECONDS_IN_MINUTE;
+            const xtime::timestamp_t offset = period == 10080 ? WEEK_OFFSET : 0;
+            if(timestamp < offset) return offset;
+            return ((timestamp - offset) / step + 1) * step + offset;
+        }
+
+        /** \brief Передать закрытие бара
+         *
+         * Каждый бар закрывается по таймеру не более одного раза и только до подтверждения биржи,
+         * подтверждение биржи передается всегда, даже если бар уже был закрыт по таймеру
+         */
+        void notify_candle_close(
+                const std::string &symbol,
+                const xquotes_common::Candle &candle,
+                const uint32_t period,
+                const bool is_confirmed) {
+            if(on_candle_close == nullptr) return;
+            {
+                std::lock_guard<std::mutex> lock(close_states_mutex);
+                CloseState &state = close_states[symbol][period];
+                if(candle.timestamp <= state.last_confirmed) return;
+                if(is_confirmed) {
+                    state.last_confirmed = candle.timestamp;
+                } else {
+                    if(candle.timestamp <= state.last_synthetic) return;
+                    state.last_synthetic = candle.timestamp;
+                }
+            }
+            on_candle_close(symbol, candle, period, is_confirmed);
+        }
+
+        /** \brief Запланировать закрытие баров периода
+         *
+         * Таймер ставится на момент времени сервера, колесо таймеров переводит его в монотонное время
+         * \param period Период
+         * \param last_close Метка времени последнего закрытия периода
+         */
+        void schedule_close_timer(const uint32_t period, const xtime::timestamp_t last_close = 0) {
+            std::lock_guard<std::mutex> lock(close_states_mutex);
+            if(!is_close_scheduler || !close_timer_wheel) return;
+            const xtime::ftimestamp_t server_timestamp = get_server_timestamp();
+            const xtime::timestamp_t t = std::max((xtime::timestamp_t)server_timestamp, last_close);
+            const xtime::timestamp_t close_timestamp = get_next_close_timestamp(period, t);
+            close_timers[period] = close_timer_wheel->schedule_at_server_time(
+                    (xtime::ftimestamp_t)close_timestamp + (xtime::ftimestamp_t)close_delay / 1000.0,
+                    TimerLifetime::wrap(close_timer_lifetime, [&, period, close_timestamp]() {
+                on_close_timer(period, close_timestamp);
+            }));
+        }
+
+        /** \brief Закрыть бары периода по таймеру
+         * \param period Период
+         * \param close_timestamp Метка времени границы периода
+         */
+        void on_close_timer(const uint32_t period, const xtime::timestamp_t close_timestamp) {
+            if(is_close_connection) return;
+            const xtime::timestamp_t open_timestamp = close_timestamp - period * xtime::SECONDS_IN_MINUTE;
+            /* собираем потоки периода: подписки и старшие периоды, собираемые локально */
+            std::set<std::string> symbols;
+            {
+                std::lock_guard<std::mutex> lock(list_subscriptions_mutex);
+                for(auto &item_symbol : list_subscriptions) {
+                    if(item_symbol.second.find(period) != item_symbol.second.end()) {
+                        symbols.insert(to_upper_case(item_symbol.first));
+                    }
+                }
+            }
+            {
+                std::lock_guard<std::mutex> lock(derived_states_mutex);
+                for(auto &item_symbol : derived_states) {
+                    for(auto &item_base : item_symbol.second) {
+                        if(item_base.second.find(period) != item_base.second.end()) {
+                            symbols.insert(item_symbol.first);
+                        }
+                    }
+                }
+            }
+            for(auto &symbol : symbols) {
+                xquotes_common::Candle candle;
+                {
+                    std::lock_guard<std::recursive_mutex> lock(candles_mutex);
+                    auto it_symbol = candles.find(symbol);
+                    if(it_symbol == candles.end()) continue;
+                    auto it_period = it_symbol->second.find(period);
+                    if(it_period == it_symbol->second.end()) continue;
+                    auto it_candle = it_period->second.find(open_timestamp);
+                    /* в баре не было сделок или данные бара не получены */
+                    if(it_candle == it_period->second.end()) continue;
+                    candle = it_candle->second;
+                }
+                notify_candle_close(symbol, candle, period, false);
+            }
+            if(period == 1) {
+                std::lock_guard<std::mutex> lock(close_wait_mutex);
+                close_wait_cv.notify_all();
+            }
+            schedule_close_timer(period, close_timestamp);
+        }
+
+        /** \brief Запланировать закрытие периода, если для него еще нет таймера
+         * \param period Период
+         */
+        void add_close_timer(const uint32_t period) {
+            /* длительность месячных баров непостоянна */
+            if(!is_close_scheduler || period == 43200) return;
+            {
+                std::lock_guard<std::mutex> lock(close_states_mutex);
+                if(close_timers.find(period) != close_timers.end()) return;
+            }
+            schedule_close_timer(period);
+        }
+
+        /** \brief Передать бар потребителю
+         *
+         * Если включена асинхронная доставка, бар попадает в очередь,
+         * иначе callback-функция вызывается в потоке вебсокета
+         */
+        inline void emit_candle(
+                const std::string &symbol,
+                const xquotes_common::Candle &candle,
+                const uint32_t period,
+                const bool close_candle,
+                const uint64_t event_time = 0) {
+            if(is_derived_streams) update_derived_candles(symbol, candle, period, close_candle, event_time);
+            const CandleEvent event(symbol, candle, period, close_candle, event_time);
+            if(candle_filter != nullptr && !candle_filter(event)) return;
+            if(close_candle) notify_candle_close(symbol, candle, period, true);
+            if(is_conflated_consumers) {
+                std::lock_guard<std::mutex> lock(conflated_consumers_mutex);
+                for(auto &item : conflated_consumers) {
+                    item.second->push(event);
+                }
+            }
+            if(candle_dispatcher) {
+                candle_dispatcher->push(event);
+                return;
+            }
+            if(on_candle != nullptr) on_candle(symbol, candle, period, close_candle);
+        }
+
+        /** \brief Проверить бар на пропуск и передать потребителю
+         *
+         * Если между последним баром потока и новым баром есть пропуск
+         * (например, после переподключения), пропущенные бары загружаются через REST API.
+         * Пока идет загрузка, новые бары потока накапливаются, а после загрузки
+         * потребитель получает закрытия пропущенных баров и накопленные бары по порядку.
+         * Месячные бары не проверяются, так как их длительность непостоянна
+         */
+        void process_candle(
+                const std::string &symbol,
+                const xquotes_common::Candle &candle,
+                const uint32_t period,
+                const bool close_candle,
+                const uint64_t event_time) {
+            if(backfill_provider == nullptr || period == 43200) {
+                emit_candle(symbol, candle, period, close_candle, event_time);
+                return;
+            }
+            const xtime::timestamp_t step = period * xtime::SECONDS_IN_MINUTE;
+            {
+                std::lock_guard<std::mutex> lock(stream_states_mutex);
+                StreamState &state = stream_states[symbol][period];
+                if(state.is_backfill) {
+                    state.buffer.push_back(CandleEvent(symbol, candle, period, close_candle, event_time));
+                    return;
+                }
+                if(candle.timestamp >= state.last_timestamp) {
+                    const xtime::timestamp_t start_date = state.is_last_closed ?
+                        (state.last_timestamp + step) : state.last_timestamp;
+                    const xtime::timestamp_t stop_date = candle.timestamp - step;
+                    const bool is_gap = state.last_timestamp != 0 &&
+                        candle.timestamp > state.last_timestamp &&
+                        start_date <= stop_date;
+                    state.last_timestamp = candle.timestamp;
+                    state.is_last_closed = close_candle;
+                    if(is_gap) {
+                        state.is_backfill = true;
+                        state.buffer.push_back(CandleEvent(symbol, candle, period, close_candle, event_time));
+                        start_backfill(symbol, period, start_date, stop_date);
+                        return;
+                    }
+                }
+            }
+            emit_candle(symbol, candle, period, close_candle, event_time);
+        }
+
+        /** \brief Запустить загрузку пропуска
+         *
+         * Пропуски загружаются небольшим пулом собственных потоков. Загрузка начинается,
+         * только когда функция проверки веса запросов разрешает запрос
+         * \param symbol Имя символа
+         * \param period Период
+         * \param start_date Метка времени открытия первого пропущенного бара
+         * \param stop_date Метка времени открытия последнего пропущенного бара
+         */
+        void start_backfill(
+                const std::string &symbol,
+                const uint32_t period,
+                const xtime::timestamp_t start_date,
+                const xtime::timestamp_t stop_date) {
+            BackfillTask task;
+            task.symbol = symbol;
+            task.period = period;
+            task.start_date = start_date;
+            task.stop_date = stop_date;
+            task.retry_time = std::chrono::steady_clock::now();
+            std::lock_guard<std::mutex> lock(backfill_mutex);
+            backfill_tasks.push_back(task);
+            backfill_cv.notify_one();
+            /* потоки добавляются по мере появления пропусков */
+            if(backfill_workers.size() >= backfill_threads ||
+                backfill_workers.size() >= backfill_tasks.size()) return;
+            backfill_workers.push_back(std::async(std::launch::async,[&]() {
+                backfill_loop();
+            }));
+        }
+
+        /** \brief Цикл потока загрузки пропусков
+         *
+         * Поток берет пропуск, время повтора которого наступило, и ждет остатка веса запросов
+         */
+        void backfill_loop() {
+            while(true) {
+                BackfillTask task;
+                {
+                    std::unique_lock<std::mutex> lock(backfill_mutex);
+                    while(true) {
+                        if(is_close_connection) return;
+                        auto it_next = backfill_tasks.end();
+                        for(auto it = backfill_tasks.begin(); it != backfill_tasks.end(); ++it) {
+                            if(it_next == backfill_tasks.end() || it->retry_time < it_next->retry_time) it_next = it;
+                        }
+                        if(it_next == backfill_tasks.end()) {
+                            backfill_cv.wait(lock);
+                            continue;
+                        }
+                        if(it_next->retry_time > std::chrono::steady_clock::now()) {
+                            backfill_cv.wait_until(lock, it_next->retry_time);
+                            continue;
+                        }
+                        if(backfill_budget != nullptr && !backfill_budget()) {
+                            backfill_cv.wait_for(lock, std::chrono::milliseconds(backfill_budget_delay));
+                            continue;
+                        }
+                        task = *it_next;
+                        backfill_tasks.erase(it_next);
+                        break;
+                    }
+                }
+                run_backfill(task);
+            }
+        }
+
+        /** \brief Загрузить пропуск
+         *
+         * Неудачная загрузка повторяется с растущей задержкой. Если все попытки неудачны,
+         * от пропуска отказываются, но накопленные бары все равно передаются, чтобы поток не остановился.
+         * Бары пропуска и бары, накопленные во время загрузки, передаются в потоке соединения,
+         * поэтому потребитель получает их по порядку и не одновременно с новыми барами
+         * \param task Пропуск потока
+         */
+        void run_backfill(const BackfillTask &task) {
+            std::vector<xquotes_common::Candle> array_candles;
+            if(!is_close_connection) {
+                int err = OK;
+                try {
+                    err = backfill_provider(array_candles, task.symbol, task.period, task.start_date, task.stop_date);
+                }
+                catch(...) {
+                    err = DATA_NOT_AVAILABLE;
+                }
+                if(err != OK) {
+                    BackfillTask next = task;
+                    ++next.attempt;
+                    std::cerr << "binance_api::CandlestickStreams backfill error, symbol: " << task.symbol
+                        << " period: " << task.period << " attempt: " << next.attempt << " code: " << err << std::endl;
+                    if(next.attempt < backfill_attempts) {
+                        uint64_t delay = backfill_retry_delay;
+                        for(uint32_t i = 1; i < next.attempt && delay < backfill_max_delay; ++i) {
+                            delay *= 2;
+                        }
+                        next.retry_time = std::chrono::steady_clock::now() +
+                            std::chrono::milliseconds(std::min(delay, backfill_max_delay));
+                        std::lock_guard<std::mutex> lock(backfill_mutex);
+                        backfill_tasks.push_back(next);
+                        backfill_cv.notify_one();
+                        return;
+                    }
+                    std::cerr << "binance_api::CandlestickStreams backfill abandoned, symbol: " << task.symbol
+                        << " period: " << task.period << std::endl;
+                    array_candles.clear();
+                }
+            }
+
+            /* оставляем только бары пропуска и упорядочиваем их */
+            std::map<xtime::timestamp_t, xquotes_common::Candle> gap_candles;
+            for(size_t i = 0; i < array_candles.size(); ++i) {
+                const xtime::timestamp_t t = array_candles[i].timestamp;
+                if(t < task.start_date || t > task.stop_date) continue;
+                gap_candles[t] = array_candles[i];
+            }
+            connection.post([&, task, gap_candles]() {
+                deliver_backfill(task, gap_candles);
+            });
+        }
+
+        /** \brief Передать бары пропуска и бары, накопленные во время загрузки
+         *
+         * Метод вызывается в потоке соединения
+         * \param task Пропуск потока
+         * \param gap_candles Загруженные бары пропуска
+         */
+        void deliver_backfill(
+                const BackfillTask &task,
+                const std::map<xtime::timestamp_t, xquotes_common::Candle> &gap_candles) {
+            {
+                std::lock_guard<std::recursive_mutex> lock(candles_mutex);
+                for(auto &item : gap_candles) {
+                    candles[task.symbol][task.period][item.first] = item.second;
+                }
+            }
+            for(auto &item : gap_candles) {
+                emit_candle(task.symbol, item.second, task.period, true);
+            }
+
+            std::vector<CandleEvent> buffer;
+            {
+                std::lock_guard<std::mutex> lock(stream_states_mutex);
+                StreamState &state = stream_states[task.symbol][task.period];
+                buffer.swap(state.buffer);
+                state.is_backfill = false;
+            }
+            for(size_t i = 0; i < buffer.size(); ++i) {
+                emit_candle(buffer[i].symbol, buffer[i].candle, buffer[i].period, buffer[i].close_candle, buffer[i].event_time);
+            }
+        }
 
         /** \brief Обновить смещение метки времени
          *
@@ -184,6 +828,12 @@ namespace binance_api {
             try {
                 json j = json::parse(response);
 
+                /* ответ на запрос подписки, например {"result":null,"id":1} */
+                if(j.find("stream") == j.end()) {
+                    subscription_manager->on_response(j);
+                    return;
+                }
+
                 /* парсим параметры потока */
                 const std::string stream = j["stream"];
                 std::string symbol, param;
@@ -204,17 +854,19 @@ namespace binance_api {
                     const double volume = std::atof(std::string((*j_kline)["v"]).c_str());
 
                     const xtime::timestamp_t open_timestamp = ((xtime::timestamp_t)(*j_kline)["t"]) / 1000;
-                    const xtime::ftimestamp_t timestamp = ((xtime::ftimestamp_t)(*j_data)["E"]) / 1000.0d;
+                    const uint64_t event_time = (*j_data)["E"];
+                    const xtime::ftimestamp_t timestamp = ((xtime::ftimestamp_t)event_time) / 1000.0d;
 
                     /* проверяем, не поменялась ли метка времени */
-                    static xtime::ftimestamp_t last_timestamp = 0;
-                    if(last_timestamp < timestamp) {
+                    if(last_event_timestamp < timestamp) {
 
                         /* если метка времени поменялась, найдем время сервера */
+                        std::shared_ptr<ServerClock> clock_ptr = std::atomic_load(&server_clock);
+                        if(clock_ptr) clock_ptr->add_passive_sample(event_time);
                         xtime::ftimestamp_t pc_timestamp = xtime::get_ftimestamp();
                         xtime::ftimestamp_t offset_timestamp = timestamp - pc_timestamp;
                         update_offset_timestamp(offset_timestamp);
-                        last_timestamp = timestamp;
+                        last_event_timestamp = timestamp;
 
                         /* запоминаем последнюю метку времени сервера */
                         last_server_timestamp = timestamp;
@@ -228,7 +880,8 @@ namespace binance_api {
                         std::lock_guard<std::recursive_mutex> lock(candles_mutex);
                         candles[s][it->second][open_timestamp] = candle;
                     }
-                    if(on_candle != nullptr) on_candle(s, candle, it->second, close_candle);
+                    update_stream_activity(s, it->second);
+                    process_candle(s, candle, it->second, close_candle, event_time);
                     is_websocket_init = true;
                 }
             }
@@ -242,10 +895,14 @@ namespace binance_api {
             }
         }
 
-        void send(const std::string &message) {
-            std::lock_guard<std::mutex> lock(save_connection_mutex);
-            if(!save_connection) return;
-            save_connection->send(message);
+        bool send(const std::string &message) {
+            return connection.send(message);
+        }
+
+        void init_subscription_manager() {
+            subscription_manager = std::make_shared<SubscriptionManager>([&](const std::string &message) -> bool {
+                return send(message);
+            });
         }
 
         std::string to_upper_case(const std::string &s){
@@ -264,12 +921,85 @@ namespace binance_api {
             return temp;
         }
 
+        /** \brief Убрать поток из списка подписок
+         * \param param Имя потока, например btcusdt@kline_1m
+         */
+        void erase_subscription(const std::string &param) {
+            const size_t pos = param.find("@kline_");
+            if(pos == std::string::npos) return;
+            auto it = str_interval_to_index.find(param.substr(pos + 7));
+            if(it == str_interval_to_index.end()) return;
+            std::lock_guard<std::mutex> lock(list_subscriptions_mutex);
+            auto it_symbol = list_subscriptions.find(param.substr(0, pos));
+            if(it_symbol == list_subscriptions.end()) return;
+            it_symbol->second.erase(it->second);
+        }
+
+        /** \brief Инициализировать callback-функции соединения
+         */
+        void init_connection() {
+            connection.set_point(point);
+            connection.set_sert_file(sert_file);
+
+            /* подписки отправляются в потоке соединения с учетом ограничения скорости */
+            connection.on_timer = [&]() {
+                subscription_manager->process();
+                check_watchdog();
+            };
+
+            connection.on_stale = [&]() {
+                if(on_stale != nullptr) on_stale(std::string(), 0);
+            };
+
+            subscription_manager->on_reject = [&](const std::string &param, const bool is_subscribe) {
+                if(is_subscribe) erase_subscription(param);
+                if(on_subscription_reject != nullptr) on_subscription_reject(param, is_subscribe);
+            };
+
+            /* читаем собщения, которые пришли */
+            connection.on_message = [&](const std::string &message) {
+                parser(message);
+            };
+
+            connection.on_open = [&]() {
+                {
+                    std::lock_guard<std::mutex> lock(stream_activity_mutex);
+                    stream_activity.clear();
+                }
+                /* подписки отправляет менеджер с учетом ограничения скорости сообщений */
+                subscription_manager->on_open();
+                is_open = true;
+                is_error = false;
+                if(on_open != nullptr) on_open();
+            };
+
+            connection.on_close = [&]() {
+                reset_connection_state();
+                is_error = true;
+                if(on_close != nullptr) on_close();
+            };
+        }
+
     public:
         std::function<void(
             const std::string &symbol,
             const xquotes_common::Candle &candle,
             const uint32_t period,
             const bool close_candle)> on_candle = nullptr;
+        std::function<void(
+            const std::string &param,
+            const bool is_subscribe)> on_subscription_reject = nullptr; /**< Сервер отклонил подписку или отписку потока */
+
+        std::function<void()> on_open = nullptr;    /**< Соединение установлено и подписки отправлены */
+        std::function<void()> on_close = nullptr;   /**< Соединение закрыто или произошла ошибка */
+        std::function<void(
+            const std::string &symbol,
+            const uint32_t period)> on_stale = nullptr;    /**< Поток устарел (пустой символ - все соединение) */
+        std::function<void(
+            const std::string &symbol,
+            const xquotes_common::Candle &candle,
+            const uint32_t period,
+            const bool is_confirmed)> on_candle_close = nullptr; /**< Бар закрыт по таймеру или подтвержден биржей */
 
         /** \brief Конструктор класс для получения потока котировок
          * \param user_point Конечная точка подключения
@@ -286,6 +1016,8 @@ namespace binance_api {
             is_close_connection = false;
             is_error = false;
             is_open = false;
+            init_subscription_manager();
+            init_connection();
         };
 
         /// Типы точек доступа для потока котировок
@@ -327,26 +1059,50 @@ namespace binance_api {
             is_close_connection = false;
             is_error = false;
             is_open = false;
+            init_subscription_manager();
+            init_connection();
         }
 
         ~CandlestickStreams() {
             is_close_connection = true;
-            std::shared_ptr<WssClient> client_ptr = std::atomic_load(&client);
-            if(client_ptr) {
-                client_ptr->stop();
+            /* после остановки соединения его callback-функции больше не вызываются */
+            connection.stop();
+            {
+                std::lock_guard<std::mutex> lock(close_wait_mutex);
+                close_wait_cv.notify_all();
             }
-
-            if(client_future.valid()) {
-                try {
-                    client_future.wait();
-                    client_future.get();
-                }
-                catch(const std::exception &e) {
-                    std::cerr << "binance_api::~CandlestickStreams() error, what: " << e.what() << std::endl;
+            /* таймеры закрытия обращаются к объекту, останавливаем их первыми */
+            close_timer_lifetime->expire();
+            {
+                std::lock_guard<std::mutex> lock(close_states_mutex);
+                is_close_scheduler = false;
+                if(close_timer_wheel) {
+                    for(auto &item : close_timers) {
+                        close_timer_wheel->cancel(item.second);
+                    }
                 }
-                catch(...) {
-                    std::cerr << "binance_api::~CandlestickStreams() error" << std::endl;
+                close_timers.clear();
+            }
+            close_timer_wheel.reset();
+            subscription_manager.reset();
+            /* дожидаемся загрузки пропусков */
+            {
+                std::lock_guard<std::mutex> lock(backfill_mutex);
+                backfill_cv.notify_all();
+            }
+            for(size_t i = 0; i < backfill_workers.size(); ++i) {
+                if(!backfill_workers[i].valid()) continue;
+                try {
+                    backfill_workers[i].wait();
+                    backfill_workers[i].get();
                 }
+                catch(...) {}
+            }
+            /* доставляем оставшиеся события до разрушения callback-функций */
+            candle_dispatcher.reset();
+            {
+                std::lock_guard<std::mutex> lock(conflated_consumers_mutex);
+                conflated_consumers.clear();
             }
         };
 
@@ -382,9 +1138,21 @@ namespace binance_api {
          * \return Метка времени сервера
          */
         inline xtime::ftimestamp_t get_server_timestamp() {
+            std::shared_ptr<ServerClock> clock_ptr = std::atomic_load(&server_clock);
+            if(clock_ptr && clock_ptr->check_estimated()) return clock_ptr->get_server_ftimestamp();
             return xtime::get_ftimestamp() + offset_timestamp;
         }
 
+        /** \brief Использовать синхронизацию времени с сервером
+         *
+         * Метки времени событий потока передаются в синхронизацию как пассивные измерения,
+         * а время сервера берется из синхронизации, как только у нее появится оценка смещения
+         * \param clock Синхронизация времени
+         */
+        inline void set_server_clock(std::shared_ptr<ServerClock> clock) {
+            std::atomic_store(&server_clock, clock);
+        }
+
         /** \brief Получить последнюю метку времени сервера
          *
          * Данный метод возвращает последнюю полученную метку времени сервера. Часовая зона: UTC/GMT
@@ -398,6 +1166,8 @@ namespace binance_api {
          * \return Смещение метки времени ПК
          */
         inline xtime::ftimestamp_t get_offset_timestamp() {
+            std::shared_ptr<ServerClock> clock_ptr = std::atomic_load(&server_clock);
+            if(clock_ptr && clock_ptr->check_estimated()) return clock_ptr->get_offset();
             return offset_timestamp;
         }
 
@@ -531,9 +1301,42 @@ namespace binance_api {
                 it_period = it_symbol->second.find(period);
             }
 
+            xtime::timestamp_t last_timestamp = 0;
             for(auto &candle : new_candles) {
                 it_period->second.insert(
                     std::pair<xtime::timestamp_t, xquotes_common::Candle>(candle.timestamp, candle));
+                if(candle.timestamp > last_timestamp) last_timestamp = candle.timestamp;
+            }
+
+            /* последний бар истории мог не закрыться, поэтому он будет проверен на пропуск */
+            std::lock_guard<std::mutex> state_lock(stream_states_mutex);
+            StreamState &state = stream_states[s][period];
+            if(last_timestamp > state.last_timestamp) {
+                state.last_timestamp = last_timestamp;
+                state.is_last_closed = false;
+            }
+            return OK;
+        }
+
+        /** \brief Получить массив японских свечей
+         * \param symbol Имя символа
+         * \param period Период
+         * \param array_candles Массив баров
+         * \return Код ошибки, вернет 0 если все в порядке
+         */
+        template<class T>
+        int get_array_candles(
+                const std::string &symbol,
+                const uint32_t period,
+                T &array_candles) {
+            std::string s = to_upper_case(symbol);
+            std::lock_guard<std::recursive_mutex> lock(candles_mutex);
+            auto it_symbol = candles.find(s);
+            if(it_symbol == candles.end()) return DATA_NOT_AVAILABLE;
+            auto it_period = it_symbol->second.find(period);
+            if(it_period == it_symbol->second.end()) return DATA_NOT_AVAILABLE;
+            for(auto &item : it_period->second) {
+                array_candles.push_back(item.second);
             }
             return OK;
         }
@@ -547,11 +1350,21 @@ namespace binance_api {
             const xtime::ftimestamp_t timestamp_stop =
                 xtime::get_first_timestamp_minute(get_server_timestamp()) +
                 xtime::SECONDS_IN_MINUTE;
+            /* ожидание прерывается закрытием минутного бара по таймеру или закрытием соединения,
+             * время ожидания пересчитывается, так как оценка смещения времени может измениться
+             */
+            std::unique_lock<std::mutex> lock(close_wait_mutex);
             while(!is_close_connection) {
                 const xtime::ftimestamp_t t = get_server_timestamp();
                 if(t >= timestamp_stop) break;
-                if(f != nullptr) f(t, timestamp_stop);
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                uint64_t delay = (uint64_t)((timestamp_stop - t) * 1000.0) + 1;
+                if(f != nullptr) {
+                    lock.unlock();
+                    f(t, timestamp_stop);
+                    lock.lock();
+                    delay = std::min(delay, (uint64_t)100);
+                }
+                close_wait_cv.wait_for(lock, std::chrono::milliseconds(delay));
             }
         }
 
@@ -579,29 +1392,339 @@ namespace binance_api {
             return std::string();
         }
 
-        /** \brief Добавить поток символа с заданным периодом
-         * \param symbol Имя символа
-         * \param period Период
+        /** \brief Настроить сторожевой таймер соединения
+         *
+         * Соединение, которое перестало доставлять данные, но не закрылось,
+         * переподключается без задержки. Метод следует вызывать до start()
+         * \param user_message_timeout Допустимое время без сообщений, мс (0 - не проверять)
+         * \param user_ping_interval Период отправки ping для измерения RTT, мс (0 - не отправлять)
+         * \param user_pong_timeout Допустимое время ожидания pong, мс
+         * \param user_stream_timeout Допустимое время без сообщений одного потока, мс (0 - не проверять)
+         * \param user_reconnect_stale_stream Переподключаться при устаревании одного потока
          */
-        void add_symbol_stream(
-                const std::string &symbol,
-                const uint32_t period) {
-            auto it = index_interval_to_str.find(period);
-            if(it == index_interval_to_str.end()) return;
-            std::string s = to_lower_case(symbol);
-            json j;
-            j["method"] = "SUBSCRIBE";
-            j["params"] = json::array();
-            std::string param = s + "@kline_" + it->second;
-            j["params"][0] = param;
-            j["id"] = 1;
-            {
-                std::lock_guard<std::mutex> lock(list_subscriptions_mutex);
-                /* имя символа ОБЯЗАТЕЛЬНО В НИЖНЕМ РЕГИСТРЕ! */
-                list_subscriptions[s][period] = true;
-            }
-            if(!is_open) return;
-            send(j.dump());
+        void set_watchdog(
+                const uint64_t user_message_timeout,
+                const uint64_t user_ping_interval = 5000,
+                const uint64_t user_pong_timeout = 5000,
+                const uint64_t user_stream_timeout = 0,
+                const bool user_reconnect_stale_stream = false) {
+            connection.set_watchdog(user_message_timeout, user_ping_interval, user_pong_timeout);
+            stream_timeout = user_stream_timeout;
+            is_reconnect_stale_stream = user_reconnect_stale_stream;
+        }
+
+        /** \brief Получить время прохождения ping-pong
+         * \return RTT последнего ping, мс (0, если еще не измерено)
+         */
+        inline double get_ping_rtt() {
+            return connection.get_ping_rtt();
+        }
+
+        /** \brief Получить время с последнего сообщения соединения
+         * \return Время, мс
+         */
+        inline uint64_t get_last_message_age() {
+            return connection.get_last_message_age();
+        }
+
+        /** \brief Получить время с последнего сообщения потока
+         *
+         * Время отслеживается, только если задано допустимое время без сообщений потока
+         * \param symbol Имя символа
+         * \param period Период
+         * \return Время, мс (0, если поток еще не получал сообщений)
+         */
+        uint64_t get_stream_age(const std::string &symbol, const uint32_t period) {
+            std::lock_guard<std::mutex> lock(stream_activity_mutex);
+            auto it_symbol = stream_activity.find(to_upper_case(symbol));
+            if(it_symbol == stream_activity.end()) return 0;
+            auto it_period = it_symbol->second.find(period);
+            if(it_period == it_symbol->second.end() || it_period->second == 0) return 0;
+            return WebSocketConnection::get_steady_ms() - it_period->second;
+        }
+
+        /** \brief Проверить, устарело ли соединение
+         * \return Вернет true, если сообщений нет дольше допустимого времени
+         */
+        inline bool check_stale() {
+            return connection.check_stale();
+        }
+
+        /** \brief Получить количество принудительных переподключений
+         * \return Количество переподключений
+         */
+        inline uint64_t get_num_stale_reconnects() {
+            return stale_reconnect_counter + connection.get_num_stale_reconnects();
+        }
+
+        /** \brief Установить общее колесо таймеров
+         *
+         * Колесо должно вести время сервера (см. TimerWheel::set_time_source).
+         * Метод вызывается до set_close_scheduler
+         * \param wheel Колесо таймеров
+         */
+        void set_timer_wheel(std::shared_ptr<TimerWheel> wheel) {
+            std::lock_guard<std::mutex> lock(close_states_mutex);
+            if(is_close_scheduler) return;
+            close_timer_wheel = wheel;
+        }
+
+        /** \brief Включить закрытие баров по таймеру
+         *
+         * На границе периода каждого потока по оценке времени сервера вызывается on_candle_close
+         * с последним значением бара и is_confirmed = false, не дожидаясь сообщения биржи.
+         * Когда биржа присылает закрытие бара, on_candle_close вызывается с is_confirmed = true
+         * и окончательным значением бара. Бар без сделок по таймеру не закрывается.
+         * Месячные бары закрываются только биржей
+         * \param enable Включить закрытие по таймеру
+         * \param user_close_delay Задержка закрытия после границы периода, мс
+         */
+        void set_close_scheduler(const bool enable = true, const uint64_t user_close_delay = 0) {
+            close_delay = user_close_delay;
+            if(!enable) {
+                std::lock_guard<std::mutex> lock(close_states_mutex);
+                is_close_scheduler = false;
+                if(close_timer_wheel) {
+                    for(auto &item : close_timers) {
+                        close_timer_wheel->cancel(item.second);
+                    }
+                }
+                close_timers.clear();
+                return;
+            }
+            std::set<uint32_t> periods;
+            {
+                std::lock_guard<std::mutex> lock(close_states_mutex);
+                if(is_close_scheduler) return;
+                if(!close_timer_wheel) {
+                    close_timer_wheel = std::make_shared<TimerWheel>();
+                    close_timer_wheel->set_time_source([&]() -> xtime::ftimestamp_t {
+                        return get_server_timestamp();
+                    });
+                }
+                is_close_scheduler = true;
+            }
+            {
+                std::lock_guard<std::mutex> lock(list_subscriptions_mutex);
+                for(auto &item_symbol : list_subscriptions) {
+                    for(auto &item_period : item_symbol.second) {
+                        periods.insert(item_period.first);
+                    }
+                }
+            }
+            {
+                std::lock_guard<std::mutex> lock(derived_states_mutex);
+                for(auto &item_symbol : derived_states) {
+                    for(auto &item_base : item_symbol.second) {
+                        for(auto &item_period : item_base.second) {
+                            periods.insert(item_period.first);
+                        }
+                    }
+                }
+            }
+            /* минутный таймер также будит wait_candle_close */
+            periods.insert(1);
+            for(auto &period : periods) {
+                add_close_timer(period);
+            }
+        }
+
+        /** \brief Установить фильтр баров
+         *
+         * Фильтр вызывается перед доставкой каждого бара потребителям,
+         * хранилище баров при этом обновляется всегда. Метод следует вызывать до start()
+         * \param filter Функция фильтра, должна вернуть false, чтобы отбросить бар
+         */
+        void set_candle_filter(std::function<bool(const CandleEvent &event)> filter) {
+            candle_filter = filter;
+        }
+
+        /** \brief Включить заполнение пропусков через REST API
+         *
+         * После переподключения или при стыковке с историей, загруженной через init_array_candles,
+         * пропущенные бары загружаются указанной функцией, добавляются в хранилище баров,
+         * а потребитель получает их закрытия по порядку перед новыми барами.
+         * Пропуски загружаются пулом собственных потоков, неудачная загрузка повторяется с растущей задержкой,
+         * а бары передаются в потоке соединения вместе с новыми барами.
+         * Метод следует вызывать до start()
+         * \param provider Функция загрузки баров
+         * \param budget Проверка остатка веса запросов (по умолчанию загрузка не ограничивается)
+         * \param num_threads Наибольшее количество потоков загрузки
+         */
+        void set_backfill_provider(
+                backfill_function provider,
+                budget_function budget = nullptr,
+                const uint32_t num_threads = 2) {
+            backfill_provider = provider;
+            backfill_budget = budget;
+            backfill_threads = num_threads == 0 ? 1 : num_threads;
+        }
+
+        /** \brief Включить асинхронную доставку баров
+         *
+         * После вызова данного метода callback-функция on_candle
+         * вызывается в отдельном потоке потребителя, а поток вебсокета
+         * только кладет бары в ограниченную неблокирующую очередь.
+         * Метод следует вызывать до start()
+         * \param queue_size Емкость очереди
+         * \param policy Политика при переполнении очереди
+         */
+        void set_async_dispatch(
+                const size_t queue_size = 4096,
+                const TypesBackpressure policy = TypesBackpressure::BLOCK) {
+            candle_dispatcher = std::make_shared<EventDispatcher<CandleEvent>>(
+                [&](const CandleEvent &event) {
+                    if(on_candle != nullptr) on_candle(event.symbol, event.candle, event.period, event.close_candle);
+                },
+                queue_size,
+                policy,
+                [](const CandleEvent &event) -> std::string {
+                    /* закрытие бара никогда не схлопывается */
+                    std::string key(event.symbol);
+                    key += "@";
+                    key += std::to_string(event.period);
+                    if(event.close_candle) {
+                        key += "@";
+                        key += std::to_string(event.candle.timestamp);
+                    }
+                    return key;
+                });
+        }
+
+        /** \brief Получить метрики очереди асинхронной доставки баров
+         * \return Метрики очереди
+         */
+        DispatcherMetrics get_dispatch_metrics() {
+            if(!candle_dispatcher) return DispatcherMetrics();
+            return candle_dispatcher->get_metrics();
+        }
+
+        /** \brief Добавить потребителя последних значений баров
+         *
+         * Потребитель получает бары в своем потоке и в своем темпе.
+         * Промежуточные обновления открытого бара для каждой пары символ-период
+         * схлопываются до последнего, закрытие бара доставляется всегда.
+         * \param callback Функция, которая будет вызвана в потоке потребителя
+         * \return Идентификатор потребителя
+         */
+        uint32_t add_conflated_consumer(std::function<void(
+                const std::string &symbol,
+                const xquotes_common::Candle &candle,
+                const uint32_t period,
+                const bool close_candle)> callback) {
+            conflated_consumer_ptr consumer = std::make_shared<ConflatingDispatcher<CandleEvent>>(
+                [callback](const CandleEvent &event) {
+                    callback(event.symbol, event.candle, event.period, event.close_candle);
+                },
+                [](const CandleEvent &event) -> std::string {
+                    std::string key(event.symbol);
+                    key += "@";
+                    key += std::to_string(event.period);
+                    return key;
+                },
+                [](const CandleEvent &event) -> bool {
+                    return event.close_candle;
+                });
+            std::lock_guard<std::mutex> lock(conflated_consumers_mutex);
+            const uint32_t id = ++conflated_consumer_id;
+            conflated_consumers[id] = consumer;
+            is_conflated_consumers = true;
+            return id;
+        }
+
+        /** \brief Удалить потребителя последних значений баров
+         *
+         * Перед удалением потребителю доставляются все накопленные бары
+         * \param id Идентификатор потребителя
+         */
+        void del_conflated_consumer(const uint32_t id) {
+            conflated_consumer_ptr consumer;
+            {
+                std::lock_guard<std::mutex> lock(conflated_consumers_mutex);
+                auto it = conflated_consumers.find(id);
+                if(it == conflated_consumers.end()) return;
+                consumer = it->second;
+                conflated_consumers.erase(it);
+                is_conflated_consumers = !conflated_consumers.empty();
+            }
+        }
+
+        /** \brief Получить метрики потребителя последних значений баров
+         * \param id Идентификатор потребителя
+         * \return Метрики доставки
+         */
+        DispatcherMetrics get_conflated_consumer_metrics(const uint32_t id) {
+            std::lock_guard<std::mutex> lock(conflated_consumers_mutex);
+            auto it = conflated_consumers.find(id);
+            if(it == conflated_consumers.end()) return DispatcherMetrics();
+            return it->second->get_metrics();
+        }
+
+        /** \brief Добавить старший период, собираемый из потока базового периода
+         *
+         * Вместо отдельной подписки бары старшего периода строятся локально из баров базового периода
+         * и доставляются так же, как бары потока. Поток базового периода добавляется автоматически.
+         * Поддерживаются периоды, на которые делятся сутки (5m, 15m, 1h, 4h, 1d и т.д.)
+         * \param symbol Имя символа
+         * \param period Старший период
+         * \param base_period Базовый период
+         * \return Вернет true, если период может быть собран из базового
+         */
+        bool add_derived_stream(
+                const std::string &symbol,
+                const uint32_t period,
+                const uint32_t base_period = 1) {
+            if(index_interval_to_str.find(base_period) == index_interval_to_str.end()) return false;
+            if(period <= base_period || (period % base_period) != 0) return false;
+            const uint32_t MINUTES_IN_DAY = 1440;
+            if(period > MINUTES_IN_DAY || (MINUTES_IN_DAY % period) != 0) return false;
+            {
+                std::lock_guard<std::mutex> lock(derived_states_mutex);
+                derived_states[to_upper_case(symbol)][base_period][period] = DerivedState();
+                is_derived_streams = true;
+            }
+            add_symbol_stream(symbol, base_period);
+            add_close_timer(period);
+            return true;
+        }
+
+        /** \brief Убрать старший период, собираемый из потока базового периода
+         *
+         * Поток базового периода не удаляется
+         * \param symbol Имя символа
+         * \param period Старший период
+         * \param base_period Базовый период
+         */
+        void del_derived_stream(
+                const std::string &symbol,
+                const uint32_t period,
+                const uint32_t base_period = 1) {
+            std::lock_guard<std::mutex> lock(derived_states_mutex);
+            auto it_symbol = derived_states.find(to_upper_case(symbol));
+            if(it_symbol == derived_states.end()) return;
+            auto it_base = it_symbol->second.find(base_period);
+            if(it_base == it_symbol->second.end()) return;
+            it_base->second.erase(period);
+        }
+
+        /** \brief Добавить поток символа с заданным периодом
+         * \param symbol Имя символа
+         * \param period Период
+         */
+        void add_symbol_stream(
+                const std::string &symbol,
+                const uint32_t period) {
+            auto it = index_interval_to_str.find(period);
+            if(it == index_interval_to_str.end()) return;
+            std::string s = to_lower_case(symbol);
+            const std::string param = s + "@kline_" + it->second;
+            {
+                std::lock_guard<std::mutex> lock(list_subscriptions_mutex);
+                /* имя символа ОБЯЗАТЕЛЬНО В НИЖНЕМ РЕГИСТРЕ! */
+                list_subscriptions[s][period] = true;
+            }
+            subscription_manager->subscribe(param);
+            add_close_timer(period);
         }
 
         /** \brief Убрать поток символа с заданным периодом
@@ -614,12 +1737,7 @@ namespace binance_api {
             auto it = index_interval_to_str.find(period);
             if(it == index_interval_to_str.end()) return;
             std::string s = to_lower_case(symbol);
-            json j;
-            j["method"] = "UNSUBSCRIBE";
-            j["params"] = json::array();
-            std::string param = s + "@kline_" + it->second;
-            j["params"][0] = param;
-            j["id"] = 1;
+            const std::string param = s + "@kline_" + it->second;
             {
                 std::lock_guard<std::mutex> lock(list_subscriptions_mutex);
                 /* имя символа ОБЯЗАТЕЛЬНО В НИЖНЕМ РЕГИСТРЕ! */
@@ -631,148 +1749,395 @@ namespace binance_api {
                     }
                 }
             }
-            if(!is_open) return;
-            send(j.dump());
+            subscription_manager->unsubscribe(param);
+        }
+
+        /** \brief Установить ограничение скорости сообщений подписки
+         *
+         * Изменения подписок накапливаются и отправляются пакетами не чаще указанной частоты
+         * \param messages_per_second Количество сообщений в секунду
+         */
+        void set_subscription_rate(const uint32_t messages_per_second) {
+            subscription_manager->set_messages_per_second(messages_per_second);
+        }
+
+        /** \brief Проверить, применены ли все изменения подписок
+         * \return Вернет true, если сервер подтвердил все подписки
+         */
+        bool check_subscriptions() {
+            return subscription_manager->synchronized();
+        }
+
+        /** \brief Использовать внешний цикл событий
+         *
+         * Вместо собственного потока соединение обслуживается потоком io_context,
+         * который может быть общим для нескольких клиентов.
+         * Метод следует вызывать до start()
+         * \param user_event_loop Указатель на io_context
+         */
+        void set_event_loop(std::shared_ptr<SimpleWeb::io_context> user_event_loop) {
+            connection.set_event_loop(user_event_loop);
+        }
+
+        /** \brief Использовать цикл событий из пула
+         * \param pool Пул циклов событий
+         */
+        void set_event_loop(EventLoopPool &pool) {
+            set_event_loop(pool.get_io_context());
         }
 
+        /** \brief Подключиться
+         *
+         * Без внешнего цикла событий соединение обслуживается собственным потоком
+         */
         void start() {
-            if(client_future.valid()) return;
-            /* запустим соединение в отдельном потоке */
-            client_future = std::async(std::launch::async,[&]() {
-                while(!is_close_connection) {
-                    try {
-                        /* создадим соединение */;
-                        client = std::make_shared<WssClient>(
-                                point,
-                                true,
-                                std::string(),
-                                std::string(),
-                                std::string(sert_file));
-
-                        /* читаем собщения, которые пришли */
-                        client->on_message =
-                                [&](std::shared_ptr<WssClient::Connection> connection,
-                                std::shared_ptr<WssClient::InMessage> message) {
-                            parser(message->string());
-                            //std::cout << "on_message " << message->string() << std::endl;
-                        };
-
-                        client->on_open =
-                            [&](std::shared_ptr<WssClient::Connection> connection) {
-                            {
-                                std::lock_guard<std::mutex> lock(save_connection_mutex);
-                                save_connection = connection;
-                            }
-                            if(list_subscriptions.size() != 0) {
-                                json j;
-                                j["method"] = "SUBSCRIBE";
-                                j["params"] = json::array();
-                                j["id"] = 1;
-                                {
-                                    std::lock_guard<std::mutex> lock(list_subscriptions_mutex);
-                                    uint32_t index = 0;
-                                    for(auto &item_symbol : list_subscriptions) {
-                                        /* имя символа ОБЯЗАТЕЛЬНО В НИЖНЕМ РЕГИСТРЕ! */
-                                        const std::string symbol = item_symbol.first;
-                                        for(auto &subscrip : item_symbol.second) {
-                                            const uint32_t period = subscrip.first;
-                                            auto it = index_interval_to_str.find(period);
-                                            if(it == index_interval_to_str.end()) return;
-                                            std::string param = symbol + "@kline_" + it->second;
-                                            j["params"][index++] = param;
-                                        }
-                                    }
-                                }
-                                //std::cout << "j.dump()" << j.dump() << std::endl;
-                                connection->send(j.dump());
-                            }
-                            is_open = true;
-                            //std::cout << "on_open" << std::endl;
-                        };
-
-                        client->on_close =
-                                [&](std::shared_ptr<WssClient::Connection> /*connection*/,
-                                int status, const std::string & /*reason*/) {
-                            is_websocket_init = false;
-                            is_open = false;
-                            is_error = true;
-                            {
-                                std::lock_guard<std::mutex> lock(save_connection_mutex);
-                                if(save_connection) save_connection.reset();
-                            }
-                            std::cerr
-                                << point
-                                << " closed connection with status code " << status
-                                << std::endl;
-                        };
-
-                        // See http://www.boost.org/doc/libs/1_55_0/doc/html/boost_asio/reference.html, Error Codes for error code meanings
-                        client->on_error =
-                                [&](std::shared_ptr<WssClient::Connection> /*connection*/,
-                                const SimpleWeb::error_code &ec) {
-                            is_websocket_init = false;
-                            is_open = false;
-                            is_error = true;
-
-                            {
-                                std::lock_guard<std::mutex> lock(save_connection_mutex);
-                                if(save_connection) save_connection.reset();
-                            }
-
-                            std::cerr
-                                << point
-                                << " wss error: " << ec
-                                << std::endl;
-                        };
-                        client->start();
-                        client.reset();
-                    } catch (std::exception& e) {
-                        is_websocket_init = false;
-                        is_error = true;
-                    }
-                    catch (...) {
-                        is_websocket_init = false;
-                        is_error = true;
-                    }
-                    if(is_close_connection) break;
-					const uint64_t RECONNECT_DELAY = 1000;
-					std::this_thread::sleep_for(std::chrono::milliseconds(RECONNECT_DELAY));
-                } // while
-            });
+            connection.start();
         }
     };
 
 
+    /** \brief Событие потока пользовательских данных
+     */
+    class UserDataEvent {
+    public:
+        /// Типы событий потока пользовательских данных
+        enum class Types {
+            BALANCE = 0,    /**< Изменение баланса */
+            POSITION = 1,   /**< Изменение позиции */
+            ORDER = 2,      /**< Изменение ордера */
+            MARGIN_CALL = 3,/**< Маржин-колл по позиции */
+            ACCOUNT = 4,    /**< Изменение счета */
+        };
+        Types type = Types::BALANCE;
+        BalanceSpec balance;
+        PositionSpec position;
+        OrderUpdateSpec order;
+        MarginCallSpec margin_call;
+        AccountUpdateSpec account_update;
+        UserDataEvent() {};
+        UserDataEvent(const BalanceSpec &_balance) :
+            type(Types::BALANCE), balance(_balance) {
+        };
+        UserDataEvent(const PositionSpec &_position) :
+            type(Types::POSITION), position(_position) {
+        };
+        UserDataEvent(const OrderUpdateSpec &_order) :
+            type(Types::ORDER), order(_order) {
+        };
+        UserDataEvent(const MarginCallSpec &_margin_call) :
+            type(Types::MARGIN_CALL), margin_call(_margin_call) {
+        };
+        UserDataEvent(const AccountUpdateSpec &_account_update) :
+            type(Types::ACCOUNT), account_update(_account_update) {
+        };
+    };
+
     /** \brief Класс потока пользовательских данных
      */
     class UserDataStreams {
     private:
-        using WssClient = SimpleWeb::SocketClient<SimpleWeb::WSS>;
         using json = nlohmann::json;
         //std::string point = "fstream.binance.com/ws/";
         std::string point = "stream.binancefuture.com/ws/";
         std::string sert_file = "curl-ca-bundle.crt";
-        std::string listen_key;
 
-        std::shared_ptr<WssClient::Connection> save_connection;
-        std::shared_ptr<WssClient> client;      /**< Webclosket Клиент */
-        std::future<void> client_future;		/**< Поток соединения */
-        std::mutex save_connection_mutex;
+        WebSocketConnection connection;         /**< Соединение */
 
         std::atomic<bool> is_websocket_init;    /**< Состояние соединения */
         std::atomic<bool> is_error;             /**< Ошибка соединения */
         std::atomic<bool> is_close_connection;  /**< Флаг для закрытия соединения */
         std::atomic<bool> is_open;
+        std::atomic<bool> is_was_open = ATOMIC_VAR_INIT(false);     /**< Соединение уже открывалось, следующее открытие - переподключение */
+        std::atomic<bool> is_cache_valid = ATOMIC_VAR_INIT(false);  /**< Балансы, позиции и ордера соответствуют серверу */
 
         std::string error_message;
         std::recursive_mutex error_message_mutex;
 
-        std::map<std::string, BalanceSpec> balances;
-        std::recursive_mutex balances_mutex;
+    public:
+        using position_key = std::pair<std::string, TypesPositionSide>;
+        using balance_table = std::map<std::string, std::shared_ptr<const BalanceSpec>>;
+        using position_table = std::map<position_key, std::shared_ptr<const PositionSpec>>;
+
+    private:
+        /* таблицы копируются при записи (копируются только указатели),
+         * читатели получают неизменяемый снимок без блокировки
+         */
+        std::shared_ptr<const balance_table> balances = std::make_shared<const balance_table>();    /**< Балансы по активам */
+        std::mutex balances_mutex;      /**< Блокировка записи балансов */
+
+        std::shared_ptr<const position_table> positions = std::make_shared<const position_table>(); /**< Позиции по символам и сторонам */
+        std::mutex positions_mutex;     /**< Блокировка записи позиций */
+
+    public:
+        using order_ptr = std::shared_ptr<const OrderUpdateSpec>;
+        using order_table = std::unordered_map<std::string, order_ptr>;
+        using order_callback = std::function<void(const OrderUpdateSpec &order)>;
+
+    private:
+        /* таблица ордеров разбита на части по хешу уникального номера,
+         * при записи копируется только часть, в которой изменился ордер
+         */
+        static const size_t ORDER_BUCKETS = 64;
+        std::array<std::shared_ptr<const order_table>, ORDER_BUCKETS> orders;  /**< Ордера по уникальным номерам, снимки частей для чтения без блокировки */
+        std::deque<std::string> final_orders;   /**< Завершенные ордера в порядке завершения */
+        size_t max_final_orders = 1024;         /**< Сколько завершенных ордеров хранить */
+        std::mutex orders_mutex;                /**< Блокировка записи таблицы ордеров */
+
+        std::deque<std::string> reconcile_buffer;   /**< Сообщения, пришедшие во время запросов сверки */
+        std::mutex reconcile_buffer_mutex;
+        bool is_reconcile_buffer = false;           /**< Сообщения откладываются до применения снимка сверки */
+
+        std::map<std::string, order_callback> order_callbacks;  /**< Функции обратного вызова отдельных ордеров */
+        std::mutex order_callbacks_mutex;
+
+    public:
+        using position_callback = std::function<void(const PositionSpec &position)>;
+
+    private:
+        /// Ожидание изменения позиции
+        class PositionWaiter {
+        public:
+            std::shared_ptr<std::promise<PositionSpec>> promise;
+            bool is_flat = false;   /**< Ждать закрытия позиции, иначе любого изменения */
+            PositionWaiter() {};
+        };
+
+        std::map<position_key, std::map<uint64_t, position_callback>> position_subscribers; /**< Подписки на изменения позиций */
+        std::map<uint64_t, position_key> position_subscriber_keys;
+        std::map<position_key, std::vector<PositionWaiter>> position_waiters;               /**< Ожидания изменений позиций */
+        uint64_t position_subscriber_counter = 0;
+        std::mutex position_subscribers_mutex;
+
+        std::shared_ptr<EventDispatcher<UserDataEvent>> user_data_dispatcher;  /**< Асинхронная доставка событий */
+
+        inline void emit_balance(const BalanceSpec &balance) {
+            if(user_data_dispatcher) {
+                user_data_dispatcher->push(UserDataEvent(balance));
+                return;
+            }
+            if(on_balance != nullptr) on_balance(balance);
+        }
+
+        inline void emit_position(const PositionSpec &position) {
+            if(user_data_dispatcher) {
+                user_data_dispatcher->push(UserDataEvent(position));
+                return;
+            }
+            if(on_position != nullptr) on_position(position);
+        }
+
+        inline void emit_account_update(const AccountUpdateSpec &account_update) {
+            if(user_data_dispatcher) {
+                user_data_dispatcher->push(UserDataEvent(account_update));
+                return;
+            }
+            if(on_account_update != nullptr) on_account_update(account_update);
+        }
+
+        /** \brief Сохранить балансы
+         *
+         * Таблица копируется, только если баланс изменился, неизменные записи сохраняют свои указатели
+         * \param list Балансы
+         */
+        void store_balances(const std::vector<BalanceSpec> &list) {
+            if(list.empty()) return;
+            std::lock_guard<std::mutex> lock(balances_mutex);
+            std::shared_ptr<const balance_table> current = std::atomic_load(&balances);
+            std::vector<size_t> changed;
+            for(size_t i = 0; i < list.size(); ++i) {
+                auto it = current->find(list[i].asset);
+                if(it != current->end() &&
+                    it->second->wallet_balance == list[i].wallet_balance &&
+                    it->second->cross_wallet_balance == list[i].cross_wallet_balance) continue;
+                changed.push_back(i);
+            }
+            if(changed.empty()) return;
+            std::shared_ptr<balance_table> table = std::make_shared<balance_table>(*current);
+            for(size_t i = 0; i < changed.size(); ++i) {
+                const BalanceSpec &balance = list[changed[i]];
+                (*table)[balance.asset] = std::make_shared<const BalanceSpec>(balance);
+            }
+            std::atomic_store(&balances, std::shared_ptr<const balance_table>(table));
+        }
+
+        /** \brief Сохранить позиции и найти изменившиеся
+         *
+         * Таблица копируется, только если позиция изменилась, неизменные записи сохраняют свои указатели
+         * \param list Позиции
+         * \param changed Позиции, размер которых изменился или которых не было
+         */
+        void store_positions(const std::vector<PositionSpec> &list, std::vector<PositionSpec> &changed) {
+            if(list.empty()) return;
+            std::lock_guard<std::mutex> lock(positions_mutex);
+            std::shared_ptr<const position_table> current = std::atomic_load(&positions);
+            const size_t first_changed = changed.size();
+            for(size_t i = 0; i < list.size(); ++i) {
+                auto it = current->find(position_key(list[i].symbol, list[i].position_side));
+                if(it != current->end() && it->second->position_amount == list[i].position_amount) continue;
+                /* более старый снимок не откатывает позицию (время 0 - неизвестно) */
+                if(it != current->end() && list[i].update_time != 0 &&
+                    it->second->update_time > list[i].update_time) continue;
+                changed.push_back(list[i]);
+            }
+            if(changed.size() == first_changed) return;
+            std::shared_ptr<position_table> table = std::make_shared<position_table>(*current);
+            for(size_t i = first_changed; i < changed.size(); ++i) {
+                const position_key key(changed[i].symbol, changed[i].position_side);
+                (*table)[key] = std::make_shared<const PositionSpec>(changed[i]);
+            }
+            std::atomic_store(&positions, std::shared_ptr<const position_table>(table));
+        }
+
+        /** \brief Уведомить подписчиков и ожидающих об изменении позиции
+         *
+         * Вызывается без блокировки позиций, функции подписчиков вызываются вне блокировок
+         * \param position Позиция
+         */
+        void notify_position_change(const PositionSpec &position) {
+            const position_key key(position.symbol, position.position_side);
+            std::vector<position_callback> callbacks;
+            std::vector<std::shared_ptr<std::promise<PositionSpec>>> promises;
+            {
+                std::lock_guard<std::mutex> lock(position_subscribers_mutex);
+                auto it_subscribers = position_subscribers.find(key);
+                if(it_subscribers != position_subscribers.end()) {
+                    for(auto &item : it_subscribers->second) {
+                        callbacks.push_back(item.second);
+                    }
+                }
+                auto it_waiters = position_waiters.find(key);
+                if(it_waiters != position_waiters.end()) {
+                    std::vector<PositionWaiter> &waiters = it_waiters->second;
+                    for(size_t i = 0; i < waiters.size();) {
+                        if(waiters[i].is_flat && position.position_amount != 0.0) {
+                            ++i;
+                            continue;
+                        }
+                        promises.push_back(waiters[i].promise);
+                        waiters.erase(waiters.begin() + i);
+                    }
+                    if(waiters.empty()) position_waiters.erase(it_waiters);
+                }
+            }
+            for(size_t i = 0; i < promises.size(); ++i) {
+                promises[i]->set_value(position);
+            }
+            for(size_t i = 0; i < callbacks.size(); ++i) {
+                callbacks[i](position);
+            }
+        }
+
+        /** \brief Доставить событие ордера
+         *
+         * Функция обратного вызова ордера удаляется после завершения ордера
+         * \param order Состояние ордера
+         */
+        void deliver_order(const OrderUpdateSpec &order) {
+            if(on_order != nullptr) on_order(order);
+            order_callback callback = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(order_callbacks_mutex);
+                auto it = order_callbacks.find(order.client_order_id);
+                if(it == order_callbacks.end()) return;
+                callback = it->second;
+                if(order.is_final()) order_callbacks.erase(it);
+            }
+            if(callback != nullptr) callback(order);
+        }
+
+        inline void emit_order(const OrderUpdateSpec &order) {
+            if(user_data_dispatcher) {
+                user_data_dispatcher->push(UserDataEvent(order));
+                return;
+            }
+            deliver_order(order);
+        }
+
+        inline void emit_margin_call(const MarginCallSpec &margin_call) {
+            if(user_data_dispatcher) {
+                user_data_dispatcher->push(UserDataEvent(margin_call));
+                return;
+            }
+            if(on_margin_call != nullptr) on_margin_call(margin_call);
+        }
+
+        static inline size_t get_order_bucket(const std::string &client_order_id) {
+            return std::hash<std::string>()(client_order_id) % ORDER_BUCKETS;
+        }
+
+        /** \brief Обновить таблицу ордеров
+         *
+         * Части таблицы копируются при записи (копируются только указатели на ордера части),
+         * поэтому читатели получают неизменяемый снимок части без блокировки.
+         * Завершенные ордера хранятся, пока их не больше max_final_orders
+         * \param order Состояние ордера
+         */
+        void update_order_table(const OrderUpdateSpec &order) {
+            std::lock_guard<std::mutex> lock(orders_mutex);
+            /* копии изменяемых частей, обычно одна или две */
+            std::map<size_t, std::shared_ptr<order_table>> tables;
+            auto get_table = [&](const std::string &client_order_id) -> order_table& {
+                const size_t bucket = get_order_bucket(client_order_id);
+                auto it = tables.find(bucket);
+                if(it != tables.end()) return *it->second;
+                std::shared_ptr<const order_table> table = std::atomic_load(&orders[bucket]);
+                std::shared_ptr<order_table> copy = table ? std::make_shared<order_table>(*table) : std::make_shared<order_table>();
+                tables[bucket] = copy;
+                return *copy;
+            };
+            get_table(order.client_order_id)[order.client_order_id] = std::make_shared<const OrderUpdateSpec>(order);
+            if(order.is_final()) {
+                final_orders.push_back(order.client_order_id);
+                while(final_orders.size() > max_final_orders) {
+                    order_table &table = get_table(final_orders.front());
+                    auto it = table.find(final_orders.front());
+                    if(it != table.end() && it->second->is_final()) table.erase(it);
+                    final_orders.pop_front();
+                }
+            }
+            for(auto &item : tables) {
+                std::atomic_store(&orders[item.first], std::shared_ptr<const order_table>(item.second));
+            }
+        }
 
-        std::map<std::string, std::map<TypesPositionSide, PositionSpec>> positions;
-        std::recursive_mutex positions_mutex;
+        /** \brief Удалить ордер из таблицы ордеров
+         * \param client_order_id Уникальный номер ордера
+         */
+        void erase_order(const std::string &client_order_id) {
+            std::lock_guard<std::mutex> lock(orders_mutex);
+            const size_t bucket = get_order_bucket(client_order_id);
+            std::shared_ptr<const order_table> table = std::atomic_load(&orders[bucket]);
+            if(!table || table->find(client_order_id) == table->end()) return;
+            std::shared_ptr<order_table> copy = std::make_shared<order_table>(*table);
+            copy->erase(client_order_id);
+            std::atomic_store(&orders[bucket], std::shared_ptr<const order_table>(copy));
+        }
+
+        /** \brief Применить сообщения, отложенные во время сверки
+         *
+         * Сообщения, пришедшие во время применения, тоже откладываются и применяются по порядку,
+         * после опустошения буфера сообщения снова обрабатываются в потоке соединения
+         */
+        void flush_reconcile_buffer() {
+            while(true) {
+                std::deque<std::string> messages;
+                {
+                    std::lock_guard<std::mutex> lock(reconcile_buffer_mutex);
+                    if(reconcile_buffer.empty()) {
+                        is_reconcile_buffer = false;
+                        return;
+                    }
+                    messages.swap(reconcile_buffer);
+                }
+                for(size_t i = 0; i < messages.size(); ++i) {
+                    parser(messages[i]);
+                }
+            }
+        }
 
+        static inline double get_number(const json &j) {
+            return std::atof(std::string(j).c_str());
+        }
 
         /** \brief Парсер сообщения от вебсокета
          * \param response Ответ от сервера
@@ -784,46 +2149,100 @@ namespace binance_api {
                 const std::string event = j["e"];
 
                 if(event == "ACCOUNT_UPDATE") {
-                    json j_ab = j["a"]["B"];
+                    /* событие содержит только изменившиеся балансы и позиции, их и передаем */
+                    AccountUpdateSpec account_update;
+                    const json &j_a = j["a"];
+                    if(j_a.find("m") != j_a.end()) account_update.reason = j_a["m"];
+                    account_update.event_time = (double)((uint64_t)j["E"]) / 1000.0;
+                    if(j.find("T") != j.end()) account_update.transaction_time = (double)((uint64_t)j["T"]) / 1000.0;
+                    json j_ab = j_a["B"];
                     for(size_t  i = 0; i < j_ab.size(); ++i) {
                         const std::string asset = j_ab[i]["a"];
                         const double wallet_balance = std::atof(std::string(j_ab[i]["wb"]).c_str());
                         const double cross_wallet_balance = std::atof(std::string(j_ab[i]["cw"]).c_str());
-                        std::lock_guard<std::recursive_mutex> lock(balances_mutex);
-                        balances[asset] = BalanceSpec(asset, wallet_balance, cross_wallet_balance);
-                    }
-                    if(on_balance != nullptr) {
-                        std::lock_guard<std::recursive_mutex> lock(balances_mutex);
-                        for(auto &it : balances) {
-                            on_balance(it.second);
-                        }
+                        account_update.balances.push_back(BalanceSpec(asset, wallet_balance, cross_wallet_balance));
                     }
-                    json j_ap = j["a"]["P"];
+                    json j_ap = j_a["P"];
                     for(size_t  i = 0; i < j_ap.size(); ++i) {
                         PositionSpec position;
                         position.symbol = j_ap[i]["s"];
                         position.position_amount = std::atof(std::string(j_ap[i]["pa"]).c_str());
-                        position.position_side = TypesPositionSide::NONE;
-                        if(j_ap[i]["ps"] == "BOTH") position.position_side = TypesPositionSide::BOTH;
-                        else if(j_ap[i]["ps"] == "LONG") position.position_side = TypesPositionSide::LONG;
-                        else if(j_ap[i]["ps"] == "SHORT") position.position_side = TypesPositionSide::SHORT;
-                        std::lock_guard<std::recursive_mutex> lock(positions_mutex);
-                        positions[position.symbol][position.position_side] = position;
+                        position.position_side = to_position_side(j_ap[i]["ps"]);
+                        position.update_time = account_update.transaction_time != 0 ?
+                            account_update.transaction_time : account_update.event_time;
+                        account_update.positions.push_back(position);
+                    }
+                    store_balances(account_update.balances);
+                    std::vector<PositionSpec> changed_positions;
+                    store_positions(account_update.positions, changed_positions);
+
+                    for(size_t i = 0; i < changed_positions.size(); ++i) {
+                        notify_position_change(changed_positions[i]);
+                    }
+                    if(on_balance != nullptr) {
+                        for(size_t i = 0; i < account_update.balances.size(); ++i) {
+                            emit_balance(account_update.balances[i]);
+                        }
                     }
                     if(on_position != nullptr) {
-                        std::lock_guard<std::recursive_mutex> lock(positions_mutex);
-                        for(auto &it : positions) {
-                            for(auto &p_it : it.second) {
-                                on_position(p_it.second);
-                            }
+                        for(size_t i = 0; i < account_update.positions.size(); ++i) {
+                            emit_position(account_update.positions[i]);
                         }
                     }
+                    if(on_account_update != nullptr) emit_account_update(account_update);
                 } else
                 if(event == "ORDER_TRADE_UPDATE") {
-
+                    const json &j_o = j["o"];
+                    OrderUpdateSpec order;
+                    order.symbol = j_o["s"];
+                    order.client_order_id = j_o["c"];
+                    order.order_id = j_o["i"];
+                    order.type = to_order_type(j_o["o"]);
+                    order.side = j_o["S"] == "BUY" ? TypesSide::BUY : (j_o["S"] == "SELL" ? TypesSide::SELL : TypesSide::NONE);
+                    order.position_side = to_position_side(j_o["ps"]);
+                    order.status = to_order_status(j_o["X"]);
+                    order.execution_type = j_o["x"];
+                    order.quantity = get_number(j_o["q"]);
+                    order.price = get_number(j_o["p"]);
+                    order.stop_price = get_number(j_o["sp"]);
+                    order.average_price = get_number(j_o["ap"]);
+                    order.filled_quantity = get_number(j_o["z"]);
+                    order.last_filled_quantity = get_number(j_o["l"]);
+                    order.last_filled_price = get_number(j_o["L"]);
+                    if(j_o.find("rp") != j_o.end()) order.realized_profit = get_number(j_o["rp"]);
+                    if(j_o.find("n") != j_o.end()) order.commission = get_number(j_o["n"]);
+                    if(j_o.find("N") != j_o.end() && j_o["N"].is_string()) order.commission_asset = j_o["N"];
+                    if(j_o.find("R") != j_o.end()) order.is_reduce_only = j_o["R"];
+                    if(j_o.find("cp") != j_o.end()) order.is_close_position = j_o["cp"];
+                    order.update_time = (double)((uint64_t)j_o["T"]) / 1000.0;
+                    /* событие, отложенное во время сверки, не откатывает более новый ответ сервера */
+                    order_ptr cached = get_order(order.client_order_id);
+                    if(!cached || cached->update_time <= order.update_time) update_order_table(order);
+                    emit_order(order);
+                } else
+                if(event == "listenKeyExpired") {
+                    /* после истечения ключа события не приходят, кэш больше не обновляется */
+                    is_cache_valid = false;
+                    if(on_listen_key_expired != nullptr) on_listen_key_expired();
                 } else
                 if(event == "MARGIN_CALL") {
-
+                    const double cross_wallet_balance = j.find("cw") != j.end() ? get_number(j["cw"]) : 0.0;
+                    const xtime::ftimestamp_t event_time = (double)((uint64_t)j["E"]) / 1000.0;
+                    json j_p = j["p"];
+                    for(size_t i = 0; i < j_p.size(); ++i) {
+                        MarginCallSpec margin_call;
+                        margin_call.symbol = j_p[i]["s"];
+                        margin_call.position_side = to_position_side(j_p[i]["ps"]);
+                        margin_call.margin_type = j_p[i]["mt"] == "ISOLATED" ? TypesMargin::ISOLATED : TypesMargin::CROSSED;
+                        margin_call.position_amount = get_number(j_p[i]["pa"]);
+                        if(j_p[i].find("iw") != j_p[i].end()) margin_call.isolated_wallet = get_number(j_p[i]["iw"]);
+                        margin_call.mark_price = get_number(j_p[i]["mp"]);
+                        margin_call.unrealized_profit = get_number(j_p[i]["up"]);
+                        margin_call.maintenance_margin = get_number(j_p[i]["mm"]);
+                        margin_call.cross_wallet_balance = cross_wallet_balance;
+                        margin_call.event_time = event_time;
+                        emit_margin_call(margin_call);
+                    }
                 }
             }
             catch(const json::parse_error& e) {
@@ -841,9 +2260,7 @@ namespace binance_api {
         }
 
         void send(const std::string &message) {
-            std::lock_guard<std::mutex> lock(save_connection_mutex);
-            if(!save_connection) return;
-            save_connection->send(message);
+            connection.send(message);
         }
 
         std::string to_upper_case(const std::string &s){
@@ -862,33 +2279,293 @@ namespace binance_api {
             return temp;
         }
 
+        /** \brief Инициализировать callback-функции соединения
+         * \param user_listen_key Ключ потока
+         */
+        void init_connection(const std::string &user_listen_key) {
+            connection.set_point(point + user_listen_key);
+            connection.set_sert_file(sert_file);
+
+            /* читаем собщения, которые пришли */
+            connection.on_message = [&](const std::string &message) {
+                {
+                    std::lock_guard<std::mutex> lock(reconcile_buffer_mutex);
+                    if(is_reconcile_buffer) {
+                        reconcile_buffer.push_back(message);
+                        return;
+                    }
+                }
+                parser(message);
+            };
+
+            connection.on_open = [&]() {
+                is_open = true;
+                is_error = false;
+                /* пока соединения не было, события могли быть пропущены */
+                if(is_was_open.exchange(true)) {
+                    is_cache_valid = false;
+                    if(on_reconnect != nullptr) on_reconnect();
+                }
+            };
+
+            connection.on_close = [&]() {
+                is_websocket_init = false;
+                is_open = false;
+                is_error = true;
+                is_cache_valid = false;
+            };
+        }
+
     public:
         std::function<void(const BalanceSpec &balance)> on_balance = nullptr;
         std::function<void(const PositionSpec &position)> on_position = nullptr;
+        std::function<void(const AccountUpdateSpec &account_update)> on_account_update = nullptr;   /**< Изменение счета одним событием с причиной */
+        std::function<void(const OrderUpdateSpec &order)> on_order = nullptr;              /**< Изменение любого ордера */
+        std::function<void(const MarginCallSpec &margin_call)> on_margin_call = nullptr;   /**< Маржин-колл по позиции */
         std::function<void(const std::string &data)> on_data = nullptr;
+        std::function<void()> on_reconnect = nullptr;           /**< Соединение восстановлено, состояние счета нужно сверить */
+        std::function<void()> on_listen_key_expired = nullptr;  /**< Ключ потока истек, нужен новый ключ */
+
+        /** \brief Проверить актуальность состояния счета
+         *
+         * После разрыва соединения или истечения ключа потока события могли быть пропущены,
+         * состояние снова актуально после сверки reconcile()
+         * \return Вернет true, если балансам, позициям и ордерам можно доверять
+         */
+        inline bool check_valid() const {
+            return is_cache_valid;
+        }
+
+        /** \brief Установить актуальность состояния счета
+         *
+         * Вызывается после заполнения состояния по REST API
+         * \param value Актуальность состояния
+         */
+        inline void set_valid(const bool value = true) {
+            is_cache_valid = value;
+        }
+
+        /** \brief Начать сверку состояния счета
+         *
+         * До вызова reconcile() или cancel_reconcile() сообщения потока откладываются,
+         * чтобы события, пришедшие во время запросов REST API, применялись после снимка
+         */
+        void begin_reconcile() {
+            std::lock_guard<std::mutex> lock(reconcile_buffer_mutex);
+            is_reconcile_buffer = true;
+        }
+
+        /** \brief Отменить сверку состояния счета
+         *
+         * Отложенные сообщения применяются без снимка
+         */
+        void cancel_reconcile() {
+            flush_reconcile_buffer();
+        }
+
+        /** \brief Сверить состояние счета с сервером
+         *
+         * Для всех расхождений вызываются те же callback-функции, что и для событий потока,
+         * после чего состояние отмечается актуальным. Затем применяются сообщения, отложенные
+         * после begin_reconcile(): события содержат полные значения, поэтому более старое событие
+         * будет перекрыто следующим, а ордера не откатываются к более раннему состоянию
+         * \param list_positions Позиции по REST API
+         * \param list_balances Балансы по REST API
+         * \param list_orders Открытые ордера по REST API и итоговые состояния ордеров, закрытых во время разрыва
+         * \param missing_orders Ордера кэша, которых нет на сервере (NO_SUCH_ORDER), они удаляются
+         */
+        void reconcile(
+                const std::vector<PositionSpec> &list_positions,
+                const std::vector<BalanceSpec> &list_balances,
+                const std::vector<OrderUpdateSpec> &list_orders,
+                const std::vector<std::string> &missing_orders = std::vector<std::string>()) {
+            AccountUpdateSpec account_update;
+            account_update.reason = "RECONCILE";
+            account_update.event_time = xtime::get_ftimestamp();
+
+            std::shared_ptr<const balance_table> balance_snapshot = get_balances_snapshot();
+            for(size_t i = 0; i < list_balances.size(); ++i) {
+                auto it = balance_snapshot->find(list_balances[i].asset);
+                if(it != balance_snapshot->end() &&
+                    it->second->wallet_balance == list_balances[i].wallet_balance &&
+                    it->second->cross_wallet_balance == list_balances[i].cross_wallet_balance) continue;
+                account_update.balances.push_back(list_balances[i]);
+            }
+            store_balances(account_update.balances);
+            store_positions(list_positions, account_update.positions);
+
+            std::vector<OrderUpdateSpec> changed_orders;
+            for(size_t i = 0; i < list_orders.size(); ++i) {
+                order_ptr order = get_order(list_orders[i].client_order_id);
+                /* событие потока могло прийти позже ответа сервера */
+                if(order && order->update_time > list_orders[i].update_time) continue;
+                if(order && order->status == list_orders[i].status &&
+                    order->filled_quantity == list_orders[i].filled_quantity) continue;
+                update_order_table(list_orders[i]);
+                changed_orders.push_back(list_orders[i]);
+            }
+            for(size_t i = 0; i < missing_orders.size(); ++i) {
+                erase_order(missing_orders[i]);
+            }
+            is_cache_valid = true;
+
+            for(size_t i = 0; i < account_update.positions.size(); ++i) {
+                notify_position_change(account_update.positions[i]);
+            }
+            if(on_balance != nullptr) {
+                for(size_t i = 0; i < account_update.balances.size(); ++i) {
+                    emit_balance(account_update.balances[i]);
+                }
+            }
+            if(on_position != nullptr) {
+                for(size_t i = 0; i < account_update.positions.size(); ++i) {
+                    emit_position(account_update.positions[i]);
+                }
+            }
+            for(size_t i = 0; i < changed_orders.size(); ++i) {
+                emit_order(changed_orders[i]);
+            }
+            if(on_account_update != nullptr &&
+                (!account_update.balances.empty() || !account_update.positions.empty())) {
+                emit_account_update(account_update);
+            }
+            flush_reconcile_buffer();
+        }
+
+        /** \brief Установить новый ключ потока
+         *
+         * Ключ применяется при следующем подключении, см. force_reconnect()
+         * \param user_listen_key Ключ потока
+         */
+        void set_listen_key(const std::string &user_listen_key) {
+            connection.set_point(point + user_listen_key);
+        }
+
+        /** \brief Переподключиться
+         *
+         * Используется после смены ключа потока
+         */
+        void force_reconnect() {
+            if(is_close_connection) return;
+            is_cache_valid = false;
+            connection.force_reconnect();
+        }
+
+        /** \brief Получить состояние ордера
+         *
+         * Чтение из снимка таблицы ордеров без блокировки и без запроса к серверу
+         * \param client_order_id Уникальный номер ордера
+         * \return Состояние ордера или nullptr, если ордера нет
+         */
+        order_ptr get_order(const std::string &client_order_id) const {
+            std::shared_ptr<const order_table> table = std::atomic_load(&orders[get_order_bucket(client_order_id)]);
+            if(!table) return order_ptr();
+            auto it = table->find(client_order_id);
+            if(it == table->end()) return order_ptr();
+            return it->second;
+        }
+
+        /** \brief Получить состояние ордера
+         * \param client_order_id Уникальный номер ордера
+         * \param order Состояние ордера
+         * \return Вернет true, если ордер есть
+         */
+        bool get_order(const std::string &client_order_id, OrderUpdateSpec &order) const {
+            order_ptr ptr = get_order(client_order_id);
+            if(!ptr) return false;
+            order = *ptr;
+            return true;
+        }
+
+        /** \brief Получить открытые ордера
+         *
+         * Каждая часть таблицы читается из своего снимка
+         * \param symbol Символ (пустая строка - все символы)
+         * \return Открытые ордера
+         */
+        std::vector<OrderUpdateSpec> get_open_orders(const std::string &symbol = std::string()) const {
+            std::vector<OrderUpdateSpec> temp;
+            for(size_t bucket = 0; bucket < ORDER_BUCKETS; ++bucket) {
+                std::shared_ptr<const order_table> table = std::atomic_load(&orders[bucket]);
+                if(!table) continue;
+                for(auto &item : *table) {
+                    if(item.second->is_final()) continue;
+                    if(!symbol.empty() && item.second->symbol != symbol) continue;
+                    temp.push_back(*item.second);
+                }
+            }
+            return temp;
+        }
+
+        /** \brief Установить состояние ордера
+         *
+         * Позволяет заполнить таблицу ордеров по REST API, события потока ее обновляют
+         * \param order Состояние ордера
+         */
+        void set_order(const OrderUpdateSpec &order) {
+            update_order_table(order);
+        }
+
+        /** \brief Установить функцию обратного вызова ордера
+         *
+         * Функция вызывается при каждом событии ордера и удаляется после его завершения
+         * \param client_order_id Уникальный номер ордера
+         * \param callback Функция обратного вызова
+         */
+        void set_order_callback(const std::string &client_order_id, order_callback callback) {
+            std::lock_guard<std::mutex> lock(order_callbacks_mutex);
+            if(callback == nullptr) order_callbacks.erase(client_order_id);
+            else order_callbacks[client_order_id] = callback;
+        }
+
+        /** \brief Удалить функцию обратного вызова ордера
+         * \param client_order_id Уникальный номер ордера
+         */
+        void remove_order_callback(const std::string &client_order_id) {
+            std::lock_guard<std::mutex> lock(order_callbacks_mutex);
+            order_callbacks.erase(client_order_id);
+        }
 
         /** \brief Получить балансы всех колешьков
          * \return Вернет массив балансов кошельков
          */
-        std::vector<BalanceSpec> get_all_balance() {
+        std::vector<BalanceSpec> get_all_balance() const {
             std::vector<BalanceSpec> temp;
-            std::lock_guard<std::recursive_mutex> lock(balances_mutex);
-            for(auto &it : balances) {
-                temp.push_back(it.second);
+            std::shared_ptr<const balance_table> table = std::atomic_load(&balances);
+            for(auto &it : *table) {
+                temp.push_back(*it.second);
             }
             return temp;
         }
 
+        /** \brief Получить снимок балансов
+         *
+         * Снимок неизменяем и читается без блокировки
+         * \return Балансы по активам
+         */
+        inline std::shared_ptr<const balance_table> get_balances_snapshot() const {
+            return std::atomic_load(&balances);
+        }
+
+        /** \brief Получить снимок позиций
+         *
+         * Снимок неизменяем и читается без блокировки
+         * \return Позиции по символам и сторонам
+         */
+        inline std::shared_ptr<const position_table> get_positions_snapshot() const {
+            return std::atomic_load(&positions);
+        }
+
         /** \brief Получить баланс колешька
          * \param asset Актив
          * \param balance Баланс колешька
          * \return Вернет true, если баланс кошелька есть
          */
-        bool get_balance(const std::string &asset, BalanceSpec &balance) {
-            std::lock_guard<std::recursive_mutex> lock(balances_mutex);
-            auto it = balances.find(asset);
-            if(it == balances.end()) return false;
-            balance = it->second;
+        bool get_balance(const std::string &asset, BalanceSpec &balance) const {
+            std::shared_ptr<const balance_table> table = std::atomic_load(&balances);
+            auto it = table->find(asset);
+            if(it == table->end()) return false;
+            balance = *it->second;
             return true;
         }
 
@@ -898,30 +2575,170 @@ namespace binance_api {
          * \param position Данные по позиции
          * \return Вернет true, если баланс кошелька есть
          */
-        bool get_position(const std::string &symbol, const TypesPositionSide position_side, PositionSpec &position) {
-            std::lock_guard<std::recursive_mutex> lock(positions_mutex);
-            auto it = positions.find(symbol);
-            if(it == positions.end()) return false;
-            auto p_it = it->second.find(position_side);
-            if(p_it == it->second.end()) return false;
-            position = p_it->second;
+        bool get_position(const std::string &symbol, const TypesPositionSide position_side, PositionSpec &position) const {
+            std::shared_ptr<const position_table> table = std::atomic_load(&positions);
+            auto it = table->find(position_key(symbol, position_side));
+            if(it == table->end()) return false;
+            position = *it->second;
             return true;
         }
 
+        /** \brief Включить асинхронную доставку событий
+         *
+         * После вызова данного метода callback-функции on_balance, on_position, on_account_update,
+         * on_order, on_margin_call и функции ордеров вызываются в отдельном потоке потребителя.
+         * Метод следует вызывать до start()
+         * \param queue_size Емкость очереди
+         * \param policy Политика при переполнении очереди
+         */
+        void set_async_dispatch(
+                const size_t queue_size = 4096,
+                const TypesBackpressure policy = TypesBackpressure::BLOCK) {
+            user_data_dispatcher = std::make_shared<EventDispatcher<UserDataEvent>>(
+                [&](const UserDataEvent &event) {
+                    switch(event.type) {
+                    case UserDataEvent::Types::BALANCE:
+                        if(on_balance != nullptr) on_balance(event.balance);
+                        break;
+                    case UserDataEvent::Types::POSITION:
+                        if(on_position != nullptr) on_position(event.position);
+                        break;
+                    case UserDataEvent::Types::ORDER:
+                        deliver_order(event.order);
+                        break;
+                    case UserDataEvent::Types::MARGIN_CALL:
+                        if(on_margin_call != nullptr) on_margin_call(event.margin_call);
+                        break;
+                    case UserDataEvent::Types::ACCOUNT:
+                        if(on_account_update != nullptr) on_account_update(event.account_update);
+                        break;
+                    };
+                },
+                queue_size,
+                policy,
+                [](const UserDataEvent &event) -> std::string {
+                    switch(event.type) {
+                    case UserDataEvent::Types::BALANCE:
+                        return "B@" + event.balance.asset;
+                    case UserDataEvent::Types::ORDER:
+                        return "O@" + event.order.client_order_id;
+                    case UserDataEvent::Types::MARGIN_CALL:
+                        return "M@" + event.margin_call.symbol + "@" + std::to_string((int)event.margin_call.position_side);
+                    case UserDataEvent::Types::ACCOUNT:
+                        return "A@" + std::to_string((uint64_t)(event.account_update.event_time * 1000.0));
+                    default:
+                        break;
+                    };
+                    return "P@" + event.position.symbol + "@" + std::to_string((int)event.position.position_side);
+                });
+        }
+
+        /** \brief Получить метрики очереди асинхронной доставки событий
+         * \return Метрики очереди
+         */
+        DispatcherMetrics get_dispatch_metrics() {
+            if(!user_data_dispatcher) return DispatcherMetrics();
+            return user_data_dispatcher->get_metrics();
+        }
+
         /** \brief Установить позицию
          * \param position Позиция
          */
         void set_position(const PositionSpec &position) {
-            std::lock_guard<std::recursive_mutex> lock(positions_mutex);
-            positions[position.symbol][position.position_side] = position;
+            std::vector<PositionSpec> changed;
+            store_positions(std::vector<PositionSpec>(1, position), changed);
+            if(!changed.empty()) notify_position_change(position);
+        }
+
+        /** \brief Подписаться на изменения позиции
+         *
+         * Функция вызывается в потоке вебсокета только при изменении размера указанной позиции
+         * \param symbol Символ
+         * \param position_side Тип позиции (SHORT, LONG, BOTH)
+         * \param callback Функция обратного вызова
+         * \return ID подписки
+         */
+        uint64_t subscribe_position(
+                const std::string &symbol,
+                const TypesPositionSide position_side,
+                position_callback callback) {
+            std::lock_guard<std::mutex> lock(position_subscribers_mutex);
+            const uint64_t id = ++position_subscriber_counter;
+            const position_key key(symbol, position_side);
+            position_subscribers[key][id] = callback;
+            position_subscriber_keys[id] = key;
+            return id;
+        }
+
+        /** \brief Отписаться от изменений позиции
+         * \param id ID подписки
+         */
+        void unsubscribe_position(const uint64_t id) {
+            std::lock_guard<std::mutex> lock(position_subscribers_mutex);
+            auto it_key = position_subscriber_keys.find(id);
+            if(it_key == position_subscriber_keys.end()) return;
+            auto it = position_subscribers.find(it_key->second);
+            if(it != position_subscribers.end()) {
+                it->second.erase(id);
+                if(it->second.empty()) position_subscribers.erase(it);
+            }
+            position_subscriber_keys.erase(it_key);
+        }
+
+        /** \brief Дождаться изменения позиции
+         *
+         * Ожидание не занимает поток: future получает позицию при следующем изменении ее размера
+         * Если объект будет разрушен раньше, future получит исключение std::future_error (broken_promise)
+         * \param symbol Символ
+         * \param position_side Тип позиции (SHORT, LONG, BOTH)
+         * \return Позиция после изменения
+         */
+        std::future<PositionSpec> wait_position_change(
+                const std::string &symbol,
+                const TypesPositionSide position_side) {
+            PositionWaiter waiter;
+            waiter.promise = std::make_shared<std::promise<PositionSpec>>();
+            std::future<PositionSpec> future = waiter.promise->get_future();
+            std::lock_guard<std::mutex> lock(position_subscribers_mutex);
+            position_waiters[position_key(symbol, position_side)].push_back(waiter);
+            return future;
+        }
+
+        /** \brief Дождаться закрытия позиции
+         *
+         * Если позиции нет, future готов сразу
+         * \param symbol Символ
+         * \param position_side Тип позиции (SHORT, LONG, BOTH)
+         * \return Закрытая позиция
+         */
+        std::future<PositionSpec> wait_position_flat(
+                const std::string &symbol,
+                const TypesPositionSide position_side) {
+            PositionWaiter waiter;
+            waiter.promise = std::make_shared<std::promise<PositionSpec>>();
+            waiter.is_flat = true;
+            std::future<PositionSpec> future = waiter.promise->get_future();
+            /* проверку и постановку в очередь выполняем под одной блокировкой с уведомлением,
+             * чтобы не пропустить закрытие между ними
+             */
+            std::lock_guard<std::mutex> lock(position_subscribers_mutex);
+            PositionSpec position;
+            if(!get_position(symbol, position_side, position) || position.position_amount == 0.0) {
+                position.symbol = symbol;
+                position.position_side = position_side;
+                position.position_amount = 0;
+                waiter.promise->set_value(position);
+                return future;
+            }
+            position_waiters[position_key(symbol, position_side)].push_back(waiter);
+            return future;
         }
 
         /** \brief Установить баланс
          * \param balance Баланс
          */
         void set_balance(const BalanceSpec &balance) {
-            std::lock_guard<std::recursive_mutex> lock(balances_mutex);
-            balances[balance.asset] = balance;
+            store_balances(std::vector<BalanceSpec>(1, balance));
         }
 
         /** \brief Конструктор класса для получения потока пользовательских данных
@@ -932,8 +2749,7 @@ namespace binance_api {
         UserDataStreams(
                 const std::string &user_listen_key,
                 const bool is_demo = true,
-                const std::string user_sert_file = "curl-ca-bundle.crt") :
-                listen_key(user_listen_key) {
+                const std::string user_sert_file = "curl-ca-bundle.crt") {
             /* инициализируем переменные */
             if(is_demo) point = "stream.binancefuture.com/ws/";
             else point = "fstream.binance.com/ws/";
@@ -942,27 +2758,15 @@ namespace binance_api {
             is_close_connection = false;
             is_error = false;
             is_open = false;
+            init_connection(user_listen_key);
         }
 
         ~UserDataStreams() {
             is_close_connection = true;
-            std::shared_ptr<WssClient> client_ptr = std::atomic_load(&client);
-            if(client_ptr) {
-                client_ptr->stop();
-            }
-
-            if(client_future.valid()) {
-                try {
-                    client_future.wait();
-                    client_future.get();
-                }
-                catch(const std::exception &e) {
-                    std::cerr << "binance_api::~UserDataStreams() error, what: " << e.what() << std::endl;
-                }
-                catch(...) {
-                    std::cerr << "binance_api::~UserDataStreams() error" << std::endl;
-                }
-            }
+            /* после остановки соединения его callback-функции больше не вызываются */
+            connection.stop();
+            /* доставляем оставшиеся события до разрушения callback-функций */
+            user_data_dispatcher.reset();
         };
 
         /** \brief Состояние соединения
@@ -1015,89 +2819,30 @@ namespace binance_api {
             return std::string();
         }
 
+        /** \brief Использовать внешний цикл событий
+         *
+         * Вместо собственного потока соединение обслуживается потоком io_context,
+         * который может быть общим для нескольких клиентов.
+         * Метод следует вызывать до start()
+         * \param user_event_loop Указатель на io_context
+         */
+        void set_event_loop(std::shared_ptr<SimpleWeb::io_context> user_event_loop) {
+            connection.set_event_loop(user_event_loop);
+        }
+
+        /** \brief Использовать цикл событий из пула
+         * \param pool Пул циклов событий
+         */
+        void set_event_loop(EventLoopPool &pool) {
+            set_event_loop(pool.get_io_context());
+        }
+
         /** \brief Запустить поток
+         *
+         * Без внешнего цикла событий соединение обслуживается собственным потоком
          */
         void start() {
-            if(client_future.valid()) return;
-            /* запустим соединение в отдельном потоке */
-            client_future = std::async(std::launch::async,[&]() {
-                while(!is_close_connection) {
-                    try {
-                        /* создадим соединение */;
-                        client = std::make_shared<WssClient>(
-                                (point + listen_key),
-                                true,
-                                std::string(),
-                                std::string(),
-                                std::string(sert_file));
-
-                        /* читаем собщения, которые пришли */
-                        client->on_message =
-                                [&](std::shared_ptr<WssClient::Connection> connection,
-                                std::shared_ptr<WssClient::InMessage> message) {
-                            parser(message->string());
-                            //std::cout << "on_message " << message->string() << std::endl;
-                        };
-
-                        client->on_open =
-                            [&](std::shared_ptr<WssClient::Connection> connection) {
-                            {
-                                std::lock_guard<std::mutex> lock(save_connection_mutex);
-                                save_connection = connection;
-                            }
-                            is_open = true;
-                            //std::cout << "on_open" << std::endl;
-                        };
-
-                        client->on_close =
-                                [&](std::shared_ptr<WssClient::Connection> /*connection*/,
-                                int status, const std::string & /*reason*/) {
-                            is_websocket_init = false;
-                            is_open = false;
-                            is_error = true;
-                            {
-                                std::lock_guard<std::mutex> lock(save_connection_mutex);
-                                if(save_connection) save_connection.reset();
-                            }
-                            std::cerr
-                                << point
-                                << " closed connection with status code " << status
-                                << std::endl;
-                        };
-
-                        // See http://www.boost.org/doc/libs/1_55_0/doc/html/boost_asio/reference.html, Error Codes for error code meanings
-                        client->on_error =
-                                [&](std::shared_ptr<WssClient::Connection> /*connection*/,
-                                const SimpleWeb::error_code &ec) {
-                            is_websocket_init = false;
-                            is_open = false;
-                            is_error = true;
-
-                            {
-                                std::lock_guard<std::mutex> lock(save_connection_mutex);
-                                if(save_connection) save_connection.reset();
-                            }
-
-                            std::cerr
-                                << point
-                                << " wss error: " << ec
-                                << std::endl;
-                        };
-                        client->start();
-                        client.reset();
-                    } catch (std::exception& e) {
-                        is_websocket_init = false;
-                        is_error = true;
-                    }
-                    catch (...) {
-                        is_websocket_init = false;
-                        is_error = true;
-                    }
-                    if(is_close_connection) break;
-					const uint64_t RECONNECT_DELAY = 1000;
-					std::this_thread::sleep_for(std::chrono::milliseconds(RECONNECT_DELAY));
-                } // while
-            });
+            connection.start();
         }
     };
 }
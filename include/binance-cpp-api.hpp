@@ -28,6 +28,8 @@
 #include "binance-cpp-fapi-http.hpp"
 #include "binance-cpp-sapi-http.hpp"
 #include "binance-cpp-api-websocket.hpp"
+#include "binance-cpp-api-websocket-book-ticker.hpp"
+#include "binance-cpp-api-order-engine.hpp"
 #include "named-pipe-server.hpp"
 #include "tools\binance-cpp-api-mql-hst.hpp"
 
@@ -37,11 +39,16 @@ namespace binance_api {
 
     class BinanceApi {
     private:
+        std::shared_ptr<EventLoopPool> event_loop_pool;            /**< Общий цикл событий вебсокетов, должен быть разрушен последним */
+        std::shared_ptr<TimerWheel> timer_wheel;                    /**< Общее колесо таймеров по времени сервера */
         std::shared_ptr<CandlestickStreams> timestamp_streams;      /**< Поток котировок для определения смещения метки времени */
         std::shared_ptr<CandlestickStreams> candlestick_streams;    /**< Поток котировок */
+        std::shared_ptr<BookTickerStreams> book_ticker_streams;     /**< Поток лучших цен для расчета ордеров */
         std::shared_ptr<BinanceHttpFApi> binance_http_fapi;
         std::shared_ptr<BinanceHttpSApi> binance_http_sapi;
         std::shared_ptr<UserDataStreams> user_data_streams;         /**< Поток пользовательских данных */
+        std::shared_ptr<ServerClock> server_clock;                  /**< Синхронизация времени с сервером */
+        std::shared_ptr<OrderEngine> order_engine;                  /**< Сопровождение сделок */
         std::shared_ptr<SimpleNamedPipe::NamedPipeServer> pipe_server;
         std::vector<std::shared_ptr<binance_api::MqlHst>> mql_history;
         std::mutex mql_history_mutex;
@@ -82,46 +89,572 @@ namespace binance_api {
         };
 
         std::vector<atomwrapper<bool>> is_init_mql_history;
-        std::vector<atomwrapper<bool>> is_once_mql_history;
 
         std::string listen_key;
 
-        std::mutex request_future_mutex;
-        std::vector<std::future<void>> request_future;
         std::atomic<bool> is_future_shutdown = ATOMIC_VAR_INIT(false);
 
 
         std::future<void> user_data_streams_future;
         std::atomic<bool> is_user_data_streams_future_shutdown = ATOMIC_VAR_INIT(false);
 
+        std::shared_ptr<TimerLifetime> timer_lifetime = std::make_shared<TimerLifetime>();
+        const uint64_t RECONCILE_MIN_DELAY = 1000;                  /**< Первая задержка повтора сверки, мс */
+        const uint64_t RECONCILE_MAX_DELAY = 60000;                 /**< Максимальная задержка повтора сверки, мс */
+        std::atomic<uint64_t> reconcile_retry_delay = ATOMIC_VAR_INIT(1000);
+
+        const uint64_t BOOK_TICKER_MESSAGE_TIMEOUT = 30000;         /**< Допустимое время без сообщений потока лучших цен, мс */
+        std::atomic<uint64_t> book_ticker_max_age = ATOMIC_VAR_INIT(5000);  /**< Возраст лучших цен, после которого используется цена бара, мс */
+
+        /* ограничения закрытия позиций */
+        const size_t FLATTEN_MAX_WORKERS = 64;                      /**< Наибольшее количество потоков закрытия позиций и отмены ордеров */
+        const uint64_t ORDER_LIMIT_WINDOW = 10000;                  /**< Окно ограничения количества ордеров, мс */
+        const uint32_t BACKFILL_RESERVE_WEIGHT = 600;               /**< Остаток веса запросов минуты, который загрузка пропусков оставляет ордерам */
+        std::deque<std::chrono::steady_clock::time_point> flatten_order_times;  /**< Время отправки ордеров закрытия в окне */
+        uint32_t flatten_weight = 0;                                /**< Вес выполняющихся запросов закрытия */
+        std::mutex flatten_budget_mutex;
+        std::condition_variable flatten_budget_cv;
+        std::vector<TimerWheel::timer_id> maintenance_timers;       /**< Периодические таймеры обслуживания */
+        std::deque<std::function<bool()>> maintenance_tasks;        /**< Задачи обслуживания, false - критическая ошибка */
+        std::mutex maintenance_mutex;
+        std::condition_variable maintenance_cv;
+
         std::atomic<bool> is_error = ATOMIC_VAR_INIT(false);
 
-        /** \brief Очистить список запросов
+        /** \brief Получить цену для расчета ордера
+         *
+         * Для длинной позиции используется лучшая цена продажи, для короткой - лучшая цена покупки.
+         * Если потока лучших цен нет, соединение потока разорвано или устарело, по символу еще нет данных
+         * или цены старше book_ticker_max_age, используется цена закрытия бара
+         * \param symbol Символ
+         * \param position_side Тип позиции (LONG или SHORT)
+         * \return Цена (0, если цены нет)
          */
-        void clear_request_future() {
-            std::lock_guard<std::mutex> lock(request_future_mutex);
-            size_t index = 0;
-            while(index < request_future.size()) {
-                try {
-                    if(request_future[index].valid()) {
-                        std::future_status status = request_future[index].wait_for(std::chrono::milliseconds(0));
-                        if(status == std::future_status::ready) {
-                            request_future[index].get();
-                            request_future.erase(request_future.begin() + index);
-                            continue;
-                        }
+        double get_order_price(const std::string &symbol, const TypesPositionSide position_side) {
+            if(book_ticker_streams) {
+                BookTickerStreams::handle_t handle = book_ticker_streams->get_handle(symbol);
+                /* подписываемся на символ при первом ордере, пока данных нет используем цену бара */
+                if(handle == BookTickerStreams::INVALID_HANDLE) handle = book_ticker_streams->add_symbol_stream(symbol);
+                BookTickerSpec ticker;
+                if(book_ticker_streams->connected() &&
+                    !book_ticker_streams->check_stale() &&
+                    book_ticker_streams->get_book_ticker(handle, ticker)) {
+                    const uint64_t server_time = (uint64_t)(get_server_ftimestamp() * 1000.0);
+                    const bool is_fresh = ticker.event_time == 0 ||
+                        server_time <= (ticker.event_time + book_ticker_max_age);
+                    const double price = position_side == TypesPositionSide::SHORT ? ticker.bid_price : ticker.ask_price;
+                    if(is_fresh && price > 0) return price;
+                }
+            }
+            if(!candlestick_streams) return 0;
+            return candlestick_streams->get_price(symbol);
+        }
+
+        /** \brief Синхронизировать время с сервером
+         *
+         * Смещение времени оценивается по запросам времени сервера с измерением RTT,
+         * а между запросами уточняется метками времени событий потоков котировок
+         * \return Код ошибки
+         */
+        int sync_server_clock() {
+            if(!server_clock || !binance_http_fapi) return DATA_NOT_AVAILABLE;
+            return server_clock->sync([&](uint64_t &server_time) -> int {
+                return binance_http_fapi->get_server_time(server_time);
+            });
+        }
+
+        /** \brief Сверить состояние счета с сервером
+         *
+         * Позиции, балансы и открытые ордера запрашиваются параллельно, затем кэш потока
+         * пользовательских данных сверяется с ответами и снова отмечается актуальным.
+         * События потока, пришедшие во время запросов, применяются после снимка
+         * \return Код ошибки
+         */
+        int reconcile_account() {
+            std::shared_ptr<BinanceHttpFApi> http = binance_http_fapi;
+            std::shared_ptr<UserDataStreams> streams = user_data_streams;
+            if(!http || !streams) return DATA_NOT_AVAILABLE;
+            std::vector<PositionSpec> list_positions;
+            std::vector<BalanceSpec> list_balances;
+            std::vector<OrderUpdateSpec> list_orders;
+            std::vector<std::string> missing_orders;
+            streams->begin_reconcile();
+            /* запросы независимы, выполняем их параллельно */
+            std::future<int> position_future = std::async(std::launch::async, [&]() -> int {
+                return http->get_position_risk("", [&](const PositionSpec &position) {
+                    list_positions.push_back(position);
+                });
+            });
+            std::future<int> balance_future = std::async(std::launch::async, [&]() -> int {
+                return http->get_balance([&](const BalanceSpec &balance) {
+                    list_balances.push_back(balance);
+                });
+            });
+            const int err_orders = http->get_open_orders("", list_orders);
+            const int err_positions = position_future.get();
+            const int err_balances = balance_future.get();
+            if(err_positions != OK) {
+                std::cerr <<"Error: BinanceApi::reconcile_account(), what: binance_http_fapi::get_position_risk(), code: " << err_positions << std::endl;
+                streams->cancel_reconcile();
+                return err_positions;
+            }
+            if(err_balances != OK) {
+                std::cerr <<"Error: BinanceApi::reconcile_account(), what: binance_http_fapi::get_balance(), code: " << err_balances << std::endl;
+                streams->cancel_reconcile();
+                return err_balances;
+            }
+            if(err_orders != OK) {
+                std::cerr <<"Error: BinanceApi::reconcile_account(), what: binance_http_fapi::get_open_orders(), code: " << err_orders << std::endl;
+                streams->cancel_reconcile();
+                return err_orders;
+            }
+            /* ордера, которые закрылись во время разрыва, запрашиваем отдельно */
+            std::set<std::string> open_ids;
+            for(size_t i = 0; i < list_orders.size(); ++i) {
+                open_ids.insert(list_orders[i].client_order_id);
+            }
+            std::vector<OrderUpdateSpec> cached_orders = streams->get_open_orders();
+            for(size_t i = 0; i < cached_orders.size(); ++i) {
+                if(open_ids.find(cached_orders[i].client_order_id) != open_ids.end()) continue;
+                OrderUpdateSpec order;
+                int err = http->get_order(cached_orders[i].symbol, cached_orders[i].client_order_id, order);
+                /* ордера нет на сервере (например, истек срок хранения), удаляем его из кэша */
+                if(err == NO_SUCH_ORDER) {
+                    missing_orders.push_back(cached_orders[i].client_order_id);
+                    continue;
+                }
+                if(err != OK) {
+                    std::cerr <<"Error: BinanceApi::reconcile_account(), what: binance_http_fapi::get_order(), code: " << err << std::endl;
+                    streams->cancel_reconcile();
+                    return err;
+                }
+                list_orders.push_back(order);
+            }
+            streams->reconcile(list_positions, list_balances, list_orders, missing_orders);
+            return OK;
+        }
+
+        /** \brief Запланировать сверку состояния счета
+         *
+         * Сверка выполняется в потоке обслуживания. При ошибке она повторяется
+         * с экспоненциально растущей задержкой, после успешной сверки задержка сбрасывается
+         */
+        void schedule_reconcile() {
+            post_maintenance([&]() -> bool {
+                int err = reconcile_account();
+                if(err == OK) {
+                    reconcile_retry_delay = RECONCILE_MIN_DELAY;
+                    return true;
+                }
+                if(timer_wheel) {
+                    const uint64_t delay = reconcile_retry_delay;
+                    reconcile_retry_delay = std::min(delay * 2, RECONCILE_MAX_DELAY);
+                    timer_wheel->schedule_after(delay, TimerLifetime::wrap(timer_lifetime, [&]() {
+                        schedule_reconcile();
+                    }));
+                }
+                return true;
+            });
+        }
+
+        /** \brief Продлить или обновить ключ потока пользовательских данных
+         *
+         * Если сервер выдал другой ключ, поток переподключается с ним, после чего выполняется сверка
+         * \return Код ошибки
+         */
+        int renew_listen_key() {
+            if(!binance_http_fapi || !user_data_streams) return DATA_NOT_AVAILABLE;
+            std::string new_listen_key;
+            int err = binance_http_fapi->start_user_data_stream(new_listen_key);
+            if(err != OK) return err;
+            if(new_listen_key == listen_key && user_data_streams->check_valid()) return OK;
+            listen_key = new_listen_key;
+            user_data_streams->set_listen_key(listen_key);
+            user_data_streams->force_reconnect();
+            return OK;
+        }
+
+        /** \brief Получить позицию
+         *
+         * Пока состояние счета не сверено после разрыва потока, позиция запрашивается по REST API
+         * \param symbol Символ
+         * \param position_side Тип позиции (SHORT, LONG, BOTH)
+         * \param position Позиция
+         * \return Вернет true, если позиция есть
+         */
+        bool get_position(const std::string &symbol, const TypesPositionSide position_side, PositionSpec &position) {
+            if(user_data_streams->check_valid()) return user_data_streams->get_position(symbol, position_side, position);
+            bool is_found = false;
+            int err = binance_http_fapi->get_position_risk(symbol, [&](const PositionSpec &item) {
+                if(item.position_side != position_side) return;
+                position = item;
+                is_found = true;
+            });
+            if(err != OK) return user_data_streams->get_position(symbol, position_side, position);
+            return is_found;
+        }
+
+        /** \brief Задача закрытия позиции или отмены ордеров символа
+         */
+        class FlattenTask {
+        public:
+            size_t index = 0;           /**< Индекс результата символа */
+            bool is_order = false;      /**< Задача отправляет ордер закрытия позиции */
+            OrderRequestSpec order;     /**< Ордер закрытия позиции */
+            FlattenTask() {};
+        };
+
+        /** \brief Получить открытые позиции и символы с открытыми ордерами
+         *
+         * Пока кэш потока пользовательских данных актуален, запросы к серверу не выполняются,
+         * иначе позиции и открытые ордера запрашиваются параллельно
+         * \param positions Открытые позиции
+         * \param order_symbols Символы с открытыми ордерами
+         * \param is_orders_known Вернет false, если открытые ордера получить не удалось
+         * \return Код ошибки
+         */
+        int get_flatten_state(
+                std::vector<PositionSpec> &positions,
+                std::set<std::string> &order_symbols,
+                bool &is_orders_known) {
+            std::shared_ptr<BinanceHttpFApi> http = binance_http_fapi;
+            std::shared_ptr<UserDataStreams> streams = user_data_streams;
+            is_orders_known = true;
+            if(streams->check_valid()) {
+                std::shared_ptr<const UserDataStreams::position_table> table = streams->get_positions_snapshot();
+                for(auto &item : *table) {
+                    if(item.second->position_amount != 0.0) positions.push_back(*item.second);
+                }
+                std::vector<OrderUpdateSpec> list_orders = streams->get_open_orders();
+                for(size_t i = 0; i < list_orders.size(); ++i) {
+                    order_symbols.insert(list_orders[i].symbol);
+                }
+                return OK;
+            }
+            std::vector<OrderUpdateSpec> list_orders;
+            std::future<int> orders_future = std::async(std::launch::async, [&]() -> int {
+                return http->get_open_orders("", list_orders);
+            });
+            const int err_positions = http->get_position_risk("", [&](const PositionSpec &position) {
+                if(position.position_amount != 0.0) positions.push_back(position);
+            });
+            const int err_orders = orders_future.get();
+            if(err_positions != OK) {
+                std::cerr <<"Error: BinanceApi::get_flatten_state(), what: binance_http_fapi::get_position_risk(), code: " << err_positions << std::endl;
+                return err_positions;
+            }
+            if(err_orders != OK) {
+                /* без списка ордеров отменяем ордера всех символов */
+                std::cerr <<"Error: BinanceApi::get_flatten_state(), what: binance_http_fapi::get_open_orders(), code: " << err_orders << std::endl;
+                is_orders_known = false;
+                return OK;
+            }
+            for(size_t i = 0; i < list_orders.size(); ++i) {
+                order_symbols.insert(list_orders[i].symbol);
+            }
+            return OK;
+        }
+
+        /** \brief Выполнить задачу закрытия позиции или отмены ордеров
+         * \param task Задача
+         * \param symbol Символ
+         * \return Код ошибки
+         */
+        int run_flatten_task(const FlattenTask &task, const std::string &symbol) {
+            if(!task.is_order) return binance_http_fapi->cancel_all_order(symbol);
+            OrderResultSpec result;
+            /* через сопровождение сделок ордер не будет продублирован при неизвестном ответе */
+            std::shared_ptr<OrderEngine> engine = std::atomic_load(&order_engine);
+            int err = engine ?
+                engine->submit_order(task.order, result) :
+                binance_http_fapi->open_order(task.order, result);
+            return err != OK ? err : result.error_code;
+        }
+
+        /** \brief Дождаться веса запросов и ограничения ордеров для задачи закрытия
+         *
+         * Ордера учитываются в скользящем окне ORDER_LIMIT_WINDOW, вес запроса сравнивается
+         * с остатком веса текущей минуты за вычетом запросов, которые еще выполняются
+         * \param task Задача
+         */
+        void acquire_flatten_budget(const FlattenTask &task) {
+            const uint32_t weight = task.is_order ?
+                BinanceHttpFApi::ORDER_WEIGHT : BinanceHttpFApi::CANCEL_ALL_ORDERS_WEIGHT;
+            const std::chrono::milliseconds window(ORDER_LIMIT_WINDOW);
+            std::unique_lock<std::mutex> lock(flatten_budget_mutex);
+            while(true) {
+                const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+                while(!flatten_order_times.empty() && (now - flatten_order_times.front()) >= window) {
+                    flatten_order_times.pop_front();
+                }
+                const size_t order_limit = std::max((uint32_t)1, binance_http_fapi->get_order_limit());
+                if(task.is_order && flatten_order_times.size() >= order_limit) {
+                    flatten_budget_cv.wait_until(lock, flatten_order_times.front() + window);
+                    continue;
+                }
+                /* вес освобождается после выполнения запросов или в следующую минуту */
+                if(binance_http_fapi->get_request_budget() < (flatten_weight + weight)) {
+                    flatten_budget_cv.wait_for(lock, std::chrono::milliseconds(100));
+                    continue;
+                }
+                if(task.is_order) flatten_order_times.push_back(now);
+                flatten_weight += weight;
+                return;
+            }
+        }
+
+        /** \brief Освободить вес запроса задачи закрытия
+         * \param task Задача
+         */
+        void release_flatten_budget(const FlattenTask &task) {
+            const uint32_t weight = task.is_order ?
+                BinanceHttpFApi::ORDER_WEIGHT : BinanceHttpFApi::CANCEL_ALL_ORDERS_WEIGHT;
+            std::lock_guard<std::mutex> lock(flatten_budget_mutex);
+            flatten_weight -= weight;
+            flatten_budget_cv.notify_all();
+        }
+
+        /** \brief Получить количество потоков закрытия
+         *
+         * Потоков не больше, чем задач, и не больше, чем запросов, которые позволяют
+         * остаток веса текущей минуты и ограничение количества ордеров
+         * \param tasks Задачи
+         * \return Количество потоков
+         */
+        size_t get_flatten_workers(const std::vector<FlattenTask> &tasks) {
+            bool is_order = false;
+            for(size_t i = 0; i < tasks.size() && !is_order; ++i) {
+                is_order = tasks[i].is_order;
+            }
+            const uint32_t weight = BinanceHttpFApi::ORDER_WEIGHT > BinanceHttpFApi::CANCEL_ALL_ORDERS_WEIGHT ?
+                BinanceHttpFApi::ORDER_WEIGHT : BinanceHttpFApi::CANCEL_ALL_ORDERS_WEIGHT;
+            size_t num_requests = binance_http_fapi->get_request_budget() / weight;
+            if(is_order) num_requests = std::min(num_requests, (size_t)binance_http_fapi->get_order_limit());
+            return std::max((size_t)1, std::min(std::min(tasks.size(), num_requests), FLATTEN_MAX_WORKERS));
+        }
+
+        /** \brief Выполнить задачи закрытия в потоках закрытия
+         *
+         * Единственная задача (например, закрытие одного символа) выполняется в вызывающем потоке
+         * \param tasks Задачи
+         * \param results Результаты символов
+         */
+        void run_flatten_tasks(const std::vector<FlattenTask> &tasks, std::vector<FlattenResultSpec> &results) {
+            if(tasks.empty()) return;
+            std::vector<int> errors(tasks.size(), OK);
+            std::atomic<size_t> next_task = ATOMIC_VAR_INIT(0);
+            auto run_worker = [&]() {
+                while(true) {
+                    const size_t i = next_task++;
+                    if(i >= tasks.size()) break;
+                    acquire_flatten_budget(tasks[i]);
+                    try {
+                        errors[i] = run_flatten_task(tasks[i], results[tasks[i].index].symbol);
+                    } catch(...) {
+                        errors[i] = DATA_NOT_AVAILABLE;
                     }
+                    release_flatten_budget(tasks[i]);
                 }
-                catch(const std::exception &e) {
-                    std::cerr <<"Error: BinanceApi::clear_request_future(), what: " << e.what() << std::endl;
+            };
+            const size_t num_workers = get_flatten_workers(tasks);
+            if(num_workers == 1) {
+                run_worker();
+            } else {
+                std::vector<std::future<void>> workers;
+                for(size_t n = 0; n < num_workers; ++n) {
+                    workers.push_back(std::async(std::launch::async, run_worker));
                 }
-                catch(...) {
-                    std::cerr <<"Error: BinanceApi::clear_request_future()" << std::endl;
+                for(size_t n = 0; n < workers.size(); ++n) {
+                    workers[n].get();
+                }
+            }
+            for(size_t i = 0; i < tasks.size(); ++i) {
+                FlattenResultSpec &result = results[tasks[i].index];
+                if(tasks[i].is_order) {
+                    if(errors[i] == OK) ++result.closed_positions;
+                    else if(result.close_error_code == OK) result.close_error_code = errors[i];
+                } else {
+                    result.cancel_error_code = errors[i];
+                    result.is_canceled = errors[i] == OK;
                 }
-                ++index;
             }
         }
 
+        /** \brief Закрыть позиции и отменить ордера символов
+         *
+         * Сначала отправляются ордера закрытия позиций всех символов, затем отменяются ордера.
+         * Запросы выполняются потоками по числу задач в пределах остатка веса запросов (см. get_flatten_workers()),
+         * каждый запрос ожидает остатка веса запросов и ограничения количества ордеров (см. acquire_flatten_budget()).
+         * Закрытие одного символа выполняется в вызывающем потоке
+         * \param symbols Символы
+         * \param is_all Добавить все символы с позициями и ордерами
+         * \param results Результаты символов
+         * \return Код ошибки
+         */
+        int flatten_symbols(
+                const std::vector<std::string> &symbols,
+                const bool is_all,
+                std::vector<FlattenResultSpec> &results) {
+            results.clear();
+            if(is_error) return DATA_NOT_AVAILABLE;
+            if(!binance_http_fapi) return DATA_NOT_AVAILABLE;
+            if(!user_data_streams) return DATA_NOT_AVAILABLE;
+            std::vector<PositionSpec> positions;
+            std::set<std::string> order_symbols;
+            bool is_orders_known = true;
+            int err = get_flatten_state(positions, order_symbols, is_orders_known);
+            if(err != OK) return err;
+
+            std::map<std::string, size_t> indexes;
+            auto add_symbol = [&](const std::string &symbol) {
+                if(indexes.find(symbol) != indexes.end()) return;
+                indexes[symbol] = results.size();
+                results.push_back(FlattenResultSpec());
+                results.back().symbol = symbol;
+            };
+            for(size_t i = 0; i < symbols.size(); ++i) {
+                add_symbol(symbols[i]);
+            }
+            if(is_all) {
+                for(size_t i = 0; i < positions.size(); ++i) {
+                    add_symbol(positions[i].symbol);
+                }
+                for(auto &symbol : order_symbols) {
+                    add_symbol(symbol);
+                }
+            }
+
+            /* отмена ордеров после закрытия позиций, иначе стоп ордера снимаются раньше, чем закрыта позиция */
+            std::vector<FlattenTask> close_tasks;
+            std::vector<FlattenTask> cancel_tasks;
+            std::vector<bool> is_position(results.size(), false);
+            for(size_t i = 0; i < positions.size(); ++i) {
+                auto it = indexes.find(positions[i].symbol);
+                if(it == indexes.end()) continue;
+                FlattenTask task;
+                task.index = it->second;
+                task.is_order = true;
+                task.order.symbol = positions[i].symbol;
+                task.order.new_client_order_id = get_uuid(get_server_ftimestamp());
+                task.order.type = TypesOrder::MARKET;
+                task.order.position_side = positions[i].position_side;
+                task.order.quantity = std::abs(positions[i].position_amount);
+                if(positions[i].position_side == TypesPositionSide::LONG) task.order.side = TypesSide::SELL;
+                else if(positions[i].position_side == TypesPositionSide::SHORT) task.order.side = TypesSide::BUY;
+                else {
+                    task.order.side = positions[i].position_amount > 0 ? TypesSide::SELL : TypesSide::BUY;
+                    task.order.reduce_only = true;
+                }
+                close_tasks.push_back(task);
+                is_position[task.index] = true;
+            }
+            for(size_t i = 0; i < results.size(); ++i) {
+                if(is_orders_known && !is_position[i] &&
+                    order_symbols.find(results[i].symbol) == order_symbols.end()) continue;
+                FlattenTask task;
+                task.index = i;
+                cancel_tasks.push_back(task);
+            }
+            run_flatten_tasks(close_tasks, results);
+            run_flatten_tasks(cancel_tasks, results);
+
+            for(size_t i = 0; i < results.size(); ++i) {
+                const int err_symbol = results[i].get_error_code();
+                if(err_symbol == OK) continue;
+                std::cerr <<"Error: BinanceApi::flatten_symbols(), what: " << results[i].symbol << ", code: " << err_symbol << std::endl;
+                if(err == OK) err = err_symbol;
+            }
+            return err;
+        }
+
+        /** \brief Передать задачу обслуживания в поток обслуживания
+         *
+         * Запросы к серверу не выполняются в потоке колеса таймеров, чтобы не задерживать другие таймеры
+         * \param task Задача, вернет false при критической ошибке
+         */
+        void post_maintenance(std::function<bool()> task) {
+            std::lock_guard<std::mutex> lock(maintenance_mutex);
+            maintenance_tasks.push_back(task);
+            maintenance_cv.notify_one();
+        }
+
+        /// Остановить таймеры обслуживания
+        void stop_maintenance_timers() {
+            std::lock_guard<std::mutex> lock(maintenance_mutex);
+            if(timer_wheel) {
+                for(size_t i = 0; i < maintenance_timers.size(); ++i) {
+                    timer_wheel->cancel(maintenance_timers[i]);
+                }
+            }
+            maintenance_timers.clear();
+            maintenance_tasks.clear();
+        }
+
+        /** \brief Запустить таймеры обслуживания
+         * \param period Период таймера, мс
+         * \param task Задача таймера
+         */
+        void add_maintenance_timer(const uint64_t period, std::function<bool()> task) {
+            const TimerWheel::timer_id id = timer_wheel->schedule_every(period, TimerLifetime::wrap(timer_lifetime, [&, task]() {
+                post_maintenance(task);
+            }));
+            std::lock_guard<std::mutex> lock(maintenance_mutex);
+            maintenance_timers.push_back(id);
+        }
+
+        void start_maintenance_timers() {
+            /* продление потока пользовательских данных, истекший ключ заменяется новым */
+            add_maintenance_timer(xtime::SECONDS_IN_MINUTE * 30 * 1000, [&]() -> bool {
+                if(!binance_http_fapi) return true;
+                int err = binance_http_fapi->keepalive_user_data_stream();
+                if(err != binance_api::OK) {
+                    std::cerr <<"Error: BinanceApi::init_main, what: binance_http_fapi::keepalive_user_data_stream(), code: " << err << std::endl;
+                    err = renew_listen_key();
+                    if(err != binance_api::OK) {
+                        std::cerr <<"Error: BinanceApi::init_main, what: binance_http_fapi::start_user_data_stream(), code: " << err << std::endl;
+                        return false;
+                    }
+                }
+                return true;
+            });
+
+            /* синхронизация времени, ошибка не критична - остается прежняя оценка смещения */
+            add_maintenance_timer(xtime::SECONDS_IN_MINUTE * 1000, [&]() -> bool {
+                int err = sync_server_clock();
+                if(err != binance_api::OK) {
+                    std::cerr <<"Error: BinanceApi::init_main, what: binance_http_fapi::get_server_time(), code: " << err << std::endl;
+                }
+                return true;
+            });
+
+            /* обновление параметров символов */
+            add_maintenance_timer(xtime::SECONDS_IN_MINUTE * 1000, [&]() -> bool {
+                if(binance_http_fapi) {
+                    int err = binance_http_fapi->get_exchange_info();
+                    if(err != binance_api::OK) {
+                        std::cerr <<"Error: BinanceApi::init_main, what: binance_http_fapi::get_exchange_info(), code: " << err << std::endl;
+                        return false;
+                    }
+                }
+                if(binance_http_sapi) {
+                    int err = binance_http_sapi->get_exchange_info();
+                    if(err != binance_api::OK) {
+                        std::cerr <<"Error: BinanceApi::init_main, what: binance_http_sapi::get_exchange_info(), code: " << err << std::endl;
+                        return false;
+                    }
+                }
+                return true;
+            });
+
+            /* пинг клиентов именованного канала */
+            add_maintenance_timer(5000, [&]() -> bool {
+                if(is_pipe_server && pipe_server) {
+                    pipe_server->send_all("{\"ping\":1}");
+                }
+                return true;
+            });
+        }
+
     public:
 
         /** \brief Инициализация главных компонент API
@@ -154,8 +687,26 @@ namespace binance_api {
                 return false;
             }
 
+            /* синхронизируем время до первого запроса с подписью */
+            server_clock = std::make_shared<ServerClock>();
+            binance_http_fapi->set_server_clock(server_clock);
+            binance_http_sapi->set_server_clock(server_clock);
+            int err = sync_server_clock();
+            if(err != binance_api::OK) {
+                std::cerr <<"Error: BinanceApi::init_main(), what: binance_http_fapi::get_server_time(), code: " << err << std::endl;
+            }
+
+            /* все таймеры API (экспирация сделок, закрытие баров, обслуживание) ведутся по времени сервера */
+            if(!timer_wheel) timer_wheel = std::make_shared<TimerWheel>();
+            {
+                std::shared_ptr<ServerClock> clock_ptr = server_clock;
+                timer_wheel->set_time_source([clock_ptr]() -> xtime::ftimestamp_t {
+                    return clock_ptr->get_server_ftimestamp();
+                });
+            }
+
             /* устанавливаем режим хеджирования */
-            int err = binance_http_fapi->change_position_mode(settings.position_mode);
+            err = binance_http_fapi->change_position_mode(settings.position_mode);
             if(err != binance_api::OK) {
                 is_error = true;
                 std::cerr <<"Error: BinanceApi::init_main(), what: binance_http_fapi::change_position_mode(), code: " << err << std::endl;
@@ -195,6 +746,10 @@ namespace binance_api {
 
             /* создаем поток пользовательских данных */
             user_data_streams = std::make_shared<UserDataStreams>(listen_key, settings.demo);
+            if(settings.event_loop_threads > 0) {
+                if(!event_loop_pool) event_loop_pool = std::make_shared<EventLoopPool>(settings.event_loop_threads, settings.event_loop_cores);
+                user_data_streams->set_event_loop(*event_loop_pool);
+            }
             user_data_streams->on_balance = [&](const binance_api::BalanceSpec &balance){
                 //std::cout << "on_balance, " << balance.asset << " balance: " << balance.wallet_balance << std::endl;
                 if(is_pipe_server && pipe_server) {
@@ -209,32 +764,57 @@ namespace binance_api {
                 }
             };
 
+            /* после разрыва соединения или истечения ключа события могли быть пропущены */
+            user_data_streams->on_reconnect = [&]() {
+                schedule_reconcile();
+            };
+
+            user_data_streams->on_listen_key_expired = [&]() {
+                post_maintenance([&]() -> bool {
+                    int err = renew_listen_key();
+                    if(err != binance_api::OK) {
+                        std::cerr <<"Error: BinanceApi::init_main, what: binance_http_fapi::start_user_data_stream(), code: " << err << std::endl;
+                        return false;
+                    }
+                    return true;
+                });
+            };
+
             user_data_streams->on_position = [&](const binance_api::PositionSpec &position){
                 //std::cout
                 //    << "on_position, " << position.symbol
                 //    << " position side: " << (int)position.position_side
                 //    << " amount: " << position.position_amount << std::endl;
+                std::shared_ptr<OrderEngine> engine = std::atomic_load(&order_engine);
+                if(engine) engine->on_position(position);
             };
 
+            /* сделки сопровождаются по событиям позиций, а не опросом в отдельных потоках */
+            std::atomic_store(&order_engine, std::make_shared<OrderEngine>(
+                binance_http_fapi,
+                user_data_streams,
+                [&](const std::string &symbol) -> int {
+                    return close_order(symbol);
+                },
+                [&](const std::string &symbol, const TypesPositionSide position_side) -> double {
+                    return get_order_price(symbol, position_side);
+                },
+                settings.order_engine_threads,
+                timer_wheel));
+
+            /* переносим обработку событий из потока вебсокета в поток потребителя */
+            if(settings.dispatch_queue_size > 0) {
+                user_data_streams->set_async_dispatch(settings.dispatch_queue_size, settings.dispatch_policy);
+            }
+
             /*  запускаем поток пользовательских данных */
             user_data_streams->start();
 
-            /* узнаем состояние позиций */
-            err = binance_http_fapi->get_position_risk("",[&](const binance_api::PositionSpec &position) {
-                user_data_streams->set_position(position);
-            });
+            /* узнаем состояние позиций, баланс и открытые ордера */
+            err = reconcile_account();
             if(err != binance_api::OK) {
                 is_error = true;
-                std::cerr <<"Error: BinanceApi::init_main(), what: binance_http_fapi::get_position_risk(), code: " << err << std::endl;
-                return false;
-            }
-
-            /* узнаем баланс */
-            err = binance_http_fapi->get_balance([&](const binance_api::BalanceSpec &balance) {
-                user_data_streams->set_balance(balance);
-            });
-            if(err != binance_api::OK) {
-                std::cerr <<"Error: BinanceApi::init_main(), what: binance_http_fapi::get_balance(), code: " << err << std::endl;
+                std::cerr <<"Error: BinanceApi::init_main(), what: reconcile_account(), code: " << err << std::endl;
                 return false;
             }
 
@@ -252,6 +832,8 @@ namespace binance_api {
             timestamp_streams = std::make_shared<CandlestickStreams>(
                 endpoint_type,
                 settings.sert_file);
+            if(event_loop_pool) timestamp_streams->set_event_loop(*event_loop_pool);
+            timestamp_streams->set_server_clock(server_clock);
 
             const std::vector<std::string> timestamp_streams_symbol = {"BTCUSDT", "ETCUSDT", "LTCUSDT"};
             const uint32_t timestamp_streams_period = 1;
@@ -260,12 +842,34 @@ namespace binance_api {
             timestamp_streams->add_symbol_stream(timestamp_streams_symbol[2], timestamp_streams_period);
             timestamp_streams->start();
 
+            /* поток лучших цен для расчета тейк-профита и стоп-лосса по исполнимой цене */
+            if(settings.book_ticker_stream) {
+                book_ticker_streams = std::make_shared<BookTickerStreams>(
+                    settings.demo ? BookTickerStreams::EndpointTypes::FUTURES_DEMO : BookTickerStreams::EndpointTypes::FUTURES_REAL,
+                    2048,
+                    settings.sert_file);
+                if(event_loop_pool) book_ticker_streams->set_event_loop(*event_loop_pool);
+                /* зависшее соединение переподключается, а его цены не используются для расчета ордеров */
+                book_ticker_streams->set_watchdog(BOOK_TICKER_MESSAGE_TIMEOUT);
+                book_ticker_max_age = settings.book_ticker_max_age;
+                for(size_t i = 0; i < settings.symbols.size(); ++i) {
+                    book_ticker_streams->add_symbol_stream(settings.symbols[i].first);
+                }
+                book_ticker_streams->start();
+            }
 
-            /* Запускаем очень медленный поток для продления работы потока user_data_streams.
-             * Также в данном потоке обновляем смещение метки времени для http api.
+
+            /* Запускаем поток обслуживания: продление работы потока user_data_streams,
+             * синхронизация времени с сервером и обновление параметров символов.
+             * Задачи поступают от периодических таймеров колеса таймеров, поток ждет их без опроса.
              * Перед запуском также проверяем, не был ли поток запущен ранее.
              */
+            stop_maintenance_timers();
             is_user_data_streams_future_shutdown = true;
+            {
+                std::lock_guard<std::mutex> lock(maintenance_mutex);
+                maintenance_cv.notify_all();
+            }
             if(user_data_streams_future.valid()) {
                 try {
                     user_data_streams_future.wait();
@@ -281,64 +885,27 @@ namespace binance_api {
             is_user_data_streams_future_shutdown = false;
 
             user_data_streams_future = std::async(std::launch::async,[&] {
-                xtime::timestamp_t last_time = xtime::get_timestamp();
-                xtime::timestamp_t last_time2 = xtime::get_timestamp();
                 while(!is_future_shutdown && !is_user_data_streams_future_shutdown) {
-                    //
-                    xtime::timestamp_t cur_time = xtime::get_timestamp();
-                    if((cur_time - last_time) > (xtime::SECONDS_IN_MINUTE * 30)) {
-                        last_time = cur_time;
-                        /* подписка на поток пользовательских данных */
-                        if(binance_http_fapi) {
-                            int err = binance_http_fapi->keepalive_user_data_stream();
-                            if(err != binance_api::OK) {
-                                is_error = true;
-                                std::cerr <<"Error: BinanceApi::init_main, what: binance_http_fapi::keepalive_user_data_stream(), code: " << err << std::endl;
-                                return;
-                            }
-                        }
+                    std::function<bool()> task;
+                    {
+                        std::unique_lock<std::mutex> lock(maintenance_mutex);
+                        maintenance_cv.wait(lock, [&]() {
+                            return !maintenance_tasks.empty() ||
+                                is_future_shutdown ||
+                                is_user_data_streams_future_shutdown;
+                        });
+                        if(maintenance_tasks.empty()) continue;
+                        task = maintenance_tasks.front();
+                        maintenance_tasks.pop_front();
                     }
-                    //
-                    cur_time = xtime::get_timestamp();
-                    if((cur_time - last_time2) > xtime::SECONDS_IN_MINUTE) {
-                        last_time2 = cur_time;
-                        if(binance_http_fapi) {
-                            int err = binance_http_fapi->get_exchange_info();
-                            if(err != binance_api::OK) {
-                                is_error = true;
-                                std::cerr <<"Error: BinanceApi::init_main, what: binance_http_fapi::get_exchange_info(), code: " << err << std::endl;
-                                return;
-                            }
-                        }
-                        if(binance_http_sapi) {
-                            int err = binance_http_sapi->get_exchange_info();
-                            if(err != binance_api::OK) {
-                                is_error = true;
-                                std::cerr <<"Error: BinanceApi::init_main, what: binance_http_sapi::get_exchange_info(), code: " << err << std::endl;
-                                return;
-                            }
-                        }
-                    }
-
-                    /* обновляем смещение метки времени доступынм образом */
-                    if(binance_http_fapi) {
-                        if(candlestick_streams && candlestick_streams->connected()) {
-                            binance_http_fapi->set_server_offset_timestamp(candlestick_streams->get_offset_timestamp());
-                        } else
-                        if(timestamp_streams && timestamp_streams->connected()) {
-                            binance_http_fapi->set_server_offset_timestamp(timestamp_streams->get_offset_timestamp());
-                        }
-                    }
-
-                    /* отправляем пинг */
-                    if(is_pipe_server && pipe_server) {
-                        pipe_server->send_all("{\"ping\":1}");
+                    if(!task()) {
+                        is_error = true;
+                        stop_maintenance_timers();
+                        return;
                     }
-
-                    /* ждем некоторое время, данный поток не должен быть быстрым */
-                    std::this_thread::sleep_for(std::chrono::milliseconds(5000));
                 };
             });
+            start_maintenance_timers();
             return true;
         }
 
@@ -359,6 +926,17 @@ namespace binance_api {
             candlestick_streams = std::make_shared<CandlestickStreams>(
                 endpoint_type,
                 settings.sert_file);
+            candlestick_streams->set_server_clock(server_clock);
+            candlestick_streams->set_timer_wheel(timer_wheel);
+            if(settings.event_loop_threads > 0) {
+                if(!event_loop_pool) event_loop_pool = std::make_shared<EventLoopPool>(settings.event_loop_threads, settings.event_loop_cores);
+                candlestick_streams->set_event_loop(*event_loop_pool);
+            }
+
+            /* запись истории MQL не должна задерживать поток вебсокета */
+            if(settings.dispatch_queue_size > 0) {
+                candlestick_streams->set_async_dispatch(settings.dispatch_queue_size, settings.dispatch_policy);
+            }
 
             /* проверяем параметры символов */
             for(size_t i = 0; i < settings.symbols.size(); ++i) {
@@ -406,16 +984,13 @@ namespace binance_api {
             }
 
             is_init_mql_history.resize(settings.symbols.size());
-            is_once_mql_history.resize(settings.symbols.size());
             for(size_t i = 0; i < settings.symbols.size(); ++i) {
                 is_init_mql_history.push_back(std::atomic<bool>(false));
-                is_once_mql_history.push_back(std::atomic<bool>(false));
                 //is_init_mql_history[i] = false;
-                //is_once_mql_history[i] = false;
             }
 
             /* инициализируем callback функцию потока котировок */
-            candlestick_streams->on_candle = [&](
+            auto mql_candle_callback = [&](
                     const std::string &symbol,
                     const xquotes_common::Candle &candle,
                     const uint32_t period,
@@ -436,32 +1011,6 @@ namespace binance_api {
                         /* проверяем наличие инициализации исторических данных */
                         if(is_init_mql_history[i] == false) continue;
 
-                        /* проверяем, была ли только что загрузка исторических данных */
-                        if(is_once_mql_history[i] == false) {
-                            /* получаем последнюю метку времени исторических данных */
-                            xtime::timestamp_t last_timestamp = 0;
-                            {
-                                std::lock_guard<std::mutex> lock(mql_history_mutex);
-                                last_timestamp = mql_history[i]->get_last_timestamp();
-                            }
-
-                            /* проверяем, не успел ли прийти новый бар,
-                             * пока мы загружали исторические данных
-                             */
-                            if(candle.timestamp > last_timestamp) {
-                                /* добавляем пропущенные исторические данные */
-                                const xtime::timestamp_t step_time = period * xtime::SECONDS_IN_MINUTE;
-                                for(xtime::timestamp_t t = last_timestamp; t < candle.timestamp; t += step_time) {
-                                    xquotes_common::Candle old_candle = candlestick_streams->get_timestamp_candle(symbol, period, t);
-                                    std::lock_guard<std::mutex> lock(mql_history_mutex);
-
-                                    /* если бар есть в истории потока котировок, то загрузим данные. Иначе пропускаем */
-                                    if(old_candle.close != 0 && old_candle.timestamp == t) mql_history[i]->add_new_candle(old_candle);
-                                }
-                            }
-                            is_once_mql_history[i] = true;
-                        }
-
                         /* если параметры соответствуют, обновляем исторические данные */
                         if(close_candle) {
                             std::lock_guard<std::mutex> lock(mql_history_mutex);
@@ -488,12 +1037,31 @@ namespace binance_api {
 #               endif
             };
 
-            /* инициализируем потоки котировок */
-            for(size_t i = 0; i < settings.symbols.size(); ++i) {
-                candlestick_streams->add_symbol_stream(settings.symbols[i].first, settings.symbols[i].second);
+            /* запись истории MQL может отставать от потока, тогда ей достаточно последних значений баров */
+            if(settings.conflate_candles) {
+                candlestick_streams->add_conflated_consumer(mql_candle_callback);
+            } else {
+                candlestick_streams->on_candle = mql_candle_callback;
             }
-            candlestick_streams->start();
-            candlestick_streams->wait();
+
+            /* пропуски после переподключения и между историей и потоком загружаются через REST API
+             * собственными потоками загрузки, пока остаток веса запросов минуты не меньше резерва
+             */
+            CandlestickStreams::budget_function backfill_budget = nullptr;
+            if(settings.futures_candlestick_stream) {
+                backfill_budget = [&]() -> bool {
+                    return binance_http_fapi->get_request_budget() >= BACKFILL_RESERVE_WEIGHT;
+                };
+            }
+            candlestick_streams->set_backfill_provider([&](
+                    std::vector<xquotes_common::Candle> &candles,
+                    const std::string &symbol,
+                    const uint32_t period,
+                    const xtime::timestamp_t start_date,
+                    const xtime::timestamp_t stop_date) -> int {
+                if(settings.futures_candlestick_stream) return binance_http_fapi->get_historical_data(candles, symbol, period, start_date, stop_date);
+                return binance_http_sapi->get_historical_data(candles, symbol, period, start_date, stop_date);
+            }, backfill_budget);
 
             /* загружаем исторические данные */
             for(size_t i = 0; i < settings.symbols.size(); ++i) {
@@ -524,10 +1092,42 @@ namespace binance_api {
 #               endif
                 }
 
+                /* передаем историю потоку котировок, чтобы он дозагрузил бары до первого бара потока */
+                candlestick_streams->init_array_candles(settings.symbols[i].first, settings.symbols[i].second, candles);
+
                 /* ставим флаг инициализации исторических данных */
                 is_init_mql_history[i] = true;
                 std::cout << settings.symbols[i].first << " init, date: " << xtime::get_str_date_time(start_date) << " - " << xtime::get_str_date_time(stop_date) << std::endl;
             }
+
+            /* старшие периоды собираем из минутного потока, для этого нужна минутная история текущих баров */
+            std::map<std::string, uint32_t> resample_periods;
+            if(settings.resample_candles) {
+                const uint32_t MINUTES_IN_DAY = 1440;
+                for(size_t i = 0; i < settings.symbols.size(); ++i) {
+                    const uint32_t period = settings.symbols[i].second;
+                    if(period <= 1 || period > MINUTES_IN_DAY || (MINUTES_IN_DAY % period) != 0) continue;
+                    uint32_t &max_period = resample_periods[settings.symbols[i].first];
+                    max_period = std::max(max_period, period);
+                }
+                for(auto &item : resample_periods) {
+                    const xtime::timestamp_t stop_date = xtime::get_first_timestamp_minute();
+                    const xtime::timestamp_t start_date = stop_date - (item.second * xtime::SECONDS_IN_MINUTE);
+                    std::vector<xquotes_common::Candle> candles;
+                    if(settings.futures_candlestick_stream) binance_http_fapi->get_historical_data(candles, item.first, 1, start_date, stop_date);
+                    else binance_http_sapi->get_historical_data(candles, item.first, 1, start_date, stop_date);
+                    candlestick_streams->init_array_candles(item.first, 1, candles);
+                }
+            }
+
+            /* инициализируем потоки котировок */
+            for(size_t i = 0; i < settings.symbols.size(); ++i) {
+                if(resample_periods.find(settings.symbols[i].first) != resample_periods.end() &&
+                    candlestick_streams->add_derived_stream(settings.symbols[i].first, settings.symbols[i].second)) continue;
+                candlestick_streams->add_symbol_stream(settings.symbols[i].first, settings.symbols[i].second);
+            }
+            candlestick_streams->start();
+            candlestick_streams->wait();
             return true;
         }
 
@@ -750,8 +1350,15 @@ namespace binance_api {
         };
 
         ~BinanceApi() {
-            if(is_error) return;
+            /* таймеры обслуживания обращаются к объекту, останавливаем их первыми */
+            timer_lifetime->expire();
+            stop_maintenance_timers();
             is_future_shutdown = true;
+            {
+                std::lock_guard<std::mutex> lock(maintenance_mutex);
+                maintenance_cv.notify_all();
+            }
+            if(is_error) return;
             /* отключаем поток пользовательских данных */
             if(binance_http_fapi) {
                 int err = binance_http_fapi->delete_user_data_stream();
@@ -761,24 +1368,8 @@ namespace binance_api {
                 }
             }
 
-            /* закрываем все потоки */
-            {
-                std::lock_guard<std::mutex> lock(request_future_mutex);
-                for(size_t i = 0; i < request_future.size(); ++i) {
-                    if(request_future[i].valid()) {
-                        try {
-                            request_future[i].wait();
-                            request_future[i].get();
-                        }
-                        catch(const std::exception &e) {
-                            std::cerr <<"Error: BinanceApi::~BinanceApi(), waht: request_future, exception: " << e.what() << std::endl;
-                        }
-                        catch(...) {
-                            std::cerr <<"Error: BinanceApi::~BinanceApi(), waht: request_future" << std::endl;
-                        }
-                    }
-                }
-            }
+            /* закрываем открытые сделки и останавливаем их сопровождение */
+            std::atomic_store(&order_engine, std::shared_ptr<OrderEngine>());
 
             if(user_data_streams_future.valid()) {
                 try {
@@ -804,9 +1395,14 @@ namespace binance_api {
             if(!binance_http_fapi) return DATA_NOT_AVAILABLE;
             if(!binance_http_sapi) return DATA_NOT_AVAILABLE;
             if(!user_data_streams) return DATA_NOT_AVAILABLE;
+            if(position_amount == 0) {
+                /* вся позиция закрывается одновременно с отменой ордеров */
+                std::vector<FlattenResultSpec> results;
+                return close_orders(std::vector<std::string>(1, symbol), results);
+            }
             /* проверяем наличие позиции по данной паре */
             PositionSpec position;
-            if(user_data_streams->get_position(symbol, TypesPositionSide::LONG, position) && position.position_amount != 0.0) {
+            if(get_position(symbol, TypesPositionSide::LONG, position) && position.position_amount != 0.0) {
                 /* закрываем позицию */
                 //std::cout << "LONG " << position.position_amount << std::endl;
                 int err = binance_http_fapi->open_market_order(
@@ -826,7 +1422,7 @@ namespace binance_api {
                 }
                 if(err != OK || err1 != OK) return std::min(err, err1);
             } else
-            if(user_data_streams->get_position(symbol, TypesPositionSide::SHORT, position) && position.position_amount != 0.0) {
+            if(get_position(symbol, TypesPositionSide::SHORT, position) && position.position_amount != 0.0) {
                 /* закрываем позицию */
                 //std::cout << "SHORT " << position.position_amount << std::endl;
                 int err = binance_http_fapi->open_market_order(
@@ -846,7 +1442,7 @@ namespace binance_api {
                 }
                 if(err != OK || err1 != OK) return std::min(err, err1);
             } else
-            if(user_data_streams->get_position(symbol, TypesPositionSide::BOTH, position) && position.position_amount != 0.0) {
+            if(get_position(symbol, TypesPositionSide::BOTH, position) && position.position_amount != 0.0) {
                 /* закрываем позицию */
                 //std::cout << "BOTH " << position.position_amount << std::endl;
                 const TypesSide side = position.position_amount > 0 ? TypesSide::SELL : TypesSide::BUY;
@@ -870,6 +1466,28 @@ namespace binance_api {
             return OK;
         }
 
+        /** \brief Закрыть позиции и отменить ордера нескольких символов
+         *
+         * Закрытие и отмена выполняются одновременно для всех символов в пределах
+         * ограничений веса запросов и количества ордеров
+         * \param symbols Символы
+         * \param results Результаты символов в том же порядке
+         * \return Код ошибки. Вернет первую ошибку символа, если она была
+         */
+        int close_orders(const std::vector<std::string> &symbols, std::vector<FlattenResultSpec> &results) {
+            return flatten_symbols(symbols, false, results);
+        }
+
+        /** \brief Закрыть все позиции и отменить все ордера
+         *
+         * Используется при завершении работы или аварийном выходе из рынка
+         * \param results Результаты символов, у которых были позиции или ордера
+         * \return Код ошибки. Вернет первую ошибку символа, если она была
+         */
+        int flatten_all(std::vector<FlattenResultSpec> &results) {
+            return flatten_symbols(std::vector<std::string>(), true, results);
+        }
+
         /** \brief Открыть ордер
          * \param symbol Символ
          * \param position_side
@@ -900,194 +1518,21 @@ namespace binance_api {
             if(!binance_http_fapi) return DATA_NOT_AVAILABLE;
             if(!binance_http_sapi) return DATA_NOT_AVAILABLE;
             if(!user_data_streams) return DATA_NOT_AVAILABLE;
-            /* запускаем асинхронное открытие сделки */
-            {
-                std::lock_guard<std::mutex> lock(request_future_mutex);
-                request_future.resize(request_future.size() + 1);
-                request_future.back() = std::async(std::launch::async,[&,
-                        symbol,
-                        position_side,
-                        position_mode,
-                        quantity,
-                        take_profit,
-                        stop_loss,
-                        expiration,
-                        use_date,
-                        recv_window,
-                        callback] {
-                    xtime::ftimestamp_t open_timestamp = 0; // здесь будет время открытия сделки
-
-                    /* проверяем наличие позиции по данной паре и закрываем, если есть */
-                    int err = close_order(symbol);
-                    if(err != OK) {
-                        std::cerr <<"Error: BinanceApi::open_order(), what close_order(), code: " << err << std::endl;
-                        if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_1, get_server_ftimestamp());
-                        return;
-                    }
-
-                    /* создаем уникальные номера сделок */
-                    std::array<std::string, 4> order_ids = {
-                        get_uuid(get_server_ftimestamp()),
-                        get_uuid(get_server_ftimestamp()),
-                        get_uuid(get_server_ftimestamp()),
-                        get_uuid(get_server_ftimestamp())};
-
-                    /* определяем состояния сделок */
-                    TypesSide side = position_side == TypesPositionSide::LONG ? TypesSide::BUY : position_side == TypesPositionSide::SHORT ? TypesSide::SELL : TypesSide::NONE;
-                    TypesSide side_close = position_side == TypesPositionSide::LONG ? TypesSide::SELL : position_side == TypesPositionSide::SHORT ? TypesSide::BUY : TypesSide::NONE;
-                    TypesPositionSide real_position_side = position_mode == TypesPositionMode::One_way_Mode ? TypesPositionSide::BOTH : position_side;
-
-                    /* открываем маркет ордер */
-                    int err1 = 0, err2 = 0, err3 = 0;
-                    if((err1 = binance_http_fapi->open_market_order(
-                            symbol,
-                            order_ids[0],
-                            side,
-                            real_position_side,
-                            position_mode,
-                            quantity,
-                            recv_window,
-                            [&](const xtime::ftimestamp_t timestamp){
-                                /* запоминаем время открытия ордера */
-                                open_timestamp = timestamp;
-                            })) != OK) {
-                        /* ордер открылся с ошибкой, дальшей нет смысла продолжать */
-                        std::cerr <<"Error: BinanceApi::open_order(), what open_market_order(), code: " << err1 << std::endl;
-                        if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_1, get_server_ftimestamp());
-                        return;
-                    }
-
-                    if(callback != nullptr) callback(OPEN_ORDER_STATUS_OPEN, open_timestamp);
-
-                    /* открываем два стоп маркета */
-                    err2 = binance_http_fapi->open_stop_market_order(
-                        symbol,
-                        order_ids[1],
-                        binance_api::TypesOrder::TAKE_PROFIT_MARKET,
-                        side_close,
-                        real_position_side,
-                        position_mode,
-                        quantity,
-                        take_profit,
-                        false,
-                        recv_window);
-
-                    err3 = binance_http_fapi->open_stop_market_order(
-                        symbol,
-                        order_ids[2],
-                        binance_api::TypesOrder::STOP_MARKET,
-                        side_close,
-                        real_position_side,
-                        position_mode,
-                        quantity,
-                        stop_loss,
-                        false,
-                        recv_window);
-
-                    /* проверяем ситуацию, когда уже сработал один из стоп маркет ордеров или была ошибка */
-                    if(err2 != OK || err3 != OK) {
-                        if(err2 == ORDER_WOULD_IMMEDIATELY_TRIGGER || err3 == ORDER_WOULD_IMMEDIATELY_TRIGGER) {
-                            if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_3, get_server_ftimestamp());
-                            std::cerr <<"Error: BinanceApi::open_order(), what open_stop_market_order(), code: " << err2 << " code-2: " << err3 <<std::endl;
-                        } else {
-                            if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_4, get_server_ftimestamp());
-                            std::cerr <<"Error: BinanceApi::open_order(), what open_stop_market_order(), code: " << err2 << " code-2: " << err3 <<std::endl;
-                        }
-                        //std::cerr <<"Error: BinanceApi::open_order(), what open_stop_market_order(), code: " << err2 << " code-2: " << err3 <<std::endl;
-                        //int err_code = std::min(err2,err3);
-
-                        /* закрываем маркет ордер */
-                        const size_t attempts = 10;
-                        for(uint32_t i = 0; i < attempts; ++i) {
-                            if((err1 = binance_http_fapi->open_market_order(
-                                    symbol,
-                                    order_ids[4],
-                                    side_close,
-                                    real_position_side,
-                                    position_mode,
-                                    quantity,
-                                    recv_window)) != OK) {
-                                std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-                                continue;
-                            }
-                            break;
-                        }
-                        if(err1 != OK) {
-                            if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_5, get_server_ftimestamp());
-                            std::cerr <<"Error: BinanceApi::open_order(), what open_market_order(), code: " << err1 << std::endl;
-                        }
-
-                        /* закрывем стоп ордера, если они были открыты */
-                        err1 = binance_http_fapi->cancel_all_order(symbol);
-                        if(err1 != OK) {
-                            if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_6, get_server_ftimestamp());
-                            std::cerr <<"Error: BinanceApi::open_order(), what cancel_all_order(), code: " << err1 << std::endl;
-                        }
-                        if(callback != nullptr) callback(OPEN_ORDER_STATUS_CLOSE_1, get_server_ftimestamp());
-                        //std::cout <<"order open and close " << xtime::get_str_date_time(open_timestamp) << std::endl;
-                        return;
-                    }
-
-                    //std::cout <<"order open " << xtime::get_str_date_time(open_timestamp) << std::endl;
-
-                    /* теперь ждем либо дату экспирации либо задержку на время экспирации */
-                    xtime::ftimestamp_t stop_timestamp = use_date ? expiration : open_timestamp + expiration;
-                    while(true) {
-                        /* проверяем условия выхода из цикла */
-                        PositionSpec position;
-                        if(user_data_streams->get_position(symbol, real_position_side, position) &&
-                            position.position_amount == 0.0) {
-                            /* позиция была закрыта */
-
-                            /* закрывем стоп ордера, если они были открыты */
-                            err1 = binance_http_fapi->cancel_all_order(symbol);
-                            if(err1 != OK) {
-                                if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_7, get_server_ftimestamp());
-                                std::cerr <<"Error: BinanceApi::open_order(), what cancel_all_order(), code: " << err1 << std::endl;
-                            }
-                            if(callback != nullptr) callback(OPEN_ORDER_STATUS_CLOSE_2, get_server_ftimestamp());
-                            break;
-                        }
-
-                        if(get_server_ftimestamp() >= stop_timestamp || is_future_shutdown) {
-                            //std::cout <<"order expired" << std::endl;
-                            /* закрываем маркет ордер */
-                            const size_t attempts = 10;
-                            for(uint32_t i = 0; i < attempts; ++i) {
-                                if((err1 = binance_http_fapi->open_market_order(
-                                        symbol,
-                                        order_ids[4],
-                                        side_close,
-                                        real_position_side,
-                                        position_mode,
-                                        quantity,
-                                        recv_window)) != OK) {
-                                    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-                                    continue;
-                                }
-                                break;
-                            }
-                            if(err1 != OK) {
-                                if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_8, get_server_ftimestamp());
-                                std::cerr <<"Error: BinanceApi::open_order(), what open_market_order(), code: " << err1 << std::endl;
-                            }
-                            /* закрывем стоп ордера, если они были открыты */
-                            err1 = binance_http_fapi->cancel_all_order(symbol);
-                            if(err1 != OK) {
-                                if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_9, get_server_ftimestamp());
-                                std::cerr <<"Error: BinanceApi::open_order(), what cancel_all_order(), code: " << err1 << std::endl;
-                            }
-                            if(callback != nullptr) callback(OPEN_ORDER_STATUS_CLOSE_3, get_server_ftimestamp());
-                            break;
-                        }
-                        std::this_thread::sleep_for(std::chrono::milliseconds(10));
-                    }
-                    /* здесь официально становится известно, что сделка закрылась */
-                    //std::cout <<"order close" << std::endl;
-                });
-            }
-            clear_request_future();
-            return OK;
+            std::shared_ptr<OrderEngine> engine = std::atomic_load(&order_engine);
+            if(!engine) return DATA_NOT_AVAILABLE;
+            BracketOrderSpec spec;
+            spec.symbol = symbol;
+            spec.position_side = position_side;
+            spec.position_mode = position_mode;
+            spec.quantities.push_back(quantity);
+            spec.take_profit = take_profit;
+            spec.stop_loss = stop_loss;
+            spec.is_market_close = true;
+            spec.expiration = expiration;
+            spec.use_date = use_date;
+            spec.recv_window = recv_window;
+            spec.callback = callback;
+            return engine->open_bracket(spec);
         }
 
         /** \brief Открыть ордер
@@ -1121,258 +1566,36 @@ namespace binance_api {
             if(!binance_http_fapi) return DATA_NOT_AVAILABLE;
             if(!binance_http_sapi) return DATA_NOT_AVAILABLE;
             if(!user_data_streams) return DATA_NOT_AVAILABLE;
+            std::shared_ptr<OrderEngine> engine = std::atomic_load(&order_engine);
+            if(!engine) return DATA_NOT_AVAILABLE;
 
-            double price = 0.0;
             /* инициализируем тейк профит и стоп лосс, если они указаны */
             if(take_profit_pips != 0 || stop_loss_pips != 0) {
-                if(!candlestick_streams) return DATA_NOT_AVAILABLE;
-                if((price = candlestick_streams->get_price(symbol)) == 0) return NO_PRICE_STREAM_SUBSCRIPTION;
+                if(!candlestick_streams && !book_ticker_streams) return DATA_NOT_AVAILABLE;
+                if(get_order_price(symbol, position_side) == 0) return NO_PRICE_STREAM_SUBSCRIPTION;
             }
 
-            /* запускаем асинхронное открытие сделки */
-            {
-                std::lock_guard<std::mutex> lock(request_future_mutex);
-                request_future.resize(request_future.size() + 1);
-                request_future.back() = std::async(std::launch::async,[&,
-                        symbol,
-                        position_side,
-                        position_mode,
-                        //quantity,
-                        quantitys,
-                        take_profit_pips,
-                        stop_loss_pips,
-                        //take_profit,
-                        //stop_loss,
-                        expiration,
-                        use_date,
-                        recv_window,
-                        callback] {
-                    xtime::ftimestamp_t open_timestamp = 0; // здесь будет время открытия сделки
-
-                    /* проверяем наличие позиции по данной паре и закрываем, если есть */
-                    int err = close_order(symbol);
-                    if(err != OK) {
-                        std::cerr <<"Error: BinanceApi::open_order_v2(), what close_order(), code: " << err << std::endl;
-                        if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_1, get_server_ftimestamp());
-                        return;
-                    }
-
-                    /* создаем уникальные номера сделок */
-                    std::array<std::string, 4> order_ids = {
-                        get_uuid(get_server_ftimestamp()),
-                        get_uuid(get_server_ftimestamp()),
-                        get_uuid(get_server_ftimestamp()),
-                        get_uuid(get_server_ftimestamp())};
-
-                    /* определяем состояния сделок */
-                    TypesSide side = position_side == TypesPositionSide::LONG ? TypesSide::BUY : position_side == TypesPositionSide::SHORT ? TypesSide::SELL : TypesSide::NONE;
-                    TypesSide side_close = position_side == TypesPositionSide::LONG ? TypesSide::SELL : position_side == TypesPositionSide::SHORT ? TypesSide::BUY : TypesSide::NONE;
-                    TypesPositionSide real_position_side = position_mode == TypesPositionMode::One_way_Mode ? TypesPositionSide::BOTH : position_side;
-
-                    double quantity = 0.0;
-                    /* открываем маркет ордер */
-                    int err1 = OK, err2 = OK, err3 = OK;
-                    for(size_t i = 0; i < quantitys.size(); ++i) {
-                        if((err1 = binance_http_fapi->open_market_order(
-                                symbol,
-                                get_uuid(get_server_ftimestamp()),
-                                side,
-                                real_position_side,
-                                position_mode,
-                                quantitys[i],
-                                recv_window,
-                                [&](const xtime::ftimestamp_t timestamp){
-                                    /* запоминаем время открытия ордера */
-                                    open_timestamp = timestamp;
-                                })) != OK) {
-                            /* ордер открылся с ошибкой, дальшей нет смысла продолжать */
-                            std::cerr <<"Error: BinanceApi::open_order_v2(), what open_market_order(), code: " << err1 << std::endl;
-                            if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_1, get_server_ftimestamp());
-                            continue;
-                        } else {
-                            quantity += quantitys[i];
-                        }
-                    }
-
-                    if(quantity == 0) {
-                        std::cerr <<"Error: BinanceApi::open_order_v2(), quantity == 0, what open_market_order(), code: " << ((int)std::min(err1, (int)DATA_NOT_AVAILABLE)) << std::endl;
-                        return;
-                    }
-
-                    if(callback != nullptr) callback(OPEN_ORDER_STATUS_OPEN, open_timestamp);
-
-                    /* получаем последнюю цену актива */
-                    double last_price = 0.0;
-                    if((take_profit_pips != 0 || stop_loss_pips != 0) && (last_price = candlestick_streams->get_price(symbol)) == 0) {
-                        if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_10, get_server_ftimestamp());
-                        /* закрываем маркет ордер, так как невозможно установить тейк профит и стоп лосс  */
-                        int err = close_order(symbol);
-                        std::cerr <<"Error: BinanceApi::open_order_v2(), what: candlestick_streams->get_price(), price: " << last_price << std::endl;
-                        if(err != OK) {
-                            std::cerr <<"Error: BinanceApi::open_order_v2(), what: close_order(), code: " << err << std::endl;
-                            if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_1, get_server_ftimestamp());
-                            return;
-                        }
-                    }
-
-                    /* инициализируем тейк профит и стоп лосс, если они указаны */
-                    double step_price = 0.0;
-                    double take_profit = 0.0;
-                    double stop_loss = 0.0;
-                    if(take_profit_pips != 0 || stop_loss_pips != 0) {
-                        uint32_t mult = std::pow(10, binance_http_fapi->get_precision(symbol));
-                        step_price = 1.0d/(double)mult;
-                        take_profit = position_side == TypesPositionSide::LONG ? (last_price + step_price * (double)take_profit_pips) : (last_price - step_price * (double)take_profit_pips);
-                        stop_loss = position_side == TypesPositionSide::LONG ? (last_price - step_price * (double)stop_loss_pips) : (last_price + step_price * (double)stop_loss_pips);
-                        take_profit = (double)((uint64_t)((take_profit * (double)mult) + 0.5d)) / (double)mult;
-                        stop_loss = (double)((uint64_t)((stop_loss * (double)mult) + 0.5d)) / (double)mult;
-                        if(position_side == TypesPositionSide::LONG) std::cout << "LONG ";
-                        else if(position_side == TypesPositionSide::SHORT) std::cout << "SHORT ";
-                        if(side_close == TypesSide::BUY) std::cout << "BUY ";
-                        else if(side_close == TypesSide::SELL) std::cout << "SELL ";
-                        std::cout << " price: " << last_price << " take: " << take_profit << " stop: " << stop_loss << std::endl;
-                    }
-
-                    /* открываем два стоп маркета */
-                    if(take_profit_pips != 0) {
-                        err2 = binance_http_fapi->open_stop_market_order(
-                            symbol,
-                            order_ids[1],
-                            binance_api::TypesOrder::TAKE_PROFIT_MARKET,
-                            side_close,
-                            real_position_side,
-                            position_mode,
-                            quantity,
-                            take_profit,
-                            true,
-                            recv_window);
-                    }
-
-                    if(stop_loss_pips != 0) {
-                        err3 = binance_http_fapi->open_stop_market_order(
-                            symbol,
-                            order_ids[2],
-                            binance_api::TypesOrder::STOP_MARKET,
-                            side_close,
-                            real_position_side,
-                            position_mode,
-                            quantity,
-                            stop_loss,
-                            true,
-                            recv_window);
-                    }
-
-                    /* проверяем ситуацию, когда уже сработал один из стоп маркет ордеров или была ошибка */
-                    if(err2 != OK || err3 != OK) {
-                        if(err2 == ORDER_WOULD_IMMEDIATELY_TRIGGER || err3 == ORDER_WOULD_IMMEDIATELY_TRIGGER) {
-                            if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_3, get_server_ftimestamp());
-                            std::cerr <<"Error: BinanceApi::open_order_v2(), what open_stop_market_order(), take profit code: " << err2 << " stop loss code: " << err3 <<std::endl;
-                        } else {
-                            if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_4, get_server_ftimestamp());
-                            std::cerr <<"Error: BinanceApi::open_order_v2(), what open_stop_market_order(), take profit code: " << err2 << " stop loss code: " << err3 <<std::endl;
-                        }
-
-                        /* закрываем маркет ордер */
-                        int err = close_order(symbol);
-                        if(err != OK) {
-                            std::cerr <<"Error: BinanceApi::open_order_v2(), what close_order(), code: " << err << std::endl;
-                            if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_1, get_server_ftimestamp());
-                            return;
-                        }
-
-#                       if(0)
-                        const size_t attempts = 10;
-                        for(uint32_t i = 0; i < attempts; ++i) {
-                            if((err1 = binance_http_fapi->open_market_order(
-                                    symbol,
-                                    order_ids[4],
-                                    side_close,
-                                    real_position_side,
-                                    position_mode,
-                                    quantity,
-                                    recv_window)) != OK) {
-                                std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-                                continue;
-                            }
-                            break;
-                        }
-                        if(err1 != OK) {
-                            if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_5, get_server_ftimestamp());
-                            std::cerr <<"Error: BinanceApi::open_order_v2(), what open_market_order(), code: " << err1 << std::endl;
-                        }
-#                       endif
-
-                        /* закрывем стоп ордера, если они были открыты */
-                        err1 = binance_http_fapi->cancel_all_order(symbol);
-                        if(err1 != OK) {
-                            if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_6, get_server_ftimestamp());
-                            std::cerr <<"Error: BinanceApi::open_order_v2(), what cancel_all_order(), code: " << err1 << std::endl;
-                        }
-                        if(callback != nullptr) callback(OPEN_ORDER_STATUS_CLOSE_1, get_server_ftimestamp());
-                        return;
-                    }
-
-                    /* теперь ждем либо дату экспирации либо задержку на время экспирации */
-                    xtime::ftimestamp_t stop_timestamp = use_date ? expiration : open_timestamp + expiration;
-                    while(true) {
-                        /* проверяем условия выхода из цикла */
-                        PositionSpec position;
-                        if(user_data_streams->get_position(symbol, real_position_side, position) &&
-                            position.position_amount == 0.0) {
-                            /* позиция была закрыта */
-
-                            /* закрывем стоп ордера, если они были открыты */
-                            err1 = binance_http_fapi->cancel_all_order(symbol);
-                            if(err1 != OK) {
-                                if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_7, get_server_ftimestamp());
-                                std::cerr <<"Error: BinanceApi::open_order_v2(), what cancel_all_order(), code: " << err1 << std::endl;
-                            }
-                            if(callback != nullptr) callback(OPEN_ORDER_STATUS_CLOSE_2, get_server_ftimestamp());
-                            break;
-                        }
-
-                        if(get_server_ftimestamp() >= stop_timestamp || is_future_shutdown) {
-                            //std::cout <<"order expired" << std::endl;
-                            /* закрываем маркет ордер */
-                            const size_t attempts = 10;
-                            for(uint32_t i = 0; i < attempts; ++i) {
-                                if((err1 = binance_http_fapi->open_market_order(
-                                        symbol,
-                                        order_ids[4],
-                                        side_close,
-                                        real_position_side,
-                                        position_mode,
-                                        quantity,
-                                        recv_window)) != OK) {
-                                    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-                                    continue;
-                                }
-                                break;
-                            }
-                            if(err1 != OK) {
-                                if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_8, get_server_ftimestamp());
-                                std::cerr <<"Error: BinanceApi::open_order_v2(), what open_market_order(), code: " << err1 << std::endl;
-                            }
-                            /* закрывем стоп ордера, если они были открыты */
-                            err1 = binance_http_fapi->cancel_all_order(symbol);
-                            if(err1 != OK) {
-                                if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_9, get_server_ftimestamp());
-                                std::cerr <<"Error: BinanceApi::open_order_v2(), what cancel_all_order(), code: " << err1 << std::endl;
-                            }
-                            if(callback != nullptr) callback(OPEN_ORDER_STATUS_CLOSE_3, get_server_ftimestamp());
-                            break;
-                        }
-                        std::this_thread::sleep_for(std::chrono::milliseconds(10));
-                    }
-                    /* здесь официально становится известно, что сделка закрылась */
-                    //std::cout <<"order close" << std::endl;
-                });
-            }
-            clear_request_future();
-            return OK;
+            BracketOrderSpec spec;
+            spec.symbol = symbol;
+            spec.position_side = position_side;
+            spec.position_mode = position_mode;
+            spec.quantities = quantitys;
+            spec.take_profit_pips = take_profit_pips;
+            spec.stop_loss_pips = stop_loss_pips;
+            spec.is_pips = true;
+            spec.is_close_position = true;
+            spec.expiration = expiration;
+            spec.use_date = use_date;
+            spec.recv_window = recv_window;
+            spec.callback = callback;
+            return engine->open_bracket(spec);
         }
 
         /** \brief Открыть ордер
+         *
+         * Позиция открывается без тейк-профита, стоп-лосса и экспирации,
+         * сделка завершается, когда позиция будет закрыта. Если событие позиции
+         * потока пользовательских данных потеряно, закрытие обнаруживается периодическим запросом позиции
          * \param symbol Символ
          * \param position_side
          * \param position_mode
@@ -1395,238 +1618,46 @@ namespace binance_api {
             if(!binance_http_fapi) return DATA_NOT_AVAILABLE;
             if(!binance_http_sapi) return DATA_NOT_AVAILABLE;
             if(!user_data_streams) return DATA_NOT_AVAILABLE;
+            std::shared_ptr<OrderEngine> engine = std::atomic_load(&order_engine);
+            if(!engine) return DATA_NOT_AVAILABLE;
+            BracketOrderSpec spec;
+            spec.symbol = symbol;
+            spec.position_side = position_side;
+            spec.position_mode = position_mode;
+            spec.quantities = quantitys;
+            spec.is_pips = true;
+            spec.is_expiration = false;
+            spec.recv_window = recv_window;
+            spec.callback = callback;
+            return engine->open_bracket(spec);
+        }
 
-            double price = 0.0;
-
-            /* запускаем асинхронное открытие сделки */
-            {
-                std::lock_guard<std::mutex> lock(request_future_mutex);
-                request_future.resize(request_future.size() + 1);
-                request_future.back() = std::async(std::launch::async,[&,
-                        symbol,
-                        position_side,
-                        position_mode,
-                        quantitys,
-                        recv_window,
-                        callback] {
-                    xtime::ftimestamp_t open_timestamp = 0; // здесь будет время открытия сделки
-
-                    /* проверяем наличие позиции по данной паре и закрываем, если есть */
-                    int err = close_order(symbol);
-                    if(err != OK) {
-                        std::cerr <<"Error: BinanceApi::open_order_v2(), what close_order(), code: " << err << std::endl;
-                        if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_1, get_server_ftimestamp());
-                        return;
-                    }
-
-
-
-                    /* определяем состояния сделок */
-                    TypesSide side = position_side == TypesPositionSide::LONG ? TypesSide::BUY : position_side == TypesPositionSide::SHORT ? TypesSide::SELL : TypesSide::NONE;
-                    TypesSide side_close = position_side == TypesPositionSide::LONG ? TypesSide::SELL : position_side == TypesPositionSide::SHORT ? TypesSide::BUY : TypesSide::NONE;
-                    TypesPositionSide real_position_side = position_mode == TypesPositionMode::One_way_Mode ? TypesPositionSide::BOTH : position_side;
-
-                    double quantity = 0.0;
-                    /* открываем маркет ордер */
-                    int err1 = OK, err2 = OK, err3 = OK;
-                    for(size_t i = 0; i < quantitys.size(); ++i) {
-                        if((err1 = binance_http_fapi->open_market_order(
-                                symbol,
-                                get_uuid(get_server_ftimestamp()),
-                                side,
-                                real_position_side,
-                                position_mode,
-                                quantitys[i],
-                                recv_window,
-                                [&](const xtime::ftimestamp_t timestamp){
-                                    /* запоминаем время открытия ордера */
-                                    open_timestamp = timestamp;
-                                })) != OK) {
-                            /* ордер открылся с ошибкой, дальшей нет смысла продолжать */
-                            std::cerr <<"Error: BinanceApi::open_order_v2(), what open_market_order(), code: " << err1 << std::endl;
-                            if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_1, get_server_ftimestamp());
-                            continue;
-                        } else {
-                            quantity += quantitys[i];
-                        }
-                    }
-
-                    if(quantity == 0) {
-                        std::cerr <<"Error: BinanceApi::open_order_v2(), quantity == 0, what open_market_order(), code: " << ((int)std::min(err1, (int)DATA_NOT_AVAILABLE)) << std::endl;
-                        return;
-                    }
-
-                    if(callback != nullptr) callback(OPEN_ORDER_STATUS_OPEN, open_timestamp);
-
-                    /* получаем последнюю цену актива */
-                    double last_price = 0.0;
-                    if((take_profit_pips != 0 || stop_loss_pips != 0) && (last_price = candlestick_streams->get_price(symbol)) == 0) {
-                        if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_10, get_server_ftimestamp());
-                        /* закрываем маркет ордер, так как невозможно установить тейк профит и стоп лосс  */
-                        int err = close_order(symbol);
-                        std::cerr <<"Error: BinanceApi::open_order_v2(), what: candlestick_streams->get_price(), price: " << last_price << std::endl;
-                        if(err != OK) {
-                            std::cerr <<"Error: BinanceApi::open_order_v2(), what: close_order(), code: " << err << std::endl;
-                            if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_1, get_server_ftimestamp());
-                            return;
-                        }
-                    }
-
-                    /* инициализируем тейк профит и стоп лосс, если они указаны */
-                    double step_price = 0.0;
-                    double take_profit = 0.0;
-                    double stop_loss = 0.0;
-                    if(take_profit_pips != 0 || stop_loss_pips != 0) {
-                        uint32_t mult = std::pow(10, binance_http_fapi->get_precision(symbol));
-                        step_price = 1.0d/(double)mult;
-                        take_profit = position_side == TypesPositionSide::LONG ? (last_price + step_price * (double)take_profit_pips) : (last_price - step_price * (double)take_profit_pips);
-                        stop_loss = position_side == TypesPositionSide::LONG ? (last_price - step_price * (double)stop_loss_pips) : (last_price + step_price * (double)stop_loss_pips);
-                        take_profit = (double)((uint64_t)((take_profit * (double)mult) + 0.5d)) / (double)mult;
-                        stop_loss = (double)((uint64_t)((stop_loss * (double)mult) + 0.5d)) / (double)mult;
-                        if(position_side == TypesPositionSide::LONG) std::cout << "LONG ";
-                        else if(position_side == TypesPositionSide::SHORT) std::cout << "SHORT ";
-                        if(side_close == TypesSide::BUY) std::cout << "BUY ";
-                        else if(side_close == TypesSide::SELL) std::cout << "SELL ";
-                        std::cout << " price: " << last_price << " take: " << take_profit << " stop: " << stop_loss << std::endl;
-                    }
-
-                    /* открываем два стоп маркета */
-                    if(take_profit_pips != 0) {
-                        err2 = binance_http_fapi->open_stop_market_order(
-                            symbol,
-                            order_ids[1],
-                            binance_api::TypesOrder::TAKE_PROFIT_MARKET,
-                            side_close,
-                            real_position_side,
-                            position_mode,
-                            quantity,
-                            take_profit,
-                            true,
-                            recv_window);
-                    }
-
-                    if(stop_loss_pips != 0) {
-                        err3 = binance_http_fapi->open_stop_market_order(
-                            symbol,
-                            order_ids[2],
-                            binance_api::TypesOrder::STOP_MARKET,
-                            side_close,
-                            real_position_side,
-                            position_mode,
-                            quantity,
-                            stop_loss,
-                            true,
-                            recv_window);
-                    }
-
-                    /* проверяем ситуацию, когда уже сработал один из стоп маркет ордеров или была ошибка */
-                    if(err2 != OK || err3 != OK) {
-                        if(err2 == ORDER_WOULD_IMMEDIATELY_TRIGGER || err3 == ORDER_WOULD_IMMEDIATELY_TRIGGER) {
-                            if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_3, get_server_ftimestamp());
-                            std::cerr <<"Error: BinanceApi::open_order_v2(), what open_stop_market_order(), take profit code: " << err2 << " stop loss code: " << err3 <<std::endl;
-                        } else {
-                            if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_4, get_server_ftimestamp());
-                            std::cerr <<"Error: BinanceApi::open_order_v2(), what open_stop_market_order(), take profit code: " << err2 << " stop loss code: " << err3 <<std::endl;
-                        }
-
-                        /* закрываем маркет ордер */
-                        int err = close_order(symbol);
-                        if(err != OK) {
-                            std::cerr <<"Error: BinanceApi::open_order_v2(), what close_order(), code: " << err << std::endl;
-                            if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_1, get_server_ftimestamp());
-                            return;
-                        }
-
-#                       if(0)
-                        const size_t attempts = 10;
-                        for(uint32_t i = 0; i < attempts; ++i) {
-                            if((err1 = binance_http_fapi->open_market_order(
-                                    symbol,
-                                    order_ids[4],
-                                    side_close,
-                                    real_position_side,
-                                    position_mode,
-                                    quantity,
-                                    recv_window)) != OK) {
-                                std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-                                continue;
-                            }
-                            break;
-                        }
-                        if(err1 != OK) {
-                            if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_5, get_server_ftimestamp());
-                            std::cerr <<"Error: BinanceApi::open_order_v2(), what open_market_order(), code: " << err1 << std::endl;
-                        }
-#                       endif
-
-                        /* закрывем стоп ордера, если они были открыты */
-                        err1 = binance_http_fapi->cancel_all_order(symbol);
-                        if(err1 != OK) {
-                            if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_6, get_server_ftimestamp());
-                            std::cerr <<"Error: BinanceApi::open_order_v2(), what cancel_all_order(), code: " << err1 << std::endl;
-                        }
-                        if(callback != nullptr) callback(OPEN_ORDER_STATUS_CLOSE_1, get_server_ftimestamp());
-                        return;
-                    }
-
-                    /* теперь ждем либо дату экспирации либо задержку на время экспирации */
-                    xtime::ftimestamp_t stop_timestamp = use_date ? expiration : open_timestamp + expiration;
-                    while(true) {
-                        /* проверяем условия выхода из цикла */
-                        PositionSpec position;
-                        if(user_data_streams->get_position(symbol, real_position_side, position) &&
-                            position.position_amount == 0.0) {
-                            /* позиция была закрыта */
-
-                            /* закрывем стоп ордера, если они были открыты */
-                            err1 = binance_http_fapi->cancel_all_order(symbol);
-                            if(err1 != OK) {
-                                if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_7, get_server_ftimestamp());
-                                std::cerr <<"Error: BinanceApi::open_order_v2(), what cancel_all_order(), code: " << err1 << std::endl;
-                            }
-                            if(callback != nullptr) callback(OPEN_ORDER_STATUS_CLOSE_2, get_server_ftimestamp());
-                            break;
-                        }
-
-                        if(get_server_ftimestamp() >= stop_timestamp || is_future_shutdown) {
-                            //std::cout <<"order expired" << std::endl;
-                            /* закрываем маркет ордер */
-                            const size_t attempts = 10;
-                            for(uint32_t i = 0; i < attempts; ++i) {
-                                if((err1 = binance_http_fapi->open_market_order(
-                                        symbol,
-                                        order_ids[4],
-                                        side_close,
-                                        real_position_side,
-                                        position_mode,
-                                        quantity,
-                                        recv_window)) != OK) {
-                                    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-                                    continue;
-                                }
-                                break;
-                            }
-                            if(err1 != OK) {
-                                if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_8, get_server_ftimestamp());
-                                std::cerr <<"Error: BinanceApi::open_order_v2(), what open_market_order(), code: " << err1 << std::endl;
-                            }
-                            /* закрывем стоп ордера, если они были открыты */
-                            err1 = binance_http_fapi->cancel_all_order(symbol);
-                            if(err1 != OK) {
-                                if(callback != nullptr) callback(OPEN_ORDER_STATUS_ERROR_9, get_server_ftimestamp());
-                                std::cerr <<"Error: BinanceApi::open_order_v2(), what cancel_all_order(), code: " << err1 << std::endl;
-                            }
-                            if(callback != nullptr) callback(OPEN_ORDER_STATUS_CLOSE_3, get_server_ftimestamp());
-                            break;
-                        }
-                        std::this_thread::sleep_for(std::chrono::milliseconds(10));
-                    }
-                    /* здесь официально становится известно, что сделка закрылась */
-                    //std::cout <<"order close" << std::endl;
-                });
+        /** \brief Получить состояние ордера
+         *
+         * Состояние читается из таблицы ордеров потока пользовательских данных.
+         * Запрос к серверу выполняется, только если ордера нет в таблице
+         * \param symbol Символ
+         * \param client_order_id Уникальный номер ордера
+         * \param status Состояние ордера
+         * \return Код ошибки
+         */
+        int get_order_status(
+                const std::string &symbol,
+                const std::string &client_order_id,
+                TypesOrderStatus &status) {
+            if(is_error) return DATA_NOT_AVAILABLE;
+            if(user_data_streams) {
+                UserDataStreams::order_ptr order = user_data_streams->get_order(client_order_id);
+                if(order) {
+                    status = order->status;
+                    return OK;
+                }
             }
-            clear_request_future();
-            return OK;
+            if(!binance_http_fapi) return DATA_NOT_AVAILABLE;
+            OrderUpdateSpec order;
+            const int err = binance_http_fapi->get_order(symbol, client_order_id, order);
+            if(err == OK) status = order.status;
+            return err;
         }
     };
 
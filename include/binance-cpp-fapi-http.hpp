@@ -31,6 +31,7 @@
 #include <nlohmann/json.hpp>
 #include "hmac.hpp"
 #include "xtime.hpp"
+#include "tools/binance-cpp-api-server-clock.hpp"
 #include <thread>
 #include <future>
 #include <mutex>
@@ -97,6 +98,7 @@ namespace binance_api {
         };
 
         std::atomic<xtime::ftimestamp_t> offset_timestamp = ATOMIC_VAR_INIT(0);
+        std::shared_ptr<ServerClock> server_clock;  /**< Синхронизация времени с сервером */
 
     public:
 
@@ -104,9 +106,21 @@ namespace binance_api {
          * \return Метка времени сервера
          */
         inline xtime::ftimestamp_t get_server_ftimestamp() {
+            std::shared_ptr<ServerClock> clock_ptr = std::atomic_load(&server_clock);
+            if(clock_ptr && clock_ptr->check_estimated()) return clock_ptr->get_server_ftimestamp();
             return  xtime::get_ftimestamp() + offset_timestamp;
         }
 
+        /** \brief Использовать синхронизацию времени с сервером
+         *
+         * Пока у синхронизации нет оценки смещения, используется смещение,
+         * установленное через set_server_offset_timestamp()
+         * \param clock Синхронизация времени
+         */
+        inline void set_server_clock(std::shared_ptr<ServerClock> clock) {
+            std::atomic_store(&server_clock, clock);
+        }
+
         /** \brief Установить смещение метки времени
          * \param offset Смещение метки времени
          */
@@ -114,13 +128,56 @@ namespace binance_api {
             offset_timestamp = offset;
         }
 
+        static const uint32_t ORDER_WEIGHT = 1;                 /**< Вес запроса ордера */
+        static const uint32_t CANCEL_ALL_ORDERS_WEIGHT = 1;     /**< Вес запроса отмены всех ордеров символа */
+
+        /** \brief Получить остаток веса запросов текущей минуты
+         * \return Вес запросов, который можно отправить без ожидания следующей минуты
+         */
+        inline uint32_t get_request_budget() {
+            if(request_timestamp != xtime::get_first_timestamp_minute()) return request_limit;
+            const uint32_t counter = request_counter;
+            const uint32_t limit = request_limit;
+            return counter >= limit ? 0 : limit - counter;
+        }
+
+        /** \brief Получить ограничение количества ордеров за 10 секунд
+         * \return Количество ордеров
+         */
+        inline uint32_t get_order_limit() {
+            return order_limit;
+        }
+
     private:
 
         /* ограничение количества запросов в минуту */
         std::atomic<uint32_t> request_counter = ATOMIC_VAR_INIT(0);
         std::atomic<uint32_t> request_limit = ATOMIC_VAR_INIT(6000);
+        std::atomic<uint32_t> order_limit = ATOMIC_VAR_INIT(300);   /**< Ограничение количества ордеров за 10 секунд */
         std::atomic<xtime::timestamp_t> request_timestamp = ATOMIC_VAR_INIT(0);
 
+        /** \brief Получить вес запроса баров
+         * \param limit Ограничение количества баров
+         * \return Вес запроса
+         */
+        inline uint32_t get_klines_weight(const uint32_t limit) {
+            if(limit < 100) return 1;
+            if(limit < 500) return 2;
+            if(limit <= 1000) return 5;
+            return 10;
+        }
+
+        /** \brief Получить вес запроса стакана
+         * \param limit Количество уровней
+         * \return Вес запроса
+         */
+        inline uint32_t get_depth_weight(const uint32_t limit) {
+            if(limit <= 50) return 2;
+            if(limit <= 100) return 5;
+            if(limit <= 500) return 10;
+            return 20;
+        }
+
         void check_request_limit(const uint32_t weight = 1) {
             request_counter += weight;
             if(request_timestamp == 0) {
@@ -317,6 +374,8 @@ namespace binance_api {
             case 418: // Код возврата используется при блокировки после нарушении ограничения скорости запроса.
                 return IP_BLOCKED;
             }
+            /* остальные 5XX - ошибка на стороне сервера, запрос мог быть исполнен */
+            if(response_code >= 500 && response_code < 600) return SERVER_ERROR;
 
             if(result == CURLE_OK) {
                 if(headers.find("Content-Encoding:") != headers.end()) {
@@ -571,6 +630,29 @@ namespace binance_api {
             } catch(...) {}
         }
 
+        void parse_depth_snapshot(
+                DepthSnapshotSpec &snapshot,
+                std::string &response) {
+            json j = json::parse(response);
+            snapshot.last_update_id = j["lastUpdateId"];
+            json j_bids = j["bids"];
+            json j_asks = j["asks"];
+            snapshot.bids.clear();
+            snapshot.asks.clear();
+            snapshot.bids.reserve(j_bids.size());
+            snapshot.asks.reserve(j_asks.size());
+            for(size_t i = 0; i < j_bids.size(); ++i) {
+                snapshot.bids.push_back(DepthLevelSpec(
+                    std::atof(std::string(j_bids[i][0]).c_str()),
+                    std::atof(std::string(j_bids[i][1]).c_str())));
+            }
+            for(size_t i = 0; i < j_asks.size(); ++i) {
+                snapshot.asks.push_back(DepthLevelSpec(
+                    std::atof(std::string(j_asks[i][0]).c_str()),
+                    std::atof(std::string(j_asks[i][1]).c_str())));
+            }
+        }
+
         void parse_exchange_info(std::string &response) {
             try {
                 json j = json::parse(response);
@@ -581,7 +663,9 @@ namespace binance_api {
                         request_limit = j_rate_limits[i]["limit"];
                     } else
                     if(j_rate_limits[i]["rateLimitType"] == "ORDERS") {
-
+                        if(j_rate_limits[i]["interval"] == "SECOND" && j_rate_limits[i]["intervalNum"] == 10) {
+                            order_limit = j_rate_limits[i]["limit"];
+                        }
                     }
                 }
                 /* парсим параметры символов */
@@ -600,11 +684,189 @@ namespace binance_api {
             }
         }
 
+        /** \brief Получить параметры ордера для пакетного запроса
+         *
+         * Все значения пакетного запроса передаются строками
+         * \param order Параметры ордера
+         * \param j Параметры ордера в JSON
+         * \return Код ошибки
+         */
+        static int get_order_json(const OrderRequestSpec &order, json &j) {
+            j = json::object();
+            j["symbol"] = order.symbol;
+            if(order.side == TypesSide::BUY) j["side"] = "BUY";
+            else if(order.side == TypesSide::SELL) j["side"] = "SELL";
+            else return INVALID_PARAMETER;
+            if(order.position_side == TypesPositionSide::LONG) j["positionSide"] = "LONG";
+            else if(order.position_side == TypesPositionSide::SHORT) j["positionSide"] = "SHORT";
+            else if(order.position_side == TypesPositionSide::BOTH) j["positionSide"] = "BOTH";
+            else return INVALID_PARAMETER;
+            switch(order.type) {
+            case TypesOrder::LIMIT:
+                j["type"] = "LIMIT";
+                break;
+            case TypesOrder::MARKET:
+                j["type"] = "MARKET";
+                break;
+            case TypesOrder::STOP:
+                j["type"] = "STOP";
+                break;
+            case TypesOrder::TAKE_PROFIT:
+                j["type"] = "TAKE_PROFIT";
+                break;
+            case TypesOrder::STOP_MARKET:
+                j["type"] = "STOP_MARKET";
+                break;
+            case TypesOrder::TAKE_PROFIT_MARKET:
+                j["type"] = "TAKE_PROFIT_MARKET";
+                break;
+            default:
+                return INVALID_PARAMETER;
+            };
+            const bool is_stop =
+                order.type == TypesOrder::STOP ||
+                order.type == TypesOrder::TAKE_PROFIT ||
+                order.type == TypesOrder::STOP_MARKET ||
+                order.type == TypesOrder::TAKE_PROFIT_MARKET;
+            if(!order.close_position) j["quantity"] = std::to_string(order.quantity);
+            if(order.price != 0) j["price"] = std::to_string(order.price);
+            if(is_stop) {
+                j["stopPrice"] = std::to_string(order.stop_price);
+                j["workingType"] = order.working_type == TypesWorking::MARK_PRICE ? "MARK_PRICE" : "CONTRACT_PRICE";
+                j["closePosition"] = order.close_position ? "true" : "false";
+            }
+            switch(order.time_in_force) {
+            case TypesTimeInForce::GTC:
+                j["timeInForce"] = "GTC";
+                break;
+            case TypesTimeInForce::IOC:
+                j["timeInForce"] = "IOC";
+                break;
+            case TypesTimeInForce::FOK:
+                j["timeInForce"] = "FOK";
+                break;
+            case TypesTimeInForce::GTX:
+                j["timeInForce"] = "GTX";
+                break;
+            default:
+                break;
+            };
+            /* в режиме хеджирования сторона позиции уже определяет уменьшение позиции */
+            if(!order.close_position && order.position_side == TypesPositionSide::BOTH &&
+                (order.reduce_only || is_stop)) {
+                j["reduceOnly"] = "true";
+            }
+            if(order.new_client_order_id.size() > 0) j["newClientOrderId"] = order.new_client_order_id;
+            return OK;
+        }
+
+        /** \brief Получить параметры изменения ордера для пакетного запроса
+         * \param order Параметры изменения ордера
+         * \param j Параметры изменения ордера в JSON
+         * \return Код ошибки
+         */
+        static int get_modify_json(const OrderModifySpec &order, json &j) {
+            j = json::object();
+            j["symbol"] = order.symbol;
+            if(order.order_id != 0) j["orderId"] = std::to_string(order.order_id);
+            else if(order.orig_client_order_id.size() > 0) j["origClientOrderId"] = order.orig_client_order_id;
+            else return INVALID_PARAMETER;
+            if(order.side == TypesSide::BUY) j["side"] = "BUY";
+            else if(order.side == TypesSide::SELL) j["side"] = "SELL";
+            else return INVALID_PARAMETER;
+            j["quantity"] = std::to_string(order.quantity);
+            j["price"] = std::to_string(order.price);
+            return OK;
+        }
+
+        /** \brief Получить строку запроса из параметров ордера
+         * \param j Параметры ордера в JSON, все значения - строки
+         * \return Строка запроса
+         */
+        static std::string get_query_string(const json &j) {
+            std::string query_string;
+            for(auto it = j.begin(); it != j.end(); ++it) {
+                if(query_string.size() > 0) query_string += "&";
+                query_string += it.key();
+                query_string += "=";
+                query_string += it.value().get<std::string>();
+            }
+            return query_string;
+        }
+
+        /** \brief Разобрать результат ордера
+         *
+         * Ордер пакетного запроса с ошибкой возвращается объектом с кодом ошибки вместо ордера
+         * \param j Ордер или ошибка в ответе сервера
+         * \param result Результат ордера
+         */
+        static void parse_order_result(const json &j, OrderResultSpec &result) {
+            if(j.find("code") != j.end() && j.find("orderId") == j.end()) {
+                result.error_code = j["code"];
+                if(j.find("msg") != j.end()) result.message = j["msg"];
+                return;
+            }
+            result.symbol = j["symbol"];
+            result.order_id = j["orderId"];
+            result.client_order_id = j["clientOrderId"];
+            result.status = to_order_status(j["status"]);
+            result.update_time = (double)((uint64_t)j["updateTime"]) / 1000.0;
+            result.error_code = result.status == TypesOrderStatus::NONE ? DATA_NOT_AVAILABLE : OK;
+        }
+
+        /** \brief Разобрать ордер из ответа REST API
+         * \param j Ордер в ответе сервера
+         * \param order Состояние ордера
+         */
+        static void parse_order_update(const json &j, OrderUpdateSpec &order) {
+            order.symbol = j["symbol"];
+            order.client_order_id = j["clientOrderId"];
+            order.order_id = j["orderId"];
+            order.type = to_order_type(j["type"]);
+            order.side = j["side"] == "BUY" ? TypesSide::BUY : (j["side"] == "SELL" ? TypesSide::SELL : TypesSide::NONE);
+            order.position_side = to_position_side(j["positionSide"]);
+            order.status = to_order_status(j["status"]);
+            order.quantity = std::atof(std::string(j["origQty"]).c_str());
+            order.price = std::atof(std::string(j["price"]).c_str());
+            order.stop_price = std::atof(std::string(j["stopPrice"]).c_str());
+            order.average_price = std::atof(std::string(j["avgPrice"]).c_str());
+            order.filled_quantity = std::atof(std::string(j["executedQty"]).c_str());
+            if(j.find("reduceOnly") != j.end()) order.is_reduce_only = j["reduceOnly"];
+            if(j.find("closePosition") != j.end()) order.is_close_position = j["closePosition"];
+            order.update_time = (double)((uint64_t)j["updateTime"]) / 1000.0;
+        }
+
+        /** \brief Разобрать результаты пакетного запроса
+         * \param response Ответ сервера
+         * \param num_orders Количество ордеров запроса
+         * \param results Результаты ордеров
+         * \return Код ошибки
+         */
+        static int parse_batch_results(
+                const std::string &response,
+                const size_t num_orders,
+                std::vector<OrderResultSpec> &results) {
+            try {
+                json j = json::parse(response);
+                if(!j.is_array() || j.size() != num_orders) return PARSER_ERROR;
+                results.resize(num_orders);
+                for(size_t i = 0; i < j.size(); ++i) {
+                    parse_order_result(j[i], results[i]);
+                }
+            } catch(...) {
+                return PARSER_ERROR;
+            }
+            return OK;
+        }
+
         void add_recv_window_and_timestamp(std::string &query_string, const uint64_t recv_window) {
             query_string += "&recvWindow=";
             query_string += std::to_string(recv_window);
             query_string += "&timestamp=";
-            query_string += std::to_string((uint64_t)(get_server_ftimestamp() * 1000.0 + 1000.0));
+            /* без синхронизации смещение занижено на задержку потока, поэтому метка сдвигается на секунду */
+            std::shared_ptr<ServerClock> clock_ptr = std::atomic_load(&server_clock);
+            const bool is_clock = clock_ptr && clock_ptr->check_estimated();
+            query_string += std::to_string((uint64_t)(get_server_ftimestamp() * 1000.0 + (is_clock ? 0.0 : 1000.0)));
         }
 
         int get_request_none_security(std::string &response, const std::string &url, const uint64_t weight = 1) {
@@ -765,6 +1027,26 @@ namespace binance_api {
         }
 
 
+        /** \brief Получить время сервера
+         * \param server_time Время сервера, мс
+         * \return Код ошибки
+         */
+        int get_server_time(uint64_t &server_time) {
+            std::string url(point);
+            std::string response;
+            url += "/fapi/v1/time";
+            int err = get_request_none_security(response, url);
+            if(err != OK) return err;
+            try {
+                json j = json::parse(response);
+                server_time = j["serverTime"];
+            }
+            catch(...) {
+                return JSON_PARSER_ERROR;
+            }
+            return OK;
+        }
+
         /** \brief Получить текущие правила биржевой торговли и символьной информация
          *
          * Данные правил торговли и символьной информации сохраняются внутри класса,
@@ -781,6 +1063,36 @@ namespace binance_api {
             return OK;
         }
 
+        /** \brief Получить снимок стакана
+         *
+         * Снимок используется для синхронизации локального стакана с потоком изменений
+         * \param snapshot Снимок стакана
+         * \param symbol Имя символа
+         * \param limit Количество уровней
+         * \return Код ошибки
+         */
+        int get_depth_snapshot(
+                DepthSnapshotSpec &snapshot,
+                const std::string &symbol,
+                const uint32_t limit = 1000) {
+            std::string url(point);
+            std::string response;
+            url += "/fapi/v1/depth?";
+            url += "symbol=";
+            url += to_lower_case(symbol);
+            url += "&limit=";
+            url += std::to_string(limit);
+            int err = get_request_none_security(response, url, get_depth_weight(limit));
+            if(err != OK) return err;
+            try {
+                parse_depth_snapshot(snapshot, response);
+            }
+            catch(...) {
+                return JSON_PARSER_ERROR;
+            }
+            return OK;
+        }
+
         /** \brief Получить исторические данные
          *
          * \param candles Массив баров
@@ -805,7 +1117,7 @@ namespace binance_api {
             url += it->second;
             url += "&limit=";
             url += std::to_string(limit);
-            int err = get_request_none_security(response, url);
+            int err = get_request_none_security(response, url, get_klines_weight(limit));
             if(err != OK) return err;
             parse_history(candles, response);
             return OK;
@@ -843,7 +1155,7 @@ namespace binance_api {
             url += std::to_string(xtime::get_first_timestamp_minute(stop_date)*1000);
             url += "&limit=";
             url += std::to_string(limit);
-            int err = get_request_none_security(response, url);
+            int err = get_request_none_security(response, url, get_klines_weight(limit));
             if(err != OK) return err;
             parse_history(candles, response);
             return OK;
@@ -1286,6 +1598,191 @@ namespace binance_api {
             return DATA_NOT_AVAILABLE;
         }
 
+        /// Максимальное количество ордеров в пакетном запросе
+        static const size_t MAX_BATCH_ORDERS = 5;
+
+        /** \brief Открыть несколько ордеров одним запросом
+         *
+         * Ордера пакета обрабатываются сервером независимо, поэтому результат
+         * каждого ордера возвращается отдельно в том же порядке, что и параметры ордеров
+         * \param orders Параметры ордеров (не больше MAX_BATCH_ORDERS)
+         * \param results Результаты ордеров
+         * \param recv_window Время ожидания ответа, в мс.
+         * \return Код ошибки запроса. Вернет OK, даже если часть ордеров отклонена
+         */
+        int open_batch_orders(
+                const std::vector<OrderRequestSpec> &orders,
+                std::vector<OrderResultSpec> &results,
+                const uint64_t recv_window = 60000) {
+            results.clear();
+            if(orders.empty() || orders.size() > MAX_BATCH_ORDERS) return INVALID_PARAMETER;
+            json j_orders = json::array();
+            for(size_t i = 0; i < orders.size(); ++i) {
+                json j_order;
+                int err = get_order_json(orders[i], j_order);
+                if(err != OK) return err;
+                j_orders.push_back(j_order);
+            }
+            std::string url(point);
+            std::string query_string;
+            std::string response;
+            query_string += "batchOrders=";
+            query_string += url_encode(j_orders.dump());
+            url += "/fapi/v1/batchOrders?";
+            int err = post_request_with_signature(response, query_string, url, recv_window, 5);
+            if(err != OK) return err;
+            results.resize(orders.size());
+            for(size_t i = 0; i < orders.size(); ++i) {
+                results[i].symbol = orders[i].symbol;
+                results[i].client_order_id = orders[i].new_client_order_id;
+            }
+            return parse_batch_results(response, orders.size(), results);
+        }
+
+        /** \brief Открыть ордер
+         * \param order Параметры ордера
+         * \param result Результат ордера
+         * \param recv_window Время ожидания ответа, в мс.
+         * \return Код ошибки. При неизвестном состоянии исполнения (см. check_unknown_status())
+         * ордер нужно найти по уникальному номеру, а не отправлять повторно
+         */
+        int open_order(
+                const OrderRequestSpec &order,
+                OrderResultSpec &result,
+                const uint64_t recv_window = 60000) {
+            result = OrderResultSpec();
+            result.symbol = order.symbol;
+            result.client_order_id = order.new_client_order_id;
+            json j_order;
+            int err = get_order_json(order, j_order);
+            if(err != OK) return err;
+            std::string url(point);
+            std::string query_string(get_query_string(j_order));
+            std::string response;
+            url += "/fapi/v1/order?";
+            err = post_request_with_signature(response, query_string, url, recv_window, ORDER_WEIGHT);
+            if(err != OK) {
+                result.error_code = err;
+                return err;
+            }
+            try {
+                json j = json::parse(response);
+                parse_order_result(j, result);
+            } catch(...) {
+                return PARSER_ERROR;
+            }
+            return result.error_code;
+        }
+
+        /// Максимальное количество ордеров в пакетной отмене
+        static const size_t MAX_BATCH_CANCEL_ORDERS = 10;
+
+        /** \brief Отменить несколько ордеров символа одним запросом
+         *
+         * В отличие от cancel_all_order() отменяются только указанные ордера
+         * \param symbol Торговый символ
+         * \param orig_client_order_ids Уникальные номера ордеров (не больше MAX_BATCH_CANCEL_ORDERS)
+         * \param results Результаты отмены ордеров в том же порядке
+         * \param recv_window Время ожидания ответа, в мс.
+         * \return Код ошибки запроса. Вернет OK, даже если часть ордеров не отменена
+         */
+        int cancel_batch_orders(
+                const std::string &symbol,
+                const std::vector<std::string> &orig_client_order_ids,
+                std::vector<OrderResultSpec> &results,
+                const uint64_t recv_window = 60000) {
+            results.clear();
+            if(orig_client_order_ids.empty() || orig_client_order_ids.size() > MAX_BATCH_CANCEL_ORDERS) return INVALID_PARAMETER;
+            json j_ids = orig_client_order_ids;
+            std::string url(point);
+            std::string query_string;
+            std::string response;
+            query_string += "symbol=";
+            query_string += symbol;
+            query_string += "&origClientOrderIdList=";
+            query_string += url_encode(j_ids.dump());
+            url += "/fapi/v1/batchOrders?";
+            int err = delete_request_with_signature(response, query_string, url, recv_window);
+            if(err != OK) return err;
+            results.resize(orig_client_order_ids.size());
+            for(size_t i = 0; i < orig_client_order_ids.size(); ++i) {
+                results[i].symbol = symbol;
+                results[i].client_order_id = orig_client_order_ids[i];
+            }
+            return parse_batch_results(response, orig_client_order_ids.size(), results);
+        }
+
+        /** \brief Изменить цену и размер лимитного ордера
+         *
+         * Ордер изменяется без отмены и сохраняет свой ID
+         * \param order Параметры изменения ордера
+         * \param result Результат изменения
+         * \param recv_window Время ожидания ответа, в мс.
+         * \return Код ошибки
+         */
+        int modify_order(
+                const OrderModifySpec &order,
+                OrderResultSpec &result,
+                const uint64_t recv_window = 60000) {
+            result = OrderResultSpec();
+            result.symbol = order.symbol;
+            result.client_order_id = order.orig_client_order_id;
+            json j_order;
+            int err = get_modify_json(order, j_order);
+            if(err != OK) return err;
+            std::string url(point);
+            std::string query_string(get_query_string(j_order));
+            std::string response;
+            url += "/fapi/v1/order?";
+            err = put_request_with_signature(response, query_string, url, recv_window);
+            if(err != OK) {
+                result.error_code = err;
+                return err;
+            }
+            try {
+                json j = json::parse(response);
+                parse_order_result(j, result);
+            } catch(...) {
+                return PARSER_ERROR;
+            }
+            return result.error_code;
+        }
+
+        /** \brief Изменить несколько лимитных ордеров одним запросом
+         * \param orders Параметры изменения ордеров (не больше MAX_BATCH_ORDERS)
+         * \param results Результаты изменения ордеров в том же порядке
+         * \param recv_window Время ожидания ответа, в мс.
+         * \return Код ошибки запроса. Вернет OK, даже если часть ордеров не изменена
+         */
+        int modify_batch_orders(
+                const std::vector<OrderModifySpec> &orders,
+                std::vector<OrderResultSpec> &results,
+                const uint64_t recv_window = 60000) {
+            results.clear();
+            if(orders.empty() || orders.size() > MAX_BATCH_ORDERS) return INVALID_PARAMETER;
+            json j_orders = json::array();
+            for(size_t i = 0; i < orders.size(); ++i) {
+                json j_order;
+                int err = get_modify_json(orders[i], j_order);
+                if(err != OK) return err;
+                j_orders.push_back(j_order);
+            }
+            std::string url(point);
+            std::string query_string;
+            std::string response;
+            query_string += "batchOrders=";
+            query_string += url_encode(j_orders.dump());
+            url += "/fapi/v1/batchOrders?";
+            int err = put_request_with_signature(response, query_string, url, recv_window, 5);
+            if(err != OK) return err;
+            results.resize(orders.size());
+            for(size_t i = 0; i < orders.size(); ++i) {
+                results[i].symbol = orders[i].symbol;
+                results[i].client_order_id = orders[i].orig_client_order_id;
+            }
+            return parse_batch_results(response, orders.size(), results);
+        }
+
         /** \brief Отменить ордер
          * \param symbol Торговый символ
          * \param orig_client_order_id Уникальный номер сделки
@@ -1335,7 +1832,7 @@ namespace binance_api {
             query_string += "symbol=";
             query_string += symbol;
             url += "/fapi/v1/allOpenOrders?";
-            int err = delete_request_with_signature(response, query_string, url, recv_window);
+            int err = delete_request_with_signature(response, query_string, url, recv_window, CANCEL_ALL_ORDERS_WEIGHT);
             if(err != OK) return err;
             try {
                 json j = json::parse(response);
@@ -1366,7 +1863,6 @@ namespace binance_api {
             query_string += orig_client_order_id;
             url += "/fapi/v1/order?";
             int err = get_request_with_signature(response, query_string, url, recv_window);
-            std::cout << "response: " << response << std::endl;
             if(err != OK) {
                 if(callback != nullptr) callback(err, response, TypesOrderStatus::NONE);
                 return err;
@@ -1382,29 +1878,9 @@ namespace binance_api {
                  * REJECTED
                  * EXPIRED
                  */
-                std::string status = j["status"];
-                if(status == "NEW") {
-                    if(callback != nullptr) callback(PARSER_ERROR, response, TypesOrderStatus::NEW);
-                    return OK;
-                } else
-                if(status == "PARTIALLY_FILLED") {
-                    if(callback != nullptr) callback(PARSER_ERROR, response, TypesOrderStatus::PARTIALLY_FILLED);
-                    return OK;
-                } else
-                if(status == "FILLED") {
-                    if(callback != nullptr) callback(PARSER_ERROR, response, TypesOrderStatus::FILLED);
-                    return OK;
-                } else
-                if(status == "CANCELED") {
-                    if(callback != nullptr) callback(PARSER_ERROR, response, TypesOrderStatus::CANCELED);
-                    return OK;
-                } else
-                if(status == "REJECTED") {
-                    if(callback != nullptr) callback(PARSER_ERROR, response, TypesOrderStatus::REJECTED);
-                    return OK;
-                } else
-                if(status == "EXPIRED") {
-                    if(callback != nullptr) callback(PARSER_ERROR, response, TypesOrderStatus::EXPIRED);
+                const TypesOrderStatus status = to_order_status(j["status"]);
+                if(status != TypesOrderStatus::NONE) {
+                    if(callback != nullptr) callback(OK, response, status);
                     return OK;
                 }
             } catch(...) {
@@ -1431,7 +1907,6 @@ namespace binance_api {
             query_string += orig_client_order_id;
             url += "/fapi/v1/openOrder?";
             int err = get_request_with_signature(response, query_string, url, recv_window);
-            std::cout << "response: " << response << std::endl;
             if(err != OK) {
                 if(callback != nullptr) callback(err, response, TypesOrderStatus::NONE);
                 return err;
@@ -1439,29 +1914,9 @@ namespace binance_api {
             try {
                 json j = json::parse(response);
                 std::string client_order_id = j["clientOrderId"];
-                std::string status = j["status"];
-                if(status == "NEW") {
-                    if(callback != nullptr) callback(PARSER_ERROR, response, TypesOrderStatus::NEW);
-                    return OK;
-                } else
-                if(status == "PARTIALLY_FILLED") {
-                    if(callback != nullptr) callback(PARSER_ERROR, response, TypesOrderStatus::PARTIALLY_FILLED);
-                    return OK;
-                } else
-                if(status == "FILLED") {
-                    if(callback != nullptr) callback(PARSER_ERROR, response, TypesOrderStatus::FILLED);
-                    return OK;
-                } else
-                if(status == "CANCELED") {
-                    if(callback != nullptr) callback(PARSER_ERROR, response, TypesOrderStatus::CANCELED);
-                    return OK;
-                } else
-                if(status == "REJECTED") {
-                    if(callback != nullptr) callback(PARSER_ERROR, response, TypesOrderStatus::REJECTED);
-                    return OK;
-                } else
-                if(status == "EXPIRED") {
-                    if(callback != nullptr) callback(PARSER_ERROR, response, TypesOrderStatus::EXPIRED);
+                const TypesOrderStatus status = to_order_status(j["status"]);
+                if(status != TypesOrderStatus::NONE) {
+                    if(callback != nullptr) callback(OK, response, status);
                     return OK;
                 }
             } catch(...) {
@@ -1471,6 +1926,72 @@ namespace binance_api {
             return DATA_NOT_AVAILABLE;
         }
 
+        /** \brief Получить состояние ордера
+         * \param symbol Торговый символ
+         * \param orig_client_order_id Уникальный номер ордера
+         * \param order Состояние ордера
+         * \param recv_window Время ожидания ответа, в мс.
+         * \return Код ошибки
+         */
+        int get_order(
+                const std::string &symbol,
+                const std::string &orig_client_order_id,
+                OrderUpdateSpec &order,
+                const uint64_t recv_window = 60000) {
+            std::string url(point);
+            std::string query_string;
+            std::string response;
+            query_string += "symbol=";
+            query_string += symbol;
+            query_string += "&origClientOrderId=";
+            query_string += orig_client_order_id;
+            url += "/fapi/v1/order?";
+            int err = get_request_with_signature(response, query_string, url, recv_window);
+            if(err != OK) return err;
+            try {
+                json j = json::parse(response);
+                parse_order_update(j, order);
+            } catch(...) {
+                return PARSER_ERROR;
+            }
+            return OK;
+        }
+
+        /** \brief Получить открытые ордера
+         * \param symbol Торговый символ. Если указать пустую строку, получим ордера по всем символам
+         * \param orders Открытые ордера
+         * \param recv_window Время ожидания ответа, в мс.
+         * \return Код ошибки
+         */
+        int get_open_orders(
+                const std::string &symbol,
+                std::vector<OrderUpdateSpec> &orders,
+                const uint64_t recv_window = 60000) {
+            orders.clear();
+            std::string url(point);
+            std::string query_string;
+            std::string response;
+            if(symbol.size() != 0) {
+                query_string += "symbol=";
+                query_string += symbol;
+            }
+            url += "/fapi/v1/openOrders?";
+            const uint64_t weight = symbol.size() == 0 ? 40 : 1;
+            int err = get_request_with_signature(response, query_string, url, recv_window, weight);
+            if(err != OK) return err;
+            try {
+                json j = json::parse(response);
+                for(size_t i = 0; i < j.size(); ++i) {
+                    OrderUpdateSpec order;
+                    parse_order_update(j[i], order);
+                    orders.push_back(order);
+                }
+            } catch(...) {
+                return PARSER_ERROR;
+            }
+            return OK;
+        }
+
         int get_open_orders(
                 const std::string &symbol,
                 const uint64_t recv_window = 60000,
@@ -1533,6 +2054,7 @@ namespace binance_api {
                     PositionSpec position;
                     position.symbol = j[i]["symbol"];
                     position.position_amount = std::atof(std::string(j[i]["positionAmt"]).c_str());
+                    if(j[i].find("updateTime") != j[i].end()) position.update_time = (double)((uint64_t)j[i]["updateTime"]) / 1000.0;
                     position.position_side = TypesPositionSide::NONE;
                     std::string str_position_side = j[i]["positionSide"];
                     if(str_position_side == "BOTH") position.position_side = TypesPositionSide::BOTH;
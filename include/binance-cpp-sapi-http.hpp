@@ -31,6 +31,7 @@
 #include <nlohmann/json.hpp>
 #include "hmac.hpp"
 #include "xtime.hpp"
+#include "tools/binance-cpp-api-server-clock.hpp"
 #include <thread>
 #include <future>
 #include <mutex>
@@ -95,6 +96,7 @@ namespace binance_api {
         };
 
         std::atomic<xtime::ftimestamp_t> offset_timestamp = ATOMIC_VAR_INIT(0);
+        std::shared_ptr<ServerClock> server_clock;  /**< Синхронизация времени с сервером */
 
     public:
 
@@ -102,9 +104,21 @@ namespace binance_api {
          * \return Метка времени сервера
          */
         inline xtime::ftimestamp_t get_server_ftimestamp() {
+            std::shared_ptr<ServerClock> clock_ptr = std::atomic_load(&server_clock);
+            if(clock_ptr && clock_ptr->check_estimated()) return clock_ptr->get_server_ftimestamp();
             return  xtime::get_ftimestamp() + offset_timestamp;
         }
 
+        /** \brief Использовать синхронизацию времени с сервером
+         *
+         * Пока у синхронизации нет оценки смещения, используется смещение,
+         * установленное через set_server_offset_timestamp()
+         * \param clock Синхронизация времени
+         */
+        inline void set_server_clock(std::shared_ptr<ServerClock> clock) {
+            std::atomic_store(&server_clock, clock);
+        }
+
         /** \brief Установить смещение метки времени
          * \param offset Смещение метки времени
          */
@@ -119,6 +133,17 @@ namespace binance_api {
         std::atomic<uint32_t> request_limit = ATOMIC_VAR_INIT(6000);
         std::atomic<xtime::timestamp_t> request_timestamp = ATOMIC_VAR_INIT(0);
 
+        /** \brief Получить вес запроса стакана
+         * \param limit Количество уровней
+         * \return Вес запроса
+         */
+        inline uint32_t get_depth_weight(const uint32_t limit) {
+            if(limit <= 100) return 5;
+            if(limit <= 500) return 25;
+            if(limit <= 1000) return 50;
+            return 250;
+        }
+
         void check_request_limit(const uint32_t weight = 1) {
             request_counter += weight;
             if(request_timestamp == 0) {
@@ -314,6 +339,8 @@ namespace binance_api {
             case 418: // Код возврата используется при блокировки после нарушении ограничения скорости запроса.
                 return IP_BLOCKED;
             }
+            /* остальные 5XX - ошибка на стороне сервера, запрос мог быть исполнен */
+            if(response_code >= 500 && response_code < 600) return SERVER_ERROR;
 
             if(result == CURLE_OK) {
                 if(headers.find("Content-Encoding:") != headers.end()) {
@@ -576,6 +603,29 @@ namespace binance_api {
             } catch(...) {}
         }
 
+        void parse_depth_snapshot(
+                DepthSnapshotSpec &snapshot,
+                std::string &response) {
+            json j = json::parse(response);
+            snapshot.last_update_id = j["lastUpdateId"];
+            json j_bids = j["bids"];
+            json j_asks = j["asks"];
+            snapshot.bids.clear();
+            snapshot.asks.clear();
+            snapshot.bids.reserve(j_bids.size());
+            snapshot.asks.reserve(j_asks.size());
+            for(size_t i = 0; i < j_bids.size(); ++i) {
+                snapshot.bids.push_back(DepthLevelSpec(
+                    std::atof(std::string(j_bids[i][0]).c_str()),
+                    std::atof(std::string(j_bids[i][1]).c_str())));
+            }
+            for(size_t i = 0; i < j_asks.size(); ++i) {
+                snapshot.asks.push_back(DepthLevelSpec(
+                    std::atof(std::string(j_asks[i][0]).c_str()),
+                    std::atof(std::string(j_asks[i][1]).c_str())));
+            }
+        }
+
         void parse_exchange_info(std::string &response) {
             try {
                 json j = json::parse(response);
@@ -609,7 +659,10 @@ namespace binance_api {
             query_string += "&recvWindow=";
             query_string += std::to_string(recv_window);
             query_string += "&timestamp=";
-            query_string += std::to_string((uint64_t)(get_server_ftimestamp() * 1000.0 + 1000.0));
+            /* без синхронизации смещение занижено на задержку потока, поэтому метка сдвигается на секунду */
+            std::shared_ptr<ServerClock> clock_ptr = std::atomic_load(&server_clock);
+            const bool is_clock = clock_ptr && clock_ptr->check_estimated();
+            query_string += std::to_string((uint64_t)(get_server_ftimestamp() * 1000.0 + (is_clock ? 0.0 : 1000.0)));
         }
 
         int get_request_none_security(std::string &response, const std::string &url, const uint64_t weight = 1) {
@@ -770,6 +823,26 @@ namespace binance_api {
             return false;
         }
 
+        /** \brief Получить время сервера
+         * \param server_time Время сервера, мс
+         * \return Код ошибки
+         */
+        int get_server_time(uint64_t &server_time) {
+            std::string url(point);
+            std::string response;
+            url += "/api/v3/time";
+            int err = get_request_none_security(response, url);
+            if(err != OK) return err;
+            try {
+                json j = json::parse(response);
+                server_time = j["serverTime"];
+            }
+            catch(...) {
+                return JSON_PARSER_ERROR;
+            }
+            return OK;
+        }
+
         /** \brief Получить текущие правила биржевой торговли и символьной информация
          *
          * Данные правил торговли и символьной информации сохраняются внутри класса,
@@ -786,6 +859,36 @@ namespace binance_api {
             return OK;
         }
 
+        /** \brief Получить снимок стакана
+         *
+         * Снимок используется для синхронизации локального стакана с потоком изменений
+         * \param snapshot Снимок стакана
+         * \param symbol Имя символа
+         * \param limit Количество уровней
+         * \return Код ошибки
+         */
+        int get_depth_snapshot(
+                DepthSnapshotSpec &snapshot,
+                const std::string &symbol,
+                const uint32_t limit = 1000) {
+            std::string url(point);
+            std::string response;
+            url += "/api/v3/depth?";
+            url += "symbol=";
+            url += to_upper_case(symbol);
+            url += "&limit=";
+            url += std::to_string(limit);
+            int err = get_request_none_security(response, url, get_depth_weight(limit));
+            if(err != OK) return err;
+            try {
+                parse_depth_snapshot(snapshot, response);
+            }
+            catch(...) {
+                return JSON_PARSER_ERROR;
+            }
+            return OK;
+        }
+
         /** \brief Получить исторические данные
          *
          * \param candles Массив баров
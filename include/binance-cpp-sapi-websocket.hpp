@@ -26,6 +26,9 @@
 
 #include "binance-cpp-api-common.hpp"
 #include "client_wss.hpp"
+#include "tools/binance-cpp-api-event-loop.hpp"
+#include "tools/binance-cpp-api-websocket-connection.hpp"
+#include "tools/binance-cpp-api-subscription-manager.hpp"
 #include <openssl/ssl.h>
 #include <wincrypt.h>
 #include <xtime.hpp>
@@ -49,16 +52,12 @@ namespace binance_api {
      */
     class CandlestickStreamsSApi {
     private:
-        using WssClient = SimpleWeb::SocketClient<SimpleWeb::WSS>;
         using json = nlohmann::json;
         std::string point = "stream.binance.com:9443/stream";
         //std::string point = "fstream.binance.com/stream";
         std::string sert_file = "curl-ca-bundle.crt";
 
-        std::shared_ptr<WssClient::Connection> save_connection;
-        std::shared_ptr<WssClient> client;      /**< Webclosket Клиент */
-        std::future<void> client_future;		/**< Поток соединения */
-        std::mutex save_connection_mutex;
+        WebSocketConnection connection;         /**< Соединение */
 
         const std::map<std::string, uint32_t> str_interval_to_index = {
             {"1m",1},{"3m",3},{"5m",5},{"15m",15},{"30m",30},
@@ -74,6 +73,7 @@ namespace binance_api {
 
         std::map<std::string, std::map<uint32_t, bool>> list_subscriptions;
         std::mutex list_subscriptions_mutex;
+        std::shared_ptr<SubscriptionManager> subscription_manager;    /**< Менеджер подписок */
 
         using candle_data = std::map<xtime::timestamp_t, xquotes_common::Candle>;
         using period_data = std::map<uint32_t, candle_data>;
@@ -184,6 +184,12 @@ namespace binance_api {
             try {
                 json j = json::parse(response);
 
+                /* ответ на запрос подписки, например {"result":null,"id":1} */
+                if(j.find("stream") == j.end()) {
+                    subscription_manager->on_response(j);
+                    return;
+                }
+
                 /* парсим параметры потока */
                 const std::string stream = j["stream"];
                 std::string symbol, param;
@@ -242,10 +248,14 @@ namespace binance_api {
             }
         }
 
-        void send(const std::string &message) {
-            std::lock_guard<std::mutex> lock(save_connection_mutex);
-            if(!save_connection) return;
-            save_connection->send(message);
+        bool send(const std::string &message) {
+            return connection.send(message);
+        }
+
+        void init_subscription_manager() {
+            subscription_manager = std::make_shared<SubscriptionManager>([&](const std::string &message) -> bool {
+                return send(message);
+            });
         }
 
         std::string to_upper_case(const std::string &s){
@@ -264,12 +274,64 @@ namespace binance_api {
             return temp;
         }
 
+        /** \brief Убрать поток из списка подписок
+         * \param param Имя потока, например btcusdt@kline_1m
+         */
+        void erase_subscription(const std::string &param) {
+            const size_t pos = param.find("@kline_");
+            if(pos == std::string::npos) return;
+            auto it = str_interval_to_index.find(param.substr(pos + 7));
+            if(it == str_interval_to_index.end()) return;
+            std::lock_guard<std::mutex> lock(list_subscriptions_mutex);
+            auto it_symbol = list_subscriptions.find(param.substr(0, pos));
+            if(it_symbol == list_subscriptions.end()) return;
+            it_symbol->second.erase(it->second);
+        }
+
+        /** \brief Инициализировать callback-функции соединения
+         */
+        void init_connection() {
+            connection.set_point(point);
+            connection.set_sert_file(sert_file);
+
+            /* подписки отправляются в потоке соединения с учетом ограничения скорости */
+            connection.on_timer = [&]() {
+                subscription_manager->process();
+            };
+
+            subscription_manager->on_reject = [&](const std::string &param, const bool is_subscribe) {
+                if(is_subscribe) erase_subscription(param);
+                if(on_subscription_reject != nullptr) on_subscription_reject(param, is_subscribe);
+            };
+
+            /* читаем собщения, которые пришли */
+            connection.on_message = [&](const std::string &message) {
+                parser(message);
+            };
+
+            connection.on_open = [&]() {
+                /* подписки отправляет менеджер с учетом ограничения скорости сообщений */
+                subscription_manager->on_open();
+                is_open = true;
+            };
+
+            connection.on_close = [&]() {
+                is_websocket_init = false;
+                is_open = false;
+                is_error = true;
+                subscription_manager->on_close();
+            };
+        }
+
     public:
         std::function<void(
             const std::string &symbol,
             const xquotes_common::Candle &candle,
             const uint32_t period,
             const bool close_candle)> on_candle = nullptr;
+        std::function<void(
+            const std::string &param,
+            const bool is_subscribe)> on_subscription_reject = nullptr; /**< Сервер отклонил подписку или отписку потока */
 
         /** \brief Конструктор класс для получения потока котировок
          * \param user_point Конечная точка подключения
@@ -286,6 +348,8 @@ namespace binance_api {
             is_close_connection = false;
             is_error = false;
             is_open = false;
+            init_subscription_manager();
+            init_connection();
         }
 
         /** \brief Конструктор класс для получения потока котировок
@@ -304,27 +368,15 @@ namespace binance_api {
             is_close_connection = false;
             is_error = false;
             is_open = false;
+            init_subscription_manager();
+            init_connection();
         }
 
         ~CandlestickStreamsSApi() {
             is_close_connection = true;
-            std::shared_ptr<WssClient> client_ptr = std::atomic_load(&client);
-            if(client_ptr) {
-                client_ptr->stop();
-            }
-
-            if(client_future.valid()) {
-                try {
-                    client_future.wait();
-                    client_future.get();
-                }
-                catch(const std::exception &e) {
-                    std::cerr << "binance_api::~CandlestickStreams() error, what: " << e.what() << std::endl;
-                }
-                catch(...) {
-                    std::cerr << "binance_api::~CandlestickStreams() error" << std::endl;
-                }
-            }
+            /* после остановки соединения его callback-функции больше не вызываются */
+            connection.stop();
+            subscription_manager.reset();
         };
 
         /** \brief Состояние соединения
@@ -566,19 +618,13 @@ namespace binance_api {
             auto it = index_interval_to_str.find(period);
             if(it == index_interval_to_str.end()) return;
             std::string s = to_lower_case(symbol);
-            json j;
-            j["method"] = "SUBSCRIBE";
-            j["params"] = json::array();
-            std::string param = s + "@kline_" + it->second;
-            j["params"][0] = param;
-            j["id"] = 1;
+            const std::string param = s + "@kline_" + it->second;
             {
                 std::lock_guard<std::mutex> lock(list_subscriptions_mutex);
                 /* имя символа ОБЯЗАТЕЛЬНО В НИЖНЕМ РЕГИСТРЕ! */
                 list_subscriptions[s][period] = true;
             }
-            if(!is_open) return;
-            send(j.dump());
+            subscription_manager->subscribe(param);
         }
 
         /** \brief Убрать поток символа с заданным периодом
@@ -591,12 +637,7 @@ namespace binance_api {
             auto it = index_interval_to_str.find(period);
             if(it == index_interval_to_str.end()) return;
             std::string s = to_lower_case(symbol);
-            json j;
-            j["method"] = "UNSUBSCRIBE";
-            j["params"] = json::array();
-            std::string param = s + "@kline_" + it->second;
-            j["params"][0] = param;
-            j["id"] = 1;
+            const std::string param = s + "@kline_" + it->second;
             {
                 std::lock_guard<std::mutex> lock(list_subscriptions_mutex);
                 /* имя символа ОБЯЗАТЕЛЬНО В НИЖНЕМ РЕГИСТРЕ! */
@@ -608,114 +649,45 @@ namespace binance_api {
                     }
                 }
             }
-            if(!is_open) return;
-            send(j.dump());
+            subscription_manager->unsubscribe(param);
         }
 
-        void start() {
-            if(client_future.valid()) return;
-            /* запустим соединение в отдельном потоке */
-            client_future = std::async(std::launch::async,[&]() {
-                while(!is_close_connection) {
-                    try {
-                        /* создадим соединение */;
-                        client = std::make_shared<WssClient>(
-                                point,
-                                true,
-                                std::string(),
-                                std::string(),
-                                std::string(sert_file));
-
-                        /* читаем собщения, которые пришли */
-                        client->on_message =
-                                [&](std::shared_ptr<WssClient::Connection> connection,
-                                std::shared_ptr<WssClient::InMessage> message) {
-                            parser(message->string());
-                            //std::cout << "on_message " << message->string() << std::endl;
-                        };
-
-                        client->on_open =
-                            [&](std::shared_ptr<WssClient::Connection> connection) {
-                            {
-                                std::lock_guard<std::mutex> lock(save_connection_mutex);
-                                save_connection = connection;
-                            }
-                            if(list_subscriptions.size() != 0) {
-                                json j;
-                                j["method"] = "SUBSCRIBE";
-                                j["params"] = json::array();
-                                j["id"] = 1;
-                                {
-                                    std::lock_guard<std::mutex> lock(list_subscriptions_mutex);
-                                    uint32_t index = 0;
-                                    for(auto &item_symbol : list_subscriptions) {
-                                        /* имя символа ОБЯЗАТЕЛЬНО В НИЖНЕМ РЕГИСТРЕ! */
-                                        const std::string symbol = item_symbol.first;
-                                        for(auto &subscrip : item_symbol.second) {
-                                            const uint32_t period = subscrip.first;
-                                            auto it = index_interval_to_str.find(period);
-                                            if(it == index_interval_to_str.end()) return;
-                                            std::string param = symbol + "@kline_" + it->second;
-                                            j["params"][index++] = param;
-                                        }
-                                    }
-                                }
-                                //std::cout << "j.dump()" << j.dump() << std::endl;
-                                connection->send(j.dump());
-                            }
-                            is_open = true;
-                            //std::cout << "on_open" << std::endl;
-                        };
-
-                        client->on_close =
-                                [&](std::shared_ptr<WssClient::Connection> /*connection*/,
-                                int status, const std::string & /*reason*/) {
-                            is_websocket_init = false;
-                            is_open = false;
-                            is_error = true;
-                            {
-                                std::lock_guard<std::mutex> lock(save_connection_mutex);
-                                if(save_connection) save_connection.reset();
-                            }
-                            std::cerr
-                                << point
-                                << " closed connection with status code " << status
-                                << std::endl;
-                        };
-
-                        // See http://www.boost.org/doc/libs/1_55_0/doc/html/boost_asio/reference.html, Error Codes for error code meanings
-                        client->on_error =
-                                [&](std::shared_ptr<WssClient::Connection> /*connection*/,
-                                const SimpleWeb::error_code &ec) {
-                            is_websocket_init = false;
-                            is_open = false;
-                            is_error = true;
-
-                            {
-                                std::lock_guard<std::mutex> lock(save_connection_mutex);
-                                if(save_connection) save_connection.reset();
-                            }
+        /** \brief Установить ограничение скорости сообщений подписки
+         *
+         * Изменения подписок накапливаются и отправляются пакетами не чаще указанной частоты
+         * \param messages_per_second Количество сообщений в секунду
+         */
+        void set_subscription_rate(const uint32_t messages_per_second) {
+            subscription_manager->set_messages_per_second(messages_per_second);
+        }
 
-                            std::cerr
-                                << point
-                                << " wss error: " << ec
-                                << std::endl;
-                        };
-                        client->start();
-                        client.reset();
-                    } catch (std::exception& e) {
-                        is_websocket_init = false;
-                        is_error = true;
-                    }
-                    catch (...) {
-                        is_websocket_init = false;
-                        is_error = true;
-                    }
-                    if(is_close_connection) break;
-					const uint64_t RECONNECT_DELAY = 1000;
-					std::this_thread::sleep_for(std::chrono::milliseconds(RECONNECT_DELAY));
-                } // while
-            });
+        /** \brief Проверить, применены ли все изменения подписок
+         * \return Вернет true, если сервер подтвердил все подписки
+         */
+        bool check_subscriptions() {
+            return subscription_manager->synchronized();
+        }
+
+        /** \brief Использовать внешний цикл событий
+         *
+         * Вместо собственного потока соединение обслуживается потоком io_context,
+         * который может быть общим для нескольких клиентов.
+         * Метод следует вызывать до start()
+         * \param user_event_loop Указатель на io_context
+         */
+        void set_event_loop(std::shared_ptr<SimpleWeb::io_context> user_event_loop) {
+            connection.set_event_loop(user_event_loop);
+        }
+
+        /** \brief Использовать цикл событий из пула
+         * \param pool Пул циклов событий
+         */
+        void set_event_loop(EventLoopPool &pool) {
+            set_event_loop(pool.get_io_context());
+        }
+
+        void start() {
+            connection.start();
         }
     };
 
@@ -724,17 +696,13 @@ namespace binance_api {
      */
     class UserDataStreamsSApi {
     private:
-        using WssClient = SimpleWeb::SocketClient<SimpleWeb::WSS>;
         using json = nlohmann::json;
         //std::string point = "fstream.binance.com/ws/";
         std::string point = "stream.binancefuture.com/ws/";
         std::string sert_file = "curl-ca-bundle.crt";
         std::string listen_key;
 
-        std::shared_ptr<WssClient::Connection> save_connection;
-        std::shared_ptr<WssClient> client;      /**< Webclosket Клиент */
-        std::future<void> client_future;		/**< Поток соединения */
-        std::mutex save_connection_mutex;
+        WebSocketConnection connection;         /**< Соединение */
 
         std::atomic<bool> is_websocket_init;    /**< Состояние соединения */
         std::atomic<bool> is_error;             /**< Ошибка соединения */
@@ -818,9 +786,7 @@ namespace binance_api {
         }
 
         void send(const std::string &message) {
-            std::lock_guard<std::mutex> lock(save_connection_mutex);
-            if(!save_connection) return;
-            save_connection->send(message);
+            connection.send(message);
         }
 
         std::string to_upper_case(const std::string &s){
@@ -839,6 +805,28 @@ namespace binance_api {
             return temp;
         }
 
+        /** \brief Инициализировать callback-функции соединения
+         */
+        void init_connection() {
+            connection.set_point(point + listen_key);
+            connection.set_sert_file(sert_file);
+
+            /* читаем собщения, которые пришли */
+            connection.on_message = [&](const std::string &message) {
+                parser(message);
+            };
+
+            connection.on_open = [&]() {
+                is_open = true;
+            };
+
+            connection.on_close = [&]() {
+                is_websocket_init = false;
+                is_open = false;
+                is_error = true;
+            };
+        }
+
     public:
         std::function<void(const BalanceSpec &balance)> on_balance = nullptr;
         std::function<void(const PositionSpec &position)> on_position = nullptr;
@@ -919,27 +907,13 @@ namespace binance_api {
             is_close_connection = false;
             is_error = false;
             is_open = false;
+            init_connection();
         }
 
         ~UserDataStreamsSApi() {
             is_close_connection = true;
-            std::shared_ptr<WssClient> client_ptr = std::atomic_load(&client);
-            if(client_ptr) {
-                client_ptr->stop();
-            }
-
-            if(client_future.valid()) {
-                try {
-                    client_future.wait();
-                    client_future.get();
-                }
-                catch(const std::exception &e) {
-                    std::cerr << "binance_api::~UserDataStreams() error, what: " << e.what() << std::endl;
-                }
-                catch(...) {
-                    std::cerr << "binance_api::~UserDataStreams() error" << std::endl;
-                }
-            }
+            /* после остановки соединения его callback-функции больше не вызываются */
+            connection.stop();
         };
 
         /** \brief Состояние соединения
@@ -992,89 +966,28 @@ namespace binance_api {
             return std::string();
         }
 
+        /** \brief Использовать внешний цикл событий
+         *
+         * Вместо собственного потока соединение обслуживается потоком io_context,
+         * который может быть общим для нескольких клиентов.
+         * Метод следует вызывать до start()
+         * \param user_event_loop Указатель на io_context
+         */
+        void set_event_loop(std::shared_ptr<SimpleWeb::io_context> user_event_loop) {
+            connection.set_event_loop(user_event_loop);
+        }
+
+        /** \brief Использовать цикл событий из пула
+         * \param pool Пул циклов событий
+         */
+        void set_event_loop(EventLoopPool &pool) {
+            set_event_loop(pool.get_io_context());
+        }
+
         /** \brief Запустить поток
          */
         void start() {
-            if(client_future.valid()) return;
-            /* запустим соединение в отдельном потоке */
-            client_future = std::async(std::launch::async,[&]() {
-                while(!is_close_connection) {
-                    try {
-                        /* создадим соединение */;
-                        client = std::make_shared<WssClient>(
-                                (point + listen_key),
-                                true,
-                                std::string(),
-                                std::string(),
-                                std::string(sert_file));
-
-                        /* читаем собщения, которые пришли */
-                        client->on_message =
-                                [&](std::shared_ptr<WssClient::Connection> connection,
-                                std::shared_ptr<WssClient::InMessage> message) {
-                            parser(message->string());
-                            //std::cout << "on_message " << message->string() << std::endl;
-                        };
-
-                        client->on_open =
-                            [&](std::shared_ptr<WssClient::Connection> connection) {
-                            {
-                                std::lock_guard<std::mutex> lock(save_connection_mutex);
-                                save_connection = connection;
-                            }
-                            is_open = true;
-                            //std::cout << "on_open" << std::endl;
-                        };
-
-                        client->on_close =
-                                [&](std::shared_ptr<WssClient::Connection> /*connection*/,
-                                int status, const std::string & /*reason*/) {
-                            is_websocket_init = false;
-                            is_open = false;
-                            is_error = true;
-                            {
-                                std::lock_guard<std::mutex> lock(save_connection_mutex);
-                                if(save_connection) save_connection.reset();
-                            }
-                            std::cerr
-                                << point
-                                << " closed connection with status code " << status
-                                << std::endl;
-                        };
-
-                        // See http://www.boost.org/doc/libs/1_55_0/doc/html/boost_asio/reference.html, Error Codes for error code meanings
-                        client->on_error =
-                                [&](std::shared_ptr<WssClient::Connection> /*connection*/,
-                                const SimpleWeb::error_code &ec) {
-                            is_websocket_init = false;
-                            is_open = false;
-                            is_error = true;
-
-                            {
-                                std::lock_guard<std::mutex> lock(save_connection_mutex);
-                                if(save_connection) save_connection.reset();
-                            }
-
-                            std::cerr
-                                << point
-                                << " wss error: " << ec
-                                << std::endl;
-                        };
-                        client->start();
-                        client.reset();
-                    } catch (std::exception& e) {
-                        is_websocket_init = false;
-                        is_error = true;
-                    }
-                    catch (...) {
-                        is_websocket_init = false;
-                        is_error = true;
-                    }
-                    if(is_close_connection) break;
-					const uint64_t RECONNECT_DELAY = 1000;
-					std::this_thread::sleep_for(std::chrono::milliseconds(RECONNECT_DELAY));
-                } // while
-            });
+            connection.start();
         }
     };
 }
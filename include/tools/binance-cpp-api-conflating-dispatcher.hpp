@@ -0,0 +1,156 @@
+#ifndef BINANCE_CPP_API_CONFLATING_DISPATCHER_HPP_INCLUDED
+#define BINANCE_CPP_API_CONFLATING_DISPATCHER_HPP_INCLUDED
+
+#include "binance-cpp-api-event-dispatcher.hpp"
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <atomic>
+#include <vector>
+#include <map>
+
+namespace binance_api {
+
+    /** \brief Класс для доставки последних значений медленному потребителю
+     *
+     * Для каждого ключа (например, символ и период) хранится один "грязный" слот.
+     * Пока потребитель не забрал слот, новые промежуточные события перезаписывают его.
+     * Финальные события (например, закрытие бара) никогда не схлопываются:
+     * они занимают слот ключа и следующее событие с этим ключом создает новый слот.
+     * Таким образом, работа потребителя ограничена количеством ключей, а не частотой сообщений.
+     */
+    template<class T>
+    class ConflatingDispatcher {
+    private:
+        std::function<void(const T &event)> callback;
+        std::function<std::string(const T &event)> get_key;
+        std::function<bool(const T &event)> is_final;
+
+        std::vector<T> slots;                       /**< Слоты в порядке поступления */
+        std::map<std::string, size_t> dirty_index;  /**< Индекс грязных слотов по ключу */
+        std::mutex slots_mutex;
+        std::condition_variable slots_cv;
+        std::atomic<bool> is_shutdown = ATOMIC_VAR_INIT(false);
+        std::future<void> consumer_future;          /**< Поток потребителя */
+
+        std::atomic<uint64_t> pushed_counter = ATOMIC_VAR_INIT(0);
+        std::atomic<uint64_t> delivered_counter = ATOMIC_VAR_INIT(0);
+        std::atomic<uint64_t> conflated_counter = ATOMIC_VAR_INIT(0);
+        std::atomic<size_t> queue_depth = ATOMIC_VAR_INIT(0);
+        std::atomic<size_t> max_queue_depth = ATOMIC_VAR_INIT(0);
+
+        inline void deliver(const T &event) {
+            try {
+                if(callback != nullptr) callback(event);
+            }
+            catch(const std::exception &e) {
+                std::cerr << "binance_api::ConflatingDispatcher callback error, what: " << e.what() << std::endl;
+            }
+            catch(...) {
+                std::cerr << "binance_api::ConflatingDispatcher callback error" << std::endl;
+            }
+            ++delivered_counter;
+        }
+
+        void consumer_loop() {
+            std::vector<T> temp;
+            while(true) {
+                {
+                    std::unique_lock<std::mutex> lock(slots_mutex);
+                    slots_cv.wait(lock, [&]() {
+                        return !slots.empty() || is_shutdown;
+                    });
+                    if(slots.empty() && is_shutdown) break;
+                    temp.swap(slots);
+                    dirty_index.clear();
+                    queue_depth = 0;
+                }
+                for(size_t i = 0; i < temp.size(); ++i) {
+                    deliver(temp[i]);
+                }
+                temp.clear();
+            }
+        }
+
+    public:
+
+        /** \brief Конструктор диспетчера последних значений
+         * \param user_callback Функция, которая будет вызвана в потоке потребителя
+         * \param user_get_key Функция получения ключа события
+         * \param user_is_final Функция проверки финального события, которое нельзя схлопнуть
+         */
+        ConflatingDispatcher(
+                std::function<void(const T &event)> user_callback,
+                std::function<std::string(const T &event)> user_get_key,
+                std::function<bool(const T &event)> user_is_final = nullptr) :
+                callback(user_callback),
+                get_key(user_get_key),
+                is_final(user_is_final) {
+            consumer_future = std::async(std::launch::async,[&]() {
+                consumer_loop();
+            });
+        }
+
+        ~ConflatingDispatcher() {
+            {
+                std::lock_guard<std::mutex> lock(slots_mutex);
+                is_shutdown = true;
+                slots_cv.notify_one();
+            }
+            if(consumer_future.valid()) {
+                try {
+                    consumer_future.wait();
+                    consumer_future.get();
+                }
+                catch(const std::exception &e) {
+                    std::cerr << "binance_api::~ConflatingDispatcher() error, what: " << e.what() << std::endl;
+                }
+                catch(...) {
+                    std::cerr << "binance_api::~ConflatingDispatcher() error" << std::endl;
+                }
+            }
+        }
+
+        /** \brief Передать событие потребителю
+         * \param event Событие
+         * \return Вернет false, если диспетчер остановлен
+         */
+        bool push(const T &event) {
+            if(is_shutdown) return false;
+            ++pushed_counter;
+            const std::string key = get_key != nullptr ? get_key(event) : std::string();
+            const bool final_event = is_final != nullptr ? is_final(event) : false;
+            std::lock_guard<std::mutex> lock(slots_mutex);
+            auto it = dirty_index.find(key);
+            if(it != dirty_index.end()) {
+                /* промежуточное событие заменяется более новым */
+                slots[it->second] = event;
+                ++conflated_counter;
+                if(final_event) dirty_index.erase(it);
+            } else {
+                if(!final_event) dirty_index[key] = slots.size();
+                slots.push_back(event);
+            }
+            const size_t depth = slots.size();
+            queue_depth = depth;
+            if(depth > max_queue_depth) max_queue_depth = depth;
+            slots_cv.notify_one();
+            return true;
+        }
+
+        /** \brief Получить метрики доставки
+         * \return Метрики доставки
+         */
+        DispatcherMetrics get_metrics() const {
+            DispatcherMetrics metrics;
+            metrics.queue_depth = queue_depth;
+            metrics.max_queue_depth = max_queue_depth;
+            metrics.pushed = pushed_counter;
+            metrics.delivered = delivered_counter;
+            metrics.conflated = conflated_counter;
+            return metrics;
+        }
+    };
+}
+
+#endif // BINANCE_CPP_API_CONFLATING_DISPATCHER_HPP_INCLUDED
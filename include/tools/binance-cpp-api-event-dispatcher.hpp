@@ -0,0 +1,273 @@
+#ifndef BINANCE_CPP_API_EVENT_DISPATCHER_HPP_INCLUDED
+#define BINANCE_CPP_API_EVENT_DISPATCHER_HPP_INCLUDED
+
+#include <binance-cpp-api-common.hpp>
+#include "binance-cpp-api-lock-free-queue.hpp"
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <atomic>
+#include <vector>
+#include <list>
+#include <map>
+
+namespace binance_api {
+    using namespace common;
+
+    /** \brief Метрики очереди событий
+     */
+    class DispatcherMetrics {
+    public:
+        size_t queue_depth = 0;         /**< Текущая глубина очереди */
+        size_t max_queue_depth = 0;     /**< Максимальная глубина очереди */
+        size_t capacity = 0;            /**< Емкость очереди */
+        uint64_t pushed = 0;            /**< Количество поступивших событий */
+        uint64_t delivered = 0;         /**< Количество доставленных событий */
+        uint64_t dropped = 0;           /**< Количество выброшенных событий */
+        uint64_t conflated = 0;         /**< Количество схлопнутых событий */
+        DispatcherMetrics() {};
+    };
+
+    /** \brief Класс для асинхронной доставки событий потребителю
+     *
+     * Поток вебсокета только кладет событие в ограниченную очередь,
+     * а callback-функция вызывается в отдельном потоке потребителя.
+     * При переполнении очереди используется одна из политик TypesBackpressure.
+     * Для политики CONFLATE необходимо задать функцию получения ключа события:
+     * события с одинаковым ключом, не успевшие попасть в очередь, схлопываются до последнего.
+     * Схлопнутое событие переносится в конец буфера, поэтому порядок событий разных ключей
+     * одного потока сохраняется. При политике BLOCK производитель ждет освобождения места в очереди.
+     */
+    template<class T>
+    class EventDispatcher {
+    private:
+        LockFreeQueue<T> queue;
+        const TypesBackpressure policy;
+        std::function<void(const T &event)> callback;
+        std::function<std::string(const T &event)> get_key;
+
+        /* события, не поместившиеся в очередь при политике CONFLATE */
+        std::list<T> conflated_events;
+        std::map<std::string, typename std::list<T>::iterator> conflated_index;
+        std::mutex conflated_mutex;
+        std::atomic<bool> is_conflated = ATOMIC_VAR_INIT(false);
+
+        /* флаги ожидания меняются и проверяются под блокировкой, иначе пробуждение может быть потеряно */
+        std::mutex wait_mutex;
+        std::condition_variable wait_cv;
+        bool is_wait = false;
+        /* ожидание места в очереди при политике BLOCK */
+        std::mutex space_mutex;
+        std::condition_variable space_cv;
+        uint32_t space_waiters = 0;
+        std::atomic<bool> is_shutdown = ATOMIC_VAR_INIT(false);
+        std::future<void> consumer_future;  /**< Поток потребителя */
+
+        std::atomic<uint64_t> pushed_counter = ATOMIC_VAR_INIT(0);
+        std::atomic<uint64_t> delivered_counter = ATOMIC_VAR_INIT(0);
+        std::atomic<uint64_t> dropped_counter = ATOMIC_VAR_INIT(0);
+        std::atomic<uint64_t> conflated_counter = ATOMIC_VAR_INIT(0);
+        std::atomic<size_t> max_queue_depth = ATOMIC_VAR_INIT(0);
+
+        inline void update_max_queue_depth() {
+            const size_t depth = queue.size();
+            size_t last_depth = max_queue_depth;
+            while(depth > last_depth && !max_queue_depth.compare_exchange_weak(last_depth, depth)) {};
+        }
+
+        inline void notify() {
+            std::lock_guard<std::mutex> lock(wait_mutex);
+            if(is_wait) wait_cv.notify_one();
+        }
+
+        inline void notify_space() {
+            if(policy != TypesBackpressure::BLOCK) return;
+            std::lock_guard<std::mutex> lock(space_mutex);
+            if(space_waiters > 0) space_cv.notify_all();
+        }
+
+        /** \brief Дождаться места в очереди и положить событие
+         * \return Вернет false, если диспетчер остановлен
+         */
+        bool push_blocking(const T &event) {
+            while(!queue.try_push(event)) {
+                if(is_shutdown) return false;
+                notify();
+                std::unique_lock<std::mutex> lock(space_mutex);
+                ++space_waiters;
+                space_cv.wait(lock, [&]() {
+                    return queue.size() < queue.capacity() || is_shutdown;
+                });
+                --space_waiters;
+            }
+            return true;
+        }
+
+        inline void deliver(const T &event) {
+            try {
+                if(callback != nullptr) callback(event);
+            }
+            catch(const std::exception &e) {
+                std::cerr << "binance_api::EventDispatcher callback error, what: " << e.what() << std::endl;
+            }
+            catch(...) {
+                std::cerr << "binance_api::EventDispatcher callback error" << std::endl;
+            }
+            ++delivered_counter;
+        }
+
+        /** \brief Положить событие в буфер схлопывания
+         * \return Вернет true, если событие было сохранено
+         */
+        bool push_conflated(const T &event) {
+            std::lock_guard<std::mutex> lock(conflated_mutex);
+            /* пока буфер пуст, порядок событий можно сохранить через очередь */
+            if(!is_conflated && queue.try_push(event)) return false;
+            const std::string key = get_key != nullptr ? get_key(event) : std::string();
+            auto it = conflated_index.find(key);
+            if(it != conflated_index.end()) {
+                /* последнее значение ключа встает после событий, поступивших раньше него */
+                conflated_events.erase(it->second);
+                ++conflated_counter;
+            }
+            conflated_index[key] = conflated_events.insert(conflated_events.end(), event);
+            is_conflated = true;
+            return true;
+        }
+
+        void flush_conflated() {
+            std::list<T> temp;
+            {
+                std::lock_guard<std::mutex> lock(conflated_mutex);
+                temp.swap(conflated_events);
+                conflated_index.clear();
+                is_conflated = false;
+            }
+            for(auto &event : temp) {
+                deliver(event);
+            }
+        }
+
+        void consumer_loop() {
+            T event;
+            while(true) {
+                while(queue.try_pop(event)) {
+                    notify_space();
+                    deliver(event);
+                }
+                if(is_conflated) {
+                    flush_conflated();
+                    continue;
+                }
+                if(is_shutdown) {
+                    if(queue.empty() && !is_conflated) break;
+                    continue;
+                }
+                std::unique_lock<std::mutex> lock(wait_mutex);
+                is_wait = true;
+                wait_cv.wait(lock, [&]() {
+                    return !queue.empty() || is_conflated || is_shutdown;
+                });
+                is_wait = false;
+            }
+        }
+
+    public:
+
+        /** \brief Конструктор диспетчера событий
+         * \param user_callback Функция, которая будет вызвана в потоке потребителя
+         * \param user_capacity Емкость очереди
+         * \param user_policy Политика при переполнении очереди
+         * \param user_get_key Функция получения ключа события для политики CONFLATE
+         */
+        EventDispatcher(
+                std::function<void(const T &event)> user_callback,
+                const size_t user_capacity = 4096,
+                const TypesBackpressure user_policy = TypesBackpressure::BLOCK,
+                std::function<std::string(const T &event)> user_get_key = nullptr) :
+                queue(user_capacity),
+                policy(user_policy),
+                callback(user_callback),
+                get_key(user_get_key) {
+            consumer_future = std::async(std::launch::async,[&]() {
+                consumer_loop();
+            });
+        }
+
+        ~EventDispatcher() {
+            is_shutdown = true;
+            {
+                std::lock_guard<std::mutex> lock(wait_mutex);
+                wait_cv.notify_one();
+            }
+            {
+                std::lock_guard<std::mutex> lock(space_mutex);
+                space_cv.notify_all();
+            }
+            if(consumer_future.valid()) {
+                try {
+                    consumer_future.wait();
+                    consumer_future.get();
+                }
+                catch(const std::exception &e) {
+                    std::cerr << "binance_api::~EventDispatcher() error, what: " << e.what() << std::endl;
+                }
+                catch(...) {
+                    std::cerr << "binance_api::~EventDispatcher() error" << std::endl;
+                }
+            }
+        }
+
+        /** \brief Передать событие потребителю
+         * \param event Событие
+         * \return Вернет false, если диспетчер остановлен
+         */
+        bool push(const T &event) {
+            if(is_shutdown) return false;
+            ++pushed_counter;
+            switch(policy) {
+            case TypesBackpressure::BLOCK:
+                if(!push_blocking(event)) return false;
+                break;
+            case TypesBackpressure::DROP_OLDEST:
+                while(!queue.try_push(event)) {
+                    T temp;
+                    if(queue.try_pop(temp)) ++dropped_counter;
+                }
+                break;
+            case TypesBackpressure::CONFLATE:
+                if(is_conflated || !queue.try_push(event)) {
+                    push_conflated(event);
+                }
+                break;
+            };
+            update_max_queue_depth();
+            notify();
+            return true;
+        }
+
+        /** \brief Получить метрики очереди
+         * \return Метрики очереди
+         */
+        DispatcherMetrics get_metrics() const {
+            DispatcherMetrics metrics;
+            metrics.queue_depth = queue.size();
+            metrics.max_queue_depth = max_queue_depth;
+            metrics.capacity = queue.capacity();
+            metrics.pushed = pushed_counter;
+            metrics.delivered = delivered_counter;
+            metrics.dropped = dropped_counter;
+            metrics.conflated = conflated_counter;
+            return metrics;
+        }
+
+        /** \brief Получить текущую глубину очереди
+         * \return Количество событий, ожидающих доставки
+         */
+        inline size_t get_queue_depth() const {
+            return queue.size();
+        }
+    };
+}
+
+#endif // BINANCE_CPP_API_EVENT_DISPATCHER_HPP_INCLUDED
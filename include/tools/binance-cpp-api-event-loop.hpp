@@ -0,0 +1,171 @@
+#ifndef BINANCE_CPP_API_EVENT_LOOP_HPP_INCLUDED
+#define BINANCE_CPP_API_EVENT_LOOP_HPP_INCLUDED
+
+#include "client_wss.hpp"
+#include <functional>
+#include <future>
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <iostream>
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace binance_api {
+
+    /** \brief Пул циклов событий для вебсокет клиентов
+     *
+     * Пул содержит небольшое фиксированное количество io_context, каждый из которых
+     * обслуживается одним потоком. Потоки можно закрепить за ядрами процессора.
+     * Пул должен существовать дольше, чем потоки котировок и пользовательских данных, которые его используют.
+     */
+    class EventLoopPool {
+    public:
+        using io_context_ptr = std::shared_ptr<SimpleWeb::io_context>;
+
+    private:
+        using work_guard = SimpleWeb::asio::executor_work_guard<SimpleWeb::io_context::executor_type>;
+
+        std::vector<io_context_ptr> io_contexts;
+        std::vector<std::shared_ptr<work_guard>> work_guards;
+        std::vector<std::future<void>> loop_futures;    /**< Потоки циклов событий */
+        std::atomic<size_t> next_index = ATOMIC_VAR_INIT(0);
+
+        /** \brief Закрепить текущий поток за ядром процессора
+         * \param core Номер ядра
+         * \return Вернет true в случае успеха
+         */
+        static bool pin_current_thread(const int core) {
+            if(core < 0) return false;
+#           if defined(_WIN32)
+            const DWORD_PTR mask = ((DWORD_PTR)1) << core;
+            return SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#           elif defined(__linux__)
+            cpu_set_t cpuset;
+            CPU_ZERO(&cpuset);
+            CPU_SET(core, &cpuset);
+            return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset) == 0;
+#           else
+            return false;
+#           endif
+        }
+
+    public:
+
+        /** \brief Конструктор пула циклов событий
+         * \param num_threads Количество потоков (и io_context)
+         * \param cores Номера ядер для закрепления потоков. Если массив пуст, потоки не закрепляются
+         */
+        EventLoopPool(
+                const size_t num_threads = 1,
+                const std::vector<int> &cores = std::vector<int>()) {
+            const size_t n = num_threads == 0 ? 1 : num_threads;
+            for(size_t i = 0; i < n; ++i) {
+                io_context_ptr io = std::make_shared<SimpleWeb::io_context>(1);
+                io_contexts.push_back(io);
+                work_guards.push_back(std::make_shared<work_guard>(io->get_executor()));
+                const int core = i < cores.size() ? cores[i] : -1;
+                loop_futures.push_back(std::async(std::launch::async,[io, core]() {
+                    if(core >= 0 && !pin_current_thread(core)) {
+                        std::cerr << "binance_api::EventLoopPool error, what: failed to pin thread to core " << core << std::endl;
+                    }
+                    while(true) {
+                        try {
+                            io->run();
+                            break;
+                        }
+                        catch(const std::exception &e) {
+                            std::cerr << "binance_api::EventLoopPool error, what: " << e.what() << std::endl;
+                        }
+                        catch(...) {
+                            std::cerr << "binance_api::EventLoopPool error" << std::endl;
+                        }
+                    }
+                }));
+            }
+        }
+
+        ~EventLoopPool() {
+            work_guards.clear();
+            for(size_t i = 0; i < io_contexts.size(); ++i) {
+                io_contexts[i]->stop();
+            }
+            for(size_t i = 0; i < loop_futures.size(); ++i) {
+                if(!loop_futures[i].valid()) continue;
+                try {
+                    loop_futures[i].wait();
+                    loop_futures[i].get();
+                }
+                catch(const std::exception &e) {
+                    std::cerr << "binance_api::~EventLoopPool() error, what: " << e.what() << std::endl;
+                }
+                catch(...) {
+                    std::cerr << "binance_api::~EventLoopPool() error" << std::endl;
+                }
+            }
+        }
+
+        /** \brief Получить io_context
+         *
+         * io_context выдаются по кругу, чтобы распределить клиенты по потокам
+         * \return Указатель на io_context
+         */
+        io_context_ptr get_io_context() {
+            const size_t index = next_index++;
+            return io_contexts[index % io_contexts.size()];
+        }
+
+        /** \brief Получить io_context по индексу
+         * \param index Индекс потока
+         * \return Указатель на io_context
+         */
+        io_context_ptr get_io_context(const size_t index) {
+            return io_contexts[index % io_contexts.size()];
+        }
+
+        /** \brief Получить количество потоков
+         * \return Количество потоков
+         */
+        inline size_t size() const {
+            return io_contexts.size();
+        }
+
+        /** \brief Выполнить функцию в потоке io_context и дождаться ее завершения
+         *
+         * Если метод вызван из потока io_context, функция выполняется сразу
+         * \param io Указатель на io_context
+         * \param f Функция
+         */
+        static void invoke(const io_context_ptr &io, std::function<void()> f) {
+            if(!io || io->stopped() || io->get_executor().running_in_this_thread()) {
+                f();
+                return;
+            }
+            std::shared_ptr<std::promise<void>> done = std::make_shared<std::promise<void>>();
+            std::shared_ptr<std::atomic<bool>> is_run = std::make_shared<std::atomic<bool>>(false);
+            std::future<void> done_future = done->get_future();
+            SimpleWeb::asio::post(*io, [f, done, is_run]() {
+                if(!is_run->exchange(true)) {
+                    try {
+                        f();
+                    }
+                    catch(...) {}
+                }
+                done->set_value();
+            });
+            /* если цикл событий остановлен, функция уже не будет выполнена в его потоке */
+            while(done_future.wait_for(std::chrono::milliseconds(10)) != std::future_status::ready) {
+                if(io->stopped() && !is_run->exchange(true)) {
+                    f();
+                    return;
+                }
+            }
+        }
+    };
+}
+
+#endif // BINANCE_CPP_API_EVENT_LOOP_HPP_INCLUDED
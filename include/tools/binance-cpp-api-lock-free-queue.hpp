@@ -0,0 +1,129 @@
+#ifndef BINANCE_CPP_API_LOCK_FREE_QUEUE_HPP_INCLUDED
+#define BINANCE_CPP_API_LOCK_FREE_QUEUE_HPP_INCLUDED
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+
+namespace binance_api {
+
+    /** \brief Ограниченная неблокирующая очередь
+     *
+     * Кольцевой буфер с порядковым номером в каждой ячейке (алгоритм Д. Вьюкова).
+     * Очередь допускает несколько производителей и несколько потребителей,
+     * поэтому ее можно использовать и как SPSC, и как MPSC очередь.
+     * Размер буфера округляется вверх до степени двойки.
+     */
+    template<class T>
+    class LockFreeQueue {
+    private:
+        static const size_t CACHE_LINE_SIZE = 64;
+
+        struct Cell {
+            std::atomic<size_t> sequence;
+            T data;
+        };
+
+        std::unique_ptr<Cell[]> buffer;
+        size_t buffer_mask = 0;
+
+        alignas(CACHE_LINE_SIZE) std::atomic<size_t> enqueue_pos;   /**< Позиция записи */
+        alignas(CACHE_LINE_SIZE) std::atomic<size_t> dequeue_pos;   /**< Позиция чтения */
+
+    public:
+
+        /** \brief Конструктор очереди
+         * \param user_capacity Емкость очереди
+         */
+        LockFreeQueue(const size_t user_capacity = 1024) {
+            size_t capacity = 2;
+            while(capacity < user_capacity) capacity <<= 1;
+            buffer = std::unique_ptr<Cell[]>(new Cell[capacity]);
+            buffer_mask = capacity - 1;
+            for(size_t i = 0; i < capacity; ++i) {
+                buffer[i].sequence.store(i, std::memory_order_relaxed);
+            }
+            enqueue_pos.store(0, std::memory_order_relaxed);
+            dequeue_pos.store(0, std::memory_order_relaxed);
+        }
+
+        LockFreeQueue(const LockFreeQueue &) = delete;
+        LockFreeQueue &operator=(const LockFreeQueue &) = delete;
+
+        /** \brief Добавить элемент в очередь
+         * \param value Элемент
+         * \return Вернет false, если очередь заполнена
+         */
+        template<class V>
+        bool try_push(V &&value) {
+            Cell *cell = nullptr;
+            size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+            while(true) {
+                cell = &buffer[pos & buffer_mask];
+                const size_t seq = cell->sequence.load(std::memory_order_acquire);
+                const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+                if(diff == 0) {
+                    if(enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+                } else
+                if(diff < 0) {
+                    return false;
+                } else {
+                    pos = enqueue_pos.load(std::memory_order_relaxed);
+                }
+            }
+            cell->data = std::forward<V>(value);
+            cell->sequence.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        /** \brief Извлечь элемент из очереди
+         * \param value Элемент
+         * \return Вернет false, если очередь пуста
+         */
+        bool try_pop(T &value) {
+            Cell *cell = nullptr;
+            size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+            while(true) {
+                cell = &buffer[pos & buffer_mask];
+                const size_t seq = cell->sequence.load(std::memory_order_acquire);
+                const intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+                if(diff == 0) {
+                    if(dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+                } else
+                if(diff < 0) {
+                    return false;
+                } else {
+                    pos = dequeue_pos.load(std::memory_order_relaxed);
+                }
+            }
+            value = std::move(cell->data);
+            cell->sequence.store(pos + buffer_mask + 1, std::memory_order_release);
+            return true;
+        }
+
+        /** \brief Получить приблизительное количество элементов в очереди
+         * \return Количество элементов
+         */
+        inline size_t size() const {
+            const size_t head = dequeue_pos.load(std::memory_order_relaxed);
+            const size_t tail = enqueue_pos.load(std::memory_order_relaxed);
+            return tail > head ? (tail - head) : 0;
+        }
+
+        /** \brief Проверить, пуста ли очередь
+         * \return Вернет true, если очередь пуста
+         */
+        inline bool empty() const {
+            return size() == 0;
+        }
+
+        /** \brief Получить емкость очереди
+         * \return Емкость очереди
+         */
+        inline size_t capacity() const {
+            return buffer_mask + 1;
+        }
+    };
+}
+
+#endif // BINANCE_CPP_API_LOCK_FREE_QUEUE_HPP_INCLUDED
@@ -0,0 +1,312 @@
+#ifndef BINANCE_CPP_API_ORDER_BOOK_HPP_INCLUDED
+#define BINANCE_CPP_API_ORDER_BOOK_HPP_INCLUDED
+
+#include <binance-cpp-api-common.hpp>
+#include <algorithm>
+#include <vector>
+
+namespace binance_api {
+    using namespace common;
+
+    /** \brief Класс локального стакана
+     *
+     * Уровни каждой стороны хранятся в непрерывном отсортированном массиве,
+     * лучшая цена находится в конце массива. Большинство обновлений приходится
+     * на уровни рядом с лучшей ценой, поэтому вставка и удаление сдвигают мало элементов,
+     * а лучшие цены доступны за O(1).
+     * Класс не потокобезопасен.
+     */
+    class OrderBook {
+    private:
+        std::vector<DepthLevelSpec> bids;   /**< Покупка, по возрастанию цены */
+        std::vector<DepthLevelSpec> asks;   /**< Продажа, по убыванию цены */
+        uint64_t last_update_id = 0;
+
+        /** \brief Обновить уровень стороны стакана
+         * \param levels Уровни стороны
+         * \param price Цена
+         * \param quantity Количество (0 - удалить уровень)
+         * \param comp Сравнение, упорядочивающее уровни от худшей цены к лучшей
+         */
+        template<class Compare>
+        static void update_level(
+                std::vector<DepthLevelSpec> &levels,
+                const double price,
+                const double quantity,
+                Compare comp) {
+            auto it = std::lower_bound(levels.begin(), levels.end(), price,
+                [&](const DepthLevelSpec &level, const double value) {
+                return comp(level.price, value);
+            });
+            const bool is_found = it != levels.end() && it->price == price;
+            if(quantity == 0) {
+                if(is_found) levels.erase(it);
+                return;
+            }
+            if(is_found) it->quantity = quantity;
+            else levels.insert(it, DepthLevelSpec(price, quantity));
+        }
+
+        /** \brief Заполнить сторону стакана уровнями снимка
+         *
+         * Уровни копируются и сортируются один раз. Для повторяющейся цены остается последний уровень,
+         * уровни с нулевым количеством удаляются, как при поуровневом обновлении
+         * \param levels Уровни стороны
+         * \param snapshot_levels Уровни снимка
+         * \param comp Сравнение, упорядочивающее уровни от худшей цены к лучшей
+         */
+        template<class Compare>
+        static void assign_levels(
+                std::vector<DepthLevelSpec> &levels,
+                const std::vector<DepthLevelSpec> &snapshot_levels,
+                Compare comp) {
+            levels.assign(snapshot_levels.begin(), snapshot_levels.end());
+            std::stable_sort(levels.begin(), levels.end(),
+                [&](const DepthLevelSpec &a, const DepthLevelSpec &b) {
+                return comp(a.price, b.price);
+            });
+            /* для одинаковых цен оставляем последний уровень, затем удаляем нулевые */
+            size_t n = 0;
+            for(size_t i = 0; i < levels.size(); ++i) {
+                if(i + 1 < levels.size() && levels[i + 1].price == levels[i].price) continue;
+                if(levels[i].quantity == 0) continue;
+                levels[n++] = levels[i];
+            }
+            levels.resize(n);
+        }
+
+        static void copy_top(
+                const std::vector<DepthLevelSpec> &levels,
+                std::vector<DepthLevelSpec> &top,
+                const size_t depth) {
+            top.clear();
+            const size_t n = depth == 0 ? levels.size() : std::min(depth, levels.size());
+            top.reserve(n);
+            for(size_t i = 0; i < n; ++i) {
+                top.push_back(levels[levels.size() - 1 - i]);
+            }
+        }
+
+    public:
+
+        OrderBook() {};
+
+        /** \brief Очистить стакан
+         */
+        void clear() {
+            bids.clear();
+            asks.clear();
+            last_update_id = 0;
+        }
+
+        /** \brief Установить снимок стакана
+         * \param snapshot Снимок стакана
+         */
+        void set_snapshot(const DepthSnapshotSpec &snapshot) {
+            assign_levels(bids, snapshot.bids, [](const double a, const double b) {
+                return a < b;
+            });
+            assign_levels(asks, snapshot.asks, [](const double a, const double b) {
+                return a > b;
+            });
+            last_update_id = snapshot.last_update_id;
+        }
+
+        /** \brief Обновить уровень покупки
+         * \param price Цена
+         * \param quantity Количество (0 - удалить уровень)
+         */
+        inline void update_bid(const double price, const double quantity) {
+            update_level(bids, price, quantity, [](const double a, const double b) {
+                return a < b;
+            });
+        }
+
+        /** \brief Обновить уровень продажи
+         * \param price Цена
+         * \param quantity Количество (0 - удалить уровень)
+         */
+        inline void update_ask(const double price, const double quantity) {
+            update_level(asks, price, quantity, [](const double a, const double b) {
+                return a > b;
+            });
+        }
+
+        inline void set_last_update_id(const uint64_t value) {
+            last_update_id = value;
+        }
+
+        inline uint64_t get_last_update_id() const {
+            return last_update_id;
+        }
+
+        /** \brief Получить лучшую цену покупки
+         * \param level Уровень
+         * \return Вернет true, если уровень есть
+         */
+        inline bool get_best_bid(DepthLevelSpec &level) const {
+            if(bids.empty()) return false;
+            level = bids.back();
+            return true;
+        }
+
+        /** \brief Получить лучшую цену продажи
+         * \param level Уровень
+         * \return Вернет true, если уровень есть
+         */
+        inline bool get_best_ask(DepthLevelSpec &level) const {
+            if(asks.empty()) return false;
+            level = asks.back();
+            return true;
+        }
+
+        /** \brief Получить уровни покупки от лучшей цены
+         * \param top Уровни
+         * \param depth Количество уровней (0 - все)
+         */
+        inline void get_bids(std::vector<DepthLevelSpec> &top, const size_t depth = 0) const {
+            copy_top(bids, top, depth);
+        }
+
+        /** \brief Получить уровни продажи от лучшей цены
+         * \param top Уровни
+         * \param depth Количество уровней (0 - все)
+         */
+        inline void get_asks(std::vector<DepthLevelSpec> &top, const size_t depth = 0) const {
+            copy_top(asks, top, depth);
+        }
+
+        inline size_t get_num_bids() const {
+            return bids.size();
+        }
+
+        inline size_t get_num_asks() const {
+            return asks.size();
+        }
+
+        inline bool empty() const {
+            return bids.empty() && asks.empty();
+        }
+    };
+
+    /** \brief Изменение стакана из потока глубины рынка
+     */
+    class DepthUpdateSpec {
+    public:
+        uint64_t first_update_id = 0;   /**< U */
+        uint64_t final_update_id = 0;   /**< u */
+        uint64_t prev_update_id = 0;    /**< pu, только для фьючерсов */
+        uint64_t event_time = 0;        /**< E */
+        std::vector<DepthLevelSpec> bids;
+        std::vector<DepthLevelSpec> asks;
+        DepthUpdateSpec() {};
+    };
+
+    /** \brief Класс синхронизации локального стакана со снимком и потоком изменений
+     *
+     * Правила Binance: изменения буферизуются до загрузки снимка, изменения старше снимка
+     * отбрасываются, первое примененное изменение должно содержать lastUpdateId снимка,
+     * далее каждое изменение продолжает предыдущее (pu для фьючерсов, U для спота).
+     * Класс не потокобезопасен.
+     */
+    class OrderBookSync {
+    public:
+
+        /// Результат проверки последовательности
+        enum class SequenceTypes {
+            APPLY,  /**< Изменение нужно применить */
+            SKIP,   /**< Изменение уже вошло в стакан */
+            GAP,    /**< Разрыв последовательности */
+        };
+
+        OrderBook book;
+        std::vector<DepthUpdateSpec> buffer;    /**< Изменения, пришедшие до синхронизации */
+        bool is_futures = true;                 /**< Правила последовательности фьючерсов (pu) или спота */
+        bool is_synced = false;                 /**< Стакан синхронизирован */
+        bool is_first_update = true;            /**< Следующее изменение - первое после снимка */
+        uint64_t event_time = 0;                /**< Время последнего примененного изменения */
+
+        OrderBookSync(const bool user_is_futures = true) : is_futures(user_is_futures) {};
+
+        /** \brief Проверить последовательность изменения
+         * \param update Изменение стакана
+         * \return Результат проверки
+         */
+        SequenceTypes check_sequence(const DepthUpdateSpec &update) const {
+            const uint64_t last_id = book.get_last_update_id();
+            if(is_futures) {
+                if(is_first_update) {
+                    /* первое изменение должно содержать lastUpdateId снимка */
+                    if(update.final_update_id < last_id) return SequenceTypes::SKIP;
+                    if(update.first_update_id <= last_id) return SequenceTypes::APPLY;
+                    return SequenceTypes::GAP;
+                }
+                if(update.final_update_id <= last_id) return SequenceTypes::SKIP;
+                if(update.prev_update_id == last_id) return SequenceTypes::APPLY;
+                return SequenceTypes::GAP;
+            }
+            if(is_first_update) {
+                if(update.final_update_id <= last_id) return SequenceTypes::SKIP;
+                if(update.first_update_id <= (last_id + 1)) return SequenceTypes::APPLY;
+                return SequenceTypes::GAP;
+            }
+            if(update.final_update_id <= last_id) return SequenceTypes::SKIP;
+            if(update.first_update_id == (last_id + 1)) return SequenceTypes::APPLY;
+            return SequenceTypes::GAP;
+        }
+
+        /** \brief Применить изменение стакана
+         * \param update Изменение стакана
+         */
+        void apply_update(const DepthUpdateSpec &update) {
+            for(size_t i = 0; i < update.bids.size(); ++i) {
+                book.update_bid(update.bids[i].price, update.bids[i].quantity);
+            }
+            for(size_t i = 0; i < update.asks.size(); ++i) {
+                book.update_ask(update.asks[i].price, update.asks[i].quantity);
+            }
+            book.set_last_update_id(update.final_update_id);
+            event_time = update.event_time;
+            is_first_update = false;
+        }
+
+        /** \brief Применить снимок и накопленные изменения
+         *
+         * Если изменения начинаются позже снимка, стакан очищается,
+         * а изменения остаются в буфере до следующего снимка
+         * \param snapshot Снимок стакана
+         * \return Вернет true, если стакан синхронизирован
+         */
+        bool apply_snapshot(const DepthSnapshotSpec &snapshot) {
+            book.set_snapshot(snapshot);
+            is_first_update = true;
+            for(size_t index = 0; index < buffer.size(); ++index) {
+                const SequenceTypes result = check_sequence(buffer[index]);
+                if(result == SequenceTypes::SKIP) continue;
+                if(result == SequenceTypes::GAP) {
+                    /* снимок старше изменений, нужен более новый снимок */
+                    buffer.erase(buffer.begin(), buffer.begin() + index);
+                    book.clear();
+                    is_first_update = true;
+                    return false;
+                }
+                apply_update(buffer[index]);
+            }
+            buffer.clear();
+            is_synced = true;
+            return true;
+        }
+
+        /** \brief Начать синхронизацию заново
+         * \param is_clear_buffer Удалить накопленные изменения
+         */
+        void reset(const bool is_clear_buffer = true) {
+            if(is_clear_buffer) buffer.clear();
+            book.clear();
+            is_synced = false;
+            is_first_update = true;
+        }
+    };
+}
+
+#endif // BINANCE_CPP_API_ORDER_BOOK_HPP_INCLUDED
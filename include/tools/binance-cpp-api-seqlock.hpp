@@ -0,0 +1,133 @@
+#ifndef BINANCE_CPP_API_SEQLOCK_HPP_INCLUDED
+#define BINANCE_CPP_API_SEQLOCK_HPP_INCLUDED
+
+#include <atomic>
+#include <cstring>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+
+namespace binance_api {
+
+    /** \brief Класс данных под защитой счетчика последовательности (seqlock)
+     *
+     * Один писатель увеличивает счетчик до и после записи, поэтому во время записи он нечетный.
+     * Читатели не блокируют писателя: копия данных принимается, только если счетчик
+     * был четным и не изменился за время копирования, иначе чтение повторяется.
+     * Данные должны быть тривиально копируемыми.
+     */
+    template<class T>
+    class SeqLock {
+    private:
+        static_assert(std::is_trivially_copyable<T>::value, "SeqLock requires trivially copyable data");
+
+        alignas(64) std::atomic<uint64_t> sequence = ATOMIC_VAR_INIT(0);
+        alignas(64) T data;
+
+    public:
+
+        SeqLock() : data() {};
+
+        /** \brief Записать данные
+         *
+         * Метод рассчитан на одного писателя
+         * \param value Данные
+         */
+        void store(const T &value) {
+            const uint64_t seq = sequence.load(std::memory_order_relaxed);
+            sequence.store(seq + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            std::memcpy((void*)&data, (const void*)&value, sizeof(T));
+            std::atomic_thread_fence(std::memory_order_release);
+            sequence.store(seq + 2, std::memory_order_relaxed);
+        }
+
+        /** \brief Прочитать согласованную копию данных
+         * \param value Данные
+         * \return Номер версии данных (0, если данные еще не записывались)
+         */
+        uint64_t load(T &value) const {
+            while(true) {
+                const uint64_t seq_before = sequence.load(std::memory_order_acquire);
+                if(seq_before & 1) continue;
+                std::memcpy((void*)&value, (const void*)&data, sizeof(T));
+                std::atomic_thread_fence(std::memory_order_acquire);
+                const uint64_t seq_after = sequence.load(std::memory_order_relaxed);
+                if(seq_before == seq_after) return seq_before / 2;
+            }
+        }
+
+        /** \brief Получить номер версии данных
+         * \return Номер версии (увеличивается после каждой записи)
+         */
+        inline uint64_t get_version() const {
+            return sequence.load(std::memory_order_acquire) / 2;
+        }
+    };
+
+    /** \brief Массив слотов SeqLock фиксированного размера
+     *
+     * SeqLock выровнен по строке кэша, а new[] до C++17 не гарантирует расширенное выравнивание,
+     * поэтому память выделяется с запасом и слоты размещаются по выровненному адресу
+     */
+    template<class T>
+    class SeqLockArray {
+    private:
+        void *memory = nullptr;
+        SeqLock<T> *items = nullptr;
+        size_t length = 0;
+
+        void release() {
+            for(size_t i = 0; i < length; ++i) {
+                items[i].~SeqLock<T>();
+            }
+            ::operator delete(memory);
+            memory = nullptr;
+            items = nullptr;
+            length = 0;
+        }
+
+    public:
+
+        SeqLockArray() {};
+
+        SeqLockArray(const SeqLockArray &) = delete;
+        SeqLockArray &operator=(const SeqLockArray &) = delete;
+
+        ~SeqLockArray() {
+            release();
+        }
+
+        /** \brief Создать слоты
+         *
+         * Прежние слоты удаляются
+         * \param size Количество слотов
+         */
+        void reset(const size_t size) {
+            release();
+            if(size == 0) return;
+            const size_t alignment = alignof(SeqLock<T>);
+            memory = ::operator new(size * sizeof(SeqLock<T>) + alignment);
+            const uintptr_t address = (reinterpret_cast<uintptr_t>(memory) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+            items = reinterpret_cast<SeqLock<T>*>(address);
+            for(size_t i = 0; i < size; ++i) {
+                new (items + i) SeqLock<T>();
+            }
+            length = size;
+        }
+
+        inline size_t size() const {
+            return length;
+        }
+
+        inline SeqLock<T> &operator[](const size_t index) {
+            return items[index];
+        }
+
+        inline const SeqLock<T> &operator[](const size_t index) const {
+            return items[index];
+        }
+    };
+}
+
+#endif // BINANCE_CPP_API_SEQLOCK_HPP_INCLUDED
@@ -0,0 +1,277 @@
+#ifndef BINANCE_CPP_API_SERVER_CLOCK_HPP_INCLUDED
+#define BINANCE_CPP_API_SERVER_CLOCK_HPP_INCLUDED
+
+#include <binance-cpp-api-common.hpp>
+#include <xtime.hpp>
+#include <functional>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <cmath>
+
+namespace binance_api {
+
+    /** \brief Класс синхронизации времени с сервером
+     *
+     * Время компьютера ведется по монотонным часам от метки времени, полученной при создании объекта,
+     * поэтому чтение времени не обращается к системным часам и не зависит от их перевода.
+     * Смещение времени сервера оценивается как в NTP: по запросам времени сервера с измерением RTT
+     * выбирается измерение с наименьшей задержкой, погрешность которого не больше половины RTT.
+     * Метки времени событий потоков дают нижнюю границу смещения (событие не может прийти раньше,
+     * чем произошло) и уточняют оценку внутри погрешности запроса.
+     * Уход часов компьютера оценивается по смещениям, измеренным в разное время.
+     * Все метки времени - в секундах, часовая зона UTC.
+     */
+    class ServerClock {
+    public:
+
+        /// Функция запроса времени сервера
+        using request_function = std::function<int(uint64_t &server_time)>;
+
+    private:
+        using clock = std::chrono::steady_clock;
+
+        /// Измерение по запросу времени сервера
+        class Sample {
+        public:
+            xtime::ftimestamp_t local_time = 0;     /**< Время компьютера в середине запроса */
+            xtime::ftimestamp_t offset = 0;         /**< Смещение времени сервера */
+            xtime::ftimestamp_t delay = 0;          /**< Время прохождения запроса */
+            Sample() {};
+        };
+
+        const clock::time_point base_steady;
+        const xtime::ftimestamp_t base_timestamp;
+
+        std::deque<Sample> samples;                 /**< Последние измерения по запросам */
+        std::mutex clock_mutex;
+        size_t max_samples = 8;
+
+        xtime::ftimestamp_t passive_bound = 0;      /**< Нижняя граница смещения по событиям потоков */
+        xtime::ftimestamp_t passive_bound_time = 0; /**< Время компьютера нижней границы */
+        xtime::ftimestamp_t passive_window = 60;    /**< Время жизни нижней границы, сек. */
+        bool is_passive_bound = false;
+
+        xtime::ftimestamp_t last_drift_offset = 0;  /**< Смещение для оценки ухода часов */
+        xtime::ftimestamp_t last_drift_time = 0;
+        bool is_drift = false;
+        const xtime::ftimestamp_t min_drift_interval = 60;  /**< Минимальный интервал оценки ухода часов, сек. */
+        const xtime::ftimestamp_t max_drift = 0.0005;       /**< Максимальный уход часов, сек. в сек. */
+
+        std::atomic<double> offset = ATOMIC_VAR_INIT(0);        /**< Смещение времени сервера на момент оценки */
+        std::atomic<double> offset_time = ATOMIC_VAR_INIT(0);   /**< Время компьютера оценки смещения */
+        std::atomic<double> drift = ATOMIC_VAR_INIT(0);         /**< Уход часов компьютера относительно сервера */
+        std::atomic<double> error = ATOMIC_VAR_INIT(0);         /**< Погрешность оценки смещения */
+        std::atomic<bool> is_synced = ATOMIC_VAR_INIT(false);   /**< Было хотя бы одно измерение по запросу */
+        std::atomic<bool> is_estimated = ATOMIC_VAR_INIT(false);
+        std::atomic<uint64_t> sync_counter = ATOMIC_VAR_INIT(0);
+
+        /** \brief Обновить оценку смещения
+         *
+         * Метод вызывается под блокировкой clock_mutex
+         * \param now Время компьютера
+         */
+        void update_estimate(const xtime::ftimestamp_t now) {
+            /* нижняя граница по событиям потоков устаревает, так как задержка потока меняется */
+            if(is_passive_bound && (now - passive_bound_time) > passive_window) is_passive_bound = false;
+
+            xtime::ftimestamp_t new_offset = 0;
+            xtime::ftimestamp_t new_error = 0;
+            if(!samples.empty()) {
+                /* фильтр минимальной задержки */
+                const xtime::ftimestamp_t current_drift = drift;
+                auto it_best = std::min_element(samples.begin(), samples.end(),
+                    [](const Sample &a, const Sample &b) {
+                    return a.delay < b.delay;
+                });
+                new_offset = it_best->offset + current_drift * (now - it_best->local_time);
+                new_error = it_best->delay / 2.0;
+                /* нижняя граница уточняет оценку только в пределах погрешности запроса */
+                if(is_passive_bound && passive_bound > new_offset) {
+                    const xtime::ftimestamp_t upper = new_offset + new_error;
+                    const xtime::ftimestamp_t bound = std::min(passive_bound, upper);
+                    new_error = upper - bound;
+                    new_offset = bound;
+                }
+            } else
+            if(is_passive_bound) {
+                new_offset = passive_bound;
+                new_error = 0;
+            } else return;
+
+            offset = new_offset;
+            offset_time = now;
+            error = new_error;
+            is_estimated = true;
+        }
+
+        /** \brief Обновить оценку ухода часов
+         *
+         * Метод вызывается под блокировкой clock_mutex после нового измерения по запросу
+         * \param now Время компьютера
+         */
+        void update_drift(const xtime::ftimestamp_t now) {
+            if(last_drift_time == 0) {
+                last_drift_time = now;
+                last_drift_offset = offset;
+                return;
+            }
+            const xtime::ftimestamp_t dt = now - last_drift_time;
+            if(dt < min_drift_interval) return;
+            const xtime::ftimestamp_t current_offset = offset;
+            xtime::ftimestamp_t value = (current_offset - last_drift_offset) / dt;
+            value = std::max(-max_drift, std::min(max_drift, value));
+            /* сглаживаем, так как каждое смещение измерено с погрешностью */
+            drift = is_drift ? (0.75 * drift + 0.25 * value) : value;
+            is_drift = true;
+            last_drift_time = now;
+            last_drift_offset = current_offset;
+        }
+
+    public:
+
+        /** \brief Конструктор синхронизации времени
+         * \param user_max_samples Количество последних измерений для фильтра минимальной задержки
+         */
+        ServerClock(const size_t user_max_samples = 8) :
+            base_steady(clock::now()),
+            base_timestamp(xtime::get_ftimestamp()),
+            max_samples(user_max_samples == 0 ? 1 : user_max_samples) {
+        }
+
+        /** \brief Получить время компьютера по монотонным часам
+         * \return Метка времени компьютера
+         */
+        inline xtime::ftimestamp_t get_local_ftimestamp() const {
+            return base_timestamp +
+                std::chrono::duration<double>(clock::now() - base_steady).count();
+        }
+
+        /** \brief Получить смещение времени сервера
+         * \param local_time Время компьютера
+         * \return Смещение времени сервера с учетом ухода часов
+         */
+        inline xtime::ftimestamp_t get_offset(const xtime::ftimestamp_t local_time) const {
+            return offset + drift * (local_time - offset_time);
+        }
+
+        /** \brief Получить текущее смещение времени сервера
+         * \return Смещение времени сервера
+         */
+        inline xtime::ftimestamp_t get_offset() const {
+            return get_offset(get_local_ftimestamp());
+        }
+
+        /** \brief Получить время сервера
+         * \return Метка времени сервера
+         */
+        inline xtime::ftimestamp_t get_server_ftimestamp() const {
+            const xtime::ftimestamp_t local_time = get_local_ftimestamp();
+            return local_time + get_offset(local_time);
+        }
+
+        /** \brief Получить время сервера в миллисекундах
+         * \return Метка времени сервера, мс
+         */
+        inline uint64_t get_server_timestamp_ms() const {
+            return (uint64_t)(get_server_ftimestamp() * 1000.0);
+        }
+
+        /** \brief Добавить измерение по запросу времени сервера
+         * \param send_time Время компьютера отправки запроса
+         * \param receive_time Время компьютера получения ответа
+         * \param server_time Время сервера из ответа, мс
+         */
+        void add_sample(
+                const xtime::ftimestamp_t send_time,
+                const xtime::ftimestamp_t receive_time,
+                const uint64_t server_time) {
+            if(receive_time < send_time) return;
+            Sample sample;
+            sample.local_time = (send_time + receive_time) / 2.0;
+            sample.offset = ((xtime::ftimestamp_t)server_time / 1000.0) - sample.local_time;
+            sample.delay = receive_time - send_time;
+            std::lock_guard<std::mutex> lock(clock_mutex);
+            samples.push_back(sample);
+            while(samples.size() > max_samples) samples.pop_front();
+            update_estimate(receive_time);
+            update_drift(receive_time);
+            is_synced = true;
+            ++sync_counter;
+        }
+
+        /** \brief Добавить метку времени события потока
+         * \param event_time Время события сервера, мс
+         * \param receive_time Время компьютера получения события (0 - текущее)
+         */
+        void add_passive_sample(
+                const uint64_t event_time,
+                const xtime::ftimestamp_t receive_time = 0) {
+            const xtime::ftimestamp_t local_time = receive_time == 0 ? get_local_ftimestamp() : receive_time;
+            const xtime::ftimestamp_t bound = ((xtime::ftimestamp_t)event_time / 1000.0) - local_time;
+            std::lock_guard<std::mutex> lock(clock_mutex);
+            if(is_passive_bound && (local_time - passive_bound_time) <= passive_window && bound <= passive_bound) return;
+            passive_bound = bound;
+            passive_bound_time = local_time;
+            is_passive_bound = true;
+            update_estimate(local_time);
+        }
+
+        /** \brief Синхронизировать время запросами времени сервера
+         * \param request Функция запроса времени сервера
+         * \param num_requests Количество запросов
+         * \return Код ошибки последнего запроса, вернет 0 если хотя бы один запрос выполнен
+         */
+        int sync(const request_function &request, const uint32_t num_requests = 4) {
+            if(request == nullptr) return common::DATA_NOT_AVAILABLE;
+            int err = common::DATA_NOT_AVAILABLE;
+            bool is_ok = false;
+            for(uint32_t i = 0; i < num_requests; ++i) {
+                uint64_t server_time = 0;
+                const xtime::ftimestamp_t send_time = get_local_ftimestamp();
+                err = request(server_time);
+                const xtime::ftimestamp_t receive_time = get_local_ftimestamp();
+                if(err != common::OK) continue;
+                add_sample(send_time, receive_time, server_time);
+                is_ok = true;
+            }
+            return is_ok ? (int)common::OK : err;
+        }
+
+        /** \brief Получить погрешность оценки смещения
+         * \return Погрешность, сек. (половина наименьшей задержки запроса)
+         */
+        inline xtime::ftimestamp_t get_error() const {
+            return error;
+        }
+
+        /** \brief Получить уход часов компьютера
+         * \return Уход часов, сек. в сек.
+         */
+        inline xtime::ftimestamp_t get_drift() const {
+            return drift;
+        }
+
+        /** \brief Проверить наличие оценки смещения
+         * \return Вернет true, если есть хотя бы одно измерение
+         */
+        inline bool check_estimated() const {
+            return is_estimated;
+        }
+
+        /** \brief Проверить синхронизацию запросами
+         * \return Вернет true, если был хотя бы один запрос времени сервера
+         */
+        inline bool check_synced() const {
+            return is_synced;
+        }
+
+        inline uint64_t get_num_syncs() const {
+            return sync_counter;
+        }
+    };
+}
+
+#endif // BINANCE_CPP_API_SERVER_CLOCK_HPP_INCLUDED
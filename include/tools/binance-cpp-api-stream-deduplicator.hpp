@@ -0,0 +1,89 @@
+#ifndef BINANCE_CPP_API_STREAM_DEDUPLICATOR_HPP_INCLUDED
+#define BINANCE_CPP_API_STREAM_DEDUPLICATOR_HPP_INCLUDED
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace binance_api {
+
+    /** \brief Класс для удаления повторов сообщений из нескольких соединений
+     *
+     * Несколько соединений несут одинаковые подписки. Для каждого потока запоминается
+     * время последнего принятого события и время открытия последнего принятого закрытого бара.
+     * Побеждает сообщение, пришедшее первым: то же событие из другого соединения отбрасывается.
+     * Закрытие бара принимается, даже если более новое обновление уже пришло по другому соединению,
+     * чтобы закрытие не было потеряно.
+     */
+    class StreamDeduplicator {
+    private:
+        class StreamState {
+        public:
+            uint64_t last_event_time = 0;       /**< Время последнего принятого события */
+            uint64_t last_close_open_time = 0;  /**< Время открытия последнего принятого закрытого бара */
+            bool is_close = false;
+            StreamState() {};
+        };
+
+        std::unordered_map<std::string, StreamState> streams;
+        std::mutex streams_mutex;
+        std::atomic<uint64_t> accepted_counter = ATOMIC_VAR_INIT(0);
+        std::atomic<uint64_t> duplicate_counter = ATOMIC_VAR_INIT(0);
+
+    public:
+
+        StreamDeduplicator() {};
+
+        /** \brief Проверить сообщение и запомнить его, если оно новое
+         * \param stream Имя потока
+         * \param event_time Время события на сервере (0, если неизвестно)
+         * \param open_time Время открытия бара
+         * \param is_close Флаг закрытия бара
+         * \return Вернет true, если сообщение пришло первым и его нужно доставить
+         */
+        bool check(
+                const std::string &stream,
+                const uint64_t event_time,
+                const uint64_t open_time,
+                const bool is_close) {
+            std::lock_guard<std::mutex> lock(streams_mutex);
+            StreamState &state = streams[stream];
+            if(is_close) {
+                if(state.is_close && open_time <= state.last_close_open_time) {
+                    ++duplicate_counter;
+                    return false;
+                }
+                state.is_close = true;
+                state.last_close_open_time = open_time;
+                if(event_time > state.last_event_time) state.last_event_time = event_time;
+                ++accepted_counter;
+                return true;
+            }
+            if(event_time <= state.last_event_time ||
+                (state.is_close && open_time <= state.last_close_open_time)) {
+                ++duplicate_counter;
+                return false;
+            }
+            state.last_event_time = event_time;
+            ++accepted_counter;
+            return true;
+        }
+
+        /** \brief Получить количество принятых сообщений
+         * \return Количество сообщений
+         */
+        inline uint64_t get_accepted() const {
+            return accepted_counter;
+        }
+
+        /** \brief Получить количество отброшенных повторов
+         * \return Количество сообщений
+         */
+        inline uint64_t get_duplicates() const {
+            return duplicate_counter;
+        }
+    };
+}
+
+#endif // BINANCE_CPP_API_STREAM_DEDUPLICATOR_HPP_INCLUDED
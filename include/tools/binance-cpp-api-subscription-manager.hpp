@@ -0,0 +1,311 @@
+#ifndef BINANCE_CPP_API_SUBSCRIPTION_MANAGER_HPP_INCLUDED
+#define BINANCE_CPP_API_SUBSCRIPTION_MANAGER_HPP_INCLUDED
+
+#include <nlohmann/json.hpp>
+#include <functional>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <mutex>
+#include <map>
+#include <set>
+#include <iostream>
+
+namespace binance_api {
+
+    /** \brief Класс для управления подписками вебсокета
+     *
+     * Изменения подписок не отправляются сразу, а накапливаются.
+     * Метод process() сравнивает желаемый набор потоков с набором, подтвержденным сервером
+     * с учетом отправленных запросов, и отправляет разницу сообщениями SUBSCRIBE/UNSUBSCRIBE
+     * максимального размера не чаще, чем допускает ограничение скорости сообщений соединения.
+     * Собственного потока у менеджера нет, process() вызывается периодически в потоке соединения.
+     * Ответы сервера сопоставляются с запросами по id, отклоненные запросы передаются в on_reject.
+     */
+    class SubscriptionManager {
+    public:
+        using json = nlohmann::json;
+
+        /// Запрос, ожидающий подтверждения
+        class Request {
+        public:
+            bool is_subscribe = true;
+            std::vector<std::string> params;
+            std::chrono::steady_clock::time_point send_time;
+            Request() {};
+        };
+
+        /** \brief Сервер отклонил запрос
+         *
+         * Отклоненная подписка удаляется из желаемых потоков,
+         * отклоненная отписка не повторяется до следующего соединения
+         */
+        std::function<void(
+            const std::string &param,
+            const bool is_subscribe)> on_reject = nullptr;
+
+    private:
+        std::function<bool(const std::string &message)> send_message;
+
+        std::set<std::string> desired;          /**< Потоки, на которые нужно быть подписанным */
+        std::set<std::string> acked;            /**< Потоки, подписка на которые подтверждена сервером */
+        std::set<std::string> rejected;         /**< Потоки, отписка от которых отклонена сервером */
+        std::map<uint64_t, Request> requests;   /**< Запросы, ожидающие подтверждения */
+        std::mutex subscriptions_mutex;
+
+        std::atomic<bool> is_connected = ATOMIC_VAR_INIT(false);
+        std::atomic<uint64_t> last_id = ATOMIC_VAR_INIT(0);
+        std::atomic<uint32_t> messages_per_second = ATOMIC_VAR_INIT(5);
+        std::atomic<uint32_t> max_params = ATOMIC_VAR_INIT(200);
+        std::chrono::steady_clock::time_point last_send_time;
+
+        const uint64_t ACK_TIMEOUT = 10000;
+
+        /** \brief Получить потоки с учетом запросов, ожидающих подтверждения
+         * \return Набор потоков, который будет на сервере после подтверждения всех запросов
+         */
+        std::set<std::string> get_expected() const {
+            std::set<std::string> expected = acked;
+            for(auto &item : requests) {
+                for(auto &param : item.second.params) {
+                    if(item.second.is_subscribe) expected.insert(param);
+                    else expected.erase(param);
+                }
+            }
+            return expected;
+        }
+
+        /** \brief Сформировать одно сообщение из разницы подписок
+         * \param is_subscribe Флаг подписки
+         * \param params Параметры сообщения
+         * \return Вернет true, если есть что отправить
+         */
+        bool get_diff(bool &is_subscribe, std::vector<std::string> &params) const {
+            params.clear();
+            const size_t max_size = max_params;
+            const std::set<std::string> expected = get_expected();
+            /* сначала отписываемся, чтобы не превысить лимит потоков соединения */
+            for(auto &item : expected) {
+                if(desired.find(item) != desired.end()) continue;
+                if(rejected.find(item) != rejected.end()) continue;
+                params.push_back(item);
+                if(params.size() >= max_size) break;
+            }
+            if(!params.empty()) {
+                is_subscribe = false;
+                return true;
+            }
+            for(auto &item : desired) {
+                if(expected.find(item) != expected.end()) continue;
+                params.push_back(item);
+                if(params.size() >= max_size) break;
+            }
+            is_subscribe = true;
+            return !params.empty();
+        }
+
+        /** \brief Удалить запросы без подтверждения
+         *
+         * Если сервер не ответил, состояние подписок неизвестно,
+         * поэтому потоки запроса снова попадут в разницу
+         */
+        void check_timeout(const std::chrono::steady_clock::time_point &now) {
+            auto it = requests.begin();
+            while(it != requests.end()) {
+                if(now - it->second.send_time < std::chrono::milliseconds(ACK_TIMEOUT)) {
+                    ++it;
+                    continue;
+                }
+                std::cerr << "binance_api::SubscriptionManager error, what: no response for request id " << it->first << std::endl;
+                it = requests.erase(it);
+            }
+        }
+
+    public:
+
+        /** \brief Конструктор менеджера подписок
+         * \param user_send_message Функция отправки сообщения в соединение
+         * \param user_messages_per_second Ограничение скорости сообщений соединения
+         */
+        SubscriptionManager(
+                std::function<bool(const std::string &message)> user_send_message,
+                const uint32_t user_messages_per_second = 5) :
+                send_message(user_send_message),
+                messages_per_second(user_messages_per_second) {
+        }
+
+        /** \brief Установить ограничение скорости сообщений
+         * \param value Количество сообщений в секунду
+         */
+        void set_messages_per_second(const uint32_t value) {
+            messages_per_second = value;
+        }
+
+        /** \brief Установить максимальное количество потоков в одном сообщении
+         * \param value Количество потоков
+         */
+        void set_max_params(const uint32_t value) {
+            max_params = value == 0 ? 1 : value;
+        }
+
+        /** \brief Подписаться на поток
+         *
+         * Подписка будет отправлена при следующем вызове process()
+         * \param param Имя потока, например btcusdt@kline_1m
+         */
+        void subscribe(const std::string &param) {
+            std::lock_guard<std::mutex> lock(subscriptions_mutex);
+            desired.insert(param);
+            rejected.erase(param);
+        }
+
+        /** \brief Отписаться от потока
+         *
+         * Отписка будет отправлена при следующем вызове process()
+         * \param param Имя потока, например btcusdt@kline_1m
+         */
+        void unsubscribe(const std::string &param) {
+            std::lock_guard<std::mutex> lock(subscriptions_mutex);
+            desired.erase(param);
+            rejected.erase(param);
+        }
+
+        /** \brief Отправить изменения подписок
+         *
+         * Метод отправляет не больше одного сообщения за вызов с учетом ограничения скорости
+         * и удаляет запросы без подтверждения. Вызывается периодически в потоке соединения
+         */
+        void process() {
+            std::unique_lock<std::mutex> lock(subscriptions_mutex);
+            const auto now = std::chrono::steady_clock::now();
+            check_timeout(now);
+            if(!is_connected) return;
+
+            /* соблюдаем ограничение скорости сообщений */
+            const uint32_t rate = messages_per_second == 0 ? 1 : (uint32_t)messages_per_second;
+            const auto min_interval = std::chrono::milliseconds(1000 / rate + 1);
+            if(now - last_send_time < min_interval) return;
+
+            bool is_subscribe = true;
+            std::vector<std::string> params;
+            if(!get_diff(is_subscribe, params)) return;
+
+            const uint64_t id = ++last_id;
+            json j;
+            j["method"] = is_subscribe ? "SUBSCRIBE" : "UNSUBSCRIBE";
+            j["params"] = params;
+            j["id"] = id;
+
+            Request request;
+            request.is_subscribe = is_subscribe;
+            request.params = params;
+            request.send_time = now;
+            last_send_time = now;
+
+            /* запрос регистрируется до отправки, так как ответ может прийти раньше возврата из send */
+            requests[id] = request;
+
+            lock.unlock();
+            const bool is_send = send_message != nullptr && send_message(j.dump());
+            if(is_send) return;
+            lock.lock();
+            requests.erase(id);
+        }
+
+        /** \brief Обработать открытие соединения
+         *
+         * Новое соединение не имеет подписок, поэтому все желаемые потоки будут отправлены заново
+         */
+        void on_open() {
+            std::lock_guard<std::mutex> lock(subscriptions_mutex);
+            acked.clear();
+            rejected.clear();
+            requests.clear();
+            is_connected = true;
+        }
+
+        /** \brief Обработать закрытие соединения
+         */
+        void on_close() {
+            std::lock_guard<std::mutex> lock(subscriptions_mutex);
+            is_connected = false;
+            acked.clear();
+            rejected.clear();
+            requests.clear();
+        }
+
+        /** \brief Обработать ответ сервера
+         *
+         * Пример ответа: {"result":null,"id":1}
+         * Пример ошибки: {"error":{"code":2,"msg":"Invalid request"},"id":1}
+         * \param j Ответ сервера
+         * \return Вернет true, если сообщение является ответом на запрос
+         */
+        bool on_response(const json &j) {
+            auto it_id = j.find("id");
+            if(it_id == j.end() || !it_id->is_number()) return false;
+            const uint64_t id = *it_id;
+            Request request;
+            bool is_error = false;
+            {
+                std::lock_guard<std::mutex> lock(subscriptions_mutex);
+                auto it = requests.find(id);
+                if(it == requests.end()) return true;
+                request = it->second;
+                requests.erase(it);
+                auto it_error = j.find("error");
+                is_error = it_error != j.end() && !it_error->is_null();
+                if(is_error) {
+                    std::cerr << "binance_api::SubscriptionManager error, what: " << it_error->dump() << std::endl;
+                }
+                for(auto &param : request.params) {
+                    if(!is_error) {
+                        if(request.is_subscribe) acked.insert(param);
+                        else acked.erase(param);
+                    } else
+                    if(request.is_subscribe) {
+                        /* отклоненную подписку больше не запрашиваем, чтобы не повторять ошибку */
+                        desired.erase(param);
+                    } else {
+                        /* поток остается подписанным, отписку не повторяем */
+                        rejected.insert(param);
+                    }
+                }
+            }
+            if(!is_error || on_reject == nullptr) return true;
+            for(auto &param : request.params) {
+                on_reject(param, request.is_subscribe);
+            }
+            return true;
+        }
+
+        /** \brief Получить количество запросов, ожидающих подтверждения
+         * \return Количество запросов
+         */
+        size_t get_num_pending_requests() {
+            std::lock_guard<std::mutex> lock(subscriptions_mutex);
+            return requests.size();
+        }
+
+        /** \brief Получить потоки, подписка на которые подтверждена сервером
+         * \return Набор потоков
+         */
+        std::set<std::string> get_acked() {
+            std::lock_guard<std::mutex> lock(subscriptions_mutex);
+            return acked;
+        }
+
+        /** \brief Проверить, совпадают ли подписки на сервере с желаемыми
+         * \return Вернет true, если все изменения отправлены и подтверждены
+         */
+        bool synchronized() {
+            std::lock_guard<std::mutex> lock(subscriptions_mutex);
+            if(!requests.empty()) return false;
+            bool is_subscribe = true;
+            std::vector<std::string> params;
+            return !get_diff(is_subscribe, params);
+        }
+    };
+}
+
+#endif // BINANCE_CPP_API_SUBSCRIPTION_MANAGER_HPP_INCLUDED
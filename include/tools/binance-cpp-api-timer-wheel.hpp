@@ -0,0 +1,463 @@
+#ifndef BINANCE_CPP_API_TIMER_WHEEL_HPP_INCLUDED
+#define BINANCE_CPP_API_TIMER_WHEEL_HPP_INCLUDED
+
+#include <xtime.hpp>
+#include <condition_variable>
+#include <unordered_map>
+#include <functional>
+#include <algorithm>
+#include <future>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <array>
+#include <mutex>
+#include <list>
+#include <memory>
+#include <iostream>
+
+namespace binance_api {
+
+    /** \brief Класс времени жизни владельца таймеров
+     *
+     * Функции таймеров, обернутые через wrap(), не вызываются после expire().
+     * Владелец вызывает expire() в деструкторе, метод дожидается выполняемой функции
+     */
+    class TimerLifetime {
+    private:
+        std::mutex lifetime_mutex;
+        bool is_alive = true;
+
+    public:
+
+        TimerLifetime() {};
+
+        /** \brief Запретить вызов функций таймеров владельца
+         */
+        void expire() {
+            std::lock_guard<std::mutex> lock(lifetime_mutex);
+            is_alive = false;
+        }
+
+        /** \brief Обернуть функцию таймера
+         * \param lifetime Время жизни владельца
+         * \param callback Функция таймера
+         * \return Функция, которая ничего не делает после expire()
+         */
+        static std::function<void()> wrap(
+                std::shared_ptr<TimerLifetime> lifetime,
+                std::function<void()> callback) {
+            return [lifetime, callback]() {
+                std::lock_guard<std::mutex> lock(lifetime->lifetime_mutex);
+                if(!lifetime->is_alive) return;
+                callback();
+            };
+        }
+    };
+
+    /** \brief Класс таймеров на основе иерархического колеса таймеров
+     *
+     * Колесо состоит из нескольких уровней по 256 ячеек: ячейка нижнего уровня - один такт,
+     * ячейка каждого следующего уровня - полный оборот предыдущего. Таймер попадает
+     * на уровень, соответствующий времени до срабатывания, и спускается на нижние уровни,
+     * когда до него доходит очередь, поэтому добавление и отмена выполняются за O(1).
+     * Занятые ячейки каждого уровня отмечены в битовой карте, поэтому поток колеса
+     * просыпается только к ближайшему такту, на котором есть работа, и не опрашивает пустые ячейки.
+     * Время отсчитывается по монотонным часам,
+     * таймеры по времени сервера переводятся в монотонное время через источник времени.
+     * Функции таймеров выполняются в потоке колеса и не должны надолго его блокировать.
+     */
+    class TimerWheel {
+    public:
+        using timer_id = uint64_t;
+        using clock = std::chrono::steady_clock;
+
+    private:
+        static const uint32_t SLOT_BITS = 8;
+        static const uint64_t NUM_SLOTS = 1 << SLOT_BITS;
+        static const uint64_t SLOT_MASK = NUM_SLOTS - 1;
+        static const uint32_t NUM_LEVELS = 4;
+        static const uint32_t NUM_WORDS = NUM_SLOTS / 64;
+
+        class Timer {
+        public:
+            timer_id id = 0;
+            uint64_t expire_tick = 0;       /**< Такт срабатывания */
+            uint64_t period = 0;            /**< Период повтора в тактах (0 - однократный таймер) */
+            std::function<void()> callback;
+            Timer() {};
+        };
+
+        using slot_t = std::list<Timer>;
+
+        /// Положение таймера в колесе
+        class Position {
+        public:
+            uint32_t level = 0;
+            uint32_t slot = 0;
+            slot_t::iterator it;
+            Position() {};
+        };
+
+        std::array<std::array<slot_t, NUM_SLOTS>, NUM_LEVELS> levels;
+        std::array<size_t, NUM_LEVELS> level_size;                  /**< Количество таймеров на уровнях */
+        std::array<std::array<uint64_t, NUM_WORDS>, NUM_LEVELS> occupied;  /**< Битовые карты непустых ячеек уровней */
+        std::unordered_map<timer_id, Position> index;               /**< Положение таймеров для отмены */
+        std::mutex wheel_mutex;
+        std::condition_variable wheel_cv;
+
+        const uint64_t tick_ms;             /**< Длительность такта, мс */
+        clock::time_point start_time;
+        uint64_t current_tick = 0;          /**< Последний обработанный такт */
+        timer_id last_id = 0;
+        std::atomic<bool> is_shutdown = ATOMIC_VAR_INIT(false);
+        std::function<xtime::ftimestamp_t()> time_source = nullptr;  /**< Время сервера */
+        std::mutex time_source_mutex;
+        std::future<void> wheel_future;
+
+        inline uint64_t get_tick(const clock::time_point &t) const {
+            if(t <= start_time) return 0;
+            return std::chrono::duration_cast<std::chrono::milliseconds>(t - start_time).count() / tick_ms;
+        }
+
+        inline clock::time_point get_tick_time(const uint64_t tick) const {
+            return start_time + std::chrono::milliseconds(tick * tick_ms);
+        }
+
+        static inline uint32_t count_trailing_zeros(uint64_t value) {
+#           if defined(__GNUC__)
+            return (uint32_t)__builtin_ctzll(value);
+#           else
+            uint32_t n = 0;
+            while((value & 1) == 0) {
+                value >>= 1;
+                ++n;
+            }
+            return n;
+#           endif
+        }
+
+        inline void set_occupied(const uint32_t level, const uint32_t slot) {
+            occupied[level][slot >> 6] |= ((uint64_t)1 << (slot & 63));
+        }
+
+        inline void clear_occupied(const uint32_t level, const uint32_t slot) {
+            occupied[level][slot >> 6] &= ~((uint64_t)1 << (slot & 63));
+        }
+
+        /** \brief Найти ближайшую непустую ячейку уровня
+         * \param level Уровень
+         * \param from Ячейка, с которой начинается поиск по кругу
+         * \return Расстояние до непустой ячейки в ячейках (NUM_SLOTS, если уровень пуст)
+         */
+        uint32_t find_occupied(const uint32_t level, const uint32_t from) const {
+            const std::array<uint64_t, NUM_WORDS> &bits = occupied[level];
+            uint32_t word = from >> 6;
+            uint64_t mask = bits[word] & (~(uint64_t)0 << (from & 63));
+            /* последний шаг снова проверяет первое слово, уже без маски начальной ячейки */
+            for(uint32_t i = 0; i <= NUM_WORDS; ++i) {
+                if(mask != 0) {
+                    const uint32_t slot = (word << 6) + count_trailing_zeros(mask);
+                    return (slot - from) & SLOT_MASK;
+                }
+                word = (word + 1) % NUM_WORDS;
+                mask = bits[word];
+            }
+            return NUM_SLOTS;
+        }
+
+        /** \brief Разместить таймер в колесе
+         *
+         * Метод вызывается под блокировкой wheel_mutex
+         * \param timer Таймер
+         * \param is_cascade Таймер спускается с верхнего уровня в текущем такте
+         * и может сработать в нем же, новый таймер срабатывает не раньше следующего такта
+         */
+        void insert(Timer &&timer, const bool is_cascade = false) {
+            const uint64_t min_tick = is_cascade ? current_tick : (current_tick + 1);
+            if(timer.expire_tick < min_tick) timer.expire_tick = min_tick;
+            const uint64_t delta = timer.expire_tick - current_tick;
+            uint32_t level = 0;
+            while(level < (NUM_LEVELS - 1) && delta >= ((uint64_t)1 << (SLOT_BITS * (level + 1)))) {
+                ++level;
+            }
+            /* таймеры дальше последнего уровня ждут в его последней ячейке и размещаются повторно */
+            const uint64_t max_delta = ((uint64_t)1 << (SLOT_BITS * NUM_LEVELS)) - 1;
+            const uint64_t place_tick = delta > max_delta ? (current_tick + max_delta) : timer.expire_tick;
+            const uint32_t slot = (uint32_t)((place_tick >> (SLOT_BITS * level)) & SLOT_MASK);
+            slot_t &list = levels[level][slot];
+            const timer_id id = timer.id;
+            list.push_back(std::move(timer));
+            Position &position = index[id];
+            position.level = level;
+            position.slot = slot;
+            position.it = std::prev(list.end());
+            ++level_size[level];
+            set_occupied(level, slot);
+        }
+
+        /** \brief Спустить таймеры ячейки на нижние уровни
+         *
+         * Метод вызывается под блокировкой wheel_mutex
+         */
+        void cascade(const uint32_t level, const uint32_t slot) {
+            slot_t list;
+            list.swap(levels[level][slot]);
+            level_size[level] -= list.size();
+            clear_occupied(level, slot);
+            for(auto &timer : list) {
+                insert(std::move(timer), true);
+            }
+        }
+
+        /** \brief Обработать очередной такт
+         *
+         * Метод вызывается под блокировкой wheel_mutex
+         * \param expired Функции сработавших таймеров
+         */
+        void process_tick(std::vector<std::function<void()>> &expired) {
+            ++current_tick;
+            for(uint32_t level = 1; level < NUM_LEVELS; ++level) {
+                if((current_tick & (((uint64_t)1 << (SLOT_BITS * level)) - 1)) != 0) break;
+                cascade(level, (uint32_t)((current_tick >> (SLOT_BITS * level)) & SLOT_MASK));
+            }
+            slot_t list;
+            list.swap(levels[0][current_tick & SLOT_MASK]);
+            level_size[0] -= list.size();
+            clear_occupied(0, (uint32_t)(current_tick & SLOT_MASK));
+            for(auto &timer : list) {
+                if(timer.period == 0) {
+                    index.erase(timer.id);
+                    expired.push_back(std::move(timer.callback));
+                    continue;
+                }
+                /* периодический таймер размещается снова до вызова, чтобы его можно было отменить */
+                expired.push_back(timer.callback);
+                timer.expire_tick += timer.period;
+                insert(std::move(timer));
+            }
+        }
+
+        /** \brief Найти следующий такт, на котором у колеса есть работа
+         *
+         * Для нижнего уровня это ближайшая непустая ячейка, для верхних уровней -
+         * ближайший спуск непустой ячейки. Метод вызывается под блокировкой wheel_mutex
+         */
+        uint64_t get_next_tick() const {
+            uint64_t next_tick = 0;
+            for(uint32_t level = 0; level < NUM_LEVELS; ++level) {
+                if(level_size[level] == 0) continue;
+                const uint64_t span = (uint64_t)1 << (SLOT_BITS * level);
+                /* ближайший такт, на котором обрабатывается ячейка уровня */
+                const uint64_t first_tick = level == 0 ? (current_tick + 1) : ((current_tick / span + 1) * span);
+                const uint32_t distance = find_occupied(level, (uint32_t)((first_tick >> (SLOT_BITS * level)) & SLOT_MASK));
+                if(distance >= NUM_SLOTS) continue;
+                const uint64_t tick = first_tick + distance * span;
+                if(next_tick == 0 || tick < next_tick) next_tick = tick;
+            }
+            return next_tick == 0 ? (current_tick + 1) : next_tick;
+        }
+
+        /** \brief Обработать все такты до текущего времени
+         *
+         * Пустые такты пропускаются. Метод вызывается под блокировкой wheel_mutex
+         * \param expired Функции сработавших таймеров
+         */
+        void process_due_ticks(std::vector<std::function<void()>> &expired) {
+            const uint64_t now_tick = get_tick(clock::now());
+            while(current_tick < now_tick && !index.empty()) {
+                const uint64_t tick = get_next_tick();
+                if(tick > now_tick) {
+                    current_tick = now_tick;
+                    break;
+                }
+                current_tick = tick - 1;
+                process_tick(expired);
+            }
+            if(index.empty()) current_tick = std::max(current_tick, now_tick);
+        }
+
+        void wheel_loop() {
+            std::vector<std::function<void()>> expired;
+            while(!is_shutdown) {
+                {
+                    std::unique_lock<std::mutex> lock(wheel_mutex);
+                    /* без таймеров поток спит до добавления таймера */
+                    wheel_cv.wait(lock, [&]() {
+                        return is_shutdown || !index.empty();
+                    });
+                    if(is_shutdown) break;
+                    process_due_ticks(expired);
+                    if(expired.empty()) {
+                        /* добавление таймера будит поток, чтобы пересчитать ближайший такт */
+                        wheel_cv.wait_until(lock, get_tick_time(get_next_tick()));
+                        if(is_shutdown) break;
+                        /* после любого пробуждения обрабатываем такты, время которых уже наступило */
+                        process_due_ticks(expired);
+                    }
+                }
+                for(size_t i = 0; i < expired.size(); ++i) {
+                    try {
+                        if(expired[i] != nullptr) expired[i]();
+                    }
+                    catch(const std::exception &e) {
+                        std::cerr << "binance_api::TimerWheel callback error, what: " << e.what() << std::endl;
+                    }
+                    catch(...) {
+                        std::cerr << "binance_api::TimerWheel callback error" << std::endl;
+                    }
+                }
+                expired.clear();
+            }
+        }
+
+        timer_id add_timer(const uint64_t expire_tick, const uint64_t period, std::function<void()> callback) {
+            std::lock_guard<std::mutex> lock(wheel_mutex);
+            /* пустое колесо не вращалось, переводим его на текущий такт */
+            if(index.empty()) {
+                const uint64_t now_tick = get_tick(clock::now());
+                if(now_tick > current_tick) current_tick = now_tick;
+            }
+            Timer timer;
+            timer.id = ++last_id;
+            timer.expire_tick = expire_tick;
+            timer.period = period;
+            timer.callback = callback;
+            insert(std::move(timer));
+            wheel_cv.notify_one();
+            return last_id;
+        }
+
+        inline uint64_t get_deadline_tick(const clock::time_point &deadline) const {
+            /* таймер срабатывает не раньше заданного момента */
+            uint64_t tick = get_tick(deadline);
+            if(deadline > get_tick_time(tick)) ++tick;
+            return tick;
+        }
+
+    public:
+
+        /** \brief Конструктор колеса таймеров
+         * \param user_tick_ms Длительность такта, мс (точность таймеров)
+         */
+        TimerWheel(const uint64_t user_tick_ms = 1) :
+                tick_ms(user_tick_ms == 0 ? 1 : user_tick_ms) {
+            level_size.fill(0);
+            for(uint32_t level = 0; level < NUM_LEVELS; ++level) {
+                occupied[level].fill(0);
+            }
+            start_time = clock::now();
+            wheel_future = std::async(std::launch::async,[&]() {
+                wheel_loop();
+            });
+        }
+
+        ~TimerWheel() {
+            {
+                std::lock_guard<std::mutex> lock(wheel_mutex);
+                is_shutdown = true;
+                wheel_cv.notify_one();
+            }
+            if(wheel_future.valid()) {
+                try {
+                    wheel_future.wait();
+                    wheel_future.get();
+                }
+                catch(const std::exception &e) {
+                    std::cerr << "binance_api::~TimerWheel() error, what: " << e.what() << std::endl;
+                }
+                catch(...) {
+                    std::cerr << "binance_api::~TimerWheel() error" << std::endl;
+                }
+            }
+        }
+
+        /** \brief Установить источник времени сервера
+         * \param source Функция, возвращающая метку времени сервера, сек.
+         */
+        void set_time_source(std::function<xtime::ftimestamp_t()> source) {
+            std::lock_guard<std::mutex> lock(time_source_mutex);
+            time_source = source;
+        }
+
+        /** \brief Получить время сервера по источнику времени
+         * \return Метка времени сервера (время компьютера, если источника нет)
+         */
+        xtime::ftimestamp_t get_server_ftimestamp() {
+            std::lock_guard<std::mutex> lock(time_source_mutex);
+            if(time_source == nullptr) return xtime::get_ftimestamp();
+            return time_source();
+        }
+
+        /** \brief Запланировать таймер на момент времени
+         * \param deadline Момент срабатывания по монотонным часам
+         * \param callback Функция таймера
+         * \return ID таймера
+         */
+        inline timer_id schedule_at(const clock::time_point &deadline, std::function<void()> callback) {
+            return add_timer(get_deadline_tick(deadline), 0, callback);
+        }
+
+        /** \brief Запланировать таймер через заданное время
+         * \param delay Задержка, мс
+         * \param callback Функция таймера
+         * \return ID таймера
+         */
+        inline timer_id schedule_after(const uint64_t delay, std::function<void()> callback) {
+            return schedule_at(clock::now() + std::chrono::milliseconds(delay), callback);
+        }
+
+        /** \brief Запланировать таймер на момент времени сервера
+         *
+         * Момент переводится в монотонное время по текущей оценке времени сервера
+         * \param timestamp Метка времени сервера, сек.
+         * \param callback Функция таймера
+         * \return ID таймера
+         */
+        timer_id schedule_at_server_time(const xtime::ftimestamp_t timestamp, std::function<void()> callback) {
+            const xtime::ftimestamp_t delay = std::max(0.0, (timestamp - get_server_ftimestamp()) * 1000.0);
+            return schedule_at(clock::now() + std::chrono::microseconds((uint64_t)(delay * 1000.0)), callback);
+        }
+
+        /** \brief Запланировать периодический таймер
+         * \param period Период, мс
+         * \param callback Функция таймера
+         * \param delay Задержка первого срабатывания, мс (по умолчанию - период)
+         * \return ID таймера, действует до отмены
+         */
+        timer_id schedule_every(
+                const uint64_t period,
+                std::function<void()> callback,
+                const uint64_t delay = 0) {
+            const uint64_t period_ticks = std::max((uint64_t)1, (period + tick_ms - 1) / tick_ms);
+            const uint64_t first_delay = delay == 0 ? period : delay;
+            return add_timer(get_deadline_tick(clock::now() + std::chrono::milliseconds(first_delay)), period_ticks, callback);
+        }
+
+        /** \brief Отменить таймер
+         * \param id ID таймера
+         * \return Вернет true, если таймер еще не сработал или является периодическим
+         */
+        bool cancel(const timer_id id) {
+            std::lock_guard<std::mutex> lock(wheel_mutex);
+            auto it = index.find(id);
+            if(it == index.end()) return false;
+            slot_t &list = levels[it->second.level][it->second.slot];
+            list.erase(it->second.it);
+            --level_size[it->second.level];
+            if(list.empty()) clear_occupied(it->second.level, it->second.slot);
+            index.erase(it);
+            return true;
+        }
+
+        /** \brief Получить количество запланированных таймеров
+         * \return Количество таймеров
+         */
+        size_t size() {
+            std::lock_guard<std::mutex> lock(wheel_mutex);
+            return index.size();
+        }
+    };
+}
+
+#endif // BINANCE_CPP_API_TIMER_WHEEL_HPP_INCLUDED
@@ -0,0 +1,244 @@
+#ifndef BINANCE_CPP_API_TRADE_BAR_AGGREGATOR_HPP_INCLUDED
+#define BINANCE_CPP_API_TRADE_BAR_AGGREGATOR_HPP_INCLUDED
+
+#include <xquotes_common.hpp>
+#include <functional>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <map>
+
+namespace binance_api {
+
+    /** \brief Класс построения баров из сделок
+     *
+     * Из одного потока сделок строится любое количество баров:
+     * по времени с произвольным периодом (в том числе меньше минуты),
+     * по количеству сделок и по объему.
+     * Бар по времени закрывается первой сделкой следующего периода
+     * или вызовом close_expired_bars(). Сделки старше последнего закрытого бара
+     * и сделки прошлых периодов отбрасываются, чтобы не изменить уже переданные бары.
+     * Время открытия бара уникально для каждого ID бара. Класс не потокобезопасен.
+     */
+    class TradeBarAggregator {
+    public:
+
+        /// Типы баров
+        enum class BarTypes {
+            TIME = 0,   /**< Бар по времени */
+            TICK = 1,   /**< Бар по количеству сделок */
+            VOLUME = 2, /**< Бар по объему */
+        };
+
+        /// Параметры бара
+        class BarSpec {
+        public:
+            BarTypes type = BarTypes::TIME;
+            uint64_t interval = 0;  /**< Период бара по времени, мс */
+            uint64_t ticks = 0;     /**< Количество сделок бара */
+            double volume = 0;      /**< Объем бара */
+            BarSpec() {};
+        };
+
+        /** \brief Функция бара
+         *
+         * Время открытия передается в мс: у баров меньше секунды Candle.timestamp (в секундах) совпадает
+         */
+        using candle_function = std::function<void(
+            const std::string &symbol,
+            const xquotes_common::Candle &candle,
+            const uint32_t bar_id,
+            const uint64_t open_time,
+            const bool close_candle)>;
+
+        candle_function on_candle = nullptr;  /**< Бар обновлен или закрыт, время открытия в мс */
+
+    private:
+
+        /// Состояние незакрытого бара
+        class BarState {
+        public:
+            xquotes_common::Candle candle;
+            uint64_t open_time = 0;     /**< Время открытия бара, мс */
+            uint64_t closed_time = 0;   /**< Граница последнего закрытого бара, мс */
+            uint64_t ticks = 0;         /**< Количество сделок в баре */
+            bool is_open = false;
+            BarState() {};
+        };
+
+        std::vector<BarSpec> bars;                              /**< Параметры баров, индекс - ID бара */
+        std::map<std::string, std::vector<BarState>> states;    /**< Состояния баров символов */
+
+        uint32_t add_bars(const BarSpec &bar) {
+            bars.push_back(bar);
+            for(auto &item : states) {
+                item.second.resize(bars.size());
+            }
+            return (uint32_t)(bars.size() - 1);
+        }
+
+        inline void emit(
+                const std::string &symbol,
+                const BarState &state,
+                const uint32_t bar_id,
+                const bool close_candle) {
+            if(on_candle != nullptr) on_candle(symbol, state.candle, bar_id, state.open_time, close_candle);
+        }
+
+        /** \brief Закрыть бар
+         * \param state Состояние бара
+         * \param closed_time Граница бара, сделки до которой больше не принимаются
+         */
+        inline void close_bar(BarState &state, const uint64_t closed_time) {
+            state.closed_time = closed_time;
+            state.is_open = false;
+        }
+
+        void open_bar(
+                BarState &state,
+                const double price,
+                const double quantity,
+                const uint64_t open_time,
+                const uint64_t ticks) {
+            /* бар по сделкам может открыться в ту же миллисекунду, в которой закрылся предыдущий */
+            const uint64_t unique_time = (state.closed_time != 0 && open_time <= state.open_time) ?
+                state.open_time + 1 : open_time;
+            state.candle = xquotes_common::Candle(price, price, price, price, quantity, unique_time / 1000);
+            state.open_time = unique_time;
+            state.ticks = ticks;
+            state.is_open = true;
+        }
+
+        inline void update_bar(
+                BarState &state,
+                const double price,
+                const double quantity,
+                const uint64_t ticks) {
+            state.candle.high = std::max(state.candle.high, price);
+            state.candle.low = std::min(state.candle.low, price);
+            state.candle.close = price;
+            state.candle.volume += quantity;
+            state.ticks += ticks;
+        }
+
+    public:
+
+        TradeBarAggregator() {};
+
+        /** \brief Добавить бары по времени
+         * \param interval Период бара, мс (например, 1000 для секундных баров)
+         * \return ID бара
+         */
+        uint32_t add_time_bars(const uint64_t interval) {
+            BarSpec bar;
+            bar.type = BarTypes::TIME;
+            bar.interval = interval == 0 ? 1 : interval;
+            return add_bars(bar);
+        }
+
+        /** \brief Добавить бары по количеству сделок
+         * \param ticks Количество сделок бара
+         * \return ID бара
+         */
+        uint32_t add_tick_bars(const uint64_t ticks) {
+            BarSpec bar;
+            bar.type = BarTypes::TICK;
+            bar.ticks = ticks == 0 ? 1 : ticks;
+            return add_bars(bar);
+        }
+
+        /** \brief Добавить бары по объему
+         * \param volume Объем бара
+         * \return ID бара
+         */
+        uint32_t add_volume_bars(const double volume) {
+            BarSpec bar;
+            bar.type = BarTypes::VOLUME;
+            bar.volume = volume;
+            return add_bars(bar);
+        }
+
+        /** \brief Получить параметры бара
+         * \param bar_id ID бара
+         * \param bar Параметры бара
+         * \return Вернет true, если бар существует
+         */
+        bool get_bar_spec(const uint32_t bar_id, BarSpec &bar) const {
+            if(bar_id >= bars.size()) return false;
+            bar = bars[bar_id];
+            return true;
+        }
+
+        inline size_t get_num_bars() const {
+            return bars.size();
+        }
+
+        /** \brief Обработать сделку
+         * \param symbol Имя символа
+         * \param price Цена
+         * \param quantity Количество
+         * \param trade_time Время сделки, мс
+         * \param ticks Количество сделок (агрегированная сделка объединяет несколько сделок)
+         */
+        void on_trade(
+                const std::string &symbol,
+                const double price,
+                const double quantity,
+                const uint64_t trade_time,
+                const uint64_t ticks = 1) {
+            std::vector<BarState> &symbol_states = states[symbol];
+            if(symbol_states.size() != bars.size()) symbol_states.resize(bars.size());
+            for(uint32_t bar_id = 0; bar_id < bars.size(); ++bar_id) {
+                const BarSpec &bar = bars[bar_id];
+                BarState &state = symbol_states[bar_id];
+                /* опоздавшая сделка относится к уже закрытому бару */
+                if(trade_time < state.closed_time) continue;
+                switch(bar.type) {
+                case BarTypes::TIME: {
+                        const uint64_t open_time = trade_time - trade_time % bar.interval;
+                        /* сделка прошлого периода, бар которого уже не открыт */
+                        if(state.is_open && open_time < state.open_time) continue;
+                        if(state.is_open && open_time > state.open_time) {
+                            emit(symbol, state, bar_id, true);
+                            close_bar(state, state.open_time + bar.interval);
+                        }
+                        if(!state.is_open) open_bar(state, price, quantity, open_time, ticks);
+                        else update_bar(state, price, quantity, ticks);
+                        emit(symbol, state, bar_id, false);
+                    }
+                    break;
+                case BarTypes::TICK:
+                case BarTypes::VOLUME: {
+                        if(!state.is_open) open_bar(state, price, quantity, trade_time, ticks);
+                        else update_bar(state, price, quantity, ticks);
+                        const bool is_close = bar.type == BarTypes::TICK ?
+                            (state.ticks >= bar.ticks) : (state.candle.volume >= bar.volume);
+                        emit(symbol, state, bar_id, is_close);
+                        if(is_close) close_bar(state, trade_time);
+                    }
+                    break;
+                };
+            }
+        }
+
+        /** \brief Закрыть бары по времени, период которых истек
+         *
+         * Позволяет закрыть бар без ожидания сделки следующего периода
+         * \param server_time Время сервера, мс
+         */
+        void close_expired_bars(const uint64_t server_time) {
+            for(auto &item : states) {
+                for(uint32_t bar_id = 0; bar_id < item.second.size() && bar_id < bars.size(); ++bar_id) {
+                    const BarSpec &bar = bars[bar_id];
+                    BarState &state = item.second[bar_id];
+                    if(bar.type != BarTypes::TIME || !state.is_open) continue;
+                    if(server_time < (state.open_time + bar.interval)) continue;
+                    emit(item.first, state, bar_id, true);
+                    close_bar(state, state.open_time + bar.interval);
+                }
+            }
+        }
+    };
+}
+
+#endif // BINANCE_CPP_API_TRADE_BAR_AGGREGATOR_HPP_INCLUDED
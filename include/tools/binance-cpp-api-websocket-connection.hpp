@@ -0,0 +1,502 @@
+#ifndef BINANCE_CPP_API_WEBSOCKET_CONNECTION_HPP_INCLUDED
+#define BINANCE_CPP_API_WEBSOCKET_CONNECTION_HPP_INCLUDED
+
+#include "binance-cpp-api-event-loop.hpp"
+#include <functional>
+#include <future>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <iostream>
+
+namespace binance_api {
+
+    /** \brief Соединение вебсокета с автоматическим переподключением
+     *
+     * Общая часть потоков котировок и пользовательских данных: создание клиента,
+     * переподключение и закрытие. Соединение всегда обслуживается потоком io_context:
+     * внешним (см. EventLoopPool) или собственным, если внешний цикл событий не задан.
+     * Все callback-функции вызываются в потоке io_context, поэтому не выполняются одновременно.
+     * Сторожевой таймер проверяется там же: соединение, которое перестало доставлять данные
+     * или не отвечает на ping, переподключается без задержки.
+     */
+    class WebSocketConnection {
+    public:
+        using WssClient = SimpleWeb::SocketClient<SimpleWeb::WSS>;
+        using io_context_ptr = std::shared_ptr<SimpleWeb::io_context>;
+
+        std::function<void(const std::string &message)> on_message = nullptr;  /**< Сообщение получено */
+        std::function<void()> on_open = nullptr;    /**< Соединение установлено */
+        std::function<void()> on_close = nullptr;   /**< Соединение закрыто, вызывается один раз на каждое соединение */
+        std::function<void()> on_pong = nullptr;    /**< Получен pong */
+        std::function<void()> on_timer = nullptr;   /**< Период обслуживания соединения, см. SERVICE_DELAY */
+        std::function<void()> on_stale = nullptr;   /**< Соединение устарело и будет переподключено */
+
+        static const uint64_t RECONNECT_DELAY = 1000;   /**< Задержка переподключения, мс */
+        static const uint64_t SERVICE_DELAY = 100;      /**< Период вызова on_timer, мс */
+
+    private:
+        using work_guard = SimpleWeb::asio::executor_work_guard<SimpleWeb::io_context::executor_type>;
+
+        std::string point;
+        std::string sert_file = "curl-ca-bundle.crt";
+        std::mutex point_mutex;
+
+        io_context_ptr event_loop;                      /**< Цикл событий соединения */
+        std::shared_ptr<work_guard> own_work_guard;     /**< Собственный цикл событий, если внешний не задан */
+        std::future<void> loop_future;                  /**< Поток собственного цикла событий */
+
+        std::shared_ptr<WssClient> client;
+        std::shared_ptr<WssClient::Connection> save_connection;
+        std::mutex save_connection_mutex;
+        std::shared_ptr<SimpleWeb::asio::steady_timer> reconnect_timer;
+        std::shared_ptr<SimpleWeb::asio::steady_timer> service_timer;
+
+        std::atomic<bool> is_start = ATOMIC_VAR_INIT(false);
+        std::atomic<bool> is_stop = ATOMIC_VAR_INIT(false);
+        std::atomic<bool> is_open = ATOMIC_VAR_INIT(false);
+        std::atomic<bool> is_error = ATOMIC_VAR_INIT(false);
+        std::atomic<bool> is_client_closed = ATOMIC_VAR_INIT(true);    /**< Закрытие текущего клиента уже обработано */
+        std::atomic<bool> is_reconnect_wait = ATOMIC_VAR_INIT(false);
+
+        /* сторожевой таймер соединения */
+        std::atomic<uint64_t> message_timeout = ATOMIC_VAR_INIT(0);     /**< Допустимое время без сообщений, мс */
+        std::atomic<uint64_t> ping_interval = ATOMIC_VAR_INIT(0);       /**< Период отправки ping, мс */
+        std::atomic<uint64_t> pong_timeout = ATOMIC_VAR_INIT(5000);     /**< Допустимое время ожидания pong, мс */
+        std::atomic<uint64_t> last_message_time = ATOMIC_VAR_INIT(0);   /**< Время последнего сообщения, мс */
+        std::atomic<uint64_t> ping_send_time = ATOMIC_VAR_INIT(0);
+        std::atomic<bool> is_ping_wait = ATOMIC_VAR_INIT(false);
+        std::atomic<double> ping_rtt = ATOMIC_VAR_INIT(0);              /**< Время прохождения ping-pong, мс */
+        std::atomic<uint64_t> stale_reconnect_counter = ATOMIC_VAR_INIT(0);
+
+        std::string get_point() {
+            std::lock_guard<std::mutex> lock(point_mutex);
+            return point;
+        }
+
+        /** \brief Отключить callback-функции клиента и остановить его
+         */
+        void release_client() {
+            std::shared_ptr<WssClient> client_ptr = std::atomic_load(&client);
+            if(!client_ptr) return;
+            client_ptr->on_message = nullptr;
+            client_ptr->on_open = nullptr;
+            client_ptr->on_close = nullptr;
+            client_ptr->on_error = nullptr;
+            client_ptr->on_pong = nullptr;
+            client_ptr->stop();
+        }
+
+        /** \brief Обработать закрытие соединения
+         *
+         * Клиент может сообщить о закрытии и через on_close, и через on_error,
+         * поэтому on_close вызывается только для первого из них
+         */
+        void handle_close() {
+            if(is_client_closed.exchange(true)) return;
+            is_open = false;
+            is_ping_wait = false;
+            {
+                std::lock_guard<std::mutex> lock(save_connection_mutex);
+                save_connection.reset();
+            }
+            if(on_close != nullptr) on_close();
+        }
+
+        /** \brief Создать клиента и подключиться
+         */
+        void open_client() {
+            if(is_stop) return;
+            try {
+                std::string client_point;
+                {
+                    std::lock_guard<std::mutex> lock(point_mutex);
+                    client_point = point;
+                }
+                std::shared_ptr<WssClient> client_ptr = std::make_shared<WssClient>(
+                        client_point,
+                        true,
+                        std::string(),
+                        std::string(),
+                        std::string(sert_file));
+
+                client_ptr->on_message =
+                        [&](std::shared_ptr<WssClient::Connection> /*connection*/,
+                        std::shared_ptr<WssClient::InMessage> message) {
+                    last_message_time = get_steady_ms();
+                    if(on_message != nullptr) on_message(message->string());
+                };
+
+                client_ptr->on_open =
+                        [&](std::shared_ptr<WssClient::Connection> connection) {
+                    {
+                        std::lock_guard<std::mutex> lock(save_connection_mutex);
+                        save_connection = connection;
+                    }
+                    last_message_time = get_steady_ms();
+                    ping_send_time = last_message_time.load();
+                    is_ping_wait = false;
+                    is_open = true;
+                    is_error = false;
+                    if(on_open != nullptr) on_open();
+                };
+
+                client_ptr->on_pong =
+                        [&](std::shared_ptr<WssClient::Connection> /*connection*/) {
+                    if(is_ping_wait) {
+                        const uint64_t now = get_steady_ms();
+                        ping_rtt = (double)(now - ping_send_time);
+                        last_message_time = now;
+                        is_ping_wait = false;
+                    }
+                    if(on_pong != nullptr) on_pong();
+                };
+
+                client_ptr->on_close =
+                        [&](std::shared_ptr<WssClient::Connection> /*connection*/,
+                        int status, const std::string & /*reason*/) {
+                    std::cerr << get_point() << " closed connection with status code " << status << std::endl;
+                    is_error = true;
+                    handle_close();
+                    schedule_reconnect();
+                };
+
+                // See http://www.boost.org/doc/libs/1_55_0/doc/html/boost_asio/reference.html, Error Codes for error code meanings
+                client_ptr->on_error =
+                        [&](std::shared_ptr<WssClient::Connection> /*connection*/,
+                        const SimpleWeb::error_code &ec) {
+                    std::cerr << get_point() << " wss error: " << ec << std::endl;
+                    is_error = true;
+                    handle_close();
+                    schedule_reconnect();
+                };
+
+                client_ptr->io_service = event_loop;
+                std::atomic_store(&client, client_ptr);
+                is_client_closed = false;
+                /* при внешнем io_context метод start() не блокирует поток */
+                client_ptr->start();
+            }
+            catch(const std::exception &e) {
+                std::cerr << "binance_api::WebSocketConnection error, what: " << e.what() << std::endl;
+                is_error = true;
+                handle_close();
+                schedule_reconnect();
+            }
+            catch(...) {
+                std::cerr << "binance_api::WebSocketConnection error" << std::endl;
+                is_error = true;
+                handle_close();
+                schedule_reconnect();
+            }
+        }
+
+        /** \brief Запланировать переподключение
+         */
+        void schedule_reconnect() {
+            if(is_stop) return;
+            if(is_reconnect_wait.exchange(true)) return;
+            reconnect_timer = std::make_shared<SimpleWeb::asio::steady_timer>(*event_loop);
+            reconnect_timer->expires_after(std::chrono::milliseconds(RECONNECT_DELAY));
+            reconnect_timer->async_wait([&](const SimpleWeb::error_code &ec) {
+                if(ec) return;
+                is_reconnect_wait = false;
+                open_client();
+            });
+        }
+
+        /** \brief Переподключиться без задержки в потоке соединения
+         */
+        void reconnect_now() {
+            if(is_stop) return;
+            release_client();
+            handle_close();
+            if(reconnect_timer) reconnect_timer->cancel();
+            is_reconnect_wait = false;
+            open_client();
+        }
+
+        /** \brief Проверить сторожевой таймер
+         * \return Вернет true, если соединение устарело
+         */
+        bool check_watchdog() {
+            if(!is_open) return false;
+            const uint64_t now = get_steady_ms();
+
+            /* отправляем ping и проверяем ответ */
+            if(ping_interval > 0) {
+                if(is_ping_wait) {
+                    if((now - ping_send_time) > pong_timeout) {
+                        std::cerr << get_point() << " watchdog: no pong for " << (now - ping_send_time) << " ms" << std::endl;
+                        return true;
+                    }
+                } else
+                if((now - ping_send_time) >= ping_interval) {
+                    ping_send_time = now;
+                    is_ping_wait = true;
+                    /* 137 - ping фрейм (fin бит и opcode 9) */
+                    send("", 137);
+                }
+            }
+
+            /* проверяем время без сообщений */
+            if(message_timeout > 0 && (now - last_message_time) > message_timeout) {
+                std::cerr << get_point() << " watchdog: no messages for " << (now - last_message_time) << " ms" << std::endl;
+                return true;
+            }
+            return false;
+        }
+
+        /** \brief Запланировать обслуживание соединения
+         */
+        void schedule_service() {
+            if(is_stop) return;
+            service_timer = std::make_shared<SimpleWeb::asio::steady_timer>(*event_loop);
+            service_timer->expires_after(std::chrono::milliseconds(SERVICE_DELAY));
+            service_timer->async_wait([&](const SimpleWeb::error_code &ec) {
+                if(ec || is_stop) return;
+                try {
+                    if(check_watchdog()) {
+                        ++stale_reconnect_counter;
+                        if(on_stale != nullptr) on_stale();
+                        reconnect_now();
+                    }
+                    if(on_timer != nullptr) on_timer();
+                }
+                catch(const std::exception &e) {
+                    std::cerr << "binance_api::WebSocketConnection timer error, what: " << e.what() << std::endl;
+                }
+                catch(...) {
+                    std::cerr << "binance_api::WebSocketConnection timer error" << std::endl;
+                }
+                schedule_service();
+            });
+        }
+
+    public:
+
+        WebSocketConnection() {};
+
+        WebSocketConnection(const WebSocketConnection &) = delete;
+        WebSocketConnection &operator=(const WebSocketConnection &) = delete;
+
+        ~WebSocketConnection() {
+            stop();
+        }
+
+        /** \brief Установить конечную точку подключения
+         *
+         * Новая точка используется при следующем подключении
+         * \param user_point Конечная точка подключения
+         */
+        void set_point(const std::string &user_point) {
+            std::lock_guard<std::mutex> lock(point_mutex);
+            point = user_point;
+        }
+
+        /** \brief Установить файл-сертификат
+         *
+         * Метод следует вызывать до start()
+         * \param user_sert_file Файл-сертификат
+         */
+        void set_sert_file(const std::string &user_sert_file) {
+            if(is_start) return;
+            sert_file = user_sert_file;
+        }
+
+        /** \brief Использовать внешний цикл событий
+         *
+         * Метод следует вызывать до start()
+         * \param user_event_loop Указатель на io_context
+         */
+        void set_event_loop(io_context_ptr user_event_loop) {
+            if(is_start) return;
+            event_loop = user_event_loop;
+        }
+
+        /** \brief Получить цикл событий соединения
+         * \return Указатель на io_context (пустой до start(), если внешний цикл событий не задан)
+         */
+        inline io_context_ptr get_event_loop() {
+            return event_loop;
+        }
+
+        /** \brief Подключиться
+         *
+         * Если внешний цикл событий не задан, создается собственный цикл событий с одним потоком
+         */
+        void start() {
+            if(is_stop || is_start.exchange(true)) return;
+            if(!event_loop) {
+                event_loop = std::make_shared<SimpleWeb::io_context>(1);
+                own_work_guard = std::make_shared<work_guard>(event_loop->get_executor());
+                io_context_ptr io = event_loop;
+                loop_future = std::async(std::launch::async,[io]() {
+                    while(true) {
+                        try {
+                            io->run();
+                            break;
+                        }
+                        catch(const std::exception &e) {
+                            std::cerr << "binance_api::WebSocketConnection loop error, what: " << e.what() << std::endl;
+                        }
+                        catch(...) {
+                            std::cerr << "binance_api::WebSocketConnection loop error" << std::endl;
+                        }
+                    }
+                });
+            }
+            SimpleWeb::asio::post(*event_loop, [&]() {
+                open_client();
+                schedule_service();
+            });
+        }
+
+        /** \brief Закрыть соединение без переподключения
+         *
+         * После возврата callback-функции больше не вызываются
+         */
+        void stop() {
+            if(is_stop.exchange(true)) return;
+            if(!is_start) return;
+            EventLoopPool::invoke(event_loop, [&]() {
+                if(reconnect_timer) reconnect_timer->cancel();
+                if(service_timer) service_timer->cancel();
+                release_client();
+                std::lock_guard<std::mutex> lock(save_connection_mutex);
+                save_connection.reset();
+            });
+            if(own_work_guard) {
+                own_work_guard.reset();
+                event_loop->stop();
+                if(loop_future.valid()) {
+                    try {
+                        loop_future.wait();
+                        loop_future.get();
+                    }
+                    catch(const std::exception &e) {
+                        std::cerr << "binance_api::WebSocketConnection::stop() error, what: " << e.what() << std::endl;
+                    }
+                    catch(...) {
+                        std::cerr << "binance_api::WebSocketConnection::stop() error" << std::endl;
+                    }
+                }
+            }
+            is_open = false;
+        }
+
+        /** \brief Переподключиться без задержки
+         *
+         * Текущее соединение закрывается (on_close вызывается один раз), затем сразу открывается новое
+         */
+        void force_reconnect() {
+            if(is_stop || !is_start) return;
+            EventLoopPool::invoke(event_loop, [&]() {
+                reconnect_now();
+            });
+        }
+
+        /** \brief Выполнить функцию в потоке соединения
+         * \param f Функция
+         */
+        void post(std::function<void()> f) {
+            if(is_stop || !is_start) return;
+            SimpleWeb::asio::post(*event_loop, [&, f]() {
+                if(is_stop) return;
+                f();
+            });
+        }
+
+        /** \brief Отправить сообщение
+         * \param message Сообщение
+         * \param fin_rsv_opcode Тип фрейма (129 - текст, 137 - ping)
+         * \return Вернет false, если соединения нет
+         */
+        bool send(const std::string &message, const unsigned char fin_rsv_opcode = 129) {
+            std::lock_guard<std::mutex> lock(save_connection_mutex);
+            if(!save_connection) return false;
+            save_connection->send(message, nullptr, fin_rsv_opcode);
+            return true;
+        }
+
+        /** \brief Настроить сторожевой таймер
+         *
+         * Метод следует вызывать до start()
+         * \param user_message_timeout Допустимое время без сообщений, мс (0 - не проверять)
+         * \param user_ping_interval Период отправки ping для измерения RTT, мс (0 - не отправлять)
+         * \param user_pong_timeout Допустимое время ожидания pong, мс
+         */
+        void set_watchdog(
+                const uint64_t user_message_timeout,
+                const uint64_t user_ping_interval,
+                const uint64_t user_pong_timeout) {
+            message_timeout = user_message_timeout;
+            ping_interval = user_ping_interval;
+            pong_timeout = user_pong_timeout;
+        }
+
+        /** \brief Получить монотонное время в миллисекундах
+         * \return Время, мс
+         */
+        inline static uint64_t get_steady_ms() {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        /** \brief Получить время последнего сообщения
+         * \return Монотонное время, мс (0, если сообщений не было)
+         */
+        inline uint64_t get_last_message_time() const {
+            return last_message_time;
+        }
+
+        /** \brief Получить время с последнего сообщения
+         * \return Время, мс
+         */
+        inline uint64_t get_last_message_age() const {
+            const uint64_t last_time = last_message_time;
+            if(last_time == 0) return 0;
+            return get_steady_ms() - last_time;
+        }
+
+        /** \brief Получить время прохождения ping-pong
+         * \return RTT последнего ping, мс (0, если еще не измерено)
+         */
+        inline double get_ping_rtt() const {
+            return ping_rtt;
+        }
+
+        /** \brief Проверить, устарело ли соединение
+         * \return Вернет true, если сообщений нет дольше допустимого времени
+         */
+        inline bool check_stale() const {
+            if(message_timeout == 0) return false;
+            return get_last_message_age() > message_timeout;
+        }
+
+        /** \brief Получить количество переподключений сторожевого таймера
+         * \return Количество переподключений
+         */
+        inline uint64_t get_num_stale_reconnects() const {
+            return stale_reconnect_counter;
+        }
+
+        /** \brief Проверить, открыто ли соединение
+         * \return Вернет true, если соединение открыто
+         */
+        inline bool check_open() const {
+            return is_open;
+        }
+
+        /** \brief Проверить наличие ошибки соединения
+         * \return Вернет true, если последнее соединение закрылось с ошибкой
+         */
+        inline bool check_error() const {
+            return is_error;
+        }
+    };
+}
+
+#endif // BINANCE_CPP_API_WEBSOCKET_CONNECTION_HPP_INCLUDED